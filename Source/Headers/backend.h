@@ -33,6 +33,8 @@
 
     If the server does not exist, NULL will be returned.
     Otherwise, a pointer to that 'Server' struct will be returned.
+    Uses the cached server list unless it is stale or
+    doesn't have the server (see ServerListLookup()).
 */
 Server* ServerFromAlias(char* alias);
 
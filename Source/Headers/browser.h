@@ -25,10 +25,18 @@
 #include "ccmds.h"
 #include "cli.h"
 #include "ccolors.h"
+#include "protocol.h"
 
 extern unsigned int onlineServers; // Number of online servers
-extern Server       serverList[kMaxServersOnline]; // List of all online servers
-extern Server       backendServerList[1000]; // hashed by their uid
+
+/*
+    Client-sided. How long the server list is trusted after it
+    was last synced with root, in milliseconds. Commands in that
+    window use the list as it is instead of asking root first.
+    Changed with --cache. 0 asks root every time.
+*/
+#define SERVER_LIST_DEFAULT_TTL_MS 5000
+extern unsigned int serverListTtlMs;
 
 /*
     Add a server to the server list.
@@ -43,12 +51,199 @@ int SSAddServerToList(Server server);
 /*
     Update the server list client-side.
 
-    Make a request to the root server asking for
-    the most updated server list that is currently
-    saved on the root application.
+    If the list is older than 'serverListTtlMs' make a request
+    to the root server asking for what changed since the
+    version the client has. Otherwise it is used as it is.
 
     The server list is updated automatically and returned.
 */
-Server* UpdateServerList(); 
+Server* UpdateServerList();
+
+/*
+    Client-sided. Ask root for what changed in the
+    server list however fresh it is. Returns false if
+    the request failed and the list wasn't updated.
+*/
+bool SyncServerList();
+
+/*
+    Client-sided. Find a server by alias in the server list,
+    syncing it first if it's stale. A server that isn't in a
+    fresh list is asked for too since it may be newer than it.
+    Returns NULL if root doesn't have it either.
+*/
+Server* ServerListLookup(const char* alias);
+
+/*
+    Client-sided. True if the list was synced with root in the
+    last 'serverListTtlMs' or root pushes changes to it.
+*/
+bool ServerListFresh();
+
+/*
+    Client-sided. The client changed the server list itself,
+    e.g. made a server. The next command syncs it with root.
+*/
+void ServerListInvalidate();
+
+/*
+    Turn live server list updates on or off.
+
+    While on, root pushes server list changes to the client
+    as they happen and UpdateServerList() applies them
+    without making a request.
+*/
+void ToggleLiveServerList();
+
+/*
+    The server list is one registry of every online server.
+
+    Servers are indexed by alias (case insensitive) and by
+    their 64-bit server id, so finding one is O(1). Live servers
+    are also kept packed in an array so walking the list only
+    touches online servers, and removing one moves the last
+    server into its place instead of shifting the whole list.
+
+    Server-sided this is every room on the root server.
+    Client-sided it holds the last list received from root.
+*/
+
+/*
+    Copy 'server' into the server list.
+
+    Returns the copy kept in the list, or NULL if a
+    server with the same alias or id is already in it.
+    The alias is stored lowercased.
+*/
+Server* ServerListAdd(Server* server);
+
+/*
+    Take 'server' out of the server list. O(1).
+
+    Server-sided the memory stays valid since room threads
+    may still hold it. Client-sided it is freed.
+*/
+void ServerListRemove(Server* server);
+
+/*
+    Remove every server from the list.
+*/
+void ServerListClear();
+
+/*
+    Find a server in the list by alias or by id.
+    Returns NULL if there is no such server.
+*/
+Server* ServerListFind(const char* alias);
+Server* ServerListFindById(uint64_t serverId);
+
+/*
+    Server-sided. Find a room by id and take a reference to it
+    before the list can change, so it can't be freed until the
+    caller lets go of it with SSRoomRelease(). NULL if it isn't
+    listed, e.g. because it was shut down.
+*/
+Server* ServerListRetainById(uint64_t serverId);
+
+/*
+    The server at 'index' in the packed list of
+    online servers. 'index' must be under onlineServers.
+*/
+Server* ServerListAt(unsigned int index);
+
+/*
+    What a client needs to show a server in the browser.
+
+    This is what root sends for each server when the server list
+    is requested instead of the whole 'Server' struct. Numbers
+    are in network byte order on the wire.
+*/
+typedef struct __attribute__((packed)) ServerListingStr
+{
+    uint64_t serverId;                                // Id of the server
+    uint16_t port;                                    // Port the server is on
+    uint16_t connectedClients;                        // Clients in the server
+    uint16_t maxClients;                              // Max clients allowed in the server
+    char     alias[kMaxServerAliasLength + 1];        // Name of the server
+    char     hostHandle[kMaxClientHandleLength + 1];  // Username of the host
+} ServerListing;
+
+/*
+    Sent by root before the listings in a server list reply.
+
+    Every change to the server list on root (a server added,
+    removed or its info updated) bumps the directory version.
+    A client sends the version it last saw and only gets the
+    servers that changed since then: 'listingCount' listings of
+    added or changed servers followed by 'removedCount' ids
+    (uint64_t) of removed servers. If root no longer remembers
+    every change since that version 'fullList' is set and the
+    listings are the whole list instead.
+
+    Numbers are in network byte order on the wire.
+*/
+typedef struct __attribute__((packed)) ServerListDeltaStr
+{
+    uint64_t version;      // Directory version the client is at once the delta is applied
+    uint8_t  fullList;     // Listings replace the whole list
+    uint32_t listingCount; // Listings that follow
+    uint32_t removedCount; // Removed server ids that follow the listings
+} ServerListDelta;
+
+/*
+    Mark a listed server as changed so clients
+    syncing their list get its new info.
+*/
+void ServerListTouch(Server* server);
+
+/*
+    Server-sided. Mark that only the member count of a listed
+    server changed. Busy rooms would fill the change log with
+    joins and leaves, so the change is only logged once by
+    the next ServerListFlushCounts(), however many there were.
+*/
+void ServerListTouchCount(Server* server);
+
+/*
+    Server-sided. Log every server marked with ServerListTouchCount()
+    since the last flush as one change each. Root does this
+    on every server list tick, before pushing changes.
+*/
+void ServerListFlushCounts();
+
+/*
+    Append the servers that changed since 'sinceVersion'
+    to the body of the frame being built in 'writer'.
+
+    A 'ServerListDelta' is written followed by what it
+    describes. When nothing changed only the delta is written.
+    The directory version the client will be at is put in 'version'.
+*/
+void ServerListPack(FrameWriter* writer, uint64_t sinceVersion, uint64_t* version);
+
+/*
+    Apply a delta received from root to the client-sided list.
+    'reader' is at the 'ServerListDelta' in the frame body.
+    Returns false if the delta is cut short.
+
+    Removed servers go before listings so a name can be reused
+    between syncs. A listing that can't be added leaves the list
+    at version 0 and asks root for a full list instead.
+
+    Servers run inside the root application, so each one is
+    reached at 'rootAddress' on the port in its listing.
+*/
+bool ServerListApplyDelta(FrameReader* reader, struct sockaddr_in rootAddress);
+
+/*
+    Server-sided. Current directory version of the list.
+*/
+uint64_t ServerListVersion();
+
+/*
+    Directory version of root the client-sided list is at.
+    0 if the list was never received.
+*/
+uint64_t ServerListSyncedVersion();
 
 #endif // __BROWSER_H__
\ No newline at end of file
@@ -0,0 +1,110 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       chatlog.h
+ * @brief      optional on-disk log of what is said in rooms
+ *
+ * @note       Off unless the root server is given a directory for it
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#ifndef __CHATLOG_H__
+#define __CHATLOG_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "fanout.h"
+
+/*
+    A segment is closed and a new one
+    started once it holds this many bytes.
+*/
+#define CHATLOG_SEGMENT_BYTES (4 * 1024 * 1024)
+
+/*
+    Closed segments are deleted once a room has more than
+    this many bytes on disk or they are older than this.
+*/
+#define CHATLOG_ROOM_MAX_BYTES (64 * 1024 * 1024)
+#define CHATLOG_MAX_AGE_SEC    (7 * 24 * 60 * 60)
+
+/*
+    How often appended messages are written and
+    synced to disk, and how often old segments are
+    looked for. Messages appended in between are
+    lost if the process dies.
+*/
+#define CHATLOG_FLUSH_MS  1000
+#define CHATLOG_SWEEP_SEC 60
+
+/*
+    Most messages waiting for the writer. If the disk can't
+    keep up new messages are dropped instead of piling up.
+*/
+#define CHATLOG_MAX_PENDING 65536
+
+/*
+    Numbers about the log since it was started.
+*/
+typedef struct ChatLogMetricsStr
+{
+    uint64_t appended;       // Messages handed to the writer
+    uint64_t dropped;        // Messages lost because the writer was behind
+    uint64_t written;        // Messages on disk
+    uint64_t bytesWritten;   // Bytes on disk
+    uint64_t syncs;          // Times segments were synced
+    uint64_t segmentsRolled; // Segments closed for being full
+    uint64_t segmentsPurged; // Segments deleted for size or age
+} ChatLogMetrics;
+
+/*
+    Start logging rooms into 'directory'.
+
+    Every room gets its own segment files named by the run of
+    the root server, the room id and the segment number, so rooms
+    from an earlier run are never mixed up with new ones.
+    A background thread writes and syncs them.
+    Returns 0 on success and -1 on failure.
+*/
+int ChatLogStart(const char* directory);
+
+/*
+    True once ChatLogStart() succeeded.
+*/
+bool ChatLogEnabled();
+
+/*
+    Log a message fanned out in room 'roomId'.
+
+    Only a reference to 'frame' is kept until the writer
+    gets to it, so this never waits on the disk.
+    Does nothing if the log isn't enabled.
+*/
+void ChatLogAppend(uint64_t roomId, SharedFrame* frame);
+
+/*
+    Read the last 'count' messages of room 'roomId'
+    from disk into 'frames', oldest first.
+
+    Segments are mapped into memory and only the frames
+    returned are copied out. Messages the writer hasn't got
+    to yet aren't seen. Caller releases the frames.
+    Returns how many frames were read.
+*/
+int ChatLogQuery(uint64_t roomId, SharedFrame** frames, int count);
+
+/*
+    Copy the current numbers of the log into 'metrics'.
+*/
+void ChatLogGetMetrics(ChatLogMetrics* metrics);
+
+#endif // __CHATLOG_H__
@@ -68,7 +68,7 @@ void DisplayCommands();
 /*
     Display all the online servers.
 
-    Shows the servers index in 'serverList', 
+    Shows the servers id, 
     name, clients online and max allowed clients.
 */
 void DisplayServers();
@@ -93,12 +93,18 @@ void PrintClientMessage(User sender, char* message);
 
 /*
     Print an interface for the client to send messages
-    in a server to other clients. Takes input from the client.
-
-    Prints out messages sent by other clients.
+    in a server to other clients. The client loop takes
+    input from the client and prints messages sent by
+    other clients from then on.
 */
 int Chatroom(Server* server); // Chatroom for server
 
+/*
+    Print that the client is no longer in 'server'
+    and show the main menu again.
+*/
+void ChatroomClosed(Server* server);
+
 /*
     System messages that can be printed with
     a color in the terminal. 
@@ -25,6 +25,7 @@
 #include "browser.h"
 #include "backend.h"
 #include "root.h"
+#include "dialer.h"
 
 /*
     The local client.
@@ -43,9 +44,22 @@ extern User*  localClient; // Client struct
 void MallocLocalClient(); 
 
 /*
-    Experimental
+    Run the client until they quit.
+
+    One loop owns the terminal, the root socket and the socket
+    of the connected server. It waits on all of them at once and
+    handles each as soon as it has something, so chat and pushes
+    from root show up the moment they arrive. Nothing else reads
+    the sockets so no locks are needed. Disconnects the client
+    once they quit, Ctrl+C included.
+*/
+void RunClientLoop();
+
+/*
+    Root asked if the local client wants to pm 'handle'.
+    The next line they type is taken as the answer.
 */
-void ReceiveRootRequestsAsClient();
+void AskToAcceptPrivateMessage(const char* handle);
 
 /*
     Disconnect the client safely.
@@ -69,11 +83,11 @@ size_t ClientIndex(User* arr[], size_t size, User* value);
     Receive messages from other clients on a server.
 
     Message can either be a command or a message
-    to print on the console.
-    Local client must be connected to the server in
-    'serverInfo' for the function to work.    
+    to print on the console. Called by the client loop
+    when the connected server sent something. Only
+    reads what arrived, so it never waits.
 */
-void ReceivePeerMessagesOnServer(void* serverInfo); // Receive messages from other clients in the server
+void ReceivePeerMessagesOnServer(); // Receive messages from other clients in the server
 
 /*
     Assign a default client username 
@@ -94,13 +108,13 @@ void AssignDefaultHandle(char defaultName[]); // Default Client Username
 void ChooseClientHandle(); // Select your username
 
 /*
-    Handle console commands entered by the client
+    Handle a console command entered by the client
 
-    Perform any commands the client enters.
+    Perform the command the client entered.
     If a command doesn't exist print an error
     message.
 */
-void* HandleClientInput(); // handle commands entered by client
+void HandleClientCommand(char* cmd); // handle commands entered by client
 
 
 /*
@@ -157,19 +171,40 @@ ResponseCode MakeServerRequest(
     CMessage    optionalClientMessage
 );
 
+/*
+    Add where the root server can be reached, as "host:port",
+    "host" or "port". A host name adds every address it has.
+    Returns false if 'endpoint' isn't any of them.
+*/
+bool AddRootEndpoint(const char* endpoint);
+
 /*
     Connect the local client to the root server.
 
+    Races every endpoint added with AddRootEndpoint(), or the
+    root on this machine if none were, and joins the first that
+    answers. Gives up within DIAL_DEFAULT_POLICY's deadline
+    and prints why each endpoint failed.
+
     Must be called so that the program can resume
     and the client can take and make requests.
 */
 int ConnectToRootServer();
 
+/*
+    Make 'cfd', already joined to 'server', the
+    connection to the local clients connected server.
+
+    Lines the client types are sent to it as chat
+    until they leave or the server drops them.
+*/
+void EnterConnectedServer(int cfd, Server* server);
+
 /*
     Disconnect from localClients connected server.
 
-    Make a server request asking to be kicked
-    and update the server list.
+    Make a server request asking to be kicked, close
+    the connection and update the server list.
 */
 void LeaveConnectedServer();
 
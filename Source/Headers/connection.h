@@ -0,0 +1,127 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       connection.h
+ * @brief      buffered non-blocking socket owned by a reactor
+ *
+ * @note
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#ifndef __CONNECTION_H__
+#define __CONNECTION_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "protocol.h"
+#include "reactor.h"
+
+/*
+    Amount of bytes read from a socket at once.
+*/
+#define CONNECTION_READ_CHUNK 16384
+
+/*
+    A non-blocking socket registered on a reactor.
+
+    Bytes received are kept in 'inbound' until the owner
+    has a full message to handle. If the reactor receives for
+    its sockets they are put there before the handler is called,
+    otherwise the handler reads them with ConnectionFill(). Bytes that couldn't be sent
+    right away are kept in 'outbound' and written once the
+    socket becomes writable again.
+
+    Everything sent is whole frames. Control frames wait in 'urgent'
+    instead and are written as soon as the frame partly written
+    from 'outbound' is finished, ahead of the rest of 'outbound'.
+*/
+typedef struct ConnectionStr
+{
+    ReactorWatch    watch;            // Registration on 'reactor'
+    Reactor*        reactor;          // Event loop that owns this socket
+    int             fd;               // The socket
+
+    char*           inbound;          // Received bytes not handled yet
+    size_t          inboundLength;    // Bytes in 'inbound'
+    size_t          inboundCapacity;  // Allocated size of 'inbound'
+
+    char*           outbound;         // Bytes waiting for the socket to be writable
+    size_t          outboundLength;   // Bytes in 'outbound'
+    size_t          outboundCapacity; // Allocated size of 'outbound'
+    size_t          outboundPartial;  // Bytes left of the frame at the start of 'outbound' partly written
+
+    char*           urgent;           // Control frames waiting for the socket to be writable
+    size_t          urgentLength;     // Bytes in 'urgent'
+    size_t          urgentCapacity;   // Allocated size of 'urgent'
+    pthread_mutex_t outboundLock;     // Sends can come from any thread
+
+    bool            peerClosed;       // The other side closed the connection
+    bool            failed;           // The reactor couldn't receive or keep what it received
+    void*           owner;            // Whatever the socket belongs to. e.g: a root client
+} Connection;
+
+/*
+    Make 'fd' non-blocking, wrap it in a Connection
+    and register it on 'reactor'. 'handler' is called with
+    the connection as its context whenever the socket is ready.
+
+    Returns NULL on failure. 'fd' is not closed on failure.
+*/
+Connection* ConnectionCreate(Reactor* reactor, int fd, ReactorHandler handler, void* owner);
+
+/*
+    Read everything available on the socket into 'inbound'.
+    Does nothing if the reactor already received it.
+
+    Returns the amount of bytes read or -1 on a socket error.
+    'peerClosed' is set once the other side hangs up, bytes
+    read before that are still in 'inbound' to be handled.
+*/
+ssize_t ConnectionFill(Connection* connection);
+
+/*
+    Drop the first 'length' bytes of 'inbound'
+    once they have been handled.
+*/
+void ConnectionConsume(Connection* connection, size_t length);
+
+/*
+    Send a whole frame of 'length' bytes on the connection.
+
+    Writes right away if nothing is queued in front of it in
+    'lane', otherwise (or if the socket is full) the rest is queued
+    and sent when the socket becomes writable. Control frames only
+    wait behind other control frames and a frame partly written.
+    Safe to call from any thread.
+    Returns 0 on success and -1 if the connection is broken.
+*/
+int ConnectionSend(Connection* connection, const void* data, size_t length, PriorityLane lane);
+
+/*
+    Amount of bytes in 'lane' still waiting for the socket.
+*/
+size_t ConnectionQueued(Connection* connection, PriorityLane lane);
+
+/*
+    Write queued outbound bytes. Called when
+    the reactor says the socket is writable.
+*/
+int ConnectionFlush(Connection* connection);
+
+/*
+    Unregister, close and free a connection.
+*/
+void ConnectionDestroy(Connection* connection);
+
+#endif // __CONNECTION_H__
@@ -52,4 +52,10 @@ cpthread cpThreadCreate(void* (*function)(void*), void* parameter);
 */
 void cpThreadJoin(cpthread threadInfo);
 
+/*
+	Let a thread run on its own. Its resources are
+	freed when it finishes and it can't be joined.
+*/
+void cpThreadDetach(cpthread threadInfo);
+
 #endif // __CPTHREADS_H__
\ No newline at end of file
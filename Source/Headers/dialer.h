@@ -0,0 +1,91 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       dialer.h
+ * @brief      non-blocking connects raced over a list of endpoints
+ *
+ * @note
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#ifndef __DIALER_H__
+#define __DIALER_H__
+
+#include <stdbool.h>
+#include <netinet/in.h>
+
+/*
+    Most endpoints that can be dialed at once. A host
+    name adds every address it resolves to.
+*/
+#define DIAL_MAX_ENDPOINTS 16
+
+/*
+    How hard Dial() tries before giving up.
+
+    Endpoints are raced in order: each gets 'staggerMs' to connect
+    before the next one is started alongside it, and one that fails
+    starts the next right away. The first to connect wins and the
+    rest are closed. A round ends once every endpoint failed or
+    timed out, and the next round waits a random time between half
+    and all of 'backoffBaseMs' doubled per round, up to 'backoffMaxMs'.
+*/
+typedef struct DialPolicyStr
+{
+    unsigned int attemptTimeoutMs; // A connect still pending this long is given up on
+    unsigned int staggerMs;        // Head start an endpoint gets before the next one is raced against it
+    unsigned int backoffBaseMs;    // Wait after the first failed round
+    unsigned int backoffMaxMs;     // Longest wait between rounds
+    unsigned int rounds;           // Rounds over every endpoint before giving up
+    unsigned int deadlineMs;       // Gives up after this long whatever round it is on
+} DialPolicy;
+
+#define DIAL_DEFAULT_POLICY (DialPolicy){ \
+    .attemptTimeoutMs = 1500,             \
+    .staggerMs        = 250,              \
+    .backoffBaseMs    = 100,              \
+    .backoffMaxMs     = 1000,             \
+    .rounds           = 4,                \
+    .deadlineMs       = 5000,             \
+}
+
+/*
+    What Dial() ended with.
+*/
+typedef struct DialResultStr
+{
+    int          fd;                         // Connected blocking socket, or -1
+    unsigned int endpoint;                   // Index of the endpoint 'fd' is connected to
+    unsigned int rounds;                     // Rounds started
+    int          errors[DIAL_MAX_ENDPOINTS]; // Last errno of each endpoint. 0 if it never failed
+} DialResult;
+
+/*
+    Add the addresses of "host:port", "host" or "port" to 'endpoints',
+    which holds '*count' already. A missing host is this machine and a
+    missing port is 'defaultPort'. Host names are resolved. Returns false
+    if 'text' is neither or there is no room left for its addresses.
+*/
+bool DialParseEndpoint(const char* text, unsigned short defaultPort,
+                       struct sockaddr_in endpoints[DIAL_MAX_ENDPOINTS], unsigned int* count);
+
+/*
+    Connect a TCP socket to the first of 'endpoints' that answers.
+
+    Never blocks on a single endpoint: every connect is non-blocking
+    and they are all waited on together with one poll(), so a dead
+    endpoint costs its stagger rather than a whole connect timeout.
+    Returns true with 'result->fd' set on success. Otherwise
+    'result->errors' says why each endpoint failed.
+*/
+bool Dial(const struct sockaddr_in* endpoints, unsigned int count, const DialPolicy* policy, DialResult* result);
+
+#endif
@@ -0,0 +1,346 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       fanout.h
+ * @brief      send one encoded frame to many sockets without copying it
+ *
+ * @note
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#ifndef __FANOUT_H__
+#define __FANOUT_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include "protocol.h"
+#include "reactor.h"
+#include "workpool.h"
+
+/*
+    Most frames handed to one FanOutWrite() call.
+*/
+#define FANOUT_MAX_FRAMES 64
+
+/*
+    A finished frame shared by everyone it is sent to.
+
+    The frame is encoded once and every recipient (or queue
+    holding it) owns a reference instead of a copy. The memory
+    is freed when the last reference is released.
+*/
+typedef struct SharedFrameStr
+{
+    int    references; // Owners left. Changed atomically
+    size_t length;     // Bytes in 'data'
+    char*  data;       // Header and body of the frame
+} SharedFrame;
+
+/*
+    Take the memory of a finished frame out of 'writer'.
+    The writer is left empty and can be reused.
+    Starts with one reference. NULL on failure.
+*/
+SharedFrame* SharedFrameCreate(FrameWriter* writer);
+
+/*
+    Add a reference. Returns 'frame' for convenience.
+*/
+SharedFrame* SharedFrameRetain(SharedFrame* frame);
+
+/*
+    Drop a reference. Frees the frame once nobody holds it.
+*/
+void SharedFrameRelease(SharedFrame* frame);
+
+/*
+    Send 'frameCount' frames on a blocking socket
+    with vectored writes, so they go out in as few
+    syscalls as the socket allows.
+    Returns 0 on success and -1 if the socket failed.
+*/
+int FanOutWrite(int fd, SharedFrame** frames, int frameCount);
+
+/*
+    Send one frame to every socket in 'fds'.
+    Returns how many sockets it was delivered to.
+*/
+int FanOut(SharedFrame* frame, const int* fds, int fdCount);
+
+/*
+    Most chat frames and bytes an OutboundQueue
+    holds before its OverflowPolicy kicks in.
+*/
+#define OUTBOUND_QUEUE_FRAMES 256
+#define OUTBOUND_QUEUE_BYTES  (1024 * 1024)
+
+/*
+    Most control frames an OutboundQueue holds. They are
+    small and rare so they don't count towards the bytes
+    above, a reader this far behind on them is not reading.
+*/
+#define OUTBOUND_CONTROL_FRAMES 32
+
+/*
+    Most frames in one send handed to the reactor.
+*/
+#define OUTBOUND_SEND_FRAMES 16
+
+/*
+    What to do when a reader is so slow
+    its OutboundQueue fills up.
+*/
+typedef enum
+{
+    k_opDropOldest  = 0, // Drop the oldest queued frames to make room
+    k_opDisconnect  = 1, // Disconnect the reader
+    k_opMarkLagging = 2, // Skip new chat frames until the chat lane has drained
+} OverflowPolicy;
+
+/*
+    Frames of one PriorityLane waiting in an OutboundQueue.
+*/
+typedef struct OutboundLaneStr
+{
+    SharedFrame** frames;      // Ring of queued frames. Storage is in the queue
+    unsigned int  capacity;    // Size of the ring
+    unsigned int  head;        // Oldest queued frame
+    unsigned int  count;       // Frames queued
+    unsigned int  sending;     // Frames at the head in the send on the way
+    size_t        queuedBytes; // Bytes queued and not sent yet
+    uint64_t      dropped;     // Frames lost because the lane was full
+} OutboundLane;
+
+/*
+    Numbers about one PriorityLane of every OutboundQueue together.
+*/
+typedef struct OutboundLaneMetricsStr
+{
+    uint64_t depth;    // Frames queued right now
+    uint64_t maxDepth; // Most frames ever queued at once
+    uint64_t pushed;   // Frames pushed to a queue
+    uint64_t sent;     // Pushed frames that went out
+    uint64_t dropped;  // Frames lost because a queue was full
+} OutboundLaneMetrics;
+
+/*
+    Frames waiting to be sent to one socket.
+
+    Frames are written straight away while the socket takes
+    them. Once it is full they are queued (as references, not
+    copies) and written by the reactor when the socket becomes
+    writable, so a slow reader never blocks whoever is sending
+    to it. The queue is bounded and 'policy' decides what
+    happens once it overflows.
+
+    Every PriorityLane has its own ring and limits. Queued control
+    frames are sent before queued chat frames and lagging only
+    skips chat, so control frames still get through to a slow reader.
+
+    If the reactor takes sends (io_uring) they are handed to it
+    instead of written here, and sends for many queues go to the
+    kernel together. One send per queue is on the way at a time and
+    the frames in it can't be dropped until it completes.
+
+    The queue owns the socket and closes it when the last
+    reference is released. While registered on the reactor
+    the reactor holds a reference of its own, and so does a
+    send on the way.
+*/
+typedef struct OutboundQueueStr
+{
+    ReactorWatch     watch;                                  // Registration on 'reactor'
+    Reactor*         reactor;                                // Event loop that flushes the queue
+    int              fd;                                     // The socket
+    int              references;                             // Owners left. Changed atomically
+    OverflowPolicy   policy;                                 // What to do when the queue is full
+
+    pthread_mutex_t  lock;                                   // Pushes can come from any thread
+    OutboundLane     lanes[PRIORITY_LANES];                  // Queued frames of every lane
+    SharedFrame*     controlFrames[OUTBOUND_CONTROL_FRAMES]; // Ring of the control lane
+    SharedFrame*     chatFrames[OUTBOUND_QUEUE_FRAMES];      // Ring of the chat lane
+    size_t           headSent;                               // Bytes of the frame partly sent
+    PriorityLane     headLane;                               // Lane that frame is at the head of
+
+    bool             registered;                             // Still watched by the reactor
+    bool             lagging;                                // Skipping chat frames until the chat lane drains
+    bool             closing;                                // Send what is queued then hang up
+    bool             broken;                                 // Socket failed. Nothing more is sent
+    bool             ordered;                                // Every frame waits in the chat lane. See OutboundQueueKeepOrder()
+
+    bool             sending;                                // A send handed to the reactor hasn't completed
+    unsigned int     sendingFrames;                          // Frames in that send
+    SharedFrame*     sendFrames[OUTBOUND_SEND_FRAMES];       // References held by that send
+    PriorityLane     sendLanes[OUTBOUND_SEND_FRAMES];        // Lane each of them is queued in
+    struct iovec     sendParts[OUTBOUND_SEND_FRAMES];        // What it sends
+    struct msghdr    sendMessage;                            // Points at sendParts
+    ReactorOperation sendOperation;                          // Tells the queue once it is done
+
+    unsigned int     partition;                              // FanOutPool partition pushing to it. See FanOutPoolAssign()
+} OutboundQueue;
+
+/*
+    Make 'fd' a queued socket and register it on 'reactor'.
+    Writes never block but reads on 'fd' still can.
+    Starts with one reference. NULL on failure and
+    'fd' is not closed on failure.
+*/
+OutboundQueue* OutboundQueueCreate(Reactor* reactor, int fd, OverflowPolicy policy);
+
+/*
+    Add a reference. Returns 'queue' for convenience.
+*/
+OutboundQueue* OutboundQueueRetain(OutboundQueue* queue);
+
+/*
+    Drop a reference. The socket is closed and
+    the queue freed once nobody holds it.
+*/
+void OutboundQueueRelease(OutboundQueue* queue);
+
+/*
+    Send 'frame' or queue a reference to it in 'lane'.
+
+    Returns 0 if it was sent or queued and -1 if it was
+    dropped. e.g: the queue is closing, broken, lagging
+    or the reader was disconnected for being too slow.
+*/
+int OutboundQueuePush(OutboundQueue* queue, SharedFrame* frame, PriorityLane lane);
+
+/*
+    Push 'frameCount' frames at once. If nothing was
+    queued in front of them they go out together in as
+    few vectored writes as the socket allows.
+    Returns how many were sent or queued.
+*/
+int OutboundQueuePushBatch(OutboundQueue* queue, SharedFrame** frames, int frameCount, PriorityLane lane);
+
+/*
+    Hang up once everything queued has been sent.
+
+    Reading stops right away so a thread blocked reading
+    the socket wakes up. Nothing can be pushed after this.
+*/
+void OutboundQueueClose(OutboundQueue* queue);
+
+/*
+    Send frames in the order they were pushed, whatever their lane.
+    For readers that pass frames on (e.g. relays) and need to see
+    them in the order they happened. Do it before anything is pushed.
+*/
+void OutboundQueueKeepOrder(OutboundQueue* queue);
+
+/*
+    True while the queue is skipping chat frames. See k_opMarkLagging.
+*/
+bool OutboundQueueLagging(OutboundQueue* queue);
+
+/*
+    Push one frame to every queue in 'queues'.
+    If the reactor takes sends, the sends of every
+    queue go to the kernel in one syscall.
+    Returns how many queues took it.
+*/
+int FanOutQueued(SharedFrame* frame, OutboundQueue** queues, int queueCount, PriorityLane lane);
+
+/*
+    Copy the numbers of every lane, summed
+    over all queues, into 'metrics'.
+*/
+void OutboundLaneGetMetrics(OutboundLaneMetrics metrics[PRIORITY_LANES]);
+
+/*
+    Most threads a FanOutPool runs, and frames each
+    of them can have waiting before more are turned away.
+*/
+#define FANOUT_MAX_PARTITIONS 64
+#define FANOUT_PARTITION_JOBS 4096
+
+/*
+    Threads pushing frames to long lists of queues in parallel.
+
+    Every queue is given to one partition for good and each
+    partition has one thread, which pushes frames in the order
+    they were handed to the pool. So a queue still gets frames
+    in order while the partitions of one list are pushed to
+    on different cores at the same time.
+*/
+typedef struct FanOutPoolStr
+{
+    WorkPool*    partitions;     // One single threaded pool per partition
+    unsigned int partitionCount; // Amount of partitions
+    unsigned int nextPartition;  // Given to the next queue. Changed atomically
+    uint64_t     rejected;       // Frames a partition had no room for. Changed atomically
+} FanOutPool;
+
+/*
+    Queues to push to, grouped by partition.
+
+    Queues of partition 'i' are queues[starts[i]] up to
+    queues[starts[i + 1]]. Holds a reference to every queue
+    and is shared by the frames on the way to them.
+*/
+typedef struct FanOutListStr
+{
+    int            references;                       // Owners left. Changed atomically
+    unsigned int   count;                            // Queues in the list
+    unsigned int   partitionCount;                   // Partitions it was grouped into
+    unsigned int   starts[FANOUT_MAX_PARTITIONS + 1]; // Where every partition starts in 'queues'
+    OutboundQueue* queues[];                         // Grouped by partition
+} FanOutList;
+
+/*
+    Start one partition per online core, or 'partitions'
+    if it isn't 0. Returns 0 on success and -1 on failure.
+*/
+int FanOutPoolCreate(FanOutPool* pool, unsigned int partitions);
+
+/*
+    Give 'queue' to the next partition of 'pool', round robin.
+    Do it before the queue is put in any FanOutList.
+*/
+void FanOutPoolAssign(FanOutPool* pool, OutboundQueue* queue);
+
+/*
+    Push 'frame' to every queue in 'list', each partition
+    on its own thread. Never blocks.
+    Returns how many queues it was handed over for.
+*/
+int FanOutPoolPush(FanOutPool* pool, SharedFrame* frame, FanOutList* list, PriorityLane lane);
+
+/*
+    Push what was handed to the pool, stop its
+    threads and free its memory.
+*/
+void FanOutPoolDestroy(FanOutPool* pool);
+
+/*
+    Take a reference to each of 'queueCount' queues and group them
+    into 'partitionCount' partitions. Starts with one reference.
+    NULL on failure.
+*/
+FanOutList* FanOutListCreate(OutboundQueue** queues, unsigned int queueCount, unsigned int partitionCount);
+
+/*
+    Add a reference. Returns 'list' for convenience.
+*/
+FanOutList* FanOutListRetain(FanOutList* list);
+
+/*
+    Drop a reference. The queues are let go
+    of once nobody holds the list.
+*/
+void FanOutListRelease(FanOutList* list);
+
+#endif // __FANOUT_H__
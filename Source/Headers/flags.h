@@ -13,6 +13,8 @@ typedef enum
     k_cfAppendServer = 10,  // Append server to explorer 
     k_cfRemoveServer = -10, // Remove server from explorer
     k_cfRequestServerList = 100, // Get all updated server list
+    k_cfSubscribeServerList = 101, // Have root push server list changes as they happen
+    k_cfUnsubscribeServerList = -101, // Stop root pushing server list changes
     k_cfMakeNewServer = 920, // Create a new server clients can connect to
     k_cfRSUpdateServerWithNewInfo = 892, // A server has updated info to be pushed onto the root server
     k_cfClientDeclinedPrivateMessage = -193,
@@ -24,14 +26,21 @@ typedef enum
     k_cfBanClientFromServer = 482, // Ban a client from the server. Must be host
     k_cfKickClientFromServer = 423, // Remove client from the server. Must be host
     k_cfAddClientToServer = 10023, // Add client to server list
-    k_cfSSUpdateClientWithNewInfo = 122, // Update client in rootConnectedClients
+    k_cfSSUpdateClientWithNewInfo = 122, // Update client in the root client registry
     k_cfConnectedServerShutDown = 829, // THe server the client was connected to was shut down
     k_cfClientRequestPrivateMessage = 9403,
+    k_cfAttachRelayToServer = 10024, // A relay wants everything said in a server to pass on to its own clients
 
     // Message command
     k_cfEchoClientMessageInServer  = 1840, // Send message from client to all clients in server 
     k_cfPrintPeerClientMessage = 1323, // Receive a message from client in a server and print it out
-    k_cfPrintServerAnnouncement = 9301 // Print a message sent from the server, aka server announcement
+    k_cfPrintServerAnnouncement = 9301, // Print a message sent from the server, aka server announcement
+    k_cfRequestServerHistory = 1841, // Send the client the last messages said in the server they're in
+    k_cfClientThrottled = 1842, // Client sent requests too fast. What they sent was dropped
+    k_cfRelayClientMessage = 1843, // A relay passing on a message one of its clients sent. Has their handle
+    k_cfRelayClientJoined = 1844, // A relay asking the room to let some of its clients in. Has their handles. Answered with each and a response code
+    k_cfRelayClientLeft = 1845, // Some of a relay's clients left the room. Has their handles
+    k_cfClientMessageDropped = 1846, // What a client sent couldn't reach the room and was dropped. Has their handle
 } CommandFlag;
 
 
@@ -63,5 +72,8 @@ typedef enum
     k_rcInternalServerError = -192, // Something went wrong on the servers side
     
     // Types of errors
-    k_rcErrorPortInUse = -302, // The port client tried to make a server with is in use.
+    k_rcErrorHandleInUse = -303, // Another client on the root server already has that username
+    k_rcErrorServerNameInUse = -304, // Another online server already has that name
+    k_rcErrorServerBusy = -305, // Root had too many requests waiting to take this one
+    k_rcErrorServerFull = -306, // The server already has its max amount of clients
 } ResponseCode;
\ No newline at end of file
@@ -0,0 +1,96 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       hashmap.h
+ * @brief      open addressing hash map keyed by strings or 64-bit ids
+ *
+ * @note
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#ifndef __HASHMAP_H__
+#define __HASHMAP_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    One slot in a HashMap.
+
+    For string maps 'key' points at memory owned by
+    'value' (e.g. a handle inside a User struct) so it
+    must stay valid for as long as the entry is in the map.
+*/
+typedef struct HashMapEntryStr
+{
+    bool        used;  // Slot holds an entry
+    uint64_t    hash;  // Mixed hash used to pick the slot
+    uint64_t    id;    // Key for id maps
+    const char* key;   // Key for string maps. NULL in id maps
+    void*       value; // What the key maps to
+} HashMapEntry;
+
+/*
+    Hash map with linear probing.
+
+    Lookups, inserts and removals are O(1) on average.
+    Removal shifts the following entries back instead of
+    leaving tombstones, so the map never fills up with
+    dead slots no matter how much churn there is.
+
+    A map is either keyed by strings (HashMapGet/Put/Remove)
+    or by 64-bit ids (HashMapGetId/PutId/RemoveId), not both.
+    Not thread safe, callers must lock.
+*/
+typedef struct HashMapStr
+{
+    HashMapEntry* entries;  // 'capacity' slots
+    size_t        capacity; // Always a power of two
+    size_t        count;    // Used slots
+} HashMap;
+
+/*
+    Set up an empty map with room for at least
+    'expectedEntries' before it has to grow.
+    Returns false if memory couldn't be allocated.
+*/
+bool HashMapInit(HashMap* map, size_t expectedEntries);
+
+/*
+    Free the slots of a map. Values are not freed.
+*/
+void HashMapFree(HashMap* map);
+
+/*
+    Get the value for 'key' or NULL if it isn't in the map.
+*/
+void* HashMapGet(HashMap* map, const char* key);
+
+/*
+    Map 'key' to 'value', replacing whatever was there.
+    Returns false if the map couldn't grow.
+*/
+bool HashMapPut(HashMap* map, const char* key, void* value);
+
+/*
+    Remove 'key'. Returns the value it had or NULL.
+*/
+void* HashMapRemove(HashMap* map, const char* key);
+
+/*
+    Same as the functions above but for maps keyed by id.
+*/
+void* HashMapGetId(HashMap* map, uint64_t id);
+bool  HashMapPutId(HashMap* map, uint64_t id, void* value);
+void* HashMapRemoveId(HashMap* map, uint64_t id);
+
+#endif // __HASHMAP_H__
@@ -6,14 +6,14 @@
 // The maximum amount a specific value/parameter is allowed to be
 typedef enum MaximumValues
 {
-    kMaxServerMembers       = 100, // Can't set a servers maxClient more than this
+    kMaxServerMembers       = 100, // Can't set a servers maxClient more than this unless large rooms are on
+    kMaxLargeServerMembers  = 65535, // Most members of a large room. Server listings carry it in 16 bits
     kDefaultMaxClients      = 30, // Default parameter of a servers allowed clients
     kMaxServerAliasLength   = 32,  // Max server name length in chars
     kMaxClientHandleLength  = 20, // Max client user name length in chars
     kMaxClientMessageLength = 2000, // Max msg length in chars
-    kMaxGlobalClients       = 1000, // Max allowed clients connected to app
-    kMaxServersOnline       = 30, // Max allowed servers online
     kMaxCommandLength       = 300,
+    kMaxDirectoryChanges    = 256, // Server list changes root remembers for clients syncing their list
 } MaxValue;
 
 // The minimum amount a specific value/parameter is allowed to be
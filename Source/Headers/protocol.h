@@ -0,0 +1,265 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       protocol.h
+ * @brief      framed binary wire protocol used between clients and servers
+ *
+ * @note
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#ifndef __PROTOCOL_H__
+#define __PROTOCOL_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Version of the wire protocol. Frames with
+    any other version are rejected.
+*/
+#define PROTOCOL_VERSION 1
+
+/*
+    Largest body a frame may have. Anything
+    bigger means the peer is broken or malicious.
+*/
+#define PROTOCOL_MAX_BODY (1024 * 1024)
+
+/*
+    What a frame is.
+*/
+typedef enum
+{
+    k_fkRequest = 1, // Asks the other side to do 'command'. Expects a reply
+    k_fkReply   = 2, // Answer to the request with the same request id
+    k_fkPush    = 3, // Sent without being asked. e.g: a chat message
+} FrameKind;
+
+/*
+    Which lane a frame waits in when the socket it
+    goes to can't take it yet.
+
+    Control frames (kicks, shutdown notices, announcements,
+    invites) are few and small and go out ahead of every queued
+    chat frame, so a reader far behind on chat still hears right
+    away that they were kicked. A frame already partly sent is
+    always finished first so frames never interleave on the wire.
+*/
+typedef enum
+{
+    k_plControl = 0, // Jumps ahead of queued chat
+    k_plChat    = 1, // Messages, history and everything else
+} PriorityLane;
+
+#define PRIORITY_LANES 2
+
+/*
+    Sent in front of every frame.
+
+    'length' bytes of body follow the header. What the body
+    holds depends on 'command' and only has the fields that
+    command needs. Numbers are in network byte order.
+*/
+typedef struct __attribute__((packed)) FrameHeaderStr
+{
+    uint8_t  version;   // PROTOCOL_VERSION
+    uint8_t  kind;      // FrameKind
+    int16_t  command;   // CommandFlag of the request, or what a push is about
+    uint32_t length;    // Bytes of body after the header
+    uint32_t requestId; // Picked by whoever sends a request. Echoed in its reply. 0 for pushes
+} FrameHeader;
+
+/*
+    Bytes a FrameStream asks the socket for at once.
+*/
+#define FRAME_STREAM_CHUNK 16384
+
+/*
+    Builds one frame in memory.
+
+    Start a frame with FrameBegin() then append the body
+    with the FramePut functions. If memory runs out 'failed'
+    is set and the rest of the puts do nothing, so errors
+    only have to be checked once at FrameFinish().
+*/
+typedef struct FrameWriterStr
+{
+    char*  data;     // Header followed by the body
+    size_t length;   // Bytes written so far
+    size_t capacity; // Allocated size of 'data'
+    bool   failed;   // Ran out of memory
+} FrameWriter;
+
+/*
+    Reads the fields of a frame body in order.
+
+    Reading past the end of the body sets 'failed'
+    and returns zeroes, so a short or corrupt frame
+    only has to be checked for once at the end.
+*/
+typedef struct FrameReaderStr
+{
+    const char* data;   // The body
+    size_t      length; // Bytes in the body
+    size_t      offset; // Next byte to read
+    bool        failed; // Tried to read more than the body has
+} FrameReader;
+
+/*
+    Receive buffer of a blocking socket.
+
+    TCP doesn't keep the boundaries of what was sent. One recv()
+    can return half a frame or several frames at once, so bytes
+    are read in bulk into 'data' and frames are cut out of it.
+    Frames that arrived together are handled without another
+    syscall and partial frames wait here for the rest of their bytes.
+*/
+typedef struct FrameStreamStr
+{
+    int    fd;       // Socket to read from
+    char*  data;     // Received bytes not handled yet start at data + start
+    size_t start;    // First byte of the next frame
+    size_t length;   // End of the received bytes
+    size_t capacity; // Allocated size of 'data'
+} FrameStream;
+
+/*
+    Start a new frame in 'writer'. Whatever the writer
+    held before is dropped but its memory is reused.
+*/
+void FrameBegin(FrameWriter* writer, FrameKind kind, int command, uint32_t requestId);
+
+/*
+    Append a field to the body of the frame.
+
+    Strings are sent as a length and the characters with no
+    terminator. Short strings (handles, names) use one byte for
+    the length and long ones (chat messages) use two.
+*/
+void  FramePutU8(FrameWriter* writer, uint8_t value);
+void  FramePutU16(FrameWriter* writer, uint16_t value);
+void  FramePutU32(FrameWriter* writer, uint32_t value);
+void  FramePutU64(FrameWriter* writer, uint64_t value);
+void  FramePutString(FrameWriter* writer, const char* string);
+void  FramePutLongString(FrameWriter* writer, const char* string);
+void  FramePutBytes(FrameWriter* writer, const void* bytes, size_t length);
+
+/*
+    Make room for 'length' bytes in the body and return a
+    pointer to them for the caller to fill in. NULL on failure.
+    The pointer is only valid until the next put.
+*/
+void* FrameReserve(FrameWriter* writer, size_t length);
+
+/*
+    Fill in the length of the frame.
+    Returns false if building the frame failed.
+*/
+bool FrameFinish(FrameWriter* writer);
+
+/*
+    Free the memory of a writer.
+*/
+void FrameWriterFree(FrameWriter* writer);
+
+/*
+    Read the next field of a body. See FramePutString()
+    for how strings are sent. Strings longer than 'size' - 1
+    are cut off and always terminated.
+*/
+void     FrameReaderInit(FrameReader* reader, const char* body, size_t length);
+uint8_t  FrameGetU8(FrameReader* reader);
+uint16_t FrameGetU16(FrameReader* reader);
+uint32_t FrameGetU32(FrameReader* reader);
+uint64_t FrameGetU64(FrameReader* reader);
+void     FrameGetString(FrameReader* reader, char* string, size_t size);
+void     FrameGetLongString(FrameReader* reader, char* string, size_t size);
+bool     FrameGetBytes(FrameReader* reader, void* bytes, size_t length);
+
+/*
+    Bytes of the body not read yet.
+*/
+size_t FrameRemaining(FrameReader* reader);
+
+/*
+    Read a frame header from the start of 'data'
+    into 'header' in host byte order.
+
+    Returns 1 if a whole frame (header and body) is in 'data',
+    0 if more bytes are needed and -1 if the header is invalid.
+*/
+int FrameParse(const char* data, size_t length, FrameHeader* header);
+
+/*
+    Send a finished frame on a blocking socket.
+    Returns 0 on success and -1 on failure.
+*/
+int FrameSend(int fd, FrameWriter* writer);
+
+/*
+    Receive one whole frame from a blocking socket.
+
+    The header is put in 'header' in host byte order and
+    the body in a new buffer put in 'body' (NULL if the body
+    is empty). Caller frees 'body'.
+    Returns 0 on success and -1 if the socket failed or closed.
+*/
+int FrameReceive(int fd, FrameHeader* header, char** body);
+
+/*
+    Set up a stream for 'fd'. No memory is
+    allocated until bytes arrive.
+*/
+void FrameStreamInit(FrameStream* stream, int fd);
+
+/*
+    Get the next frame from the stream, reading from
+    the socket only if no whole frame is buffered.
+
+    The header is put in 'header' in host byte order and 'reader'
+    is set up to read the body. The body stays valid until the
+    next call. Returns 0 on success and -1 if the socket failed,
+    closed or sent something that isn't a frame.
+*/
+int FrameStreamNext(FrameStream* stream, FrameHeader* header, FrameReader* reader);
+
+/*
+    True if a whole frame is already buffered so
+    FrameStreamNext() won't have to wait on the socket.
+*/
+bool FrameStreamReady(FrameStream* stream);
+
+/*
+    Read whatever the socket has right now without waiting,
+    for callers that poll the socket themselves. Frames it
+    completed are then taken with FrameStreamNext() while
+    FrameStreamReady() is true. Returns how many bytes were
+    read, 0 if none were waiting and -1 if the socket closed
+    or failed.
+*/
+int FrameStreamFill(FrameStream* stream);
+
+/*
+    Add bytes that were received for the socket somewhere else,
+    e.g: by a reactor that reads sockets itself. Returns 0 on
+    success and -1 if memory ran out or what is buffered now
+    isn't a frame.
+*/
+int FrameStreamAppend(FrameStream* stream, const char* data, size_t length);
+
+/*
+    Free the buffer of a stream. The socket isn't closed.
+*/
+void FrameStreamFree(FrameStream* stream);
+
+#endif // __PROTOCOL_H__
@@ -0,0 +1,59 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       ratelimit.h
+ * @brief      lock-free token buckets used to limit how fast clients send
+ *
+ * @note
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#ifndef __RATELIMIT_H__
+#define __RATELIMIT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+    Allows 'rate' actions a second on average and
+    up to 'burst' at once after being idle.
+
+    Instead of a token count and a refill time the bucket
+    keeps one number: when it will be full again ('fullAt').
+    Taking a token pushes that time forward by one token's
+    worth, so the whole state fits in one 64-bit word and is
+    updated with a compare and swap. Any amount of threads
+    can take from a bucket without a lock.
+*/
+typedef struct TokenBucketStr
+{
+    uint64_t tokenNs; // Time it takes to earn one token. 0 means unlimited
+    uint64_t burstNs; // Time it takes to earn a full bucket
+    uint64_t fullAt;  // Monotonic time the bucket is full again. Changed atomically
+} TokenBucket;
+
+/*
+    Set up a full bucket. A 'rate' of 0 turns the limit off.
+*/
+void TokenBucketInit(TokenBucket* bucket, unsigned int rate, unsigned int burst);
+
+/*
+    Take one token. Returns false if the bucket is
+    empty, in which case nothing was taken.
+*/
+bool TokenBucketTake(TokenBucket* bucket);
+
+/*
+    Current monotonic time in nanoseconds.
+*/
+uint64_t MonotonicNs();
+
+#endif // __RATELIMIT_H__
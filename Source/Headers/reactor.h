@@ -0,0 +1,249 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       reactor.h
+ * @brief      non-blocking event loop used by the root server
+ *
+ * @note
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#ifndef __REACTOR_H__
+#define __REACTOR_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+/*
+    Max amount of events handled
+    in one wait on the event loop.
+*/
+#define REACTOR_MAX_EVENTS 256
+
+/*
+    Readiness events a watch can be
+    interested in. Same values as epoll.
+*/
+#define REACTOR_READ  EPOLLIN
+#define REACTOR_WRITE EPOLLOUT
+
+struct ReactorStr;
+struct UringStr;
+
+/*
+    What a reactor waits on the kernel with.
+
+    epoll is told which sockets are ready and the handlers make the
+    syscalls themselves. io_uring is handed the accepts, receives and
+    sends as requests in a shared ring, so many of them go to the kernel
+    in one syscall and their results come back the same way.
+*/
+typedef enum
+{
+    k_rbEpoll = 0, // Readiness with epoll. Works everywhere
+    k_rbUring = 1, // Requests through io_uring. Falls back to epoll if the kernel can't
+} ReactorBackend;
+
+/*
+    Backend used by reactors created from now on.
+*/
+extern ReactorBackend reactorBackend;
+
+/*
+    Called by the event loop whenever a watched
+    file descriptor is ready. 'events' is a mask
+    of REACTOR_READ, REACTOR_WRITE and EPOLLHUP/EPOLLERR.
+*/
+typedef void (*ReactorHandler)(struct ReactorStr* reactor, unsigned int events, void* context);
+
+/*
+    Called with bytes the reactor received for a watch.
+    'length' is 0 once the other side hung up and -errno
+    if the socket failed. 'data' is only valid during the call.
+*/
+typedef void (*ReactorReceiver)(struct ReactorStr* reactor, const char* data, ssize_t length, void* context);
+
+/*
+    Called with a socket the reactor accepted
+    for a watch or -errno if accepting failed.
+*/
+typedef void (*ReactorAcceptor)(struct ReactorStr* reactor, int fd, void* context);
+
+/*
+    Called on the reactor thread once a request
+    handed to the reactor is done. 'result' is what
+    the syscall would have returned or -errno.
+*/
+typedef void (*ReactorCompletion)(struct ReactorStr* reactor, int result, void* context);
+
+/*
+    A file descriptor registered on a reactor.
+
+    The memory is owned by whoever registered it
+    (usually embedded in a connection struct) and must
+    stay valid until ReactorRemove() is called.
+*/
+typedef struct ReactorWatchStr
+{
+    int             fd;       // Watched file descriptor
+    unsigned int    events;   // Events we currently want to be told about
+    ReactorHandler  handler;  // Called when 'fd' is ready
+    void*           context;  // Passed back to 'handler'
+
+    /*
+        Optional. With io_uring the reactor reads or accepts on 'fd'
+        itself and hands over the result instead of telling 'handler'
+        the socket is readable. epoll ignores them so 'handler' must
+        still cope with REACTOR_READ.
+    */
+    ReactorReceiver receiver; // Bytes received on 'fd'
+    ReactorAcceptor acceptor; // Sockets accepted on 'fd'
+    unsigned int    slot;     // Used by the io_uring backend
+} ReactorWatch;
+
+/*
+    A request handed to the reactor, e.g: a send.
+
+    The memory is owned by whoever made the request and
+    must stay valid until 'complete' has been called.
+*/
+typedef struct ReactorOperationStr
+{
+    ReactorCompletion complete; // Called once the request is done
+    void*             context;  // Passed back to 'complete'
+} ReactorOperation;
+
+/*
+    An event loop.
+
+    One thread calls ReactorRun() and every
+    registered watch has its handler called from
+    that thread when its file descriptor is ready.
+*/
+typedef struct ReactorStr
+{
+    int              epfd;     // epoll instance. -1 with io_uring
+    struct UringStr* uring;    // io_uring instance. NULL with epoll
+    bool             running;  // Set to false to stop ReactorRun()
+    uint64_t         syscalls; // Syscalls made for the sockets of this reactor. Changed atomically
+} Reactor;
+
+/*
+    Create the event loop for 'reactor' using 'reactorBackend'.
+    Returns 0 on success and -1 on failure.
+*/
+int ReactorCreate(Reactor* reactor);
+
+/*
+    Name of the backend 'reactor' ended up with.
+*/
+const char* ReactorBackendName(Reactor* reactor);
+
+/*
+    Start watching 'watch->fd' for 'watch->events'.
+    Returns 0 on success and -1 on failure.
+*/
+int ReactorAdd(Reactor* reactor, ReactorWatch* watch);
+
+/*
+    Change the events a registered watch is interested in.
+    Safe to call from any thread. REACTOR_READ can't be taken
+    away from a watch with a 'receiver' or 'acceptor'.
+*/
+int ReactorModify(Reactor* reactor, ReactorWatch* watch, unsigned int events);
+
+/*
+    Stop watching a file descriptor. Does not close it.
+*/
+void ReactorRemove(Reactor* reactor, ReactorWatch* watch);
+
+/*
+    Call 'watch->handler' every 'intervalMs' milliseconds.
+
+    Fills in 'watch->fd' with a timer and registers it. Once
+    a tick has been handled call ReactorTimerAcknowledge() or
+    the handler is called again right away.
+    Returns 0 on success and -1 on failure.
+*/
+int ReactorAddTimer(Reactor* reactor, ReactorWatch* watch, unsigned int intervalMs);
+
+/*
+    Mark the ticks of a timer watch as handled.
+*/
+void ReactorTimerAcknowledge(ReactorWatch* watch);
+
+/*
+    Wait for events and dispatch them to their
+    handlers until 'reactor->running' is false.
+*/
+void ReactorRun(Reactor* reactor);
+
+/*
+    True if sends can be handed to the reactor
+    with ReactorSendMessage(). Only with io_uring.
+*/
+bool ReactorQueuesSends(Reactor* reactor);
+
+/*
+    True if the reactor reads for watches with
+    a 'receiver' itself. Only with io_uring.
+*/
+bool ReactorReceives(Reactor* reactor);
+
+/*
+    Hand a sendmsg() on 'fd' to the reactor. 'message' and
+    everything it points to must stay valid until 'operation'
+    completes. Nothing goes to the kernel until ReactorSubmit()
+    or the next turn of the event loop, so many sends can be
+    queued and made with one syscall.
+    Returns 0 on success and -1 if it couldn't be queued.
+*/
+int ReactorSendMessage(Reactor* reactor, ReactorOperation* operation, int fd, struct msghdr* message, int flags);
+
+/*
+    Hand everything queued to the kernel now. Does nothing on
+    the reactor thread since the event loop does it before waiting.
+*/
+void ReactorSubmit(Reactor* reactor);
+
+/*
+    Count a syscall made for a socket of 'reactor'.
+*/
+void ReactorCountSyscall(Reactor* reactor);
+
+/*
+    Put a socket into non-blocking mode.
+    Returns 0 on success and -1 on failure.
+*/
+int SetSocketNonBlocking(int fd);
+
+/*
+    Raise the open file limit of this process
+    to the hard limit so the event loop can hold
+    as many client sockets as the system allows.
+*/
+void RaiseOpenFileLimit();
+
+/*
+    True if the other end of 'fd' is on this machine
+    or at one of the 'count' addresses in 'allowed'.
+*/
+bool SocketPeerAllowed(int fd, const struct in_addr* allowed, unsigned int count);
+
+#endif // __REACTOR_H__
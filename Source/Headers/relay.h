@@ -0,0 +1,197 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       relay.h
+ * @brief      relay process passing rooms on to clients of its own
+ *
+ * @note       Ran by main_relay.c
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#ifndef __RELAY_H__
+#define __RELAY_H__
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "dialer.h"
+#include "fanout.h"
+#include "hashmap.h"
+
+/*
+    Port relays listen on unless told otherwise.
+*/
+#define RELAY_PORT 18090
+
+/*
+    Connections waiting to be accepted. Clients of a large
+    room can join all at once. The kernel caps it at somaxconn.
+*/
+#define RELAY_LISTEN_BACKLOG 65535
+
+/*
+    Most upstreams a relay can be given.
+*/
+#define RELAY_MAX_UPSTREAMS 8
+
+/*
+    Frames of each room a relay remembers. Replayed to whoever
+    joins through it and used to find what it missed after
+    losing its upstream. Rooms never send more history than this.
+*/
+#define RELAY_HISTORY_LENGTH (OUTBOUND_QUEUE_FRAMES - 1)
+
+/*
+    How many times every upstream is tried, and how long to
+    wait between tries, once the one a room came through is gone.
+*/
+#define RELAY_REATTACH_ROUNDS   20
+#define RELAY_REATTACH_DELAY_MS 100
+
+/*
+    How long connecting to one upstream can take when attaching a
+    room. Dead upstreams cost this instead of a whole TCP connect
+    timeout. The room then has RELAY_JOIN_TIMEOUT_SEC to answer.
+*/
+#define RELAY_DIAL_POLICY (DialPolicy){ \
+    .attemptTimeoutMs = 1000,           \
+    .staggerMs        = 1000,           \
+    .backoffBaseMs    = 0,              \
+    .backoffMaxMs     = 0,              \
+    .rounds           = 1,              \
+    .deadlineMs       = 1000,           \
+}
+
+/*
+    Seconds a connection has to send its join before it is dropped,
+    and how often the ones that ran out of time are looked for.
+*/
+#define RELAY_JOIN_TIMEOUT_SEC 5
+#define RELAY_JOIN_SWEEP_MS    1000
+
+/*
+    Threads handling joins, and how many joins can wait for
+    one. Attaching a room to upstream can take a while,
+    so it is never done on the reactor.
+*/
+#define RELAY_WORKERS          4
+#define RELAY_WORK_QUEUE_DEPTH 1024
+
+/*
+    Messages from below a room holds while it is between
+    upstreams. They are sent on in order once it is attached
+    again. Past this whoever sends one is told it was dropped.
+*/
+#define RELAY_HELD_MESSAGES 128
+
+/*
+    Most clients named in one frame when a relay registers
+    or lets go of many at once, like after a reattach.
+*/
+#define RELAY_HANDLE_BATCH 256
+
+/*
+    A client going over the request rate of their room
+    is told so at most this often.
+*/
+#define RELAY_THROTTLE_NOTICE_MS 1000
+
+/*
+    Most addresses relays below can attach from,
+    besides this machine which always can.
+*/
+#define RELAY_MAX_PEERS 16
+
+/*
+    Where rooms are passed on from. The ROOM_PORT of the
+    root server or another relay, tried in order.
+    Set before RelayStart() is called.
+*/
+extern struct sockaddr_in relayUpstreams[RELAY_MAX_UPSTREAMS];
+extern unsigned int       relayUpstreamCount;
+
+/*
+    Where relays below are let attach from besides this machine.
+    They say which of their clients sent each message, so one
+    attached from anywhere else could speak as anyone and is refused.
+    Set before RelayStart() is called.
+*/
+extern struct in_addr relayPeers[RELAY_MAX_PEERS];
+extern unsigned int   relayPeerCount;
+
+/*
+    One room passed on by a relay.
+
+    Attached to upstream the first time someone joins it through
+    the relay and let go of once the last of them leaves. Every
+    frame the room sends comes in once from upstream and is fanned
+    out to everyone downstream, clients and relays below alike, so
+    relays can be stacked into a tree as deep as needed.
+
+    If the upstream goes away without the room shutting down the
+    next upstream is attached to and what was missed in between
+    is found in the history it sends. Clients downstream stay
+    connected the whole time and what they say meanwhile is sent
+    on once it is attached again. Clients are held to the request
+    rate the room told the relay. Guarded by relayLock.
+
+    The room decides who gets in. Clients joining through the relay,
+    or a relay below, are registered with it by handle and wait for
+    its answer, so handles are unique and maxClients holds across the
+    room and every relay. They are registered again after a reattach.
+*/
+typedef struct RelayRoomStr
+{
+    uint64_t        roomId;                        // Room upstream
+    int             references;                    // Owners left. Guarded by relayLock
+    bool            closed;                        // Shut down or let go of. Nobody new can join
+    bool            shutDown;                      // The room said it was shut down
+    bool            attaching;                     // Upstream didn't answer yet. Joins wait on relayAttachDone
+    OutboundQueue*  upstream;                      // Attachment to the room. NULL while reattaching
+    SharedFrame*    held[RELAY_HELD_MESSAGES];     // Messages from below waiting for an upstream, oldest first
+    unsigned int    heldCount;                     // Frames in 'held'
+    unsigned int    upstreamIndex;                 // What it is attached through in relayUpstreams
+    char*           info;                          // Body of the join reply handed to clients
+    size_t          infoLength;                    // Bytes in 'info'
+    OutboundQueue** downstream;                    // Clients and relays it is passed on to
+    unsigned int    downstreamCount;               // Queues in 'downstream'
+    unsigned int    downstreamCapacity;            // Allocated size of 'downstream'
+    FanOutList*     recipients;                    // Shared copy of 'downstream'. NULL until the next fan-out
+    HashMap         handles;                       // Handle to everyone in the room through this relay, or joining it
+    unsigned int    joining;                       // Clients of this relay waiting for upstream to let them in
+    SharedFrame*    history[RELAY_HISTORY_LENGTH]; // Ring of the last frames the room sent
+    unsigned int    historyLimit;                  // Frames the room itself keeps. 'history' holds no more
+    unsigned int    historyHead;                   // Oldest frame in 'history'
+    unsigned int    historyCount;                  // Frames in 'history'
+    unsigned int    clientRate;                    // Requests a second each client can make. 0 is unlimited
+} RelayRoom;
+
+/*
+    Parse "host:port" or just "port" (on this machine) into 'address'.
+    Returns false if it isn't either.
+*/
+bool RelayParseAddress(const char* text, struct sockaddr_in* address);
+
+/*
+    Listen on 'port' and start the workers and the reactor
+    reading what clients and relays below send.
+    Returns 0 on success and -1 on failure.
+*/
+int RelayStart(unsigned short port);
+
+/*
+    Run the relay's reactor on this thread. It accepts clients and
+    relays below this one, reads their joins and sends what is queued
+    for every socket, upstream and down. Returns once it stops.
+*/
+void RelayAcceptClients();
+
+#endif // __RELAY_H__
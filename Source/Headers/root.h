@@ -21,6 +21,9 @@
 #include "server.h"
 #include "backend.h"
 #include "browser.h"
+#include "reactor.h"
+#include "connection.h"
+#include "workpool.h"
 
 /*
     THe port that the root server
@@ -31,18 +34,71 @@
 */
 #define ROOT_PORT 18081 // Port the root server is running on
 
+/*
+    How often root pushes server list changes to
+    subscribed clients. Every change made during one
+    tick goes out to a client as one message.
+*/
+#define ROOT_DIRECTORY_TICK_MS 100
+
+/*
+    Worker threads that run root requests when
+    no count is given on the command line.
+*/
+#define ROOT_DEFAULT_WORKERS 4
+
+/*
+    Most root requests waiting for a worker. Past this
+    clients are told the root server is busy.
+*/
+#define ROOT_WORK_QUEUE_DEPTH 4096
+
+/*
+    How often root prints how busy its workers are.
+*/
+#define ROOT_STATS_INTERVAL_MS 60000
+
 /*
     A struct representing a response to 
     a root request made and handled.
 */
 typedef struct Response
 {
-    ResponseFlag rflag; // Response flags, tell the client what to do or what has been done
-    ResponseCode rcode; // Response code/status code. Tell if the operation succeeded
-    void*  returnValue; // Expect returned thing from making the root request like a server list
+    ResponseFlag rflag;       // Response flags, tell the client what to do or what has been done
+    ResponseCode rcode;       // Response code/status code. Tell if the operation succeeded
+    void*        returnValue; // Expect returned thing from making the root request like a server list
+    CommandFlag  command;     // Command of the request this responds to
+    uint32_t     requestId;   // Id of the request this responds to
 } RootResponse;
 
 
+/*
+    Client-sided. Requests to root that can be waiting for
+    their responses at once. Responses carry the id of the
+    request they answer, so they can come back in any order.
+*/
+#define ROOT_MAX_PENDING_REQUESTS 64
+
+/*
+    How long root keeps a pm invite open for the peer
+    to answer. The client asking gives up on the response
+    a little later, in case root's answer is on its way.
+*/
+#define ROOT_PRIVATE_MESSAGE_TIMEOUT_SEC 60
+#define ROOT_REQUEST_TIMEOUT_SEC         (ROOT_PRIVATE_MESSAGE_TIMEOUT_SEC + 5)
+
+/*
+    How often root looks for pm invites nobody answered.
+*/
+#define ROOT_PRIVATE_MESSAGE_SWEEP_MS 1000
+
+/*
+    Client-sided. Called with the response to a request made
+    with SendRootRequest() once it arrives. 'context' is what
+    was given with the request.
+*/
+typedef void (*RootResponseHandler)(RootResponse* response, void* context);
+
 /*
     A struct that holds sufficient information needed
     to make a request the root server can perform.
@@ -53,8 +109,30 @@ typedef struct RootServerRequest
     User        user;              // User who is performing the request
     Server      server;            // Related server to use when doing a command that involves server info. e.g: make new server
     CMessage    clientSentMessage; // A message sent by client. empty string if no message. ENCRYPTED
+    uint64_t    directoryVersion;  // Server list version the client has. Used with k_cfRequestServerList
+    uint32_t    requestId;         // Id of the frame the request came in. The response echoes it
 } RootRequest;
 
+/*
+    State the root server keeps for every
+    socket connected to it. Owned by the root event loop.
+*/
+typedef struct RootSessionStr
+{
+    Connection*  connection;              // Non-blocking socket to the client
+    User         user;                    // The client. Only valid once 'joined' is true
+    bool         joined;                  // Client sent k_cfConnectClientToServer
+    bool         closing;                 // Close the socket once the current request is done
+    User         privateMessageFrom;      // Client waiting for this client to answer a pm invite
+    bool         privateMessagePending;   // True while 'privateMessageFrom' is waiting
+    uint32_t     privateMessageRequestId; // Request of 'privateMessageFrom' to respond to
+    uint64_t     privateMessageDeadline;  // MonotonicNs() the invite expires at
+    unsigned int privateMessageIndex;     // Index in the open invite list while 'privateMessagePending'
+    bool         subscribed;              // Client wants server list changes pushed to it
+    unsigned int subscriberIndex;         // Index in the subscriber list while 'subscribed'
+    uint64_t     pushedDirectoryVersion;  // Server list version the client was last sent
+} RootSession;
+
 /*
     An integer of the total online clients
     that are on the app and connected to the root server
@@ -62,10 +140,20 @@ typedef struct RootServerRequest
 extern unsigned int onlineGlobalClients;
 
 /*
-    Array of all clients who are connected
-    to the root server.
+    Amount of worker threads root requests are ran on.
+    Set before calling AcceptClientsToRoot().
+*/
+extern unsigned int rootWorkerCount;
+
+/*
+    Find a client connected to the root server by
+    their handle or by their root socket (rfd). O(1).
+
+    The client is copied into 'client'.
+    Returns false if no client was found.
 */
-extern User rootConnectedClients[];
+bool RSFindClientByHandle(const char* handle, User* client);
+bool RSFindClientByRfd(int rfd, User* client);
 
 /*
     Server structure representing the root
@@ -74,15 +162,22 @@ extern User rootConnectedClients[];
 extern Server rootServer;
 
 /*
-    Find client struct in rootConnectedClients array
+    Find client in the root client registry
     and replace it with updated info.
 
-    Update a client who is in the rootConnectedClient
-    array with new info, in particular: 'updatedUserInfo'
-    provided as the function arguments.
+    Update a client who is connected to the root
+    server with new info, in particular: 'updatedUserInfo'
+    provided as the function arguments. Their rfd and
+    client id are kept.
 */
 void SSUpdateClientWithNewInfo(User updatedUserInfo);
 
+/*
+    The root session of 'handle' stops pointing at 'room' as the
+    server they are in, if it does. Called before a room is freed.
+*/
+void RSClientLeftRoom(const char* handle, Server* room);
+
 /* 
     Make a request to the root server.
 
@@ -93,6 +188,9 @@ void SSUpdateClientWithNewInfo(User updatedUserInfo);
     Once the root server receives the request, it will try and 
     perform it. After it will return a struct called 'RootResponse'
     that includes information about what happened on the root server.
+
+    Waits for the response. Other requests can be waiting for
+    theirs at the same time and are answered on the way.
 */
 RootResponse MakeRootRequest(
     CommandFlag    commandFlag,
@@ -101,6 +199,67 @@ RootResponse MakeRootRequest(
     CMessage clientMessageInfo
 ); 
 
+/*
+    Client-sided. Send a request to root without waiting for it.
+
+    Root answers requests in whatever order they finish, so
+    several can be in flight and round trips overlap. If 'handler'
+    isn't NULL it is called with the response by whoever reads it
+    off the root socket, the client loop or another request waiting.
+    Otherwise the response is kept for WaitForRootResponse().
+    Returns the id of the request, or 0 if it couldn't be sent or
+    ROOT_MAX_PENDING_REQUESTS are already waiting.
+*/
+uint32_t SendRootRequest(
+    CommandFlag         commandFlag,
+    Server              currentServer,
+    User                relatedClient,
+    CMessage            clientMessageInfo,
+    RootResponseHandler handler,
+    void*               context
+);
+
+/*
+    Client-sided. Wait for the response to request 'requestId',
+    sent with SendRootRequest() without a handler. Everything
+    else root sends in the meantime is handled on the way.
+    Returns false if the root socket failed.
+*/
+bool WaitForRootResponse(uint32_t requestId, RootResponse* response);
+
+/*
+    Handle everything root sent the client. Server list
+    changes if the client subscribed with k_cfSubscribeServerList,
+    invites to private messages and responses to requests
+    sent with a handler.
+
+    Client-sided. Only reads what has already arrived on
+    the root socket, so it never waits. Returns -1 if root
+    closed the connection and 0 otherwise.
+*/
+int ReceiveRootPushes();
+
+/*
+    Client-sided. Give up on requests sent with a handler
+    that root didn't answer within ROOT_REQUEST_TIMEOUT_SEC.
+    Their handlers are called with k_rcInternalServerError
+    so they can let go of their context.
+
+    Returns how many milliseconds until the next one
+    expires, or -1 if none are waiting. Made for poll().
+*/
+int ExpireRootRequests();
+
+/*
+    Client-sided. Get the next frame root sent.
+
+    Frames are cut out of a buffer that reads the root
+    socket in bulk. The body is valid until the next call.
+    Only the client loop reads the root socket.
+    Returns 0 on success and -1 if the root socket failed.
+*/
+int ReceiveRootFrame(FrameHeader* header, FrameReader* reader);
+
 /*
     Do a request made from a client on the root server.
 
@@ -111,24 +270,46 @@ RootResponse MakeRootRequest(
 ResponseCode DoRootRequest(void* request);
 
 /*
-    Accept client to join the root server
+    Run the root server event loop.
 
-    Receive the clients information on join using recv
-    and update it. Finally send back the update client
-    struct to them.
+    One epoll reactor owns the listening socket and
+    every client socket. It decodes requests as they arrive
+    and hands them to a pool of 'rootWorkerCount' threads, so
+    slow requests don't hold up every other client.
+    Only returns if the event loop fails.
 */
 void* AcceptClientsToRoot();
 
 /*
-    Perform request made to the root server from the client
+    Perform a request made to the root server from a client.
 
-    Forever do this unless an error happens
-    and the loop breaks. Made in a thread.
-    Do this for every client connected to the root server.
-    
-    TODO: Resource heavy so going to try another way. But this works for now
+    Called by the event loop once a full 'RootRequest'
+    has arrived on a clients socket. The first request
+    must be the join (k_cfConnectClientToServer).
+
+    Requests that only change the session are done right
+    away. Everything else is queued for a worker.
+*/
+void PerformRootRequestFromClient(RootSession* session, RootRequest* request);
+
+/*
+    Queue 'function' to run on a root worker.
+    Returns false if every worker is busy and the queue is full.
 */
-void* PerformRootRequestFromClient(void* client);
+bool RSSubmitWork(WorkFunction function, void* argument);
+
+/*
+    Copy how busy the root workers are into 'metrics'.
+*/
+void RSGetWorkMetrics(WorkPoolMetrics* metrics);
+
+/*
+    Send a frame to a client over their root socket in 'lane'.
+
+    The client is looked up by 'to->rfd'. Safe to call
+    from any thread. Returns 0 on success, -1 on failure.
+*/
+int RSSendToClient(User* to, const void* data, size_t length, PriorityLane lane);
 
 /*
     Create a root server which all clients connect to.
@@ -142,9 +323,10 @@ int CreateRootServer();
 /*
     Remove a client from the root server server-sided.
 
-    Remove them from rootConnectedClients array,
+    Remove them from the root client registry,
     decrement onlineGlobalClients by one,
     and shutdown any servers the user made.
+    Shutting down runs on a worker.
 */
 void RSDisconnectClientFromRootServer(User user); 
 
@@ -155,6 +337,10 @@ void RSDisconnectClientFromRootServer(User user);
     shut it down and disconnect other clients
     Otherwise, update the statistics of the server
     like connectedClients appropriately
+
+    Only the member whose outbound queue is 'user->outbound'
+    is removed, so someone who left and joined again with
+    the same handle isn't taken out in their place.
 */
 void SSDisconnectClientFromServer(User* user);
 
@@ -167,10 +353,11 @@ void SSDisconnectClientFromServer(User* user);
 void RSRespondToRootRequestMaker(User* to, RootResponse response);
 
 /*
-    Update a server in serverList with 'updatedServerInfo'
+    Update a listed server with 'updatedServerInfo'
 
-    Gets the index of the server by searching names in serverList
-    and replaces the 'Server' struct at that index with 'updatedServerInfo'
+    Finds the server by its id and copies the new
+    info over it. The listed server keeps its alias, socket
+    and client list so running room threads are unaffected.
 */
 void RSUpdateServerWithNewInfo(Server* updatedServerInfo);
 
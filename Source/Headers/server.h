@@ -39,34 +39,123 @@
 #include "crossplatform_threads.h"
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
 
 #include "ccolors.h"
 #include "flags.h"
 #include "../External/aes.h"
 #include "../External/aes-gcm.h"
 #include "min_max_values.h"
+#include "protocol.h"
+#include "fanout.h"
+#include "hashmap.h"
+#include "ratelimit.h"
 
 // Debug mode. Allows for more printing
 /** Not used **/
 extern bool DEBUG;
 
 /*
-    Struct describing a port
-    to see if it is in use.
+    Port every chat room is reached on.
+
+    Rooms don't have sockets of their own. Clients connect
+    to this port and name the room they want in the join
+    frame, then the connection is handed to that room.
 */
-typedef struct PortDescription
-{
-    int  port;
-    bool inUse;
-} PortDesc;
+#define ROOM_PORT 18082
+
+/*
+    Seconds a client that connected to ROOM_PORT
+    has to send its join frame before it is dropped,
+    and how often the ones out of time are looked for.
+*/
+#define ROOM_JOIN_TIMEOUT_SEC 5
+#define ROOM_JOIN_SWEEP_MS    1000
+
+/*
+    What happens to a room member who reads so slowly
+    their outbound queue fills up. See OverflowPolicy.
+*/
+extern OverflowPolicy roomOverflowPolicy;
+
+/*
+    Default amount of recent messages and bytes every
+    room keeps to replay to clients who join later.
+*/
+#define ROOM_HISTORY_LENGTH 50
+#define ROOM_HISTORY_BYTES  (64 * 1024)
+
+/*
+    Most older messages a client can ask a room for at once.
+*/
+#define ROOM_HISTORY_QUERY_MAX 200
+
+/*
+    Default amount of requests a second one client can
+    make in a room, and messages a second a whole room
+    can fan out. Both can burst to twice that after being quiet.
+*/
+#define ROOM_CLIENT_REQUEST_RATE 5
+#define ROOM_MESSAGE_RATE        50
+
+/*
+    A throttled client is told so at most this often.
+*/
+#define ROOM_THROTTLE_NOTICE_MS 1000
+
+/*
+    Requests a second each client can make in a room and
+    messages a second each room can fan out. Read when a
+    client joins or a room is created. 0 turns the limit off.
+*/
+extern unsigned int clientRequestRate;
+extern unsigned int roomMessageRate;
+
+/*
+    Most addresses relays can attach to rooms from,
+    besides this machine which always can.
+*/
+#define ROOM_MAX_RELAY_PEERS 16
+
+/*
+    Where relays are let attach to rooms from besides this machine.
+    A relay says which of its clients sent each message, so one
+    attached from anywhere else could speak as anyone and is refused.
+    Set before the room listener starts.
+*/
+extern struct in_addr roomRelayPeers[ROOM_MAX_RELAY_PEERS];
+extern unsigned int   roomRelayPeerCount;
+
+/*
+    Most messages and bytes of history each room keeps.
+    Read when a room is created. A length of 0 turns history off.
+*/
+extern unsigned int roomHistoryLength;
+extern size_t       roomHistoryBytes;
+
+/*
+    Most members a room can be made with once large rooms are on.
+
+    Rooms of up to kMaxServerMembers are always allowed. A room
+    asking for more is a large room and is only made if this is
+    above kMaxServerMembers. Never more than kMaxLargeServerMembers.
+    0 turns large rooms off. Read when the room listener starts
+    and when a room is created.
+
+    Messages in a large room are pushed to its members by a
+    FanOutPool with a thread for every core instead of by the
+    thread of whoever sent them. Each member is read by a
+    reactor of their own partition, on a thread of its own too.
+*/
+extern unsigned int largeRoomMaxClients;
 
 /*
-    A list of all ports that have been
-    used previously for some reason. Used
-    to speed up the process of checking if a port
-    is in use when making a server. (Server-sided. O(1) time-complexity)
+    Connections waiting to be accepted on ROOM_PORT while large rooms
+    are on, so thousands of members joining at once aren't refused.
+    The kernel caps it at net.core.somaxconn.
 */
-extern PortDesc portList[];
+#define ROOM_LARGE_LISTEN_BACKLOG 65535
 
 /*
     A struct which represents a client and holds information
@@ -81,8 +170,99 @@ typedef struct UserStr
     struct sockaddr_in addressInfo;                        // Client address info
     struct ServerStr*  connectedServer;                    // The server the client is connected to
     int                rfd;                                // root file descriptor. Socket of the client connected to root server
+    unsigned int       clientId;                           // Stable id given by the root server on join
+    OutboundQueue*     outbound;                           // Frames waiting to be sent to the client. Room members only
 } User;
 
+/*
+    Slots a room allocates at once. Rooms smaller than
+    this allocate only as many slots as they can hold.
+*/
+#define ROOM_MEMBER_CHUNK 1024
+
+/*
+    A client in a room through a relay. (Server-sided)
+    Relays register each of their clients with the room
+    and the room decides if they can join, like it does
+    for anyone joining it directly.
+*/
+typedef struct RelayedClientStr
+{
+    char           handle[kMaxClientHandleLength + 1]; // Handle they joined with. Their key in 'relayed'
+    OutboundQueue* relay;                              // Relay they came through
+} RelayedClient;
+
+/*
+    Who is in a room. (Server-sided)
+
+    A member keeps the slot they joined in until they leave and
+    slots freed by leaving are reused from 'freeSlots', so members
+    never move and joins, leaves and lookups are O(1). The slots in
+    use are also packed at the front of 'active' (order isn't kept)
+    with the outbound queue of each in 'outbound', so fan-out only
+    walks as many entries as there are members.
+
+    'recipients' is built the first time the room fans something
+    out after its members changed, then shared by every fan-out until
+    they change again, so a message costs one reference instead of
+    one per member. A member who left while a fan-out still uses the
+    list only misses what is pushed to them.
+
+    Relays get everything the room fans out like a member does but
+    aren't members. Their clients are kept in 'relayed' and count
+    toward the room, so handles stay unique and maxClients holds
+    no matter how someone got in.
+
+    Slots are allocated ROOM_MEMBER_CHUNK at a time as the room
+    fills up, so memory follows the members in the room instead of
+    the most it can hold, and existing slots never move.
+
+    A member or relay is left out of 'recipients' while on 'joining',
+    until their join reply is queued, so nothing said in the room can
+    reach them first. Guarded by the room's membersLock.
+*/
+typedef struct RoomMembersStr
+{
+    User**          chunks;          // Blocks of 'chunkSlots' slots. Where members live
+    unsigned int    chunkCount;      // Blocks allocated
+    unsigned int    chunkSlots;      // Slots in each block
+    unsigned int    capacity;        // Most members the room can hold
+    unsigned int    allocated;       // Slots in every block together
+    unsigned int*   freeSlots;       // Stack of unused slots
+    unsigned int    freeCount;       // Slots on 'freeSlots'
+    unsigned int*   active;          // Slots in use packed together
+    unsigned int*   activeIndex;     // Position of each slot in 'active'
+    OutboundQueue** outbound;        // Outbound queue of the member in active[i]
+    unsigned int    count;           // Members. Length of 'active'
+    HashMap         byHandle;        // Handle to the member in its slot
+    OutboundQueue** relays;          // Relays passing the room on. See k_cfAttachRelayToServer
+    unsigned int    relayCount;      // Relays in 'relays'
+    unsigned int    relayCapacity;   // Allocated size of 'relays'
+    HashMap         relayed;         // Handle to the RelayedClient of everyone in through a relay
+    OutboundQueue** joining;         // Members and relays whose join reply isn't queued yet
+    unsigned int    joiningCount;    // Queues in 'joining'
+    unsigned int    joiningCapacity; // Allocated size of 'joining'
+    FanOutList*     recipients;      // Shared copy of 'outbound' and 'relays'. NULL until the next fan-out
+} RoomMembers;
+
+/*
+    The last messages said in a room. (Server-sided)
+
+    Holds references to the frames that were fanned out, so
+    a newcomer is sent the exact same bytes with no encoding.
+    Once 'capacity' frames or roomHistoryBytes are held the
+    oldest is dropped. Guarded by the room's membersLock.
+*/
+typedef struct RoomHistoryStr
+{
+    SharedFrame** frames;   // Ring of 'capacity' frames
+    unsigned int  capacity; // Most frames kept
+    unsigned int  head;     // Oldest frame
+    unsigned int  count;    // Frames kept
+    size_t        bytes;    // Bytes of the frames kept
+    uint64_t      recorded; // Frames ever recorded, kept or not
+} RoomHistory;
+
 /*
     A struct representing a server that
     clients can connect to and send requests on.
@@ -103,8 +283,14 @@ typedef struct ServerStr
     char               alias[kMaxServerAliasLength + 1]; // used to connect to server without ip
     bool               isRoot;                           // if the connected server is the root server
     User               host;                             // Client who requested for server to be created
-    User*              clientList;                       // List of connected clients. Memory must be allocated first
-    unsigned int       serverId;                         // Unique id each server has. Used when two servers have the same name       
+    RoomMembers        members;                          // Connected clients. Server-sided only
+    RoomHistory        history;                          // Recent messages replayed on join. Server-sided only
+    TokenBucket*       messageLimit;                     // Messages a second the room fans out. Server-sided only
+    pthread_mutex_t*   membersLock;                      // Guards members, history, connectedClients and online. Server-sided only
+    uint64_t           serverId;                         // Unique id each server has. Never reused
+    unsigned int       listIndex;                        // Position in the server list. Server list use only
+    bool               countChanged;                     // Member count changed since the list last logged it. Server list use only
+    int                references;                       // The server list, every reader of the room and ServerListRetainById(). Changed atomically. Server-sided only
 } Server;
 
 /*
@@ -115,8 +301,9 @@ typedef struct ServerStr
 */
 typedef struct ServerCreationInformation
 {
-    User*   clientAKAhost; // Host of the server. The person who requested to create the server
-    Server* serverInfo;    // Info of the server to be used when creating
+    User*    clientAKAhost; // Host of the server. The person who requested to create the server
+    Server*  serverInfo;    // Info of the server to be used when creating
+    uint32_t requestId;     // Id of the host's request. Used for the response
 } ServerCreationInfo;
 
 /*
@@ -131,6 +318,30 @@ typedef struct ClientMessage
     char        message[kMaxClientMessageLength + 1]; // String message
 } CMessage;
 
+/*
+    Encode 'message' as a push frame that can be
+    sent to any amount of clients. See SSSendClientMessage().
+    Caller releases the frame. NULL on failure.
+*/
+SharedFrame* SSEncodeClientMessage(CMessage* message);
+
+/*
+    Send 'message' to a client in a server as a push frame.
+
+    The command of the frame is the messages cflag and
+    the body is the senders handle and the message.
+    Returns the bytes sent or -1 on failure.
+*/
+int SSSendClientMessage(int cfd, CMessage* message);
+
+/*
+    Client-sided. Receive a message sent with SSSendClientMessage()
+    from the receive buffer of the server socket.
+    Only the handle of the sender is filled in.
+    Returns 0 on success and -1 if the server disconnected.
+*/
+int ReceiveClientMessage(FrameStream* stream, CMessage* message);
+
 /*
     A structure representing a request
     from a client to a server.
@@ -160,17 +371,20 @@ void ServerPrint(
 );
 
 /*
-    Generate a completely random
-    server unique identifier
+    Give 'server' a new unique identifier.
+
+    Ids come from a 64-bit counter and are never
+    reused, so two servers can never share one.
 */
-unsigned int GenerateServerUID(Server* server);
+uint64_t GenerateServerUID(Server* server);
 
 /*
     Bare bones of creating a server.
-    'Server' struct must be casted to void*
+    'ServerCreationInfo' struct must be casted to void*
     and passed as the 'serverStruct' parameter.
     
-    All fields in the struct must be completed.
+    Only adds the room to the server list, no socket
+    or thread is made for it. Clients reach it on ROOM_PORT.
     Recommended to use MakeServer() instead.
 */
 void RSServerBareMetal(
@@ -190,11 +404,24 @@ int MakeServer(
     int domain, // AF_INET
     int type, // SOCK_STREAM
     int protocol, // USUALLY ZERO
-    int port,
     unsigned int maxClients,
     char* alias
 );
 
+/*
+    Start accepting clients for every room on ROOM_PORT.
+
+    One thread accepts the connections and reads their join
+    frames as they arrive without blocking, and sends what is
+    queued for members whose sockets were full. Only a whole join
+    frame is handed to the root workers, which add the client to
+    their room, so a slow client never holds up a worker. What
+    members and relays send is read by one more thread, or with
+    large rooms on by one for every core.
+    Returns 0 on success and -1 on failure.
+*/
+int SSStartRoomListener();
+
 /*
     XOR and encrypt a message by using the senders
     client file descriptor as the xor constant.
@@ -208,18 +435,77 @@ CMessage EncryptClientMessage(
 );
 
 /*
-    Listen for any request made on
-    'server' by the LATEST CONNECTED CLIENT.
+    A connection to ROOM_PORT whose join frame isn't in yet.
 
-    A new thread for this function is created
-    for every client accepted to 'server'. This
-    function listens for any requests made to the server
-    by the client accepted and calls DoServerRequest()
-    once a request is received.
+    Read by the room listener's reactor without blocking. Once
+    the frame is in it is taken off the reactor and handed to
+    a root worker, along with whatever was sent after it.
 */
-void* ListenForRequestsOnServer(
-    void* server
-);
+typedef struct RoomJoinStr
+{
+    ReactorWatch        watch;    // Registration on the room listener's reactor
+    FrameStream         stream;   // Received bytes. The join frame comes first
+    uint64_t            deadline; // MonotonicNs() the join frame has to be in by
+    struct RoomJoinStr* previous; // Joins waiting longer. Reactor thread only
+    struct RoomJoinStr* next;     // Joins waiting less long. Reactor thread only
+} RoomJoin;
+
+/*
+    A member or relay of a room whose socket is read by a reactor.
+
+    Nobody gets a thread of their own. The socket is watched for
+    requests with the others of its partition and they are handled
+    as they arrive, then the reader is freed once they leave. It holds a
+    reference to the room and to the outbound queue, which owns the socket.
+*/
+typedef struct RoomReaderStr
+{
+    ReactorWatch watch;          // Registration on 'reactor'
+    Reactor*     reactor;        // Event loop reading the socket
+    Server*      server;         // Room they are in
+    User         client;         // Who they are. A relay only has 'cfd' and 'outbound'
+    bool         relay;          // Relays send their clients' messages, not requests
+    bool         done;           // Hung up or left. Freed once what is buffered was handled
+    FrameStream  stream;         // Received bytes not handled yet
+    TokenBucket  requestLimit;   // Requests a second they can make. Members only
+    uint64_t     lastThrottleNs; // Last time they were told they are throttled
+} RoomReader;
+
+/*
+    Drop a reference to a room taken with ServerListRetainById().
+    The last one is let go once the room was shut down and taken
+    out of the server list, and frees its member table, history,
+    message limit, lock and the server itself.
+*/
+void SSRoomRelease(Server* server);
+
+/*
+    Add 'user' to the members of 'server' and keep its
+    client count up to date. The room's membersLock must be held.
+    Returns the members slot or NULL if the room is full
+    or someone with that handle is already in it.
+*/
+User* SSAddMember(Server* server, User* user);
+
+/*
+    Remove the member named 'handle' from 'server' and copy
+    them into 'removed' (can be NULL). The room's membersLock must be held.
+    Returns false if they weren't a member.
+*/
+bool SSRemoveMember(Server* server, const char* handle, User* removed);
+
+/*
+    The member of 'server' named 'handle' or NULL.
+    Only valid until the lock is released.
+    The room's membersLock must be held.
+*/
+User* SSFindMember(Server* server, const char* handle);
+
+/*
+    True if anyone in 'server' has 'handle', whether they joined
+    it directly or through a relay. The room's membersLock must be held.
+*/
+bool SSHandleTaken(Server* server, const char* handle);
 
 /*
     Return a boolean value whether or not 'username' is
@@ -232,7 +518,7 @@ bool IsClientInServer(char* username, Server* server);
     to their current connected server.
 
     Can only perform requests from a client
-    after ListenForRequestsOnServer() is called for that client
+    once their RoomReader is watching their socket
 */
 ResponseCode DoServerRequest(
     ServerRequest request
@@ -268,6 +554,8 @@ bool IsUserHost(
 
     Safely shutdown a server by closing the servers file descriptor
     as well as any client file descriptors for that server.
+    It is taken out of the server list, which lets go of its
+    reference. The room is freed once its readers are gone too.
 */
 void ShutdownServer(
     Server* server
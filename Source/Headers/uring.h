@@ -0,0 +1,59 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       uring.h
+ * @brief      io_uring backend of the reactor
+ *
+ * @note       Only used through reactor.h
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stdbool.h>
+#include "reactor.h"
+
+/*
+    Requests the submission ring holds. Requests
+    past that make the ring go to the kernel early.
+*/
+#define URING_ENTRIES 4096
+
+/*
+    Receive buffers shared by every socket of a reactor.
+
+    They are registered with the kernel once, which picks a free one
+    whenever bytes arrive on any socket. Idle sockets hold no buffer
+    of their own so this is all the receive memory a reactor needs.
+    The amount has to be a power of two.
+*/
+#define URING_RECEIVE_BUFFERS      256
+#define URING_RECEIVE_BUFFER_BYTES 16384
+
+/*
+    Set up io_uring for 'reactor'.
+    Returns 0 on success and -1 if the kernel doesn't support it.
+*/
+int UringCreate(Reactor* reactor);
+
+/*
+    Same as the Reactor functions of the same name.
+*/
+int  UringAdd(Reactor* reactor, ReactorWatch* watch);
+int  UringModify(Reactor* reactor, ReactorWatch* watch, unsigned int events);
+void UringRemove(Reactor* reactor, ReactorWatch* watch);
+void UringRun(Reactor* reactor);
+bool UringReceives(Reactor* reactor);
+int  UringSendMessage(Reactor* reactor, ReactorOperation* operation, int fd, struct msghdr* message, int flags);
+void UringSubmit(Reactor* reactor);
+
+#endif // __URING_H__
@@ -0,0 +1,104 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       workpool.h
+ * @brief      fixed size pool of worker threads fed by a bounded queue
+ *
+ * @note
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#ifndef __WORKPOOL_H__
+#define __WORKPOOL_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    A function ran by a worker. 'argument' is
+    whatever was passed to WorkPoolSubmit().
+*/
+typedef void (*WorkFunction)(void* argument);
+
+/*
+    One job waiting in the queue.
+*/
+typedef struct WorkItemStr
+{
+    WorkFunction function;   // What to run
+    void*        argument;   // Passed to 'function'
+    uint64_t     enqueuedNs; // When it was queued. Used for wait time
+} WorkItem;
+
+/*
+    Numbers about how busy a pool is.
+    Wait time is from being queued until a worker picks the job up.
+*/
+typedef struct WorkPoolMetricsStr
+{
+    size_t   queueDepth;    // Jobs waiting right now
+    size_t   maxQueueDepth; // Most jobs that were ever waiting at once
+    uint64_t submitted;     // Jobs accepted into the queue
+    uint64_t rejected;      // Jobs turned away because the queue was full
+    uint64_t completed;     // Jobs that finished running
+    uint64_t totalWaitNs;   // Wait time of every started job added up
+    uint64_t maxWaitNs;     // Longest any job waited
+} WorkPoolMetrics;
+
+/*
+    Fixed amount of threads running jobs from a queue.
+
+    The queue is a ring of 'capacity' jobs. When it is full
+    new jobs are rejected instead of piling up, so the thread
+    submitting them (usually an event loop) never blocks.
+*/
+typedef struct WorkPoolStr
+{
+    pthread_t*      workers;     // 'workerCount' threads
+    unsigned int    workerCount; // Threads in the pool
+    WorkItem*       queue;       // Ring of waiting jobs
+    size_t          capacity;    // Size of 'queue'
+    size_t          head;        // Next job to run
+    size_t          count;       // Jobs in the queue
+    bool            stopping;    // Workers exit once the queue is empty
+    pthread_mutex_t lock;        // Protects everything above and 'metrics'
+    pthread_cond_t  hasWork;     // Signaled when a job is queued or the pool stops
+    WorkPoolMetrics metrics;     // See WorkPoolGetMetrics()
+} WorkPool;
+
+/*
+    Start 'workerCount' threads with room
+    for 'capacity' waiting jobs.
+    Returns 0 on success and -1 on failure.
+*/
+int WorkPoolCreate(WorkPool* pool, unsigned int workerCount, size_t capacity);
+
+/*
+    Queue 'function' to be ran with 'argument' on a worker.
+    Never blocks. Returns false if the queue is full, the
+    job is not ran and 'argument' still belongs to the caller.
+*/
+bool WorkPoolSubmit(WorkPool* pool, WorkFunction function, void* argument);
+
+/*
+    Copy the current numbers of the pool into 'metrics'.
+*/
+void WorkPoolGetMetrics(WorkPool* pool, WorkPoolMetrics* metrics);
+
+/*
+    Run every queued job, stop the workers
+    and free the memory of the pool.
+*/
+void WorkPoolDestroy(WorkPool* pool);
+
+#endif // __WORKPOOL_H__
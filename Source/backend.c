@@ -34,65 +34,9 @@
  * @retval          Struct of info about the server
  */
 Server* ServerFromAlias(char* alias) {
-    bool duplicateNames = false;
-    int foundServers = 0;
-    Server* sarr[] = {};
-    Server* foundServer = NULL;
-
-    for (int i=0; i < onlineServers; i++){
-        Server* server = &serverList[i];
-
-        if (server->alias != NULL){
-            toLowerCase(alias); 
-            toLowerCase(server->alias);
-
-            // Compare everything lowercased
-            if (strcmp(server->alias, alias) == 0)
-            {
-                sarr[foundServers] = server;
-                foundServers+=1;
-                foundServer = server;
-            }
-        }
-    }
-
-    if (foundServers > 1)
-    {
-        // Ask user which to choose
-        SystemPrint(UNDR, true, "Choose Between These %i Servers", foundServers);
-        duplicateNames = true;
-        Server* server = NULL;
-
-        for (int i = 1; i < foundServers + 1; i++)
-        {
-            server = sarr[i];
-            printf("%i: [%i/%i] Host: %s - Server Name: %s\n", i, server->connectedClients, server->maxClients, server->host.handle, server->alias);
-        }
-
-        while (1)
-        {
-            char option[10];
-
-            printf("Option: ");
-
-            fgets(option, 10, stdin);
-            
-            // Remove the trailing newline character if it exists
-            if (option[strlen(option) - 1] == '\n') {
-                option[strlen(option) - 1] = '\0';
-            }
-
-            if (atoi(option) <= foundServers)
-            {
-                foundServer = sarr[atoi(option)];
-                
-
-                break;
-            }
-        }
-    }
-
-    return foundServer;
+    // Server names are unique and the list is indexed by name.
+    // Root is only asked if the list is stale or doesn't have it
+    return ServerListLookup(alias);
 }
 
 /**
@@ -120,12 +64,8 @@ void ExitApp(){
  * 
  */
 void JoinServer(Server* server) {
-
-    // check if there is room to join
-    if (server->connectedClients+1 > server->maxClients) {
-        SystemPrint(RED, true, "Cannot Join Server. Server Full.");
-        return;
-    }
+    // Whether there is room is up to the server. The
+    // cached count can be behind, so it isn't checked here
 
     int cfd = socket(server->domain, server->type, server->protocol);
     if (cfd < 0){
@@ -136,50 +76,83 @@ void JoinServer(Server* server) {
     int cnct = connect(cfd, (struct sockaddr*)&server->addr, sizeof(server->addr));
     if (cnct < 0){
         ErrorPrint(true, "Failed To Connect To A Server", "Error while connecting local client to a server using connect()");
+        close(cfd);
         return;
     }
 
     /*
-        Pass dereference local client to the server
-        we are joining to ask them to add us to the
-        client list and return updated information
-        about the server were connecting to
+        Every room is on the same port. Name the one we
+        want and ask to be added to its client list. It answers
+        with updated information about the server were connecting to
     */
-    User dereferenceClient = *localClient;
-    dereferenceClient.cfd = cfd;
-    dereferenceClient.addressInfo = server->addr;
-    dereferenceClient.connectedServer = server;
+    FrameWriter join = {0};
+    FrameBegin(&join, k_fkRequest, k_cfAddClientToServer, 1);
+    FramePutU64(&join, server->serverId);
+    FramePutString(&join, localClient->handle);
 
     // Send client info to server you're joining
-    int sentBytes = send(cfd, (void*)&dereferenceClient, sizeof(dereferenceClient), 0);
-    if (sentBytes <= 0)
+    int sent = FrameFinish(&join) ? FrameSend(cfd, &join) : -1;
+    FrameWriterFree(&join);
+    if (sent != 0)
     {
         ErrorPrint(true, "Sending Local Client Info To Server", "Failed while sending local clients info to requested server");
+        close(cfd);
         return;
     }
 
     // Receive most updated server info
-    Server updatedServer = {0};
-    int recvBytes = recv(cfd, (void*)&updatedServer, sizeof(Server), 0);
-    if (recvBytes <= 0)
+    FrameHeader header = {0};
+    char*       body   = NULL;
+    if (FrameReceive(cfd, &header, &body) != 0 || header.kind != k_fkReply)
     {
+        free(body);
         ErrorPrint(true, "Receiving Local Client Info From Server", "Failed while receiving updated local client info from requested server");
+        close(cfd);
+        return;
+    }
+
+    Server      updatedServer = *server;
+    FrameReader reader;
+    FrameReaderInit(&reader, body, header.length);
+
+    ResponseCode rcode = (ResponseCode)(int32_t)FrameGetU32(&reader);
+    if (rcode != k_rcRootOperationSuccessful) {
+        free(body);
+        close(cfd);
+
+        if (rcode == k_rcErrorServerFull)
+            SystemPrint(YEL, true, "'%s' Is Full.", server->alias);
+        else if (rcode == k_rcErrorHandleInUse)
+            SystemPrint(YEL, true, "Someone Named '%s' Is Already In '%s'.", localClient->handle, server->alias);
+        else
+            SystemPrint(YEL, true, "'%s' Is Offline.", server->alias);
         return;
     }
 
+    updatedServer.serverId         = FrameGetU64(&reader);
+    updatedServer.port             = FrameGetU16(&reader);
+    updatedServer.connectedClients = FrameGetU16(&reader);
+    updatedServer.maxClients       = FrameGetU16(&reader);
+    updatedServer.online           = true;
+    FrameGetString(&reader, updatedServer.alias, sizeof(updatedServer.alias));
+    FrameGetString(&reader, updatedServer.host.handle, sizeof(updatedServer.host.handle));
+    free(body);
+
+    // Only the server has its members and history
+    memset(&updatedServer.members, 0, sizeof(RoomMembers));
+    memset(&updatedServer.history, 0, sizeof(RoomHistory));
+    updatedServer.messageLimit = NULL;
+    updatedServer.membersLock  = NULL;
+
     /*
-        Update localClient struct.
+        Update localClient struct. The client loop
+        reads the server from now on.
     */
     localClient->addressInfo = server->addr;
-    localClient->cfd = cfd;
-    localClient->connectedServer = &updatedServer;
-
-    Chatroom(&updatedServer);
+    EnterConnectedServer(cfd, &updatedServer);
 }
 
 void JoinServerByName(char* name){ // Join server from its alias
-    UpdateServerList();
-
     Server* server = ServerFromAlias(name);
     if (!server) { // ServerFromAlias returns null if no server is found
         SystemPrint(YEL, true, "No Server Found With That Name.");
@@ -17,11 +17,474 @@
  */
 
 #include "Headers/browser.h"
+#include "Headers/hashmap.h"
+#include "Headers/root.h"
+#include "Headers/tools.h"
+#include "Headers/ratelimit.h"
 
-unsigned int onlineServers = 0;
-Server       serverList[kMaxServersOnline] = {0};
-Server       backendServerList[1000] = {0};
+#include <endian.h>
 
+unsigned int onlineServers   = 0;
+unsigned int serverListTtlMs = SERVER_LIST_DEFAULT_TTL_MS;
+
+/*
+    Server list registry. See browser.h.
+    'serverList' is packed: the first 'onlineServers'
+    entries are every live server, in no particular order.
+*/
+static Server**        serverList         = NULL;
+static unsigned int    serverListCapacity = 0;
+static HashMap         serversByAlias     = {0};
+static HashMap         serversById        = {0};
+static pthread_mutex_t serverListLock     = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+    Ring of the last 'kMaxDirectoryChanges' changes to the list.
+    The change that made version 'v' is at 'v % kMaxDirectoryChanges'.
+*/
+typedef struct DirectoryChangeStr
+{
+    uint64_t version;  // Directory version the change made
+    uint64_t serverId; // Server that was added, removed or updated
+} DirectoryChange;
+
+static DirectoryChange directoryChanges[kMaxDirectoryChanges];
+static uint64_t        directoryVersion       = 0; // Bumped on every change to the list
+static uint64_t        syncedDirectoryVersion = 0; // Client-sided. Root's version the list is at
+static bool            liveServerList         = false; // Client-sided. Root pushes changes to us
+static uint64_t        serverListSyncedAt     = 0; // Client-sided. MonotonicNs() of the last sync. 0 if stale
+
+/*
+    Servers marked with ServerListTouchCount() since the last
+    flush. Each is in here once. 'serverListLock' must be held.
+*/
+static uint64_t*       countChanges           = NULL;
+static unsigned int    countChangeCount       = 0;
+static unsigned int    countChangeCapacity    = 0;
+
+/*
+    Set up the registry the first time it's used.
+    'serverListLock' must be held.
+*/
+static bool ServerListReady()
+{
+    if (serverList != NULL)
+        return true;
+
+    serverListCapacity = 64;
+    serverList = malloc(sizeof(Server*) * serverListCapacity);
+
+    return serverList != NULL
+        && HashMapInit(&serversByAlias, serverListCapacity)
+        && HashMapInit(&serversById, serverListCapacity);
+}
+
+/*
+    Log a change to a server and bump the directory version.
+    'serverListLock' must be held.
+*/
+static void RecordChangeLocked(uint64_t serverId)
+{
+    directoryVersion++;
+
+    DirectoryChange* change = &directoryChanges[directoryVersion % kMaxDirectoryChanges];
+    change->version  = directoryVersion;
+    change->serverId = serverId;
+}
+
+Server* ServerListAdd(Server* server)
+{
+    Server* listed = NULL;
+
+    pthread_mutex_lock(&serverListLock);
+
+    char alias[kMaxServerAliasLength + 1];
+    snprintf(alias, sizeof(alias), "%s", server->alias);
+    toLowerCase(alias);
+
+    if (!ServerListReady()
+        || HashMapGet(&serversByAlias, alias) != NULL
+        || HashMapGetId(&serversById, server->serverId) != NULL)
+        goto done;
+
+    // Make room in the packed array
+    if (onlineServers == serverListCapacity) {
+        Server** grown = realloc(serverList, sizeof(Server*) * serverListCapacity * 2);
+        if (grown == NULL)
+            goto done;
+
+        serverList          = grown;
+        serverListCapacity *= 2;
+    }
+
+    listed = malloc(sizeof(Server));
+    if (listed == NULL)
+        goto done;
+
+    *listed = *server;
+    strcpy(listed->alias, alias);
+    listed->listIndex = onlineServers;
+
+    if (!HashMapPut(&serversByAlias, listed->alias, (void*)listed)) {
+        free(listed);
+        listed = NULL;
+        goto done;
+    }
+
+    if (!HashMapPutId(&serversById, listed->serverId, (void*)listed)) {
+        HashMapRemove(&serversByAlias, listed->alias);
+        free(listed);
+        listed = NULL;
+        goto done;
+    }
+
+    serverList[onlineServers++] = listed;
+    RecordChangeLocked(listed->serverId);
+
+done:
+    pthread_mutex_unlock(&serverListLock);
+    return listed;
+}
+
+void ServerListRemove(Server* server)
+{
+    pthread_mutex_lock(&serverListLock);
+
+    // Only remove it if this exact server is the one listed
+    if (serverList != NULL && HashMapGetId(&serversById, server->serverId) == (void*)server)
+    {
+        HashMapRemove(&serversByAlias, server->alias);
+        HashMapRemoveId(&serversById, server->serverId);
+
+        // Fill the hole with the last server so the list stays packed
+        Server* last = serverList[--onlineServers];
+        serverList[server->listIndex] = last;
+        last->listIndex = server->listIndex;
+
+        RecordChangeLocked(server->serverId);
+
+        // Room threads on root may still be using it
+        if (!rootServer.isRoot)
+            free(server);
+    }
+
+    pthread_mutex_unlock(&serverListLock);
+}
+
+void ServerListClear()
+{
+    pthread_mutex_lock(&serverListLock);
+
+    if (serverList != NULL)
+    {
+        for (unsigned int i = 0; i < onlineServers; i++)
+            free(serverList[i]);
+
+        HashMapFree(&serversByAlias);
+        HashMapFree(&serversById);
+        free(serverList);
+        serverList         = NULL;
+        serverListCapacity = 0;
+    }
+
+    onlineServers          = 0;
+    syncedDirectoryVersion = 0;
+    pthread_mutex_unlock(&serverListLock);
+}
+
+Server* ServerListFind(const char* alias)
+{
+    char key[kMaxServerAliasLength + 1];
+    snprintf(key, sizeof(key), "%s", alias);
+    toLowerCase(key);
+
+    pthread_mutex_lock(&serverListLock);
+    Server* server = (serverList != NULL) ? (Server*)HashMapGet(&serversByAlias, key) : NULL;
+    pthread_mutex_unlock(&serverListLock);
+
+    return server;
+}
+
+Server* ServerListFindById(uint64_t serverId)
+{
+    pthread_mutex_lock(&serverListLock);
+    Server* server = (serverList != NULL) ? (Server*)HashMapGetId(&serversById, serverId) : NULL;
+    pthread_mutex_unlock(&serverListLock);
+
+    return server;
+}
+
+Server* ServerListRetainById(uint64_t serverId)
+{
+    pthread_mutex_lock(&serverListLock);
+    Server* server = (serverList != NULL) ? (Server*)HashMapGetId(&serversById, serverId) : NULL;
+    if (server != NULL)
+        __atomic_add_fetch(&server->references, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&serverListLock);
+
+    return server;
+}
+
+Server* ServerListAt(unsigned int index)
+{
+    pthread_mutex_lock(&serverListLock);
+    Server* server = (index < onlineServers) ? serverList[index] : NULL;
+    pthread_mutex_unlock(&serverListLock);
+
+    return server;
+}
+
+void ServerListTouch(Server* server)
+{
+    pthread_mutex_lock(&serverListLock);
+
+    if (serverList != NULL && HashMapGetId(&serversById, server->serverId) == (void*)server)
+        RecordChangeLocked(server->serverId);
+
+    pthread_mutex_unlock(&serverListLock);
+}
+
+void ServerListTouchCount(Server* server)
+{
+    pthread_mutex_lock(&serverListLock);
+
+    if (serverList != NULL && HashMapGetId(&serversById, server->serverId) == (void*)server && !server->countChanged)
+    {
+        if (countChangeCount == countChangeCapacity) {
+            unsigned int newCapacity = countChangeCapacity ? countChangeCapacity * 2 : 64;
+            uint64_t*    grown       = realloc(countChanges, sizeof(uint64_t) * newCapacity);
+
+            if (grown != NULL) {
+                countChanges        = grown;
+                countChangeCapacity = newCapacity;
+            }
+        }
+
+        // Logged right away if it can't wait for the flush
+        if (countChangeCount < countChangeCapacity) {
+            countChanges[countChangeCount++] = server->serverId;
+            server->countChanged = true;
+        } else {
+            RecordChangeLocked(server->serverId);
+        }
+    }
+
+    pthread_mutex_unlock(&serverListLock);
+}
+
+void ServerListFlushCounts()
+{
+    pthread_mutex_lock(&serverListLock);
+
+    for (unsigned int i = 0; i < countChangeCount; i++)
+    {
+        // Servers removed since they were marked already logged that
+        Server* server = (serverList != NULL) ? (Server*)HashMapGetId(&serversById, countChanges[i]) : NULL;
+        if (server != NULL && server->countChanged) {
+            server->countChanged = false;
+            RecordChangeLocked(server->serverId);
+        }
+    }
+
+    countChangeCount = 0;
+    pthread_mutex_unlock(&serverListLock);
+}
+
+static void FillListing(ServerListing* listing, Server* server)
+{
+    listing->serverId         = htobe64(server->serverId);
+    listing->port             = htons((uint16_t)server->port);
+    listing->connectedClients = htons((uint16_t)server->connectedClients);
+    listing->maxClients       = htons((uint16_t)server->maxClients);
+    snprintf(listing->alias, sizeof(listing->alias), "%s", server->alias);
+    snprintf(listing->hostHandle, sizeof(listing->hostHandle), "%s", server->host.handle);
+}
+
+void ServerListPack(FrameWriter* writer, uint64_t sinceVersion, uint64_t* version)
+{
+    Server*      changed[kMaxDirectoryChanges];
+    uint64_t     removed[kMaxDirectoryChanges];
+    unsigned int changedCount = 0;
+    unsigned int removedCount = 0;
+
+    pthread_mutex_lock(&serverListLock);
+
+    /*
+        Send the whole list if the client never had it, is ahead
+        of us (root restarted) or is so far behind that the oldest
+        change it's missing already fell out of the log.
+    */
+    bool fullList = sinceVersion == 0
+        || sinceVersion > directoryVersion
+        || directoryVersion - sinceVersion > kMaxDirectoryChanges;
+
+    if (!fullList)
+    {
+        // Newest change first so each server is only looked at once
+        for (uint64_t version = directoryVersion; version > sinceVersion; version--)
+        {
+            uint64_t serverId = directoryChanges[version % kMaxDirectoryChanges].serverId;
+
+            bool seen = false;
+            for (unsigned int i = 0; i < changedCount && !seen; i++)
+                seen = changed[i]->serverId == serverId;
+            for (unsigned int i = 0; i < removedCount && !seen; i++)
+                seen = removed[i] == serverId;
+
+            if (seen)
+                continue;
+
+            Server* server = (serverList != NULL) ? (Server*)HashMapGetId(&serversById, serverId) : NULL;
+            if (server != NULL)
+                changed[changedCount++] = server;
+            else
+                removed[removedCount++] = serverId;
+        }
+    }
+
+    unsigned int listingCount = fullList ? onlineServers : changedCount;
+
+    ServerListDelta delta = {0};
+    delta.version      = htobe64(directoryVersion);
+    delta.fullList     = fullList;
+    delta.listingCount = htonl(listingCount);
+    delta.removedCount = htonl(removedCount);
+    FramePutBytes(writer, &delta, sizeof(delta));
+
+    ServerListing* listings = FrameReserve(writer, sizeof(ServerListing) * listingCount);
+    for (unsigned int i = 0; listings != NULL && i < listingCount; i++)
+        FillListing(&listings[i], fullList ? serverList[i] : changed[i]);
+
+    for (unsigned int i = 0; i < removedCount; i++)
+        FramePutU64(writer, removed[i]);
+
+    *version = directoryVersion;
+    pthread_mutex_unlock(&serverListLock);
+}
+
+/*
+    Client-sided. The full list asked for after a delta couldn't
+    be applied is put in place as it arrives. Nothing else to do.
+*/
+static void ServerListResynced(RootResponse* response, void* context)
+{
+}
+
+bool ServerListApplyDelta(FrameReader* reader, struct sockaddr_in rootAddress)
+{
+    ServerListDelta delta = {0};
+    if (!FrameGetBytes(reader, &delta, sizeof(delta)))
+        return false;
+
+    uint32_t listingCount = ntohl(delta.listingCount);
+    uint32_t removedCount = ntohl(delta.removedCount);
+
+    // Don't touch the list unless the whole delta is there
+    if (FrameRemaining(reader) != sizeof(ServerListing) * (size_t)listingCount + sizeof(uint64_t) * (size_t)removedCount)
+        return false;
+
+    if (delta.fullList)
+        ServerListClear();
+
+    // Removals go first. A name freed by one can be taken by a listing
+    FrameReader removedIds = *reader;
+    removedIds.offset     += sizeof(ServerListing) * (size_t)listingCount;
+    for (uint32_t i = 0; i < removedCount; i++)
+    {
+        Server* listed = ServerListFindById(FrameGetU64(&removedIds));
+        if (listed != NULL)
+            ServerListRemove(listed);
+    }
+
+    bool complete = true;
+    for (uint32_t i = 0; i < listingCount; i++)
+    {
+        ServerListing listing = {0};
+        FrameGetBytes(reader, &listing, sizeof(listing));
+
+        Server server = {0};
+        server.serverId         = be64toh(listing.serverId);
+        server.port             = ntohs(listing.port);
+        server.connectedClients = ntohs(listing.connectedClients);
+        server.maxClients       = ntohs(listing.maxClients);
+        server.online           = true;
+        server.domain           = AF_INET;
+        server.type             = SOCK_STREAM;
+        server.protocol         = 0;
+        server.addr             = rootAddress;
+        server.addr.sin_port    = listing.port; // Already network byte order
+        snprintf(server.alias, sizeof(server.alias), "%.*s", kMaxServerAliasLength, listing.alias);
+        snprintf(server.host.handle, sizeof(server.host.handle), "%.*s", kMaxClientHandleLength, listing.hostHandle);
+
+        // A server that changed is replaced by its new info
+        Server* listed = ServerListFindById(server.serverId);
+        if (listed != NULL)
+            ServerListRemove(listed);
+
+        // Names are unique on root. Whoever still has it here is gone
+        listed = ServerListFind(server.alias);
+        if (listed != NULL)
+            ServerListRemove(listed);
+
+        if (ServerListAdd(&server) == NULL)
+            complete = false;
+    }
+
+    reader->offset = removedIds.offset;
+
+    // Missing a server, the version would be a lie. Start over from a full list
+    if (!complete) {
+        ServerListInvalidate();
+        pthread_mutex_lock(&serverListLock);
+        syncedDirectoryVersion = 0;
+        pthread_mutex_unlock(&serverListLock);
+
+        SendRootRequest(k_cfRequestServerList, (Server){0}, (User){0}, (CMessage){0}, ServerListResynced, NULL);
+        return true;
+    }
+
+    pthread_mutex_lock(&serverListLock);
+    syncedDirectoryVersion = be64toh(delta.version);
+    serverListSyncedAt     = MonotonicNs();
+    pthread_mutex_unlock(&serverListLock);
+
+    return true;
+}
+
+uint64_t ServerListVersion()
+{
+    pthread_mutex_lock(&serverListLock);
+    uint64_t version = directoryVersion;
+    pthread_mutex_unlock(&serverListLock);
+
+    return version;
+}
+
+bool ServerListFresh()
+{
+    pthread_mutex_lock(&serverListLock);
+    bool fresh = liveServerList
+                 || (serverListSyncedAt != 0 && MonotonicNs() - serverListSyncedAt < (uint64_t)serverListTtlMs * 1000000ULL);
+    pthread_mutex_unlock(&serverListLock);
+
+    return fresh;
+}
+
+void ServerListInvalidate()
+{
+    pthread_mutex_lock(&serverListLock);
+    serverListSyncedAt = 0;
+    pthread_mutex_unlock(&serverListLock);
+}
+
+uint64_t ServerListSyncedVersion()
+{
+    pthread_mutex_lock(&serverListLock);
+    uint64_t version = syncedDirectoryVersion;
+    pthread_mutex_unlock(&serverListLock);
+
+    return version;
+}
 
 /**
  * @brief           Add a valid server to server list
@@ -35,25 +498,63 @@ int SSAddServerToList(Server server) {
         return -1;
     }
 
-    serverList[onlineServers] = server;
-    onlineServers++;
+    if (ServerListAdd(&server) == NULL)
+        return -1;
 
     return 0;
 }
 
-Server* UpdateServerList() {
+bool SyncServerList()
+{
     RootResponse response = MakeRootRequest(
         k_cfRequestServerList,
         (Server){0}, // no related server
         (User){0},  // no user
         (CMessage){0} // No cmessage
         );
-    
-    if (response.rcode != k_rcRootOperationSuccessful)
-        return NULL;
 
-    // MakeRootRequest already updates serverList
+    // MakeRootRequest already updates the server list
     // and onlineServers client side
     // When k_cfRequestServerList is passed.
-    return serverList;
+    return response.rcode == k_rcRootOperationSuccessful;
+}
+
+Server* UpdateServerList() {
+    // Root keeps the list current. Only apply what it pushed
+    if (liveServerList)
+        ReceiveRootPushes();
+    // Synced recently enough to be used without asking root
+    else if (!ServerListFresh() && !SyncServerList())
+        return NULL;
+
+    return ServerListAt(0);
+}
+
+Server* ServerListLookup(const char* alias)
+{
+    bool    synced = !ServerListFresh() && SyncServerList();
+    Server* server = ServerListFind(alias);
+
+    // Could have been made since the list was synced
+    if (server == NULL && !synced && !liveServerList && SyncServerList())
+        server = ServerListFind(alias);
+
+    return server;
+}
+
+void ToggleLiveServerList() {
+    RootResponse response = MakeRootRequest(
+        liveServerList ? k_cfUnsubscribeServerList : k_cfSubscribeServerList,
+        (Server){0}, // no related server
+        (User){0},  // no user
+        (CMessage){0} // No cmessage
+        );
+
+    if (response.rcode != k_rcRootOperationSuccessful) {
+        SystemPrint(RED, true, "Failed To Change Live Server List Updates.");
+        return;
+    }
+
+    liveServerList = !liveServerList;
+    SystemPrint(YEL, true, liveServerList ? "Live Server List Updates On." : "Live Server List Updates Off.");
 }
@@ -26,12 +26,14 @@ Command validCommands[] = {
     {"--help"                                    , "Show list of commands"            , DisplayCommands},
     {"--servers"                                 , "Show all servers"                 , DisplayServers}, // Show list of servers
     {"--so"                                      , "Number of online servers"         , TotalOnlineServers},
+    {"--live"                                    , "Toggle Live Server List Updates"  , ToggleLiveServerList},
+    {"--cache <ms>"                              , "Keep The Server List For <ms>"    , NULL},
     {"--si <server-name>"                        , "View Info Of a Server"            , NULL},
     {"--main"                                    , "Show The Main Menu"               , SplashScreen},
     // {"--dbg"                                     , "Toggle Debug mode"                , EnableDebugMode},
     {"--quit"                                    , "Exit The Application"             , ExitApp},
     {"--joins <server-name>"                     , "Join Server With The Name"        , NULL},
-    {"--makes <server-name> <port> <max-clients>", "Make a Server With Specified Name", NULL},
+    {"--makes <server-name> <max-clients>"       , "Make a Server With Specified Name", NULL},
     {"--pm <username>"                           , "Send a Private Message To a User" , NULL},
 };
 
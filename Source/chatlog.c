@@ -0,0 +1,596 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       chatlog.c
+ * @brief      append room messages to segment files and read them back
+ *
+ * @note
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#include "Headers/chatlog.h"
+#include "Headers/hashmap.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+/*
+    A message waiting for the writer.
+*/
+typedef struct PendingMessageStr
+{
+    uint64_t     roomId; // Room it was said in
+    SharedFrame* frame;  // Reference to the frame that was fanned out
+} PendingMessage;
+
+/*
+    The segment a room is currently appending to. Writer thread only.
+*/
+typedef struct LogRoomStr
+{
+    uint64_t     roomId;       // Room the segment belongs to
+    int          fd;           // Open segment or -1 if it was closed for being idle
+    unsigned int segment;      // Number of the segment
+    size_t       segmentBytes; // Bytes in the segment
+    bool         dirty;        // Written since the last sync
+    bool         active;       // Written since the last sweep
+} LogRoom;
+
+/*
+    A segment file found on disk.
+*/
+typedef struct SegmentFileStr
+{
+    uint64_t     run;     // Run of the root server that wrote it
+    uint64_t     roomId;  // Room it belongs to
+    unsigned int segment; // Number of the segment
+    off_t        size;    // Bytes in the file
+    time_t       written; // Last time it was written to
+} SegmentFile;
+
+static char            logDirectory[PATH_MAX];
+static uint64_t        logRun      = 0;     // Picked at start so every run has its own files
+static bool            logEnabled  = false;
+
+static pthread_mutex_t logLock     = PTHREAD_MUTEX_INITIALIZER; // Guards the pending messages and metrics
+static pthread_cond_t  logHasWork  = PTHREAD_COND_INITIALIZER;  // Signaled when a lot is pending
+static PendingMessage* logPending  = NULL;  // Messages appended since the last flush
+static size_t          logPendingCount = 0;
+static ChatLogMetrics  logMetrics  = {0};
+
+static PendingMessage* logBatch    = NULL;  // Messages being written. Swapped with 'logPending'
+static HashMap         logRooms    = {0};   // Room id to LogRoom. Writer thread only
+
+/*
+    Path of a segment of a room in this run.
+*/
+static void SegmentPath(char* path, size_t size, uint64_t run, uint64_t roomId, unsigned int segment)
+{
+    snprintf(path, size, "%s/%016" PRIx64 "-%016" PRIx64 "-%010u.seg", logDirectory, run, roomId, segment);
+}
+
+static int CompareSegments(const void* a, const void* b)
+{
+    const SegmentFile* left  = (const SegmentFile*)a;
+    const SegmentFile* right = (const SegmentFile*)b;
+
+    if (left->run != right->run)
+        return (left->run < right->run) ? -1 : 1;
+    if (left->roomId != right->roomId)
+        return (left->roomId < right->roomId) ? -1 : 1;
+    if (left->segment != right->segment)
+        return (left->segment < right->segment) ? -1 : 1;
+    return 0;
+}
+
+/*
+    Find the segment files in the log directory, sorted by
+    run, room and segment. If 'onlyRoom' isn't 0 only the
+    segments of that room in this run are listed.
+    Caller frees 'segments'. Returns how many there are or -1.
+*/
+static int ListSegments(uint64_t onlyRoom, SegmentFile** segments)
+{
+    *segments = NULL;
+
+    DIR* directory = opendir(logDirectory);
+    if (directory == NULL)
+        return -1;
+
+    int            count    = 0;
+    int            capacity = 0;
+    struct dirent* entry;
+    while ((entry = readdir(directory)) != NULL)
+    {
+        SegmentFile found = {0};
+        if (sscanf(entry->d_name, "%16" SCNx64 "-%16" SCNx64 "-%10u.seg", &found.run, &found.roomId, &found.segment) != 3)
+            continue;
+
+        if (onlyRoom != 0 && (found.run != logRun || found.roomId != onlyRoom))
+            continue;
+
+        char        path[PATH_MAX];
+        struct stat info;
+        SegmentPath(path, sizeof(path), found.run, found.roomId, found.segment);
+        if (stat(path, &info) != 0)
+            continue;
+
+        found.size    = info.st_size;
+        found.written = info.st_mtime;
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            SegmentFile* grown = realloc(*segments, sizeof(SegmentFile) * (size_t)capacity);
+            if (grown == NULL)
+                break;
+            *segments = grown;
+        }
+
+        (*segments)[count++] = found;
+    }
+
+    closedir(directory);
+    qsort(*segments, (size_t)count, sizeof(SegmentFile), CompareSegments);
+    return count;
+}
+
+/*
+    Open the segment a room appends to. The room is
+    added the first time it is written to. NULL on failure.
+*/
+static LogRoom* OpenRoom(uint64_t roomId)
+{
+    LogRoom* room = (LogRoom*)HashMapGetId(&logRooms, roomId);
+    if (room == NULL) {
+        room = calloc(1, sizeof(LogRoom));
+        if (room == NULL)
+            return NULL;
+
+        room->roomId = roomId;
+        room->fd     = -1;
+        if (!HashMapPutId(&logRooms, roomId, (void*)room)) {
+            free(room);
+            return NULL;
+        }
+    }
+
+    if (room->fd >= 0)
+        return room;
+
+    // New room or closed for being idle. Carry on where it left off
+    char path[PATH_MAX];
+    SegmentPath(path, sizeof(path), logRun, roomId, room->segment);
+    room->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (room->fd < 0)
+        return NULL;
+
+    struct stat info;
+    room->segmentBytes = (fstat(room->fd, &info) == 0) ? (size_t)info.st_size : 0;
+    return room;
+}
+
+/*
+    Close the full segment of a room and start the next one.
+*/
+static bool RollSegment(LogRoom* room)
+{
+    fdatasync(room->fd);
+    close(room->fd);
+
+    room->fd           = -1;
+    room->dirty        = false;
+    room->segment++;
+    room->segmentBytes = 0;
+
+    pthread_mutex_lock(&logLock);
+    logMetrics.segmentsRolled++;
+    pthread_mutex_unlock(&logLock);
+
+    return OpenRoom(room->roomId) != NULL;
+}
+
+/*
+    Write every part to a file. Returns 0 on success and -1 on failure.
+*/
+static int WriteParts(int fd, struct iovec* parts, int partCount)
+{
+    while (partCount > 0)
+    {
+        ssize_t wrote = writev(fd, parts, partCount);
+        if (wrote < 0 && errno == EINTR)
+            continue;
+        if (wrote <= 0)
+            return -1;
+
+        // Skip what was written. A write can stop part way through a frame
+        size_t left = (size_t)wrote;
+        while (partCount > 0 && left >= parts->iov_len)
+        {
+            left -= parts->iov_len;
+            parts++;
+            partCount--;
+        }
+
+        if (partCount > 0) {
+            parts->iov_base = (char*)parts->iov_base + left;
+            parts->iov_len -= left;
+        }
+    }
+
+    return 0;
+}
+
+/*
+    Append a batch of messages to their segments and sync
+    the segments written to. Runs of messages from the same
+    room go out in one write. The frames are released.
+*/
+static void WriteBatch(PendingMessage* batch, size_t count)
+{
+    uint64_t written = 0;
+    uint64_t bytes   = 0;
+    uint64_t dropped = 0;
+
+    size_t first = 0;
+    while (first < count)
+    {
+        uint64_t roomId = batch[first].roomId;
+        LogRoom* room   = OpenRoom(roomId);
+
+        struct iovec parts[FANOUT_MAX_FRAMES];
+        int          partCount = 0;
+        size_t       runBytes  = 0;
+        size_t       last      = first;
+        while (last < count && batch[last].roomId == roomId && partCount < FANOUT_MAX_FRAMES)
+        {
+            SharedFrame* frame = batch[last].frame;
+
+            // A segment is never left empty so a huge frame still gets written
+            bool fits = room == NULL || room->segmentBytes + runBytes == 0
+                        || room->segmentBytes + runBytes + frame->length <= CHATLOG_SEGMENT_BYTES;
+            if (!fits)
+                break;
+
+            parts[partCount].iov_base = frame->data;
+            parts[partCount].iov_len  = frame->length;
+            partCount++;
+            runBytes += frame->length;
+            last++;
+        }
+
+        // The next frame doesn't fit in the segment. Start a new one and try again
+        if (partCount == 0) {
+            if (RollSegment(room))
+                continue;
+
+            room = NULL;
+            last = first + 1;
+        }
+
+        if (room != NULL && WriteParts(room->fd, parts, partCount) == 0) {
+            room->segmentBytes += runBytes;
+            room->dirty         = true;
+            room->active        = true;
+            written            += (uint64_t)(last - first);
+            bytes              += runBytes;
+        }
+        else
+            dropped += (uint64_t)(last - first);
+
+        for (size_t i = first; i < last; i++)
+            SharedFrameRelease(batch[i].frame);
+
+        first = last;
+    }
+
+    // One sync per segment no matter how many messages it got
+    uint64_t syncs = 0;
+    for (size_t i = 0; i < logRooms.capacity; i++)
+    {
+        LogRoom* room = (LogRoom*)logRooms.entries[i].value;
+        if (!logRooms.entries[i].used || !room->dirty)
+            continue;
+
+        fdatasync(room->fd);
+        room->dirty = false;
+        syncs++;
+    }
+
+    pthread_mutex_lock(&logLock);
+    logMetrics.written      += written;
+    logMetrics.bytesWritten += bytes;
+    logMetrics.dropped      += dropped;
+    logMetrics.syncs        += syncs;
+    pthread_mutex_unlock(&logLock);
+}
+
+/*
+    True if 'segment' is the one its room is appending to.
+*/
+static bool IsOpenSegment(SegmentFile* segment)
+{
+    if (segment->run != logRun)
+        return false;
+
+    LogRoom* room = (LogRoom*)HashMapGetId(&logRooms, segment->roomId);
+    return room != NULL && room->segment == segment->segment;
+}
+
+/*
+    Delete old segments. Going from the newest segment of a room
+    to the oldest, once the room has more than CHATLOG_ROOM_MAX_BYTES
+    or a segment is older than CHATLOG_MAX_AGE_SEC the rest are deleted.
+    Rooms that weren't written to since the last sweep have their
+    segment closed so quiet rooms don't hold file descriptors.
+*/
+static void SweepSegments()
+{
+    SegmentFile* segments = NULL;
+    int          count    = ListSegments(0, &segments);
+    time_t       now      = time(NULL);
+    uint64_t     purged   = 0;
+
+    for (int newest = count - 1; newest >= 0; )
+    {
+        // Segments of one room are next to each other
+        int    oldest    = newest;
+        size_t roomBytes = 0;
+        while (oldest >= 0 && segments[oldest].run == segments[newest].run && segments[oldest].roomId == segments[newest].roomId)
+        {
+            SegmentFile* segment = &segments[oldest];
+            roomBytes += (size_t)segment->size;
+
+            bool expired = roomBytes > CHATLOG_ROOM_MAX_BYTES || now - segment->written > CHATLOG_MAX_AGE_SEC;
+            if (expired && !IsOpenSegment(segment)) {
+                char path[PATH_MAX];
+                SegmentPath(path, sizeof(path), segment->run, segment->roomId, segment->segment);
+                if (unlink(path) == 0)
+                    purged++;
+            }
+
+            oldest--;
+        }
+
+        newest = oldest;
+    }
+
+    free(segments);
+
+    for (size_t i = 0; i < logRooms.capacity; i++)
+    {
+        LogRoom* room = (LogRoom*)logRooms.entries[i].value;
+        if (!logRooms.entries[i].used)
+            continue;
+
+        if (!room->active && room->fd >= 0) {
+            close(room->fd);
+            room->fd = -1;
+        }
+
+        room->active = false;
+    }
+
+    pthread_mutex_lock(&logLock);
+    logMetrics.segmentsPurged += purged;
+    pthread_mutex_unlock(&logLock);
+}
+
+/**
+ * @brief           Write pending messages to disk on a schedule
+ * @param[in]       unused: nothing
+ * @return          void*
+ */
+static void* ChatLogWriter(void* unused)
+{
+    time_t lastSweep = time(NULL);
+
+    pthread_mutex_lock(&logLock);
+    while (1)
+    {
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_sec  += CHATLOG_FLUSH_MS / 1000;
+        wake.tv_nsec += (long)(CHATLOG_FLUSH_MS % 1000) * 1000000L;
+        if (wake.tv_nsec >= 1000000000L) {
+            wake.tv_sec++;
+            wake.tv_nsec -= 1000000000L;
+        }
+
+        // Woken early only if a lot piled up
+        while (logPendingCount < CHATLOG_MAX_PENDING / 2
+               && pthread_cond_timedwait(&logHasWork, &logLock, &wake) != ETIMEDOUT)
+            ;
+
+        // Take everything pending so appends carry on into the other buffer
+        PendingMessage* batch = logPending;
+        size_t          count = logPendingCount;
+        logPending      = logBatch;
+        logPendingCount = 0;
+        logBatch        = batch;
+        pthread_mutex_unlock(&logLock);
+
+        WriteBatch(batch, count);
+
+        if (time(NULL) - lastSweep >= CHATLOG_SWEEP_SEC) {
+            SweepSegments();
+            lastSweep = time(NULL);
+        }
+
+        pthread_mutex_lock(&logLock);
+    }
+
+    return NULL;
+}
+
+int ChatLogStart(const char* directory)
+{
+    if (logEnabled || strlen(directory) + 64 >= sizeof(logDirectory))
+        return -1;
+
+    if (mkdir(directory, 0700) != 0 && errno != EEXIST)
+        return -1;
+
+    strcpy(logDirectory, directory);
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    logRun = (uint64_t)now.tv_sec * 1000000ULL + (uint64_t)now.tv_nsec / 1000;
+
+    logPending = calloc(CHATLOG_MAX_PENDING, sizeof(PendingMessage));
+    logBatch   = calloc(CHATLOG_MAX_PENDING, sizeof(PendingMessage));
+    if (logPending == NULL || logBatch == NULL || !HashMapInit(&logRooms, 64))
+        goto start_failed;
+
+    pthread_t writer;
+    if (pthread_create(&writer, NULL, ChatLogWriter, NULL) != 0)
+        goto start_failed;
+
+    pthread_detach(writer);
+    logEnabled = true;
+    return 0;
+
+start_failed:
+    free(logPending);
+    free(logBatch);
+    HashMapFree(&logRooms);
+    logPending = NULL;
+    logBatch   = NULL;
+    return -1;
+}
+
+bool ChatLogEnabled()
+{
+    return logEnabled;
+}
+
+void ChatLogAppend(uint64_t roomId, SharedFrame* frame)
+{
+    if (!logEnabled)
+        return;
+
+    pthread_mutex_lock(&logLock);
+    if (logPendingCount == CHATLOG_MAX_PENDING) {
+        logMetrics.dropped++;
+        pthread_mutex_unlock(&logLock);
+        return;
+    }
+
+    logPending[logPendingCount].roomId = roomId;
+    logPending[logPendingCount].frame  = SharedFrameRetain(frame);
+    logPendingCount++;
+    logMetrics.appended++;
+
+    if (logPendingCount == CHATLOG_MAX_PENDING / 2)
+        pthread_cond_signal(&logHasWork);
+    pthread_mutex_unlock(&logLock);
+}
+
+/*
+    Map one segment and copy out up to its last 'wanted' frames
+    into the end of 'frames' (in front of 'filled' frames already
+    there). Returns how many frames were copied.
+*/
+static int QuerySegment(SegmentFile* segment, SharedFrame** frames, int filled, int wanted)
+{
+    char path[PATH_MAX];
+    SegmentPath(path, sizeof(path), segment->run, segment->roomId, segment->segment);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) // Rolled off since it was listed
+        return 0;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    size_t length = (size_t)info.st_size;
+    char*  data   = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return 0;
+
+    // Remember where the last 'wanted' frames start. Frames aren't indexed so walk them all
+    size_t* starts = calloc((size_t)wanted, sizeof(size_t));
+    size_t  seen   = 0;
+    size_t  offset = 0;
+    FrameHeader header;
+    while (starts != NULL && FrameParse(data + offset, length - offset, &header) == 1) // A torn frame at the end stops it
+    {
+        starts[seen % (size_t)wanted] = offset;
+        seen++;
+        offset += sizeof(FrameHeader) + header.length;
+    }
+
+    int copied = 0;
+    int found  = (seen < (size_t)wanted) ? (int)seen : wanted;
+    for (int i = 0; i < found; i++)
+    {
+        size_t start = starts[(seen - (size_t)found + (size_t)i) % (size_t)wanted];
+        FrameParse(data + start, length - start, &header);
+
+        FrameWriter writer = {0};
+        FramePutBytes(&writer, data + start, sizeof(FrameHeader) + header.length);
+        SharedFrame* frame = SharedFrameCreate(&writer);
+        FrameWriterFree(&writer);
+
+        if (frame != NULL)
+            frames[filled - found + copied++] = frame;
+    }
+
+    // Keep them packed against the frames of newer segments
+    if (copied < found)
+        memmove(&frames[filled - copied], &frames[filled - found], sizeof(SharedFrame*) * (size_t)copied);
+
+    free(starts);
+    munmap(data, length);
+    return copied;
+}
+
+int ChatLogQuery(uint64_t roomId, SharedFrame** frames, int count)
+{
+    if (!logEnabled || count <= 0)
+        return 0;
+
+    SegmentFile* segments     = NULL;
+    int          segmentCount = ListSegments(roomId, &segments);
+
+    // Newest segments first, filling 'frames' from the back
+    int filled = count;
+    for (int i = segmentCount - 1; i >= 0 && filled > 0; i--)
+        filled -= QuerySegment(&segments[i], frames, filled, filled);
+
+    free(segments);
+
+    int found = count - filled;
+    memmove(frames, &frames[filled], sizeof(SharedFrame*) * (size_t)found);
+    return found;
+}
+
+void ChatLogGetMetrics(ChatLogMetrics* metrics)
+{
+    pthread_mutex_lock(&logLock);
+    *metrics = logMetrics;
+    pthread_mutex_unlock(&logLock);
+}
@@ -69,7 +69,7 @@ void ErrorPrint(bool prefixNewline, const char* errorHeader, const char* errorMe
 
 /**
  * @brief           Main interface function, runs everything front end
- * @return          void*: Needed for threading
+ * @return          void
  * @retval          Does not return anything.
  */
 void LoadClientUserInterface() {
@@ -81,10 +81,9 @@ void LoadClientUserInterface() {
         SplashScreen();
 
         DisplayCommands(); // Display commands when you load up
-        
-        // // Create a thread to handle client inpuit
-        cpthread tinfo = cpThreadCreate(HandleClientInput, NULL);
-        cpThreadJoin(tinfo);
+
+        // Handle client input, root and servers on this thread until they quit
+        RunClientLoop();
     }
 }
 
@@ -114,9 +113,9 @@ void DisplayServers() {
     printf("  [ID] - [USR/COUNT] HOST: '' : NAME: ''\n");
 
     // Print Server List
-    for (int servIndex=0; servIndex<onlineServers; servIndex++){
-        Server server = serverList[servIndex];
-        printf("[%i] - [%i/%i] HOST: %s : NAME: %s\n", server.serverId, server.connectedClients, server.maxClients, server.host.handle, server.alias);
+    for (unsigned int servIndex=0; servIndex<onlineServers; servIndex++){
+        Server* server = ServerListAt(servIndex);
+        printf("[%" PRIu64 "] - [%i/%i] HOST: %s : NAME: %s\n", server->serverId, server->connectedClients, server->maxClients, server->host.handle, server->alias);
     }
 }
 
@@ -182,71 +181,15 @@ int Chatroom(Server* server) {
     // Clear previous terminal output
     ClearOutput();
     ServerPrint(CYN, "You are now connected to '%s'", server->alias);
+    ServerPrint(CYN, "Use '--history <count>' to See Older Messages.");
     ServerPrint(CYN, "Use '--leave' to Disconnect.\n");
+    return 0;
+}
 
-    cpthread tinfo = cpThreadCreate(ReceivePeerMessagesOnServer, (void*)server);
-    // localClient->connectedServer = server;
-
-    while (1) {
-        EnableTerminalInput();
-        char* message = malloc(kMaxClientMessageLength);
-        if (message == NULL)
-            break;
-
-        // take input from the client
-        fgets(message, kMaxClientMessageLength, stdin);
-        DisableTerminalInput();
-
-        // Remove the trailing newline character if it exists
-        if (message[strlen(message) - 1] == '\n') {
-            message[strlen(message) - 1] = '\0';
-        }
-
-        if (strlen(message) <= 0) {
-            free(message);
-            continue;
-        }
-
-        if (strcmp(localClient->connectedServer->alias, server->alias) != 0) {
-            free(message);
-            break;
-        }
-
-        // message is a command
-        int commandResult = PerformClientSideServerCommands(message);
-        if (commandResult == 99) {
-            free(message);
-            break;
-        } else if (commandResult != -1) { // command performed so dont echo the msg
-            free(message);
-            continue;
-        }
-
-        CMessage cmsg = {0};
-        cmsg.cflag    = k_cfEchoClientMessageInServer;
-        cmsg.sender   = *localClient;
-        strcpy(cmsg.message, message);
-        free(message);
-
-        ResponseCode requestStatus = MakeServerRequest(k_cfEchoClientMessageInServer, *localClient, cmsg);
-        // at this point we just sent a message
-        // go up a line if we just sent a message
-        // then delete that
-        // come back down
-        printf("\033[A\r"); // move up a line and go to the beginning
-        printf("\033[2K"); // Clear current line
-
-        // PrintClientMessage(*localClient, cmsg.message); // print our own message
-        sleep(0.3);
-    }
-
-    // We leave the connected server so default the local clients 'connectedServer' field to the rootServer again
-    localClient->connectedServer = &rootServer;
+void ChatroomClosed(Server* server) {
     ClearOutput();
     SystemPrint(CYN, false, "Disconnected From the Server '%s'", server->alias);
     SplashScreen();
-    EnableTerminalInput();
-    return 0;
 }
 
 /**
@@ -256,7 +199,6 @@ int Chatroom(Server* server) {
  * @retval          Success code
  */
 void DisplayServerInfo(char* serverName) {
-    UpdateServerList();
     Server* server = ServerFromAlias(serverName);
     
     if (server == NULL) 
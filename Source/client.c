@@ -2,8 +2,43 @@
 #include "Headers/client.h"
 #include "Headers/ccolors.h"
 
+#include <poll.h>
+#include <signal.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
 User* localClient = { 0 }; // Current client who ran the app
 
+/*
+    What lines typed by the client are taken as.
+*/
+typedef enum
+{
+    k_imCommand             = 0, // App commands like --servers
+    k_imChat                = 1, // Messages to the connected server
+    k_imPrivateMessageReply = 2, // Y or N to a pm invite
+} InputMode;
+
+/*
+    State of the client loop. Only the loop touches it, so
+    none of it needs a lock.
+*/
+static InputMode             inputMode       = k_imCommand;
+static InputMode             modeBeforeReply = k_imCommand;     // Mode to go back to once a pm invite is answered
+static char                  inputLine[kMaxClientMessageLength]; // Line being typed
+static size_t                inputLength     = 0;               // Chars in 'inputLine'
+static bool                  prompted        = false;           // Command prompt printed since the last line
+static Server                connectedRoom;                     // Copy of the server the client is in
+static FrameStream           roomStream      = { .fd = -1 };    // Socket of 'connectedRoom'. -1 outside servers
+static volatile sig_atomic_t quitRequested   = 0;               // Ctrl+C or kill. Loop disconnects and exits
+static int                   quitPipe[2]     = { -1, -1 };      // Written by signal handlers to wake the loop's poll()
+
+/*
+    Where the root server can be reached. See AddRootEndpoint().
+*/
+static struct sockaddr_in rootEndpoints[DIAL_MAX_ENDPOINTS];
+static unsigned int       rootEndpointCount = 0;
+
 void MallocLocalClient() {
     localClient = (User*)malloc(sizeof(User));
 }
@@ -34,39 +69,26 @@ ResponseCode MakeServerRequest(
 
     ResponseCode response = k_rcInternalServerError;
 
+    /*
+        The server knows who sent the request from the socket
+        so only the message goes with the command.
+    */
+    FrameWriter frame = {0};
+    FrameBegin(&frame, k_fkRequest, request.command, 0);
+    FramePutLongString(&frame, request.optionalClientMessage.message);
+
     // Send the request to the conncted server
-    int sentBytes = send(requestMaker.cfd, (void*)&request, sizeof(request), 0);
-    if (sentBytes < 0) // Error sending message
+    int sent = FrameFinish(&frame) ? FrameSend(requestMaker.cfd, &frame) : -1;
+    FrameWriterFree(&frame);
+
+    if (sent < 0) // Error sending message
     {
         ServerPrint(RED, "Error Making Server Request");
         return response;
     }
 
-    // Don't received on connected server socket if we left the server
-    if (request.command != k_cfKickClientFromServer)
-    {
-        if (request.command != k_cfEchoClientMessageInServer)
-        {
-            /*
-                Receive a response from the server as ResponseCode enum
-            */
-            int recvBytes = recv(requestMaker.cfd, (void*)&response, sizeof(ResponseCode), 0);
-            if (recvBytes <= 0)
-            {
-                ServerPrint(RED, "Error Making Request");
-                return response;
-            }
-        }
-    }
-    else 
-    {
-        if (strcmp(request.optionalClientMessage.message, localClient->handle) == 0) {
-            // Client left the server so remove connectedServer
-            localClient->connectedServer = (Server*){0};
-            localClient->cfd = 0;
-        }
-    }
-
+    // Servers don't answer kick and echo requests. Leaving is done by LeaveConnectedServer()
+    response = k_rcRootOperationSuccessful;
     return response;
 }
 
@@ -111,6 +133,40 @@ void DisconnectClient() {
     exit(EXIT_SUCCESS);
 }
 
+/*
+    Close the socket of the connected server and
+    go back to taking commands.
+*/
+static void CloseConnectedServer()
+{
+    if (roomStream.fd < 0)
+        return;
+
+    close(roomStream.fd);
+    FrameStreamFree(&roomStream);
+    localClient->cfd             = 0;
+    localClient->connectedServer = &rootServer;
+
+    // A pm invite being answered goes back to commands after
+    if (inputMode == k_imChat)
+        inputMode = k_imCommand;
+    else
+        modeBeforeReply = k_imCommand;
+
+    ChatroomClosed(&connectedRoom);
+}
+
+void EnterConnectedServer(int cfd, Server* server)
+{
+    connectedRoom                = *server;
+    localClient->cfd             = cfd;
+    localClient->connectedServer = &connectedRoom;
+    FrameStreamInit(&roomStream, cfd);
+
+    inputMode = k_imChat;
+    Chatroom(&connectedRoom);
+}
+
 void LeaveConnectedServer()
 {
     ResponseCode req = MakeServerRequest(k_cfKickClientFromServer,
@@ -118,270 +174,437 @@ void LeaveConnectedServer()
                                         (CMessage){0}
                                         );
 
-    UpdateServerList();
+    CloseConnectedServer();
+
+    // Count of the server changed. Next command asks root
+    ServerListInvalidate();
 }
 
-void ReceiveRootRequestsAsClient()
+void AskToAcceptPrivateMessage(const char* handle)
 {
-    while (1) {
-        CMessage receivedCMessage = {0};
-        int recvd = recv(localClient->rfd, (void*)&receivedCMessage, sizeof(receivedCMessage), 0);
-        
-        if (recvd < 0) // Error
-            continue;
-
-        switch (receivedCMessage.cflag)
-        {
-        case k_cfClientRequestPrivateMessage:
-            SystemPrint(GRN, true, "%s Wants to PM! Y = accept. N = decline", receivedCMessage.sender.handle);
-            
-            CMessage clientResponse = {0};
-            clientResponse.cflag = k_cfClientDeclinedPrivateMessage;
-            clientResponse.sender = *localClient;
-
-            // respond back with yes or no
-            while (1) {
-                char* inp = malloc(10);
-                fgets(inp, 10, stdin);
-
-                // Remove the trailing newline character if it exists
-                if (inp[strlen(inp) - 1] == '\n') {
-                    inp[strlen(inp) - 1] = '\0';
-                }
-
-                // Command is empty, don't need to process anything
-                if (strlen(inp) == 0) {
-                    continue;
-                }
-
-                if (strcmp(inp, "Y") == 0) {
-                    clientResponse.cflag = k_cfClientAcceptedPrivateMessage;
-                    SystemPrint(GRN, true, "You accepted the PM request.");
-                    break;
-                } else if (strcmp(inp, "N") == 0) {
-                    clientResponse.cflag = k_cfClientDeclinedPrivateMessage;
-                    SystemPrint(RED, true, "You declined the PM request.");
-                    break;
-                }
-            }
+    SystemPrint(GRN, true, "%s Wants to PM! Y = accept. N = decline", handle);
 
-            send(localClient->rfd, (void*)&clientResponse, sizeof(clientResponse), 0);
+    if (inputMode != k_imPrivateMessageReply)
+        modeBeforeReply = inputMode;
+    inputMode = k_imPrivateMessageReply;
+}
 
-            break;
-        default:
-            break;
-        }
+/*
+    Answer the pm invite with what the client typed.
+    Anything but Y or N is ignored until they answer.
+*/
+static void AnswerPrivateMessage(char* answerText)
+{
+    CommandFlag answer = k_cfClientDeclinedPrivateMessage;
+
+    if (strcmp(answerText, "Y") == 0) {
+        answer = k_cfClientAcceptedPrivateMessage;
+        SystemPrint(GRN, true, "You accepted the PM request.");
+    } else if (strcmp(answerText, "N") == 0) {
+        answer = k_cfClientDeclinedPrivateMessage;
+        SystemPrint(RED, true, "You declined the PM request.");
+    } else {
+        return;
     }
+
+    // Root knows who invited us so the answer has no body
+    FrameWriter reply = {0};
+    FrameBegin(&reply, k_fkRequest, answer, 0);
+    if (FrameFinish(&reply))
+        FrameSend(localClient->rfd, &reply);
+
+    FrameWriterFree(&reply);
+    inputMode = modeBeforeReply;
 }
 
-void ReceivePeerMessagesOnServer(void* serverInfo)
+/*
+    Do what a peer or the connected server told us to.
+    Some of them end the connection to the server.
+*/
+static void HandlePeerMessage(CMessage* receivedCMessage)
 {
-    Server* server = (Server*)serverInfo;
-    
+    // decrypt  the msg
+    if (receivedCMessage->cflag == k_cfPrintPeerClientMessage) {
+        *receivedCMessage = DecryptPeerMessage(receivedCMessage);
+    }
+
     /*
-        Check if the local client is connected to the server
-        we want to receive messages on.
+        Find out what the peer wants us to do with
+        the message. Map it to a command.
     */
-    if (strcmp(server->alias, localClient->connectedServer->alias) != 0) // Not on the server
-        return;
-    while (1)
+    switch (receivedCMessage->cflag)
+    {
+    case k_cfClientRequestPrivateMessage:
+        printf("client wants to pm\n");
+        break;
+    case k_cfPrintServerAnnouncement:
+        ServerPrint(CYN, receivedCMessage->message);
+        break;
+    case k_cfClientThrottled:
+    case k_cfClientMessageDropped:
+        // What we sent last was dropped by the server
+        ServerPrint(YEL, receivedCMessage->message);
+        break;
+    case k_cfPrintPeerClientMessage:
+        PrintClientMessage(receivedCMessage->sender, receivedCMessage->message);
+        break;
+    case k_cfKickClientFromServer:
+        // Host had the server remove us. It already did
+        ServerPrint(RED, "You have been kicked from '%s'", connectedRoom.alias);
+        CloseConnectedServer();
+        break;
+    case k_cfBanClientFromServer:
+        // TODO: Add an array of banned clients to Server struct and add this user to it.
+        ServerPrint(RED, "You Have Been Banned From '%s'\n", connectedRoom.alias);
+        LeaveConnectedServer();
+        break;
+    case k_cfConnectedServerShutDown:
+        printf("\n");
+        ServerPrint(RED, "The connected server has been shutdown.");
+        CloseConnectedServer();
+        break;
+    default:
+        break;
+    }
+}
+
+void ReceivePeerMessagesOnServer()
+{
+    // Messages that arrive together are read in one go
+    int filled = FrameStreamFill(&roomStream);
+
+    while (roomStream.fd >= 0 && FrameStreamReady(&roomStream))
     {
         /*
             Receive encrypted messages from other clients
             Decrypt them once received
         */
         CMessage receivedCMessage = { 0 };
-        int receivedBytes = recv(localClient->cfd, (void*)&receivedCMessage, sizeof(receivedCMessage), 0);
-        if (receivedBytes < 0) // Error
-            continue;
-        else if (receivedBytes == 0 && server->online) // Disconnected from seerver/Server went offline
-            break;
-        else if (receivedBytes == 0 && server->online == false) // Server was shutdown
-        {
-            ServerPrint(YEL, "Server Was Shutdown. Quitting.");
-            LeaveConnectedServer();
+        if (ReceiveClientMessage(&roomStream, &receivedCMessage) < 0) {
+            filled = -1;
             break;
         }
-        
-        // decrypt  the msg
-        if (receivedCMessage.cflag == k_cfPrintPeerClientMessage) {
-            receivedCMessage = DecryptPeerMessage(&receivedCMessage);
-        }
 
-        /*
-            Find out what the peer wants us to do with
-            the message. Map it to a command.
-        */
-        switch (receivedCMessage.cflag)
-        {
-        case k_cfClientRequestPrivateMessage:
-            printf("client wants to pm\n");
-            break;
-        case k_cfPrintServerAnnouncement:
-            ServerPrint(CYN, receivedCMessage.message);
-            break;
-        case k_cfPrintPeerClientMessage:
-            receivedCMessage.sender.handle[strlen(receivedCMessage.sender.handle)] = '\0';
-            // if (strcmp(receivedCMessage.sender.handle, localClient->handle) != 0)
-            PrintClientMessage(receivedCMessage.sender, receivedCMessage.message);
+        HandlePeerMessage(&receivedCMessage);
+    }
 
-            break;
-        case k_cfKickClientFromServer:
-            /*
-                Peer told server they want this specific user to be
-                kicked from the server.
-                
-                Request the server to remove local client.
-            */
-            localClient->connectedServer = &rootServer;
-            ServerPrint(RED, "You have been kicked from '%s'", server->alias);
-            ServerPrint(RED, "Press any key to continue...");
-            return;
-        case k_cfBanClientFromServer:
-            // TODO: Add an array of banned clients to Server struct and add this user to it.
-            
-            LeaveConnectedServer();
-            ServerPrint(RED, "You Have Been Banned From '%s'\n", server->alias);
-            return;
-        case k_cfConnectedServerShutDown:
-            localClient->connectedServer = &rootServer;
-            printf("\n");
-            ServerPrint(RED, "The connected server has been shutdown.");
-            ServerPrint(RED, "Enter any key to continue... ");
-            return;
-        default:
-            break;
-        }
+    // Disconnected from server without being told why
+    if (filled < 0 && roomStream.fd >= 0) {
+        ServerPrint(YEL, "Lost Connection To '%s'.", connectedRoom.alias);
+        CloseConnectedServer();
     }
-    // pthread_exit(NULL);
 }
 
 User CSClientFromName(char* username) {
-    User* clientList = localClient->connectedServer->clientList;
-    for (int ci = 1; ci<=localClient->connectedServer->connectedClients; ci++)
-        if (strcmp(clientList[ci].handle, username) == 0)
-            return clientList[ci];
+    // Members of a server aren't sent to clients so this only finds someone server-sided
+    User* member = SSFindMember(localClient->connectedServer, username);
+    return (member != NULL) ? *member : (User){0};
+}
 
-    return (User){0};
+/*
+    Root answered the server list asked for on connecting.
+    It was applied when the response was read.
+*/
+static void ServerListSynced(RootResponse* response, void* context)
+{
+}
+
+/*
+    Root answered a pm invite once the peer did.
+    'context' is the handle of the peer.
+*/
+static void PrivateMessageAnswered(RootResponse* response, void* context)
+{
+    char* peerName = (char*)context;
+
+    if (response->rcode == k_rcRootOperationSuccessful) {
+        // client accepted the pm
+        char pmName[kMaxServerAliasLength + 1];
+        snprintf(pmName, sizeof(pmName), "%s-%s", localClient->handle, peerName);
+        MakeServer(AF_INET, SOCK_STREAM, 0, 2, pmName);
+    } else {
+        SystemPrint(YEL, true, "%s Did Not Accept the PM.", peerName);
+    }
+
+    free(peerName);
+}
+
+/*
+    Send what the client typed in a server to everyone in it,
+    unless it was one of the commands of servers.
+*/
+static void SendChatMessage(char* message)
+{
+    // message is a command
+    int commandResult = PerformClientSideServerCommands(message);
+    if (commandResult == 99) {
+        CloseConnectedServer();
+        return;
+    } else if (commandResult != -1) { // command performed so dont echo the msg
+        return;
+    }
+
+    CMessage cmsg = {0};
+    cmsg.cflag    = k_cfEchoClientMessageInServer;
+    cmsg.sender   = *localClient;
+    strcpy(cmsg.message, message);
+
+    ResponseCode requestStatus = MakeServerRequest(k_cfEchoClientMessageInServer, *localClient, cmsg);
+    // at this point we just sent a message
+    // go up a line if we just sent a message
+    // then delete that
+    // come back down. It is printed once the server echoes it
+    printf("\033[A\r"); // move up a line and go to the beginning
+    printf("\033[2K"); // Clear current line
+    fflush(stdout);
 }
 
 /**
- * @brief           Handle clientinput by the user and treat it as a app command
- * @return          void*
+ * @brief           Handle a line entered by the user and treat it as a app command
+ * @param[in]       cmd: line the user typed
  * @retval          Nothing.
  */
-void* HandleClientInput(){
-    localClient->connectedServer = &rootServer;
+void HandleClientCommand(char* cmd){
+    bool validCmd = false;
 
-    while (1) {
-        char cmd[300];
-        bool validCmd = false;
+    /*
+    *
+    * All functions that take command line arguemnts
+    * In a case a function takes a command line argument,
+    * it must be processed specially like below
+    * 
+    */
 
-        printf("Enter Command> ");
+    // Server info command. It takes command-line arguments
+    if (strstr(cmd, "--si") != NULL) {
+        char serverName[kMaxServerAliasLength + 1];
 
-        fgets(cmd, kMaxCommandLength, stdin);
+        if (sscanf(cmd, "--si %32s", serverName) != 1) {
+            SystemPrint(RED, true, "Invalid Usage for --si. View --help for more info.");
+            return;
+        }
 
-        // Remove the trailing newline character if it exists
-        if (cmd[strlen(cmd) - 1] == '\n') {
-            cmd[strlen(cmd) - 1] = '\0';
+        DisplayServerInfo(serverName);
+        validCmd = true;
+    }
+
+    // Join server command. It takes command-line arguments
+    else if (strstr(cmd, "--joins") != NULL) {
+        char serverName[kMaxServerAliasLength + 1];
+
+        if (sscanf(cmd, "--joins %32s", serverName) != 1) {
+            SystemPrint(RED, false, "Invalid Usage for --joins. View --help for more info.");
+            return;
         }
 
-        // Command is empty, don't need to process anything
-        if (strlen(cmd) == 0) {
-            continue;
+        JoinServerByName(serverName);
+        validCmd = true;
+    }
+
+    else if (strstr(cmd, "--makes") != NULL) {
+        char         serverName[kMaxServerAliasLength + 1];
+        unsigned int maxClients;
+        unsigned int port;
+
+        // Rooms share one port now. A port is still accepted but unused
+        if (sscanf(cmd, "--makes %32s %u %u", serverName, &port, &maxClients) != 3
+            && sscanf(cmd, "--makes %32s %u", serverName, &maxClients) != 2) {
+            SystemPrint(RED, false, "Invalid Usage for --makes. View --help for more info.");
+            return;
         }
 
-        /*
-        *
-        * All functions that take command line arguemnts
-        * In a case a function takes a command line argument,
-        * it must be processed specially like below
-        * 
-        */
+        SystemPrint(CYN, true, "Making Server '%s'", serverName);
 
-        // Server info command. It takes command-line arguments
-        if (strstr(cmd, "--si") != NULL) {
-            char serverName[kMaxServerAliasLength + 1];
+        int serverCreated = MakeServer(AF_INET, SOCK_STREAM, 0, maxClients, serverName); // Error handling in the MakeServer() function
+        
+        validCmd = true;
+    }
 
-            if (sscanf(cmd, "--si %32s", serverName) != 1) {
-                SystemPrint(RED, true, "Invalid Usage for --si. View --help for more info.");
-                continue;
-            }
+    else if (strstr(cmd, "--pm") != NULL) {
+        char peerName[kMaxClientHandleLength + 1];
+        if (sscanf(cmd, "--pm %s", peerName) != 1) {
+            SystemPrint(RED, false, "Invalid Usage for --pm. View --help for more info.");
+            return;
+        }
 
-            DisplayServerInfo(serverName);
-            validCmd = true;
+        if (strcmp(peerName, localClient->handle) == 0) {
+            SystemPrint(RED, false, "Cannot PM Yourself. Try a Different User.");
+            return;
         }
 
-        // Join server command. It takes command-line arguments
-        else if (strstr(cmd, "--joins") != NULL) {
-            char serverName[kMaxServerAliasLength + 1];
+        CMessage command = {0};
+        command.cflag = k_cfClientRequestPrivateMessage;
+        strcpy(command.message, peerName);
+        command.sender = *localClient;
 
-            if (sscanf(cmd, "--joins %32s", serverName) != 1) {
-                SystemPrint(RED, false, "Invalid Usage for --joins. View --help for more info.");
-                continue;
-            }
+        // Answered once the peer does. The client keeps going until then
+        char* peer = strdup(peerName);
+        if (peer == NULL
+            || SendRootRequest(k_cfClientRequestPrivateMessage, rootServer, *localClient, command, PrivateMessageAnswered, peer) == 0) {
+            free(peer);
+            return;
+        }
 
-            JoinServerByName(serverName);
+        SystemPrint(CYN, true, "Asked %s to PM. Their Answer Will Show Up Here.", peerName);
+        validCmd = true;
+    }
+
+    // How long the server list is used before asking root again
+    else if (strstr(cmd, "--cache") != NULL) {
+        unsigned int ttlMs;
+        if (sscanf(cmd, "--cache %u", &ttlMs) != 1) {
+            SystemPrint(RED, false, "Invalid Usage for --cache. View --help for more info.");
+            return;
+        }
+
+        serverListTtlMs = ttlMs;
+        SystemPrint(YEL, true, "Server List Is Kept For %u ms.", ttlMs);
+        validCmd = true;
+    }
+
+    // Normal command function without command-line args
+    for (int i = 0; i < kNumOfCommands; i++)
+    {
+        if (strcmp(cmd, validCommands[i].kCommandName) == 0) {
+            validCommands[i].function();
             validCmd = true;
+            break;
         }
+    }
 
-        else if (strstr(cmd, "--makes") != NULL) {
-            char         serverName[kMaxServerAliasLength + 1];
-            unsigned int maxClients;
-            unsigned int port;
+    if (!validCmd)
+    {
+        SystemPrint(RED, true, "Unknown Command. Enter --help to view commands.");
+        return;
+    }
+}
 
-            if (sscanf(cmd, "--makes %32s %u %u", serverName, &port, &maxClients) != 3) {
-                SystemPrint(RED, false, "Invalid Usage for --makes. View --help for more info.");
-                continue;
-            }
+/*
+    Handle a whole line typed by the client
+    the way the client loop is taking lines now.
+*/
+static void HandleInputLine(char* line)
+{
+    // Remove the carriage return terminals may leave
+    size_t length = strlen(line);
+    if (length > 0 && line[length - 1] == '\r')
+        line[length - 1] = '\0';
 
-            SystemPrint(CYN, true, "Making Server '%s' on Port '%i'", serverName, port);
+    switch (inputMode)
+    {
+    case k_imPrivateMessageReply:
+        AnswerPrivateMessage(line);
+        break;
+    case k_imChat:
+        if (strlen(line) > 0)
+            SendChatMessage(line);
+        break;
+    default:
+        // Command is empty, don't need to process anything
+        if (strlen(line) > 0)
+            HandleClientCommand(line);
+        break;
+    }
+}
 
-            int serverCreated = MakeServer(AF_INET, SOCK_STREAM, 0, port, maxClients, serverName); // Error handling in the MakeServer() function
-            
-            validCmd = true;
+/*
+    Read what was typed and handle every line it finished.
+    Lines longer than a message are cut off.
+    Returns false once stdin is closed.
+*/
+static bool ReadClientInput()
+{
+    char    typed[256];
+    ssize_t got = read(STDIN_FILENO, typed, sizeof(typed));
+    if (got < 0)
+        return errno == EINTR || errno == EAGAIN;
+    if (got == 0)
+        return false;
+
+    for (ssize_t i = 0; i < got; i++)
+    {
+        if (typed[i] != '\n') {
+            if (inputLength < sizeof(inputLine) - 1)
+                inputLine[inputLength++] = typed[i];
+            continue;
         }
 
-        else if (strstr(cmd, "--pm") != NULL) {
-            char peerName[kMaxClientHandleLength + 1];
-            if (sscanf(cmd, "--pm %s", peerName) != 1) {
-                SystemPrint(RED, false, "Invalid Usage for --pm. View --help for more info.");
-                continue;
-            }
+        inputLine[inputLength] = '\0';
+        inputLength            = 0;
+        prompted               = false;
+        HandleInputLine(inputLine);
+    }
 
-            if (strcmp(peerName, localClient->handle) == 0) {
-                SystemPrint(RED, false, "Cannot PM Yourself. Try a Different User.");
-                continue;
-            }
+    return true;
+}
+
+/*
+    Signals only ask the client loop to quit. Disconnecting
+    takes requests that can't be made from a signal handler.
+    The byte on 'quitPipe' wakes the loop if it was in poll()
+    when the flag was set.
+*/
+static void RequestClientQuit(int signalNumber)
+{
+    int savedErrno = errno;
+
+    quitRequested = 1;
+    if (quitPipe[1] >= 0)
+        write(quitPipe[1], "q", 1);
+
+    errno = savedErrno;
+}
+
+void RunClientLoop()
+{
+    localClient->connectedServer = &rootServer;
+
+    if (pipe(quitPipe) != 0 || SetSocketNonBlocking(quitPipe[0]) != 0 || SetSocketNonBlocking(quitPipe[1]) != 0)
+        SystemPrint(RED, true, "Ctrl+C Might Not Disconnect Right Away. Error Code %i", errno);
 
-            CMessage command = {0};
-            command.cflag = k_cfClientRequestPrivateMessage;
-            strcpy(command.message, peerName);
-            command.sender = *localClient;
-            RootResponse requestPM = MakeRootRequest(k_cfClientRequestPrivateMessage, rootServer, *localClient, command);
+    signal(SIGINT, RequestClientQuit);
+    signal(SIGTERM, RequestClientQuit);
+
+    while (!quitRequested)
+    {
+        // Pushes that came in while a request waited for its response too
+        if (ReceiveRootPushes() != 0) {
+            SystemPrint(RED, true, "Lost Connection To The Root Server.");
+            break;
         }
 
-        // Normal command function without command-line args
-        for (int i = 0; i < kNumOfCommands; i++)
-        {
-            if (strcmp(cmd, validCommands[i].kCommandName) == 0) {
-                validCommands[i].function();
-                validCmd = true;
-                break;
-            }
+        if (inputMode == k_imCommand && !prompted) {
+            printf("Enter Command> ");
+            fflush(stdout);
+            prompted = true;
         }
 
-        if (!validCmd)
-        {
-            SystemPrint(RED, true, "Unknown Command. Enter --help to view commands.");
-            continue;
+        // Room socket is -1 outside servers, which poll() skips
+        struct pollfd watched[4] = {
+            { .fd = STDIN_FILENO,   .events = POLLIN },
+            { .fd = rootServer.sfd, .events = POLLIN },
+            { .fd = roomStream.fd,  .events = POLLIN },
+            { .fd = quitPipe[0],    .events = POLLIN }, // Only wakes the loop up. 'quitRequested' is checked on top
+        };
+
+        // Wakes up for requests root left unanswered too
+        if (poll(watched, 4, ExpireRootRequests()) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
         }
+
+        // Root is read at the top of the loop
+        if (watched[2].revents != 0)
+            ReceivePeerMessagesOnServer();
+
+        if (watched[0].revents != 0 && !ReadClientInput())
+            break; // End of input
     }
 
-    // pthread_exit(NULL);
+    DisconnectClient();
 }
 
-
 /*
     Return -1 if no command was performed
     Return 99 if were leaving to break out of a chatroom loop
@@ -393,6 +616,19 @@ int PerformClientSideServerCommands(char* message) {
         ResponseCode leaveRequest = MakeServerRequest(k_cfKickClientFromServer, *localClient, (CMessage){0});
         return 99; // return 99 to say the command was successful and to break if were in a thread
     }
+    else if (strncmp(message, "--history", strlen("--history")) == 0) {
+        // Older messages come in and are printed like any other
+        int count = ROOM_HISTORY_LENGTH;
+        sscanf(message, "--history %d", &count);
+
+        CMessage command = {0};
+        command.cflag  = k_cfRequestServerHistory;
+        command.sender = *localClient;
+        snprintf(command.message, sizeof(command.message), "%d", count);
+
+        MakeServerRequest(k_cfRequestServerHistory, *localClient, command);
+        return 0; // performed
+    }
     else if (strstr(message, "--kick") != NULL) {
         // local client isnt host so return out
         if (!IsUserHost(*localClient, localClient->connectedServer)) { return -1; }
@@ -494,6 +730,14 @@ int DefaultClientConnectionInfo() {
     return 0;
 }
 
+/*
+    Client-sided. Parse 'endpoint' into rootEndpoints. A missing port is ROOT_PORT.
+*/
+bool AddRootEndpoint(const char* endpoint)
+{
+    return DialParseEndpoint(endpoint, ROOT_PORT, rootEndpoints, &rootEndpointCount);
+}
+
 /**
  * @brief           Connect to the server which holds information about all other servers
  * @return          int
@@ -501,9 +745,6 @@ int DefaultClientConnectionInfo() {
  */
 int ConnectToRootServer() {
     // Fill out information about the root server used to establish client connection.
-
-    printf("Filling root server struct... ");
-    
     rootServer.domain     = AF_INET;
     rootServer.type       = SOCK_STREAM;
     rootServer.protocol   = 0;
@@ -512,53 +753,46 @@ int ConnectToRootServer() {
     rootServer.isRoot     = true;
     strcpy(rootServer.alias, "__root__");
 
-    printf("Done\n");
-    printf("Creating client socket using port %i... ", rootServer.port);
-
-    // Connect client to server. Establish a connection
-
-    int cfd = socket(rootServer.domain, rootServer.type, rootServer.protocol); // These are the settings the root server uses
-    if (cfd < 0)
-        goto close_root_connection;
-    
-    rootServer.sfd = cfd;
-
-    printf("Done\n");
-    printf("Filling address info for client to connect... ");
-
-    // Address info for main server
+    // Root on this machine unless told otherwise
+    if (rootEndpointCount == 0)
+        AddRootEndpoint("127.0.0.1");
+
+    printf("Connecting to root server (%u endpoints)... ", rootEndpointCount);
+    fflush(stdout);
+
+    // Every endpoint is raced without blocking on any of them
+    DialPolicy policy  = DIAL_DEFAULT_POLICY;
+    DialResult dialed;
+    uint64_t   startNs = MonotonicNs();
+    if (!Dial(rootEndpoints, rootEndpointCount, &policy, &dialed)) {
+        printf("Failed\n");
+        printf(RED "No root server reachable after %u rounds (%.0f ms):\n" RESET, dialed.rounds, (MonotonicNs() - startNs) / 1e6);
+        for (unsigned int i = 0; i < rootEndpointCount; i++)
+        {
+            char host[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &rootEndpoints[i].sin_addr, host, sizeof(host));
+            printf(RED "  %s:%u - %s\n" RESET, host, ntohs(rootEndpoints[i].sin_port), strerror(dialed.errors[i]));
+        }
+        printf(RED "Server may be offline. Please try again later.\n" RESET);
+        return -1;
+    }
 
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(struct sockaddr_in));
-    addr.sin_family = rootServer.domain;
-    addr.sin_port   = htons(rootServer.port); // Constant. Server will always be on this port
-    // addr.sin_addr.s_addr = inet_addr(HOST_IP_ADDRESS);
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    int cfd = dialed.fd;
 
-    // if (inet_pton(rootServer.domain, "192.168.0.12", &addr.sin_addr) < 0)
-        // goto close_root_connection;
-    
-    printf("Done\n");
-    fprintf(stderr, "Connecting client socket to main server... ");
+    // Requests go out as soon as they're made, not once root acked the last one
+    int noDelay = 1;
+    setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
 
-    // Attempt to retry connection again if it fails.
-    int attempts = 0;
-    do {
-        int con = connect(cfd, (struct sockaddr*)&addr, sizeof(addr));
-        if (con < 0) {
-            attempts++;
-            sleep(2);
-            continue;
-        }
-        break;
-    }
-    while (attempts < 5);
-    if (attempts >= 5) goto close_root_connection;
+    rootServer.sfd  = cfd;
+    rootServer.addr = rootEndpoints[dialed.endpoint]; // Servers on root are reached at this address too
+    rootServer.port = ntohs(rootServer.addr.sin_port);
 
+    char host[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &rootServer.addr.sin_addr, host, sizeof(host));
     printf("Done\n");
-    printf("Client connected to main server.\n");
+    printf("Client connected to main server at %s:%i in %.1f ms.\n", host, rootServer.port, (MonotonicNs() - startNs) / 1e6);
     printf("Filling out local client info struct... ");
-   
+
     // Fill out local client info struct
     // Handle already filled out at start of program
     DefaultClientConnectionInfo();
@@ -566,19 +800,15 @@ int ConnectToRootServer() {
     printf("Done\n");
     
     // sleep(1);
-    // Send client info
-    RootRequest req       = {0};
-    req.clientSentMessage = (CMessage){0}; // No Client Message.
-    req.cmdFlag           = k_cfConnectClientToServer;
-    req.server            = rootServer;
-    req.user              = *localClient;
-    int sendInfo = send(rootServer.sfd, (const void*)&req, sizeof(req), 0);
-
-    printf("Sent current user info. Now trying to recv.\n");
-
-    // Get response
-    RootResponse resp = {0};
-    int recvInfo = recv(rootServer.sfd, (void*)&resp, sizeof(resp), 0);
+    // Send client info and get response
+    RootResponse resp   = { .rcode = k_rcInternalServerError };
+    uint32_t     joinId = SendRootRequest(k_cfConnectClientToServer, rootServer, *localClient, (CMessage){0}, NULL, NULL);
+
+    // Server list goes in the same round trip. Root gets to it once we've joined
+    if (joinId != 0) {
+        SendRootRequest(k_cfRequestServerList, (Server){0}, (User){0}, (CMessage){0}, ServerListSynced, NULL);
+        WaitForRootResponse(joinId, &resp);
+    }
 
     printf("Received updated user info.\n");
     printf("Client Root File Descriptor: %i\n", localClient->rfd);
@@ -592,16 +822,16 @@ int ConnectToRootServer() {
         return 0;
     }
 
+    if (resp.rcode == k_rcErrorHandleInUse)
+        printf(RED "The username '%s' is already in use. Restart and pick another one.\n" RESET, localClient->handle);
+
     goto close_root_connection;
 
 // Error
 close_root_connection:
-    printf("Failed\n");
-    printf(RED "Failed to connect to main servers. Error code %i, %i attempts\n" RESET, errno, attempts);
+    printf(RED "Failed to join the root server.\n" RESET);
     close(cfd);
-
-    if (errno == ECONNREFUSED)
-        printf(RED "Server may be offline. Please try again later.\n" RESET);
+    rootServer.sfd = -1;
 
     return -1;
 }
\ No newline at end of file
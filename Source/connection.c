@@ -0,0 +1,364 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       connection.c
+ * @brief      buffered non-blocking sockets driven by a reactor
+ *
+ * @note
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#include "Headers/connection.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/*
+    Grow 'buffer' so it can hold at least 'needed' bytes.
+    Returns false if memory couldn't be allocated.
+*/
+static bool ReserveBuffer(char** buffer, size_t* capacity, size_t needed)
+{
+    if (needed <= *capacity)
+        return true;
+
+    size_t newCapacity = (*capacity == 0) ? CONNECTION_READ_CHUNK : *capacity;
+    while (newCapacity < needed)
+        newCapacity *= 2;
+
+    char* grown = realloc(*buffer, newCapacity);
+    if (grown == NULL)
+        return false;
+
+    *buffer   = grown;
+    *capacity = newCapacity;
+    return true;
+}
+
+/*
+    Keep bytes the reactor received for the connection
+    and tell its handler they are there.
+*/
+static void ConnectionReceived(Reactor* reactor, const char* data, ssize_t length, void* context)
+{
+    Connection* connection = (Connection*)context;
+
+    if (length == 0)
+        connection->peerClosed = true;
+    else if (length < 0)
+        connection->failed = true;
+    else if (!ReserveBuffer(&connection->inbound, &connection->inboundCapacity, connection->inboundLength + (size_t)length))
+        connection->failed = true;
+    else {
+        memcpy(connection->inbound + connection->inboundLength, data, (size_t)length);
+        connection->inboundLength += (size_t)length;
+    }
+
+    connection->watch.handler(reactor, REACTOR_READ, context);
+}
+
+Connection* ConnectionCreate(Reactor* reactor, int fd, ReactorHandler handler, void* owner)
+{
+    if (SetSocketNonBlocking(fd) != 0)
+        return NULL;
+
+    Connection* connection = calloc(1, sizeof(Connection));
+    if (connection == NULL)
+        return NULL;
+
+    connection->reactor        = reactor;
+    connection->fd             = fd;
+    connection->owner          = owner;
+    connection->watch.fd       = fd;
+    connection->watch.events   = REACTOR_READ;
+    connection->watch.handler  = handler;
+    connection->watch.receiver = ConnectionReceived;
+    connection->watch.context  = (void*)connection;
+    pthread_mutex_init(&connection->outboundLock, NULL);
+
+    if (ReactorAdd(reactor, &connection->watch) != 0) {
+        pthread_mutex_destroy(&connection->outboundLock);
+        free(connection);
+        return NULL;
+    }
+
+    return connection;
+}
+
+/**
+ * @brief           Read all available bytes from the socket
+ * @param[in]       connection: connection to read from
+ * @return          ssize_t
+ * @retval          bytes read or -1 on error
+ */
+ssize_t ConnectionFill(Connection* connection)
+{
+    // Already in 'inbound'
+    if (ReactorReceives(connection->reactor))
+        return connection->failed ? -1 : 0;
+
+    char    chunk[CONNECTION_READ_CHUNK];
+    ssize_t total = 0;
+
+    while (1)
+    {
+        ReactorCountSyscall(connection->reactor);
+        ssize_t received = recv(connection->fd, chunk, sizeof(chunk), 0);
+        if (received < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+
+        if (received == 0) {
+            connection->peerClosed = true;
+            break;
+        }
+
+        /*
+            Idle connections keep no receive buffer at all.
+            One is only allocated once bytes actually arrive.
+        */
+        size_t needed = connection->inboundLength + (size_t)received;
+        if (!ReserveBuffer(&connection->inbound, &connection->inboundCapacity, needed))
+            return -1;
+
+        memcpy(connection->inbound + connection->inboundLength, chunk, (size_t)received);
+        connection->inboundLength = needed;
+        total += received;
+
+        if ((size_t)received < sizeof(chunk))
+            break;
+    }
+
+    return total;
+}
+
+void ConnectionConsume(Connection* connection, size_t length)
+{
+    if (length >= connection->inboundLength) {
+        // Everything handled. Give the memory back so idle clients stay cheap
+        free(connection->inbound);
+        connection->inbound         = NULL;
+        connection->inboundLength   = 0;
+        connection->inboundCapacity = 0;
+        return;
+    }
+
+    memmove(connection->inbound, connection->inbound + length, connection->inboundLength - length);
+    connection->inboundLength -= length;
+}
+
+/*
+    Only ask the reactor for write readiness while
+    there is something queued. 'outboundLock' must be held.
+*/
+static void UpdateInterestLocked(Connection* connection)
+{
+    bool         queued = connection->outboundLength > 0 || connection->urgentLength > 0;
+    unsigned int wanted = REACTOR_READ | (queued ? REACTOR_WRITE : 0);
+    if (wanted != connection->watch.events)
+        ReactorModify(connection->reactor, &connection->watch, wanted);
+}
+
+/*
+    Send as many bytes of 'data' as the socket takes right now.
+    Returns the amount sent or -1 if the connection is broken.
+*/
+static ssize_t SendAvailable(Connection* connection, const char* data, size_t length)
+{
+    size_t written = 0;
+
+    while (written < length)
+    {
+        ReactorCountSyscall(connection->reactor);
+        ssize_t sent = send(connection->fd, data + written, length - written, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+
+        written += (size_t)sent;
+    }
+
+    return (ssize_t)written;
+}
+
+/*
+    Drop the first 'sent' bytes of a send buffer. Its memory
+    is given back once it's empty so idle clients stay cheap.
+*/
+static void DropSent(char** buffer, size_t* length, size_t* capacity, size_t sent)
+{
+    if (sent < *length) {
+        memmove(*buffer, *buffer + sent, *length - sent);
+        *length -= sent;
+        return;
+    }
+
+    free(*buffer);
+    *buffer   = NULL;
+    *length   = 0;
+    *capacity = 0;
+}
+
+/*
+    Drop 'sent' bytes written from the start of 'outbound'
+    and remember how much of the last frame they were in is
+    still to go. 'outboundLock' must be held.
+*/
+static void OutboundSentLocked(Connection* connection, size_t sent)
+{
+    size_t offset = 0;
+    size_t left   = connection->outboundPartial;
+    while (offset < sent)
+    {
+        if (left == 0) {
+            FrameHeader header;
+            if (FrameParse(connection->outbound + offset, connection->outboundLength - offset, &header) == 1)
+                left = sizeof(FrameHeader) + header.length;
+            else
+                left = connection->outboundLength - offset; // Not a frame. Finish it all
+        }
+
+        size_t taken = (left < sent - offset) ? left : sent - offset;
+        offset += taken;
+        left   -= taken;
+    }
+
+    connection->outboundPartial = left;
+    DropSent(&connection->outbound, &connection->outboundLength, &connection->outboundCapacity, sent);
+}
+
+/*
+    Write the half-written frame of 'outbound', then 'urgent',
+    then the rest of 'outbound', as far as the socket takes them.
+    'outboundLock' must be held.
+*/
+static int FlushLocked(Connection* connection)
+{
+    // Frames can't be cut in two so the one partly written goes first
+    if (connection->outboundPartial > 0) {
+        ssize_t written = SendAvailable(connection, connection->outbound, connection->outboundPartial);
+        if (written < 0)
+            return -1;
+
+        OutboundSentLocked(connection, (size_t)written);
+    }
+
+    if (connection->outboundPartial == 0 && connection->urgentLength > 0) {
+        ssize_t written = SendAvailable(connection, connection->urgent, connection->urgentLength);
+        if (written < 0)
+            return -1;
+
+        DropSent(&connection->urgent, &connection->urgentLength, &connection->urgentCapacity, (size_t)written);
+    }
+
+    if (connection->outboundPartial == 0 && connection->urgentLength == 0 && connection->outboundLength > 0) {
+        ssize_t written = SendAvailable(connection, connection->outbound, connection->outboundLength);
+        if (written < 0)
+            return -1;
+
+        OutboundSentLocked(connection, (size_t)written);
+    }
+
+    UpdateInterestLocked(connection);
+    return 0;
+}
+
+int ConnectionSend(Connection* connection, const void* data, size_t length, PriorityLane lane)
+{
+    const char* bytes  = (const char*)data;
+    size_t      offset = 0;
+
+    pthread_mutex_lock(&connection->outboundLock);
+
+    // Control frames only wait for other control frames and the frame on the wire
+    bool blocked = (lane == k_plControl)
+                 ? (connection->urgentLength > 0 || connection->outboundPartial > 0)
+                 : (connection->urgentLength > 0 || connection->outboundLength > 0);
+
+    // Nothing queued in front of us so try writing straight to the socket
+    if (!blocked) {
+        ssize_t sent = SendAvailable(connection, bytes, length);
+        if (sent < 0) {
+            pthread_mutex_unlock(&connection->outboundLock);
+            return -1;
+        }
+
+        offset = (size_t)sent;
+        if (offset == length) {
+            pthread_mutex_unlock(&connection->outboundLock);
+            return 0;
+        }
+    }
+
+    // Socket is full. Queue the rest until the reactor says it's writable
+    size_t  remaining = length - offset;
+    char**  buffer    = (lane == k_plControl) ? &connection->urgent : &connection->outbound;
+    size_t* queued    = (lane == k_plControl) ? &connection->urgentLength : &connection->outboundLength;
+    size_t* capacity  = (lane == k_plControl) ? &connection->urgentCapacity : &connection->outboundCapacity;
+    if (!ReserveBuffer(buffer, capacity, *queued + remaining)) {
+        pthread_mutex_unlock(&connection->outboundLock);
+        return -1;
+    }
+
+    // A control frame cut short is finished first since 'urgent' goes out before 'outbound'
+    memcpy(*buffer + *queued, bytes + offset, remaining);
+    *queued += remaining;
+
+    // The part of a chat frame not written is the rest of a partial frame
+    if (lane == k_plChat && offset > 0)
+        connection->outboundPartial = remaining;
+
+    UpdateInterestLocked(connection);
+
+    pthread_mutex_unlock(&connection->outboundLock);
+    return 0;
+}
+
+size_t ConnectionQueued(Connection* connection, PriorityLane lane)
+{
+    pthread_mutex_lock(&connection->outboundLock);
+    size_t queued = (lane == k_plControl) ? connection->urgentLength : connection->outboundLength;
+    pthread_mutex_unlock(&connection->outboundLock);
+
+    return queued;
+}
+
+int ConnectionFlush(Connection* connection)
+{
+    pthread_mutex_lock(&connection->outboundLock);
+    int result = FlushLocked(connection);
+    pthread_mutex_unlock(&connection->outboundLock);
+
+    return result;
+}
+
+void ConnectionDestroy(Connection* connection)
+{
+    ReactorRemove(connection->reactor, &connection->watch);
+    close(connection->fd);
+
+    pthread_mutex_destroy(&connection->outboundLock);
+    free(connection->inbound);
+    free(connection->outbound);
+    free(connection->urgent);
+    free(connection);
+}
@@ -63,4 +63,15 @@ void cpThreadJoin(cpthread threadInfo)
 	ErrorPrint(true, "Unsupported Platform", "This application is running on an unsupported platform");
 	ExitApp();
 #endif
+}
+
+void cpThreadDetach(cpthread threadInfo)
+{
+#ifdef _WIN32
+	// The thread keeps running after its handle is closed
+	if (threadInfo.winThreadHandle != NULL)
+		CloseHandle(threadInfo.winThreadHandle);
+#elif __unix__
+	pthread_detach(threadInfo.threadID);
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,299 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       dialer.c
+ * @brief      non-blocking connects raced over a list of endpoints
+ *
+ * @note
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#include "Headers/dialer.h"
+#include "Headers/ratelimit.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DIAL_NS_PER_MS 1000000ULL
+
+/*
+    A connect waiting to finish.
+*/
+typedef struct DialAttemptStr
+{
+    int          fd;        // Non-blocking socket connecting
+    unsigned int endpoint;  // Index of the endpoint it connects to
+    uint64_t     expiresAt; // MonotonicNs() it is given up at
+} DialAttempt;
+
+/*
+    Add 'address' to 'endpoints' unless it is there already.
+    Returns false if there is no room for it.
+*/
+static bool DialAddEndpoint(struct sockaddr_in address, struct sockaddr_in endpoints[DIAL_MAX_ENDPOINTS], unsigned int* count)
+{
+    for (unsigned int i = 0; i < *count; i++)
+    {
+        if (endpoints[i].sin_addr.s_addr == address.sin_addr.s_addr && endpoints[i].sin_port == address.sin_port)
+            return true;
+    }
+
+    if (*count == DIAL_MAX_ENDPOINTS)
+        return false;
+
+    endpoints[(*count)++] = address;
+    return true;
+}
+
+bool DialParseEndpoint(const char* text, unsigned short defaultPort,
+                       struct sockaddr_in endpoints[DIAL_MAX_ENDPOINTS], unsigned int* count)
+{
+    char        host[256] = {0};
+    const char* port      = strrchr(text, ':');
+    if (port != NULL) {
+        size_t hostLength = (size_t)(port - text);
+        if (hostLength == 0 || hostLength >= sizeof(host))
+            return false;
+
+        memcpy(host, text, hostLength);
+        port++;
+    }
+    else {
+        // Just a port, or just a host
+        size_t digits = strspn(text, "0123456789");
+        if (digits > 0 && text[digits] == '\0')
+            port = text;
+        else if (strlen(text) > 0 && strlen(text) < sizeof(host))
+            strcpy(host, text);
+        else
+            return false;
+    }
+
+    int number = (port != NULL) ? atoi(port) : defaultPort;
+    if (number <= 0 || number > 65535)
+        return false;
+
+    struct sockaddr_in address = {0};
+    address.sin_family         = AF_INET;
+    address.sin_port           = htons((unsigned short)number);
+    address.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+
+    if (host[0] == '\0' || inet_pton(AF_INET, host, &address.sin_addr) == 1)
+        return DialAddEndpoint(address, endpoints, count);
+
+    // Root only listens over IPv4
+    struct addrinfo  hints     = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo* addresses = NULL;
+    if (getaddrinfo(host, NULL, &hints, &addresses) != 0)
+        return false;
+
+    bool added = true;
+    for (struct addrinfo* at = addresses; at != NULL && added; at = at->ai_next)
+    {
+        address.sin_addr = ((struct sockaddr_in*)at->ai_addr)->sin_addr;
+        added = DialAddEndpoint(address, endpoints, count);
+    }
+
+    freeaddrinfo(addresses);
+    return added;
+}
+
+/*
+    Start connecting to 'endpoint' without waiting. Returns the
+    socket, or -1 with errno set if it failed right away.
+    '*connected' is true if it connected right away.
+*/
+static int DialStart(const struct sockaddr_in* endpoint, bool* connected)
+{
+    *connected = false;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    if (connect(fd, (const struct sockaddr*)endpoint, sizeof(struct sockaddr_in)) == 0)
+        *connected = true;
+    else if (errno != EINPROGRESS) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+    Wait 'ms' or until 'deadline', whichever is sooner.
+*/
+static void DialSleep(uint64_t ms, uint64_t deadline)
+{
+    uint64_t now = MonotonicNs();
+    if (now >= deadline)
+        return;
+
+    uint64_t ns = ms * DIAL_NS_PER_MS;
+    if (ns > deadline - now)
+        ns = deadline - now;
+
+    struct timespec wait = { .tv_sec = (time_t)(ns / 1000000000ULL), .tv_nsec = (long)(ns % 1000000000ULL) };
+    while (nanosleep(&wait, &wait) != 0 && errno == EINTR)
+        ;
+}
+
+/*
+    Race every endpoint once. Returns the connected socket,
+    or -1 once they all failed or 'deadline' passed.
+*/
+static int DialRound(const struct sockaddr_in* endpoints, unsigned int count, const DialPolicy* policy,
+                     uint64_t deadline, DialResult* result)
+{
+    DialAttempt  attempts[DIAL_MAX_ENDPOINTS];
+    unsigned int pending = 0;
+    unsigned int next    = 0;
+    uint64_t     startAt = MonotonicNs(); // When the next endpoint joins the race
+    int          winner  = -1;
+
+    while (winner < 0)
+    {
+        uint64_t now = MonotonicNs();
+        if (now >= deadline) {
+            for (unsigned int i = 0; i < pending; i++)
+                result->errors[attempts[i].endpoint] = ETIMEDOUT;
+            break;
+        }
+
+        // Next endpoint's turn, or nothing left to wait on
+        if (next < count && (pending == 0 || now >= startAt)) {
+            bool connected;
+            int  fd = DialStart(&endpoints[next], &connected);
+            if (fd < 0) {
+                result->errors[next++] = errno;
+                startAt = now;
+                continue;
+            }
+
+            if (connected) {
+                result->endpoint = next;
+                winner           = fd;
+                break;
+            }
+
+            attempts[pending++] = (DialAttempt){ .fd = fd, .endpoint = next++, .expiresAt = now + policy->attemptTimeoutMs * DIAL_NS_PER_MS };
+            startAt             = now + policy->staggerMs * DIAL_NS_PER_MS;
+            continue;
+        }
+
+        if (pending == 0)
+            break; // Every endpoint failed
+
+        // Sleep until a connect finishes, one expires, the next starts or time is up
+        uint64_t wakeAt = deadline;
+        if (next < count && startAt < wakeAt)
+            wakeAt = startAt;
+
+        struct pollfd watched[DIAL_MAX_ENDPOINTS];
+        for (unsigned int i = 0; i < pending; i++)
+        {
+            watched[i] = (struct pollfd){ .fd = attempts[i].fd, .events = POLLOUT };
+            if (attempts[i].expiresAt < wakeAt)
+                wakeAt = attempts[i].expiresAt;
+        }
+
+        int timeout = (wakeAt > now) ? (int)((wakeAt - now + DIAL_NS_PER_MS - 1) / DIAL_NS_PER_MS) : 0;
+        if (poll(watched, pending, timeout) < 0 && errno != EINTR)
+            break;
+
+        now = MonotonicNs();
+        for (unsigned int i = 0; i < pending; )
+        {
+            int error = 0;
+            if (watched[i].revents != 0) {
+                socklen_t size = sizeof(error);
+                if (getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, &error, &size) != 0)
+                    error = errno;
+
+                if (error == 0) {
+                    result->endpoint = attempts[i].endpoint;
+                    winner           = attempts[i].fd;
+                    attempts[i]      = attempts[--pending];
+                    break;
+                }
+            }
+            else if (now >= attempts[i].expiresAt)
+                error = ETIMEDOUT;
+
+            if (error == 0) {
+                i++;
+                continue;
+            }
+
+            // Gone. The next endpoint doesn't wait for its turn
+            result->errors[attempts[i].endpoint] = error;
+            close(attempts[i].fd);
+            attempts[i]    = attempts[--pending];
+            watched[i]     = watched[pending];
+            startAt        = now;
+        }
+    }
+
+    // Losers of the race
+    for (unsigned int i = 0; i < pending; i++)
+        close(attempts[i].fd);
+
+    return winner;
+}
+
+bool Dial(const struct sockaddr_in* endpoints, unsigned int count, const DialPolicy* policy, DialResult* result)
+{
+    memset(result, 0, sizeof(DialResult));
+    result->fd = -1;
+
+    if (count == 0 || count > DIAL_MAX_ENDPOINTS)
+        return false;
+
+    uint64_t     start    = MonotonicNs();
+    uint64_t     deadline = start + policy->deadlineMs * DIAL_NS_PER_MS;
+    unsigned int seed     = (unsigned int)(start ^ (uint64_t)getpid());
+    uint64_t     backoff  = policy->backoffBaseMs;
+
+    while (result->rounds < policy->rounds && MonotonicNs() < deadline)
+    {
+        if (result->rounds > 0) {
+            // Clients that lost root together don't all come back at once
+            uint64_t wait = backoff / 2 + (backoff > 1 ? (uint64_t)rand_r(&seed) % (backoff - backoff / 2) : 0);
+            DialSleep(wait, deadline);
+
+            backoff = (backoff * 2 < policy->backoffMaxMs) ? backoff * 2 : policy->backoffMaxMs;
+        }
+
+        result->rounds++;
+        result->fd = DialRound(endpoints, count, policy, deadline, result);
+        if (result->fd >= 0)
+            break;
+    }
+
+    if (result->fd < 0)
+        return false;
+
+    // Everyone else uses it blocking
+    int flags = fcntl(result->fd, F_GETFL);
+    fcntl(result->fd, F_SETFL, flags & ~O_NONBLOCK);
+    return true;
+}
@@ -0,0 +1,838 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       fanout.c
+ * @brief      send one encoded frame to many sockets without copying it
+ *
+ * @note
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#include "Headers/fanout.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+SharedFrame* SharedFrameCreate(FrameWriter* writer)
+{
+    if (!FrameFinish(writer))
+        return NULL;
+
+    SharedFrame* frame = malloc(sizeof(SharedFrame));
+    if (frame == NULL)
+        return NULL;
+
+    // The frame takes over the memory so nothing is copied
+    frame->references = 1;
+    frame->length     = writer->length;
+    frame->data       = writer->data;
+    memset(writer, 0, sizeof(FrameWriter));
+
+    return frame;
+}
+
+SharedFrame* SharedFrameRetain(SharedFrame* frame)
+{
+    __atomic_add_fetch(&frame->references, 1, __ATOMIC_RELAXED);
+    return frame;
+}
+
+void SharedFrameRelease(SharedFrame* frame)
+{
+    if (frame == NULL)
+        return;
+
+    if (__atomic_sub_fetch(&frame->references, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(frame->data);
+        free(frame);
+    }
+}
+
+int FanOutWrite(int fd, SharedFrame** frames, int frameCount)
+{
+    if (frameCount > FANOUT_MAX_FRAMES)
+        return -1;
+
+    struct iovec parts[FANOUT_MAX_FRAMES];
+    for (int i = 0; i < frameCount; i++)
+    {
+        parts[i].iov_base = frames[i]->data;
+        parts[i].iov_len  = frames[i]->length;
+    }
+
+    struct msghdr message = {0};
+    message.msg_iov    = parts;
+    message.msg_iovlen = (size_t)frameCount;
+
+    while (message.msg_iovlen > 0)
+    {
+        ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return -1;
+
+        // Skip what went out. The socket can take part of a frame
+        while (message.msg_iovlen > 0 && (size_t)sent >= message.msg_iov->iov_len)
+        {
+            sent -= (ssize_t)message.msg_iov->iov_len;
+            message.msg_iov++;
+            message.msg_iovlen--;
+        }
+
+        if (message.msg_iovlen > 0) {
+            message.msg_iov->iov_base = (char*)message.msg_iov->iov_base + sent;
+            message.msg_iov->iov_len -= (size_t)sent;
+        }
+    }
+
+    return 0;
+}
+
+int FanOut(SharedFrame* frame, const int* fds, int fdCount)
+{
+    int delivered = 0;
+    for (int i = 0; i < fdCount; i++)
+    {
+        if (FanOutWrite(fds[i], &frame, 1) == 0)
+            delivered++;
+    }
+
+    return delivered;
+}
+
+/*
+    Every lane of every queue together. Changed atomically.
+*/
+static OutboundLaneMetrics laneMetrics[PRIORITY_LANES];
+
+/*
+    Drop the frame at the head of 'lane'.
+    'lock' must be held.
+*/
+static void PopHeadLocked(OutboundQueue* queue, PriorityLane lane)
+{
+    OutboundLane* ring = &queue->lanes[lane];
+
+    SharedFrameRelease(ring->frames[ring->head]);
+    ring->frames[ring->head] = NULL;
+    ring->head               = (ring->head + 1) % ring->capacity;
+    ring->count--;
+
+    // The partly sent frame is always at the head of its lane
+    if (queue->headLane == lane)
+        queue->headSent = 0;
+
+    __atomic_sub_fetch(&laneMetrics[lane].depth, 1, __ATOMIC_RELAXED);
+}
+
+/*
+    Frames queued in every lane. 'lock' must be held.
+*/
+static unsigned int QueuedLocked(OutboundQueue* queue)
+{
+    unsigned int count = 0;
+    for (int lane = 0; lane < PRIORITY_LANES; lane++)
+        count += queue->lanes[lane].count;
+
+    return count;
+}
+
+/*
+    Put up to 'maxFrames' queued frames in 'frames' in the
+    order they go out, and the lane of each in 'lanes'.
+    A frame partly sent is finished first, then control
+    frames go ahead of chat frames. 'lock' must be held.
+    Returns how many were put.
+*/
+static unsigned int WireOrderLocked(OutboundQueue* queue, SharedFrame** frames, PriorityLane* lanes, unsigned int maxFrames)
+{
+    unsigned int frameCount = 0;
+
+    if (queue->headSent > 0) {
+        OutboundLane* ring = &queue->lanes[queue->headLane];
+        frames[0] = ring->frames[ring->head];
+        lanes[0]  = queue->headLane;
+        frameCount++;
+    }
+
+    for (int lane = 0; lane < PRIORITY_LANES; lane++)
+    {
+        OutboundLane* ring  = &queue->lanes[lane];
+        unsigned int  first = (queue->headSent > 0 && queue->headLane == (PriorityLane)lane) ? 1 : 0;
+        for (unsigned int i = first; i < ring->count && frameCount < maxFrames; i++)
+        {
+            frames[frameCount] = ring->frames[(ring->head + i) % ring->capacity];
+            lanes[frameCount]  = (PriorityLane)lane;
+            frameCount++;
+        }
+    }
+
+    return frameCount;
+}
+
+/*
+    Only ask the reactor for write readiness while
+    there is something to do. 'lock' must be held.
+*/
+static void UpdateInterestLocked(OutboundQueue* queue)
+{
+    if (!queue->registered)
+        return;
+
+    // A send on the way says itself when it's done
+    bool         waiting = !queue->sending && (QueuedLocked(queue) > 0 || queue->closing || queue->broken);
+    unsigned int wanted  = waiting ? REACTOR_WRITE : 0;
+    if (wanted != queue->watch.events)
+        ReactorModify(queue->reactor, &queue->watch, wanted);
+}
+
+/*
+    Give up on the socket. Queued frames are dropped and
+    a thread blocked reading it is woken. 'lock' must be held.
+*/
+static void BreakLocked(OutboundQueue* queue)
+{
+    if (!queue->broken)
+        shutdown(queue->fd, SHUT_RDWR);
+
+    queue->broken = true;
+    for (int lane = 0; lane < PRIORITY_LANES; lane++)
+    {
+        while (queue->lanes[lane].count > 0)
+            PopHeadLocked(queue, (PriorityLane)lane);
+
+        queue->lanes[lane].queuedBytes = 0;
+    }
+}
+
+/*
+    Release the frames 'sent' bytes went out in.
+    'lanes' are the lanes of the frames that were
+    written, in wire order. The socket can take part
+    of one. 'lock' must be held.
+*/
+static void AdvanceLocked(OutboundQueue* queue, size_t sent, const PriorityLane* lanes, unsigned int frameCount)
+{
+    for (unsigned int i = 0; i < frameCount && sent > 0; i++)
+    {
+        OutboundLane* ring   = &queue->lanes[lanes[i]];
+        size_t        skip   = (i == 0) ? queue->headSent : 0;
+        size_t        unsent = ring->frames[ring->head]->length - skip;
+        if (sent < unsent) {
+            ring->queuedBytes -= sent;
+            queue->headSent    = skip + sent;
+            queue->headLane    = lanes[i];
+            break;
+        }
+
+        sent              -= unsent;
+        ring->queuedBytes -= unsent;
+        __atomic_add_fetch(&laneMetrics[lanes[i]].sent, 1, __ATOMIC_RELAXED);
+        PopHeadLocked(queue, lanes[i]);
+    }
+}
+
+static void OutboundQueueSent(Reactor* reactor, int result, void* context);
+
+/*
+    Hand the frames at the head of the queue to the
+    reactor as one send. 'lock' must be held.
+    Returns 0 if a send is on the way and -1 if
+    the reactor couldn't take it.
+*/
+static int QueueSendLocked(OutboundQueue* queue)
+{
+    if (queue->sending || QueuedLocked(queue) == 0)
+        return 0;
+
+    unsigned int partCount = WireOrderLocked(queue, queue->sendFrames, queue->sendLanes, OUTBOUND_SEND_FRAMES);
+    for (unsigned int i = 0; i < partCount; i++)
+    {
+        SharedFrame* frame = queue->sendFrames[i];
+        size_t       skip  = (i == 0) ? queue->headSent : 0;
+
+        // Kept alive for the kernel even if the queue lets go of it
+        SharedFrameRetain(frame);
+        queue->sendParts[i].iov_base = frame->data + skip;
+        queue->sendParts[i].iov_len  = frame->length - skip;
+    }
+
+    memset(&queue->sendMessage, 0, sizeof(struct msghdr));
+    queue->sendMessage.msg_iov     = queue->sendParts;
+    queue->sendMessage.msg_iovlen  = partCount;
+    queue->sendOperation.complete = OutboundQueueSent;
+    queue->sendOperation.context  = (void*)queue;
+
+    if (ReactorSendMessage(queue->reactor, &queue->sendOperation, queue->fd, &queue->sendMessage, MSG_NOSIGNAL | MSG_DONTWAIT) != 0) {
+        for (unsigned int i = 0; i < partCount; i++)
+            SharedFrameRelease(queue->sendFrames[i]);
+        return -1;
+    }
+
+    // Pinned at the head of their lanes until it completes
+    for (unsigned int i = 0; i < partCount; i++)
+        queue->lanes[queue->sendLanes[i]].sending++;
+
+    OutboundQueueRetain(queue);
+    queue->sending       = true;
+    queue->sendingFrames = partCount;
+    return 0;
+}
+
+/*
+    Write as much of the queue as the socket takes
+    right now, or hand it to the reactor if it takes
+    sends. 'lock' must be held.
+    Returns 0 on success and -1 if the socket failed.
+*/
+static int FlushLocked(OutboundQueue* queue)
+{
+    // Goes to the kernel together with the sends of other queues
+    if (ReactorQueuesSends(queue->reactor) && QueueSendLocked(queue) == 0)
+        return 0;
+
+    while (QueuedLocked(queue) > 0)
+    {
+        // Everything queued goes out in one vectored write
+        SharedFrame* frames[FANOUT_MAX_FRAMES];
+        PriorityLane lanes[FANOUT_MAX_FRAMES];
+        struct iovec parts[FANOUT_MAX_FRAMES];
+        unsigned int partCount = WireOrderLocked(queue, frames, lanes, FANOUT_MAX_FRAMES);
+        for (unsigned int i = 0; i < partCount; i++)
+        {
+            size_t skip = (i == 0) ? queue->headSent : 0;
+            parts[i].iov_base = frames[i]->data + skip;
+            parts[i].iov_len  = frames[i]->length - skip;
+        }
+
+        struct msghdr message = {0};
+        message.msg_iov    = parts;
+        message.msg_iovlen = partCount;
+
+        ReactorCountSyscall(queue->reactor);
+        ssize_t sent = sendmsg(queue->fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+
+        AdvanceLocked(queue, (size_t)sent, lanes, partCount);
+    }
+
+    return 0;
+}
+
+/*
+    Count a frame of 'lane' that was never sent.
+    'lock' must be held.
+*/
+static void CountDroppedLocked(OutboundQueue* queue, PriorityLane lane)
+{
+    queue->lanes[lane].dropped++;
+    __atomic_add_fetch(&laneMetrics[lane].dropped, 1, __ATOMIC_RELAXED);
+}
+
+/*
+    Drop the oldest frame of 'lane' that hasn't started going
+    out. Returns false if there is no such frame. 'lock' must be held.
+*/
+static bool DropOldestLocked(OutboundQueue* queue, PriorityLane lane)
+{
+    OutboundLane* ring = &queue->lanes[lane];
+
+    // Half a frame or frames in a send on the way can't be taken back
+    unsigned int pinned = queue->sending ? ring->sending : ((queue->headSent > 0 && queue->headLane == lane) ? 1 : 0);
+    if (ring->count <= pinned)
+        return false;
+
+    unsigned int victim = (ring->head + pinned) % ring->capacity;
+    ring->queuedBytes  -= ring->frames[victim]->length;
+    CountDroppedLocked(queue, lane);
+
+    if (pinned == 0) {
+        PopHeadLocked(queue, lane);
+        return true;
+    }
+
+    // Drop the first one after them and move them up into its place
+    SharedFrameRelease(ring->frames[victim]);
+    for (unsigned int i = pinned; i > 0; i--)
+        ring->frames[(ring->head + i) % ring->capacity] = ring->frames[(ring->head + i - 1) % ring->capacity];
+
+    ring->frames[ring->head] = NULL;
+    ring->head = (ring->head + 1) % ring->capacity;
+    ring->count--;
+    __atomic_sub_fetch(&laneMetrics[lane].depth, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/*
+    Hang up once the queue is done with the socket,
+    otherwise only ask the reactor for what is still
+    needed. 'lock' must be held.
+    Returns true if the reactor let go of the queue and
+    its reference has to be released.
+*/
+static bool SettleLocked(OutboundQueue* queue)
+{
+    if (queue->lanes[k_plChat].count == 0)
+        queue->lagging = false; // Caught up
+
+    bool finished = queue->registered && !queue->sending && (queue->broken || (queue->closing && QueuedLocked(queue) == 0));
+    if (!finished) {
+        UpdateInterestLocked(queue);
+        return false;
+    }
+
+    if (!queue->broken)
+        shutdown(queue->fd, SHUT_WR);
+
+    queue->registered = false;
+    ReactorRemove(queue->reactor, &queue->watch);
+    return true;
+}
+
+/**
+ * @brief           Account for a send handed to the reactor once it is done
+ * @param[in]       reactor: event loop the send was made on
+ * @param[in]       result:  bytes sent or -errno
+ * @param[in]       context: the OutboundQueue
+ * @return          void
+ */
+static void OutboundQueueSent(Reactor* reactor, int result, void* context)
+{
+    OutboundQueue* queue = (OutboundQueue*)context;
+
+    pthread_mutex_lock(&queue->lock);
+    unsigned int frameCount = queue->sendingFrames;
+    for (unsigned int i = 0; i < frameCount; i++)
+        SharedFrameRelease(queue->sendFrames[i]);
+
+    for (int lane = 0; lane < PRIORITY_LANES; lane++)
+        queue->lanes[lane].sending = 0;
+
+    queue->sending       = false;
+    queue->sendingFrames = 0;
+
+    if (queue->broken)
+        ; // Everything queued was already dropped
+    else if (result > 0) {
+        AdvanceLocked(queue, (size_t)result, queue->sendLanes, frameCount);
+        if (FlushLocked(queue) != 0)
+            BreakLocked(queue);
+    }
+    else if (result != 0 && result != -EAGAIN && result != -EWOULDBLOCK && result != -EINTR)
+        BreakLocked(queue);
+
+    // Socket full means the reactor is asked to say when it's writable
+    bool finished = SettleLocked(queue);
+    pthread_mutex_unlock(&queue->lock);
+
+    if (finished)
+        OutboundQueueRelease(queue);
+
+    // The send's own reference
+    OutboundQueueRelease(queue);
+}
+
+/**
+ * @brief           Flush a queue once its socket is writable
+ * @param[in]       reactor: event loop the queue is registered on
+ * @param[in]       events:  ready events of the socket
+ * @param[in]       context: the OutboundQueue
+ * @return          void
+ */
+static void OutboundQueueHandleEvent(Reactor* reactor, unsigned int events, void* context)
+{
+    OutboundQueue* queue = (OutboundQueue*)context;
+
+    pthread_mutex_lock(&queue->lock);
+    if ((events & (EPOLLERR | EPOLLHUP)) || FlushLocked(queue) != 0)
+        BreakLocked(queue);
+
+    bool finished = SettleLocked(queue);
+    pthread_mutex_unlock(&queue->lock);
+
+    // Reactor is done with it
+    if (finished)
+        OutboundQueueRelease(queue);
+}
+
+OutboundQueue* OutboundQueueCreate(Reactor* reactor, int fd, OverflowPolicy policy)
+{
+    OutboundQueue* queue = calloc(1, sizeof(OutboundQueue));
+    if (queue == NULL)
+        return NULL;
+
+    // One reference for the caller and one for the reactor
+    queue->references    = 2;
+    queue->reactor       = reactor;
+    queue->fd            = fd;
+    queue->policy        = policy;
+    queue->registered    = true;
+    queue->watch.fd      = fd;
+    queue->watch.events  = 0; // Nothing to write yet
+    queue->watch.handler = OutboundQueueHandleEvent;
+    queue->watch.context = (void*)queue;
+    pthread_mutex_init(&queue->lock, NULL);
+
+    queue->lanes[k_plControl].frames   = queue->controlFrames;
+    queue->lanes[k_plControl].capacity = OUTBOUND_CONTROL_FRAMES;
+    queue->lanes[k_plChat].frames      = queue->chatFrames;
+    queue->lanes[k_plChat].capacity    = OUTBOUND_QUEUE_FRAMES;
+
+    if (ReactorAdd(reactor, &queue->watch) != 0) {
+        pthread_mutex_destroy(&queue->lock);
+        free(queue);
+        return NULL;
+    }
+
+    return queue;
+}
+
+OutboundQueue* OutboundQueueRetain(OutboundQueue* queue)
+{
+    __atomic_add_fetch(&queue->references, 1, __ATOMIC_RELAXED);
+    return queue;
+}
+
+void OutboundQueueRelease(OutboundQueue* queue)
+{
+    if (queue == NULL)
+        return;
+
+    if (__atomic_sub_fetch(&queue->references, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    for (int lane = 0; lane < PRIORITY_LANES; lane++)
+    {
+        while (queue->lanes[lane].count > 0)
+            PopHeadLocked(queue, (PriorityLane)lane);
+    }
+
+    pthread_mutex_destroy(&queue->lock);
+    close(queue->fd);
+    free(queue);
+}
+
+/*
+    Queue a reference to 'frame' in 'lane' without sending
+    anything. 'lock' must be held. Returns 0 if it was queued
+    and -1 if it was dropped.
+*/
+static int EnqueueLocked(OutboundQueue* queue, SharedFrame* frame, PriorityLane lane)
+{
+    OutboundLane* ring = &queue->lanes[lane];
+
+    if (queue->closing || queue->broken)
+        return -1;
+
+    // Lagging readers still get control frames
+    if (queue->lagging && lane == k_plChat) {
+        CountDroppedLocked(queue, lane);
+        return -1;
+    }
+
+    while (ring->count > 0
+           && (ring->count == ring->capacity || (lane == k_plChat && ring->queuedBytes + frame->length > OUTBOUND_QUEUE_BYTES)))
+    {
+        if (queue->policy == k_opDropOldest && DropOldestLocked(queue, lane))
+            continue;
+
+        if (queue->policy == k_opDisconnect)
+            BreakLocked(queue);
+        else if (queue->policy == k_opMarkLagging && lane == k_plChat)
+            queue->lagging = true;
+
+        CountDroppedLocked(queue, lane);
+        return -1;
+    }
+
+    ring->frames[(ring->head + ring->count) % ring->capacity] = SharedFrameRetain(frame);
+    ring->count++;
+    ring->queuedBytes += frame->length;
+
+    OutboundLaneMetrics* metrics = &laneMetrics[lane];
+    uint64_t             depth   = __atomic_add_fetch(&metrics->depth, 1, __ATOMIC_RELAXED);
+    uint64_t             deepest = __atomic_load_n(&metrics->maxDepth, __ATOMIC_RELAXED);
+    while (depth > deepest && !__atomic_compare_exchange_n(&metrics->maxDepth, &deepest, depth, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+
+    __atomic_add_fetch(&metrics->pushed, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/*
+    OutboundQueuePushBatch() without handing sends
+    queued on the reactor to the kernel yet.
+*/
+static int PushBatchUnsubmitted(OutboundQueue* queue, SharedFrame** frames, int frameCount, PriorityLane lane)
+{
+    int queued = 0;
+
+    pthread_mutex_lock(&queue->lock);
+    bool idle = (QueuedLocked(queue) == 0);
+    if (queue->ordered)
+        lane = k_plChat;
+
+    for (int i = 0; i < frameCount; i++)
+    {
+        if (EnqueueLocked(queue, frames[i], lane) == 0)
+            queued++;
+    }
+
+    // Nothing was waiting in front of them so they can go out right away
+    if (idle && QueuedLocked(queue) > 0 && FlushLocked(queue) != 0) {
+        BreakLocked(queue);
+        queued = 0;
+    }
+
+    UpdateInterestLocked(queue);
+    pthread_mutex_unlock(&queue->lock);
+    return queued;
+}
+
+int OutboundQueuePushBatch(OutboundQueue* queue, SharedFrame** frames, int frameCount, PriorityLane lane)
+{
+    int queued = PushBatchUnsubmitted(queue, frames, frameCount, lane);
+    ReactorSubmit(queue->reactor);
+    return queued;
+}
+
+int OutboundQueuePush(OutboundQueue* queue, SharedFrame* frame, PriorityLane lane)
+{
+    return (OutboundQueuePushBatch(queue, &frame, 1, lane) == 1) ? 0 : -1;
+}
+
+void OutboundQueueClose(OutboundQueue* queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    if (!queue->closing && !queue->broken)
+        shutdown(queue->fd, SHUT_RD);
+
+    // The reactor hangs up once the rest is sent
+    queue->closing = true;
+    UpdateInterestLocked(queue);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void OutboundQueueKeepOrder(OutboundQueue* queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->ordered = true;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+bool OutboundQueueLagging(OutboundQueue* queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    bool lagging = queue->lagging;
+    pthread_mutex_unlock(&queue->lock);
+
+    return lagging;
+}
+
+int FanOutQueued(SharedFrame* frame, OutboundQueue** queues, int queueCount, PriorityLane lane)
+{
+    int delivered = 0;
+    for (int i = 0; i < queueCount; i++)
+    {
+        if (PushBatchUnsubmitted(queues[i], &frame, 1, lane) == 1)
+            delivered++;
+    }
+
+    // Every send queued above goes to the kernel at once
+    for (int i = 0; i < queueCount; i++)
+    {
+        if (i == 0 || queues[i]->reactor != queues[i - 1]->reactor)
+            ReactorSubmit(queues[i]->reactor);
+    }
+
+    return delivered;
+}
+
+void OutboundLaneGetMetrics(OutboundLaneMetrics metrics[PRIORITY_LANES])
+{
+    for (int lane = 0; lane < PRIORITY_LANES; lane++)
+    {
+        metrics[lane].depth    = __atomic_load_n(&laneMetrics[lane].depth, __ATOMIC_RELAXED);
+        metrics[lane].maxDepth = __atomic_load_n(&laneMetrics[lane].maxDepth, __ATOMIC_RELAXED);
+        metrics[lane].pushed   = __atomic_load_n(&laneMetrics[lane].pushed, __ATOMIC_RELAXED);
+        metrics[lane].sent     = __atomic_load_n(&laneMetrics[lane].sent, __ATOMIC_RELAXED);
+        metrics[lane].dropped  = __atomic_load_n(&laneMetrics[lane].dropped, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+    Frame on the way to the queues of one partition of a list.
+*/
+typedef struct FanOutJobStr
+{
+    SharedFrame* frame;     // What to push. The job holds a reference
+    FanOutList*  list;      // Who to push it to. The job holds a reference
+    PriorityLane lane;      // Lane to push it in
+    unsigned int partition; // Part of 'list' to push to
+} FanOutJob;
+
+/*
+    Partition thread job. Push the frame of a FanOutJob
+    to the queues of its partition and free the job.
+*/
+static void FanOutRunJob(void* argument)
+{
+    FanOutJob*   job   = (FanOutJob*)argument;
+    unsigned int first = job->list->starts[job->partition];
+    unsigned int end   = job->list->starts[job->partition + 1];
+
+    FanOutQueued(job->frame, job->list->queues + first, (int)(end - first), job->lane);
+
+    SharedFrameRelease(job->frame);
+    FanOutListRelease(job->list);
+    free(job);
+}
+
+int FanOutPoolCreate(FanOutPool* pool, unsigned int partitions)
+{
+    memset(pool, 0, sizeof(FanOutPool));
+
+    if (partitions == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        partitions = (cores > 0) ? (unsigned int)cores : 1;
+    }
+
+    if (partitions > FANOUT_MAX_PARTITIONS)
+        partitions = FANOUT_MAX_PARTITIONS;
+
+    pool->partitions = calloc(partitions, sizeof(WorkPool));
+    if (pool->partitions == NULL)
+        return -1;
+
+    // One thread each so a partition's frames are pushed in the order they came
+    for (; pool->partitionCount < partitions; pool->partitionCount++)
+    {
+        if (WorkPoolCreate(&pool->partitions[pool->partitionCount], 1, FANOUT_PARTITION_JOBS) != 0) {
+            FanOutPoolDestroy(pool);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void FanOutPoolAssign(FanOutPool* pool, OutboundQueue* queue)
+{
+    unsigned int next = __atomic_fetch_add(&pool->nextPartition, 1, __ATOMIC_RELAXED);
+    queue->partition  = (pool->partitionCount > 0) ? next % pool->partitionCount : 0;
+}
+
+int FanOutPoolPush(FanOutPool* pool, SharedFrame* frame, FanOutList* list, PriorityLane lane)
+{
+    int handed = 0;
+    for (unsigned int partition = 0; partition < list->partitionCount; partition++)
+    {
+        unsigned int queued = list->starts[partition + 1] - list->starts[partition];
+        if (queued == 0)
+            continue;
+
+        FanOutJob* job = malloc(sizeof(FanOutJob));
+        if (job == NULL) {
+            __atomic_add_fetch(&pool->rejected, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        job->frame     = SharedFrameRetain(frame);
+        job->list      = FanOutListRetain(list);
+        job->lane      = lane;
+        job->partition = partition;
+
+        // Lists are grouped for the pool they are pushed with
+        if (partition >= pool->partitionCount || !WorkPoolSubmit(&pool->partitions[partition], FanOutRunJob, (void*)job)) {
+            __atomic_add_fetch(&pool->rejected, 1, __ATOMIC_RELAXED);
+            SharedFrameRelease(job->frame);
+            FanOutListRelease(job->list);
+            free(job);
+            continue;
+        }
+
+        handed += (int)queued;
+    }
+
+    return handed;
+}
+
+void FanOutPoolDestroy(FanOutPool* pool)
+{
+    for (unsigned int i = 0; i < pool->partitionCount; i++)
+        WorkPoolDestroy(&pool->partitions[i]);
+
+    free(pool->partitions);
+    memset(pool, 0, sizeof(FanOutPool));
+}
+
+FanOutList* FanOutListCreate(OutboundQueue** queues, unsigned int queueCount, unsigned int partitionCount)
+{
+    if (partitionCount == 0)
+        partitionCount = 1;
+
+    if (partitionCount > FANOUT_MAX_PARTITIONS)
+        partitionCount = FANOUT_MAX_PARTITIONS;
+
+    FanOutList* list = malloc(sizeof(FanOutList) + queueCount * sizeof(OutboundQueue*));
+    if (list == NULL)
+        return NULL;
+
+    list->references     = 1;
+    list->count          = queueCount;
+    list->partitionCount = partitionCount;
+    memset(list->starts, 0, sizeof(list->starts));
+
+    // Counting sort. Count every partition, then place each queue after the ones before it
+    for (unsigned int i = 0; i < queueCount; i++)
+        list->starts[queues[i]->partition % partitionCount + 1]++;
+
+    for (unsigned int partition = 0; partition < partitionCount; partition++)
+        list->starts[partition + 1] += list->starts[partition];
+
+    unsigned int placed[FANOUT_MAX_PARTITIONS];
+    memcpy(placed, list->starts, sizeof(placed));
+    for (unsigned int i = 0; i < queueCount; i++)
+        list->queues[placed[queues[i]->partition % partitionCount]++] = OutboundQueueRetain(queues[i]);
+
+    return list;
+}
+
+FanOutList* FanOutListRetain(FanOutList* list)
+{
+    __atomic_add_fetch(&list->references, 1, __ATOMIC_RELAXED);
+    return list;
+}
+
+void FanOutListRelease(FanOutList* list)
+{
+    if (list == NULL)
+        return;
+
+    if (__atomic_sub_fetch(&list->references, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    for (unsigned int i = 0; i < list->count; i++)
+        OutboundQueueRelease(list->queues[i]);
+
+    free(list);
+}
@@ -0,0 +1,227 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       hashmap.c
+ * @brief      open addressing hash map used by the root server registries
+ *
+ * @note
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#include "Headers/hashmap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define HASHMAP_MIN_CAPACITY 16
+
+/*
+    Scramble the bits of a 64-bit number
+    so nearby ids land in far apart slots. (splitmix64)
+*/
+static uint64_t MixBits(uint64_t value)
+{
+    value ^= value >> 30;
+    value *= 0xBF58476D1CE4E5B9ULL;
+    value ^= value >> 27;
+    value *= 0x94D049BB133111EBULL;
+    value ^= value >> 31;
+    return value;
+}
+
+/*
+    FNV-1a hash of a string
+*/
+static uint64_t HashString(const char* key)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (const unsigned char* c = (const unsigned char*)key; *c; c++)
+    {
+        hash ^= *c;
+        hash *= 0x100000001B3ULL;
+    }
+    return MixBits(hash);
+}
+
+static bool EntryMatches(HashMapEntry* entry, uint64_t hash, uint64_t id, const char* key)
+{
+    if (!entry->used || entry->hash != hash)
+        return false;
+
+    if (key != NULL)
+        return strcmp(entry->key, key) == 0;
+
+    return entry->id == id;
+}
+
+/*
+    Index of the entry matching the key, or of the
+    empty slot the key would be inserted into.
+*/
+static size_t FindSlot(HashMap* map, uint64_t hash, uint64_t id, const char* key)
+{
+    size_t mask  = map->capacity - 1;
+    size_t index = (size_t)hash & mask;
+
+    while (map->entries[index].used)
+    {
+        if (EntryMatches(&map->entries[index], hash, id, key))
+            return index;
+
+        index = (index + 1) & mask;
+    }
+
+    return index;
+}
+
+static bool Resize(HashMap* map, size_t newCapacity)
+{
+    HashMapEntry* newEntries = calloc(newCapacity, sizeof(HashMapEntry));
+    if (newEntries == NULL)
+        return false;
+
+    HashMapEntry* oldEntries  = map->entries;
+    size_t        oldCapacity = map->capacity;
+
+    map->entries  = newEntries;
+    map->capacity = newCapacity;
+
+    // Re-insert every entry into its slot in the bigger table
+    for (size_t i = 0; i < oldCapacity; i++)
+    {
+        if (!oldEntries[i].used)
+            continue;
+
+        size_t mask  = newCapacity - 1;
+        size_t index = (size_t)oldEntries[i].hash & mask;
+        while (newEntries[index].used)
+            index = (index + 1) & mask;
+
+        newEntries[index] = oldEntries[i];
+    }
+
+    free(oldEntries);
+    return true;
+}
+
+static void* Get(HashMap* map, uint64_t hash, uint64_t id, const char* key)
+{
+    if (map->count == 0)
+        return NULL;
+
+    HashMapEntry* entry = &map->entries[FindSlot(map, hash, id, key)];
+    return entry->used ? entry->value : NULL;
+}
+
+static bool Put(HashMap* map, uint64_t hash, uint64_t id, const char* key, void* value)
+{
+    // Keep the load under 3/4 so probe chains stay short
+    if ((map->count + 1) * 4 > map->capacity * 3 && !Resize(map, map->capacity * 2))
+        return false;
+
+    HashMapEntry* entry = &map->entries[FindSlot(map, hash, id, key)];
+    if (!entry->used)
+        map->count++;
+
+    entry->used  = true;
+    entry->hash  = hash;
+    entry->id    = id;
+    entry->key   = key;
+    entry->value = value;
+    return true;
+}
+
+static void* Remove(HashMap* map, uint64_t hash, uint64_t id, const char* key)
+{
+    if (map->count == 0)
+        return NULL;
+
+    size_t mask = map->capacity - 1;
+    size_t hole = FindSlot(map, hash, id, key);
+    if (!map->entries[hole].used)
+        return NULL;
+
+    void* value = map->entries[hole].value;
+
+    /*
+        Backward shift deletion. Move every following entry
+        of the probe chain that could live in the hole into it,
+        so lookups never have to skip over deleted slots.
+    */
+    size_t next = hole;
+    while (1)
+    {
+        next = (next + 1) & mask;
+        if (!map->entries[next].used)
+            break;
+
+        size_t home = (size_t)map->entries[next].hash & mask;
+        bool   canMove = (hole <= next) ? (home <= hole || home > next)
+                                        : (home <= hole && home > next);
+        if (canMove) {
+            map->entries[hole] = map->entries[next];
+            hole = next;
+        }
+    }
+
+    memset(&map->entries[hole], 0, sizeof(HashMapEntry));
+    map->count--;
+    return value;
+}
+
+bool HashMapInit(HashMap* map, size_t expectedEntries)
+{
+    size_t capacity = HASHMAP_MIN_CAPACITY;
+    while (capacity * 3 < expectedEntries * 4)
+        capacity *= 2;
+
+    map->entries  = calloc(capacity, sizeof(HashMapEntry));
+    map->capacity = capacity;
+    map->count    = 0;
+
+    return map->entries != NULL;
+}
+
+void HashMapFree(HashMap* map)
+{
+    free(map->entries);
+    memset(map, 0, sizeof(HashMap));
+}
+
+void* HashMapGet(HashMap* map, const char* key)
+{
+    return Get(map, HashString(key), 0, key);
+}
+
+bool HashMapPut(HashMap* map, const char* key, void* value)
+{
+    return Put(map, HashString(key), 0, key, value);
+}
+
+void* HashMapRemove(HashMap* map, const char* key)
+{
+    return Remove(map, HashString(key), 0, key);
+}
+
+void* HashMapGetId(HashMap* map, uint64_t id)
+{
+    return Get(map, MixBits(id), id, NULL);
+}
+
+bool HashMapPutId(HashMap* map, uint64_t id, void* value)
+{
+    return Put(map, MixBits(id), id, NULL, value);
+}
+
+void* HashMapRemoveId(HashMap* map, uint64_t id)
+{
+    return Remove(map, MixBits(id), id, NULL);
+}
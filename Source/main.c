@@ -1,6 +1,5 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <signal.h>
 #include "Headers/server.h"
 #include "Headers/client.h"
 
@@ -13,8 +12,20 @@
     Connect to the root server.
     Load user interface for client
 */
-int main() 
+int main(int argc, char** argv) 
 {
+    /*
+        Where root can be reached. Usage: ./main [host:port | host | port ...]
+        Raced against each other, first to answer is joined
+    */
+    for (int i = 1; i < argc; i++)
+    {
+        if (!AddRootEndpoint(argv[i])) {
+            printf("Can't use '%s' as a root server. Give host:port, host or port (at most %d addresses)\n", argv[i], DIAL_MAX_ENDPOINTS);
+            return -1;
+        }
+    }
+
     /*
         Setup base client struct.
         Allocate memory and assign a default username
@@ -28,14 +39,19 @@ int main()
     localClient->cfd = -99;
     localClient->rfd = -99;
 
-    /* 
-        Connect interrupted terminal input (i.e Ctrl+C) 
-        to DisconnectClient() to make sure client gets
-        safely disconnected and resources are freed
+    /*
+        Ctrl+C ends the app right away until the client loop
+        starts. Root lets go of a client whose socket closes.
+        The loop catches it from then on and disconnects itself,
+        see RunClientLoop()
     */
-    signal(SIGINT, DisconnectClient);
-    signal(SIGTERM, DisconnectClient);
     
+    /*
+        The client loop reads stdin itself once it starts.
+        Unbuffered, nothing typed ahead is left behind in stdio
+    */
+    setvbuf(stdin, NULL, _IONBF, 0);
+
     /* 
         Get the client to choose their username
     */
@@ -52,11 +68,10 @@ int main()
     }
 
     /*
-        Make a thread to load the client ui 
+        Load the client ui. Everything runs on
+        this thread from here until the client quits
     */
-    cpthread tinfo = cpThreadCreate(LoadClientUserInterface, NULL);
-    
-    cpThreadJoin(tinfo);
+    LoadClientUserInterface();
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,1238 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       main_bench.c
+ * @brief      load generator used to measure the root server
+ *
+ * @note       Usage: ./bench <clients> [root-pid]
+ *             Connects <clients> idle clients to the root server on
+ *             this machine and prints connections/sec. If the pid of the
+ *             root process is given, its memory use per client is printed too.
+ *
+ *             Usage: ./bench fanout <recipients> <messages> [epoll | io_uring | both] [threads]
+ *             Fans <messages> frames out to <recipients> local sockets through
+ *             outbound queues and prints messages/sec and the syscalls it took
+ *             with each reactor backend, or only the one given. If <threads>
+ *             is given the frames are pushed by a FanOutPool of that many
+ *             threads like large rooms do, otherwise by the sending thread.
+ *
+ *             Usage: ./bench room <members> <messages>
+ *             Makes a room on the root server on this machine, joins
+ *             <members> clients to it and has one of them say <messages>
+ *             messages, one after another. Prints how long joining took
+ *             and how long every message took to reach all members. The
+ *             root has to allow rooms that big and not rate limit the room.
+ *             e.g: ./root --backend io_uring --client-rate 0 --room-rate 0 --large-rooms 10000
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#include <endian.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/tcp.h>
+#include "Headers/root.h"
+#include "Headers/protocol.h"
+#include "Headers/fanout.h"
+#include "Headers/relay.h"
+
+/*
+    Body of each frame fanned out by the fan-out benchmark.
+*/
+#define BENCH_MESSAGE "the quick brown fox jumps over the lazy dog"
+
+/*
+    Readers give up once nothing arrived for this long.
+*/
+#define BENCH_STALL_MS 2000
+
+/*
+    Messages the fan-out benchmark sends ahead of the slowest
+    reader, like a client waiting on its peers. Half a queue so
+    the queues never overflow and every frame is delivered.
+*/
+#define BENCH_WINDOW (OUTBOUND_QUEUE_FRAMES / 2)
+
+/*
+    Room made by the room benchmark. Members joining at
+    once before their replies are waited for, and how many
+    times a member whose join was refused tries again.
+*/
+#define BENCH_ROOM_ALIAS    "benchroom"
+#define BENCH_JOIN_WINDOW   256
+#define BENCH_JOIN_ATTEMPTS 5
+
+/*
+    Limits of the relay trees made by the relay benchmark, and
+    how many times a relay just started is checked for listening
+    10 ms apart. Relays listen from RELAY_PORT on up.
+*/
+#define BENCH_MAX_DEPTH            8
+#define BENCH_MAX_RELAYS           64
+#define BENCH_RELAY_START_ATTEMPTS 200
+
+/*
+    Resident memory of a process in kilobytes
+    read from /proc. Returns -1 if it can't be read.
+*/
+static long ResidentKilobytes(int pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+
+    FILE* status = fopen(path, "r");
+    if (status == NULL)
+        return -1;
+
+    char line[256];
+    long rss = -1;
+    while (fgets(line, sizeof(line), status) != NULL)
+    {
+        if (sscanf(line, "VmRSS: %ld kB", &rss) == 1)
+            break;
+    }
+
+    fclose(status);
+    return rss;
+}
+
+static double Seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/*
+    Open a socket to the root server on 'port', ROOT_PORT or
+    a proxy in front of it, and join with a generated handle.
+    Returns the socket or -1.
+*/
+static int JoinRoot(int index, unsigned short port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    // Like the client, so pipelined requests aren't held back
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    char handle[kMaxClientHandleLength + 1];
+    snprintf(handle, sizeof(handle), "bench%d", index);
+
+    FrameWriter join = {0};
+    FrameBegin(&join, k_fkRequest, k_cfConnectClientToServer, 1);
+    FramePutString(&join, handle);
+
+    FrameHeader header = {0};
+    char*       body   = NULL;
+    bool        joined = FrameFinish(&join) && FrameSend(fd, &join) == 0
+                         && FrameReceive(fd, &header, &body) == 0;
+
+    // Reply starts with the response code
+    FrameReader reader;
+    FrameReaderInit(&reader, body, header.length);
+    joined = joined && (ResponseCode)(int32_t)FrameGetU32(&reader) == k_rcRootOperationSuccessful;
+
+    FrameWriterFree(&join);
+    free(body);
+
+    if (!joined) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+    Read end of every recipient socket of the
+    fan-out benchmark and what arrived on them.
+*/
+typedef struct BenchReadersStr
+{
+    struct pollfd* sockets;  // Read ends
+    int            count;    // Amount of sockets
+    uint64_t       expected; // Bytes to wait for in total
+    uint64_t       received; // Bytes read so far
+    double         finished; // When the last byte arrived
+} BenchReaders;
+
+/**
+ * @brief           Drain every recipient socket until all bytes arrived or they stall
+ * @param[in]       context: the BenchReaders
+ * @return          void*
+ * @retval          NULL
+ */
+static void* BenchReadAll(void* context)
+{
+    BenchReaders* readers = (BenchReaders*)context;
+    char          chunk[65536];
+
+    while (readers->received < readers->expected)
+    {
+        int ready = poll(readers->sockets, (nfds_t)readers->count, BENCH_STALL_MS);
+        if (ready <= 0)
+            break;
+
+        for (int i = 0; i < readers->count; i++)
+        {
+            if (!(readers->sockets[i].revents & POLLIN))
+                continue;
+
+            ssize_t got = recv(readers->sockets[i].fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+            if (got > 0)
+                __atomic_add_fetch(&readers->received, (uint64_t)got, __ATOMIC_RELAXED);
+        }
+
+        readers->finished = Seconds();
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief           Run a reactor until the process exits
+ * @param[in]       context: the Reactor
+ * @return          void*
+ */
+static void* BenchRunReactor(void* context)
+{
+    ReactorRun((Reactor*)context);
+    return NULL;
+}
+
+/*
+    Fan 'messages' frames out to 'recipients' sockets through
+    OutboundQueues on a reactor using 'backend', then print
+    how fast they arrived and how many syscalls were made
+    on the sending side. Pushed by a FanOutPool of 'threads'
+    threads if it isn't 0. Returns 0 on success.
+*/
+static int BenchFanOut(ReactorBackend backend, int recipients, int messages, unsigned int threads)
+{
+    reactorBackend = backend;
+
+    // Outlives the benchmark since its thread is never stopped
+    Reactor* reactor = calloc(1, sizeof(Reactor));
+    if (reactor == NULL || ReactorCreate(reactor) != 0) {
+        printf("Failed to create the reactor. Error Code %i\n", errno);
+        return -1;
+    }
+
+    // Outlives the benchmark for the same reason
+    FanOutPool* pool = calloc(1, sizeof(FanOutPool));
+    if (pool == NULL || (threads > 0 && FanOutPoolCreate(pool, threads) != 0)) {
+        printf("Failed to start the fan-out threads. Error Code %i\n", errno);
+        return -1;
+    }
+
+    OutboundQueue** queues  = calloc((size_t)recipients, sizeof(OutboundQueue*));
+    BenchReaders    readers = {0};
+    readers.sockets         = calloc((size_t)recipients, sizeof(struct pollfd));
+    if (queues == NULL || readers.sockets == NULL)
+        return -1;
+
+    for (int i = 0; i < recipients; i++)
+    {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+            printf("Failed to make socket %d. Error Code %i\n", i, errno);
+            return -1;
+        }
+
+        // Deep enough that only readers falling behind fill the queues
+        queues[i] = OutboundQueueCreate(reactor, pair[0], k_opDropOldest);
+        if (queues[i] == NULL)
+            return -1;
+
+        FanOutPoolAssign(pool, queues[i]);
+
+        readers.sockets[i].fd     = pair[1];
+        readers.sockets[i].events = POLLIN;
+        readers.count++;
+    }
+
+    FanOutList*  list   = FanOutListCreate(queues, (unsigned int)recipients, pool->partitionCount);
+    FrameWriter  writer = {0};
+    size_t       frameLength = 0;
+    if (list == NULL)
+        return -1;
+
+    pthread_t    reactorThread;
+    pthread_t    readerThread;
+
+    FrameBegin(&writer, k_fkPush, k_cfPrintPeerClientMessage, 0);
+    FramePutLongString(&writer, BENCH_MESSAGE);
+    FrameFinish(&writer);
+    frameLength       = writer.length;
+    readers.expected  = (uint64_t)frameLength * (uint64_t)messages * (uint64_t)recipients;
+
+    pthread_create(&reactorThread, NULL, BenchRunReactor, reactor);
+    pthread_detach(reactorThread);
+
+    uint64_t syscallsBefore = __atomic_load_n(&reactor->syscalls, __ATOMIC_RELAXED);
+    double   start          = Seconds();
+    readers.finished        = start;
+    pthread_create(&readerThread, NULL, BenchReadAll, &readers);
+
+    uint64_t perMessage = (uint64_t)frameLength * (uint64_t)recipients;
+    for (int i = 0; i < messages; i++)
+    {
+        // Don't get more than a window ahead of the readers
+        while (i >= BENCH_WINDOW && __atomic_load_n(&readers.received, __ATOMIC_RELAXED) < (uint64_t)(i - BENCH_WINDOW) * perMessage)
+            sched_yield();
+
+        // Encoded once, shared by every queue
+        FrameBegin(&writer, k_fkPush, k_cfPrintPeerClientMessage, 0);
+        FramePutLongString(&writer, BENCH_MESSAGE);
+
+        SharedFrame* frame = SharedFrameCreate(&writer);
+        if (frame == NULL)
+            return -1;
+
+        if (threads > 0)
+            FanOutPoolPush(pool, frame, list, k_plChat);
+        else
+            FanOutQueued(frame, queues, recipients, k_plChat);
+        SharedFrameRelease(frame);
+    }
+
+    pthread_join(readerThread, NULL);
+
+    double   elapsed   = readers.finished - start;
+    uint64_t syscalls  = __atomic_load_n(&reactor->syscalls, __ATOMIC_RELAXED) - syscallsBefore;
+    uint64_t delivered = readers.received / frameLength;
+
+    printf("backend             : %s\n", ReactorBackendName(reactor));
+    printf("sender threads      : %u\n", (threads > 0) ? pool->partitionCount : 1);
+    printf("recipients          : %d\n", recipients);
+    printf("messages            : %d\n", messages);
+    printf("frames delivered    : %" PRIu64 " of %" PRIu64 "\n", delivered, (uint64_t)messages * (uint64_t)recipients);
+    printf("seconds             : %.3f\n", elapsed);
+    printf("frames/sec          : %.0f\n", (elapsed > 0) ? (double)delivered / elapsed : 0.0);
+    printf("messages/sec        : %.0f\n", (elapsed > 0) ? (double)delivered / recipients / elapsed : 0.0);
+    printf("syscalls            : %" PRIu64 "\n", syscalls);
+    printf("syscalls per message: %.2f\n\n", (double)syscalls / messages);
+
+    // The reactor keeps running. Its sockets are hung up and left to it
+    FanOutListRelease(list);
+    for (int i = 0; i < recipients; i++)
+    {
+        OutboundQueueClose(queues[i]);
+        OutboundQueueRelease(queues[i]);
+        close(readers.sockets[i].fd);
+    }
+
+    FrameWriterFree(&writer);
+    free(queues);
+    free(readers.sockets);
+    return 0;
+}
+
+/*
+    Send a request on a blocking root or room socket and wait
+    for its reply, skipping pushes that arrive first. 'body'
+    is freed by the caller. Returns the response code or
+    k_rcInternalServerError if the socket failed.
+*/
+static ResponseCode BenchRequest(int fd, FrameWriter* request, FrameReader* reader, char** body)
+{
+    FrameHeader header = {0};
+    *body = NULL;
+
+    if (!FrameFinish(request) || FrameSend(fd, request) != 0)
+        return k_rcInternalServerError;
+
+    do
+    {
+        free(*body);
+        if (FrameReceive(fd, &header, body) != 0)
+            return k_rcInternalServerError;
+    } while (header.kind != k_fkReply);
+
+    // Every reply starts with the response code
+    FrameReaderInit(reader, *body, header.length);
+    ResponseCode rcode = (ResponseCode)(int32_t)FrameGetU32(reader);
+    return reader->failed ? k_rcInternalServerError : rcode;
+}
+
+/*
+    Make room 'alias' as the root client on 'rootFd'
+    and find its id in the server list. Returns 0 if it's not there.
+*/
+static uint64_t BenchMakeRoom(int rootFd, const char* alias, int members)
+{
+    FrameWriter  request = {0};
+    FrameReader  reader;
+    char*        body    = NULL;
+    uint64_t     roomId  = 0;
+
+    FrameBegin(&request, k_fkRequest, k_cfMakeNewServer, 2);
+    FramePutString(&request, alias);
+    FramePutU16(&request, (uint16_t)((members < kMaxLargeServerMembers) ? members : kMaxLargeServerMembers));
+    ResponseCode rcode = BenchRequest(rootFd, &request, &reader, &body);
+    free(body);
+
+    if (rcode != k_rcRootOperationSuccessful) {
+        printf("Failed to make the room. Response Code %i\n", rcode);
+        FrameWriterFree(&request);
+        return 0;
+    }
+
+    // Whole list. The room is in it once creation was answered
+    FrameBegin(&request, k_fkRequest, k_cfRequestServerList, 3);
+    FramePutU64(&request, 0);
+    if (BenchRequest(rootFd, &request, &reader, &body) == k_rcRootOperationSuccessful) {
+        ServerListDelta delta = {0};
+        FrameGetU32(&reader); // Response flag
+        FrameGetBytes(&reader, &delta, sizeof(delta));
+
+        for (uint32_t i = 0; i < ntohl(delta.listingCount) && !reader.failed; i++)
+        {
+            ServerListing listing = {0};
+            if (FrameGetBytes(&reader, &listing, sizeof(listing)) && strcmp(listing.alias, alias) == 0)
+                roomId = be64toh(listing.serverId);
+        }
+    }
+
+    free(body);
+    FrameWriterFree(&request);
+    return roomId;
+}
+
+/*
+    Connect to 'port', ROOM_PORT or a relay, and send the
+    join request of member 'index' of room 'roomId' without
+    waiting for the reply. Returns the socket or -1.
+*/
+static int BenchStartJoin(uint64_t roomId, int index, unsigned short port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    char handle[kMaxClientHandleLength + 1];
+    snprintf(handle, sizeof(handle), "member%d", index);
+
+    FrameWriter join = {0};
+    FrameBegin(&join, k_fkRequest, k_cfAddClientToServer, 1);
+    FramePutU64(&join, roomId);
+    FramePutString(&join, handle);
+
+    bool sent = connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0
+                && FrameFinish(&join) && FrameSend(fd, &join) == 0;
+    FrameWriterFree(&join);
+
+    if (!sent) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+    Wait for the reply to a join started with BenchStartJoin().
+    Returns false if the room refused it or the socket closed.
+*/
+static bool BenchFinishJoin(int fd)
+{
+    FrameHeader header = {0};
+    char*       body   = NULL;
+    if (FrameReceive(fd, &header, &body) != 0)
+        return false;
+
+    FrameReader reader;
+    FrameReaderInit(&reader, body, header.length);
+    bool joined = (ResponseCode)(int32_t)FrameGetU32(&reader) == k_rcRootOperationSuccessful;
+
+    free(body);
+    return joined;
+}
+
+/*
+    Receive side of one member of the benchmark room.
+    Frames are cut out of the stream as bytes arrive so
+    only the header of the current frame is kept.
+*/
+typedef struct BenchMemberStr
+{
+    int     fd;                          // Room socket
+    char    header[sizeof(FrameHeader)]; // Header of the frame being received
+    size_t  headerBytes;                 // Bytes of 'header' received
+    size_t  bodyLeft;                    // Bytes of the frame's body still to come
+    bool    chat;                        // The frame is a chat message
+    int     messages;                    // Chat messages received
+} BenchMember;
+
+/*
+    Account for 'length' bytes received by 'member'.
+    Returns how many chat messages they finished.
+*/
+static int BenchConsume(BenchMember* member, const char* data, size_t length)
+{
+    int finished = 0;
+
+    while (length > 0)
+    {
+        if (member->headerBytes < sizeof(FrameHeader)) {
+            size_t taken = sizeof(FrameHeader) - member->headerBytes;
+            taken = (taken < length) ? taken : length;
+            memcpy(member->header + member->headerBytes, data, taken);
+            member->headerBytes += taken;
+            data                += taken;
+            length              -= taken;
+
+            if (member->headerBytes < sizeof(FrameHeader))
+                break;
+
+            FrameHeader header;
+            FrameParse(member->header, sizeof(FrameHeader), &header);
+            member->bodyLeft = header.length;
+            member->chat     = (header.command == k_cfPrintPeerClientMessage);
+        }
+
+        size_t taken = (member->bodyLeft < length) ? member->bodyLeft : length;
+        member->bodyLeft -= taken;
+        data             += taken;
+        length           -= taken;
+
+        // Whole frame is in
+        if (member->bodyLeft == 0) {
+            if (member->chat) {
+                member->messages++;
+                finished++;
+            }
+            member->headerBytes = 0;
+        }
+    }
+
+    return finished;
+}
+
+static int BenchCompareDoubles(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+    Print the median, 99th percentile and slowest of
+    'count' latencies in seconds, sorting them.
+*/
+static void BenchPrintLatencies(const char* what, double* latencies, size_t count)
+{
+    if (count == 0)
+        return;
+
+    qsort(latencies, count, sizeof(double), BenchCompareDoubles);
+    printf("%-20s: p50 %.2f ms, p99 %.2f ms, max %.2f ms\n", what,
+           latencies[count / 2] * 1e3, latencies[count * 99 / 100] * 1e3, latencies[count - 1] * 1e3);
+}
+
+/*
+    How delivery went in a room benchmark, in seconds.
+*/
+typedef struct BenchRoomResultStr
+{
+    double  joinsPerSecond; // Members joined over how long joining took
+    double  lastMedian;     // Median time for a message to reach the last member
+    double  lastTail;       // 99th percentile of the same
+} BenchRoomResult;
+
+/*
+    Join 'memberCount' clients to a new room called 'alias'
+    and have the first one say 'messages' messages, each after
+    the last reached everyone. Members join through the
+    'portCount' ports in turn. Prints how long delivery took
+    and fills in 'result' if not NULL. Returns 0 on success.
+*/
+static int BenchRoom(const char* alias, int memberCount, int messages,
+                     const unsigned short* ports, int portCount, BenchRoomResult* result)
+{
+    int rootFd = JoinRoot(0, ROOT_PORT);
+    if (rootFd < 0) {
+        printf("Failed to join the root server. Error Code %i\n", errno);
+        return -1;
+    }
+
+    uint64_t roomId = BenchMakeRoom(rootFd, alias, memberCount);
+    if (roomId == 0)
+        return -1;
+
+    BenchMember* members       = calloc((size_t)memberCount, sizeof(BenchMember));
+    double*      sentAt        = calloc((size_t)messages, sizeof(double));
+    double*      deliveries    = calloc((size_t)memberCount * (size_t)messages, sizeof(double));
+    double*      lastDelivered = calloc((size_t)messages, sizeof(double));
+    int          epfd          = epoll_create1(0);
+    if (members == NULL || sentAt == NULL || deliveries == NULL || lastDelivered == NULL || epfd < 0)
+        return -1;
+
+    // Joins go out a window at a time so the root's accept backlog and workers aren't flooded
+    double start  = Seconds();
+    int    joined = 0;
+    for (int first = 0; first < memberCount; first += BENCH_JOIN_WINDOW)
+    {
+        int last = (first + BENCH_JOIN_WINDOW < memberCount) ? first + BENCH_JOIN_WINDOW : memberCount;
+        for (int i = first; i < last; i++)
+            members[i].fd = BenchStartJoin(roomId, i, ports[i % portCount]);
+
+        for (int i = first; i < last; i++)
+        {
+            // Refused while root was busy. Try again on its own
+            for (int attempt = 1; members[i].fd < 0 || !BenchFinishJoin(members[i].fd); attempt++)
+            {
+                if (members[i].fd >= 0)
+                    close(members[i].fd);
+
+                members[i].fd = -1;
+                if (attempt == BENCH_JOIN_ATTEMPTS)
+                    break;
+
+                usleep(10000 * attempt);
+                members[i].fd = BenchStartJoin(roomId, i, ports[i % portCount]);
+            }
+
+            if (members[i].fd < 0) {
+                printf("Member %d failed to join. Error Code %i\n", i, errno);
+                return -1;
+            }
+
+            struct epoll_event event = { .events = EPOLLIN, .data.u32 = (uint32_t)i };
+            epoll_ctl(epfd, EPOLL_CTL_ADD, members[i].fd, &event);
+            joined++;
+        }
+    }
+
+    double joinSeconds = Seconds() - start;
+
+    FrameWriter          say = {0};
+    struct epoll_event   events[1024];
+    char                 chunk[65536];
+    size_t               deliveryCount = 0;
+    int                  completed     = 0;
+
+    for (int message = 0; message < messages; message++)
+    {
+        FrameBegin(&say, k_fkRequest, k_cfEchoClientMessageInServer, 0);
+        FramePutLongString(&say, BENCH_MESSAGE);
+        sentAt[message] = Seconds();
+        if (!FrameFinish(&say) || FrameSend(members[0].fd, &say) != 0)
+            break;
+
+        // Everyone, the sender included, gets the message back
+        int reached = 0;
+        while (reached < joined)
+        {
+            int ready = epoll_wait(epfd, events, 1024, BENCH_STALL_MS);
+            if (ready <= 0)
+                break;
+
+            for (int e = 0; e < ready; e++)
+            {
+                BenchMember* member = &members[events[e].data.u32];
+                ssize_t      got    = recv(member->fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+                if (got <= 0)
+                    continue;
+
+                int finished = BenchConsume(member, chunk, (size_t)got);
+                if (finished > 0 && member->messages == message + 1) {
+                    double now = Seconds();
+                    deliveries[deliveryCount++] = now - sentAt[message];
+                    lastDelivered[message]      = now - sentAt[message];
+                    reached++;
+                }
+            }
+        }
+
+        if (reached < joined) {
+            printf("Message %d reached %d of %d members before stalling\n", message, reached, joined);
+            break;
+        }
+        completed++;
+    }
+
+    printf("members joined      : %d\n", joined);
+    printf("joins/sec           : %.0f\n", joined / joinSeconds);
+    printf("messages            : %d of %d reached everyone\n", completed, messages);
+    BenchPrintLatencies("delivery", deliveries, deliveryCount);
+    BenchPrintLatencies("last member reached", lastDelivered, (size_t)completed);
+
+    if (result != NULL && completed > 0) {
+        result->joinsPerSecond = joined / joinSeconds;
+        result->lastMedian     = lastDelivered[completed / 2];
+        result->lastTail       = lastDelivered[completed * 99 / 100];
+    }
+
+    // Shutting the room down hangs everyone up at once instead of one leave at a time
+    FrameBegin(&say, k_fkRequest, k_cfDisconnectClientFromRoot, 4);
+    FramePutU64(&say, roomId);
+    if (FrameFinish(&say))
+        FrameSend(rootFd, &say);
+
+    for (int i = 0; i < joined; i++)
+        close(members[i].fd);
+
+    close(rootFd);
+    close(epfd);
+    FrameWriterFree(&say);
+    free(members);
+    free(sentAt);
+    free(deliveries);
+    free(lastDelivered);
+    return (completed == messages) ? 0 : -1;
+}
+
+/*
+    Start a relay listening on 'port' with 'upstream' as its
+    only upstream and wait until it accepts connections.
+    Returns its pid or -1.
+*/
+static pid_t BenchStartRelay(const char* binary, unsigned short port, unsigned short upstream)
+{
+    char portText[8], upstreamText[8];
+    snprintf(portText, sizeof(portText), "%u", port);
+    snprintf(upstreamText, sizeof(upstreamText), "%u", upstream);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        return -1;
+
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0)
+            dup2(null, STDOUT_FILENO);
+
+        execl(binary, binary, portText, upstreamText, (char*)NULL);
+        _exit(127);
+    }
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    for (int attempt = 0; attempt < BENCH_RELAY_START_ATTEMPTS; attempt++)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+            close(fd);
+            return pid;
+        }
+
+        if (fd >= 0)
+            close(fd);
+        usleep(10000);
+    }
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+/*
+    Stop the 'count' relays in 'pids'.
+*/
+static void BenchStopRelays(pid_t* pids, int count)
+{
+    for (int i = 0; i < count; i++)
+        kill(pids[i], SIGTERM);
+
+    for (int i = 0; i < count; i++)
+        waitpid(pids[i], NULL, 0);
+}
+
+/*
+    Run the room benchmark with members joined straight to
+    the room, then through relay trees one level deeper each
+    time up to 'maxDepth', 'fanOut' relays under every relay
+    or the room. Members are spread over the bottom level.
+    Prints how delivery latency grows with depth.
+*/
+static int BenchRelay(const char* binary, int memberCount, int messages, int maxDepth, int fanOut)
+{
+    BenchRoomResult results[BENCH_MAX_DEPTH + 1] = {0};
+    int             relayCounts[BENCH_MAX_DEPTH + 1] = {0};
+    int             depths = 0;
+
+    for (int depth = 0; depth <= maxDepth; depth++)
+    {
+        pid_t          pids[BENCH_MAX_RELAYS];
+        unsigned short ports[BENCH_MAX_RELAYS];
+        unsigned short level[BENCH_MAX_RELAYS] = { ROOM_PORT };
+        int            levelCount = 1;
+        int            relays     = 0;
+        bool           started    = true;
+
+        // Each level hangs 'fanOut' relays under every relay of the level above
+        for (int d = 0; d < depth && started; d++)
+        {
+            unsigned short below[BENCH_MAX_RELAYS];
+            int            belowCount = 0;
+
+            for (int i = 0; i < levelCount && started; i++)
+            {
+                for (int f = 0; f < fanOut && started; f++)
+                {
+                    if (relays == BENCH_MAX_RELAYS) {
+                        printf("More than %d relays needed for depth %d\n", BENCH_MAX_RELAYS, depth);
+                        started = false;
+                        break;
+                    }
+
+                    ports[relays] = (unsigned short)(RELAY_PORT + relays);
+                    pids[relays]  = BenchStartRelay(binary, ports[relays], level[i]);
+                    if (pids[relays] < 0) {
+                        printf("Failed to start a relay on port %u\n", ports[relays]);
+                        started = false;
+                        break;
+                    }
+
+                    below[belowCount++] = ports[relays++];
+                }
+            }
+
+            memcpy(level, below, sizeof(below[0]) * (size_t)belowCount);
+            levelCount = belowCount;
+        }
+
+        char alias[kMaxServerAliasLength + 1];
+        snprintf(alias, sizeof(alias), "benchdepth%d", depth);
+
+        printf("-- depth %d, %d relays --\n", depth, relays);
+        int failed = !started || BenchRoom(alias, memberCount, messages, level, levelCount, &results[depth]) != 0;
+        BenchStopRelays(pids, relays);
+        if (failed)
+            break;
+
+        relayCounts[depth] = relays;
+        depths++;
+    }
+
+    printf("depth  relays  joins/sec  last p50 ms  last p99 ms\n");
+    for (int depth = 0; depth < depths; depth++)
+        printf("%5d  %6d  %9.0f  %11.2f  %11.2f\n", depth, relayCounts[depth], results[depth].joinsPerSecond,
+               results[depth].lastMedian * 1e3, results[depth].lastTail * 1e3);
+
+    return (depths == maxDepth + 1) ? 0 : -1;
+}
+
+/*
+    Bytes held back by a delayed link until they are due.
+*/
+typedef struct BenchDelayedStr
+{
+    struct BenchDelayedStr* next;   // Chunk read after this one
+    double                  due;    // When it may be passed on
+    size_t                  length; // Bytes in 'data'
+    char                    data[]; // What was read
+} BenchDelayed;
+
+/*
+    One direction of a delayed link.
+*/
+typedef struct BenchLinkStr
+{
+    int    from;    // Socket read from
+    int    to;      // Socket written to
+    double delay;   // Seconds every chunk is held back
+} BenchLink;
+
+/*
+    Pass what arrives on 'from' on to 'to' once it is
+    'delay' old, in order, like a long link would. Ends
+    when either side closes.
+*/
+static void* BenchDelayLink(void* context)
+{
+    BenchLink*    link  = (BenchLink*)context;
+    BenchDelayed* first = NULL;
+    BenchDelayed* last  = NULL;
+    bool          open  = true;
+
+    while (open || first != NULL)
+    {
+        // Wake up for new bytes or the oldest chunk falling due
+        int timeout = -1;
+        if (first != NULL) {
+            double wait = first->due - Seconds();
+            timeout = (wait > 0) ? (int)(wait * 1e3) + 1 : 0;
+        }
+
+        struct pollfd from = { .fd = link->from, .events = POLLIN };
+        if (open && poll(&from, 1, timeout) > 0) {
+            BenchDelayed* chunk = malloc(sizeof(BenchDelayed) + FRAME_STREAM_CHUNK);
+            ssize_t       got   = (chunk != NULL) ? recv(link->from, chunk->data, FRAME_STREAM_CHUNK, 0) : -1;
+            if (got <= 0) {
+                free(chunk);
+                open = false;
+            } else {
+                chunk->next   = NULL;
+                chunk->due    = Seconds() + link->delay;
+                chunk->length = (size_t)got;
+                if (last != NULL)
+                    last->next = chunk;
+                else
+                    first = chunk;
+                last = chunk;
+            }
+        } else if (!open && timeout > 0) {
+            usleep((useconds_t)timeout * 1000);
+        }
+
+        while (first != NULL && first->due <= Seconds())
+        {
+            BenchDelayed* chunk = first;
+            first = chunk->next;
+            if (first == NULL)
+                last = NULL;
+
+            if (send(link->to, chunk->data, chunk->length, MSG_NOSIGNAL) != (ssize_t)chunk->length)
+                open = false;
+            free(chunk);
+        }
+    }
+
+    // Both sides see the link go down
+    shutdown(link->to, SHUT_WR);
+    return NULL;
+}
+
+/*
+    Listen on a free port and relay the one connection made to it
+    to the root server, 'delay' seconds late each way. The port is
+    put in 'port'. Returns the listening socket or -1.
+*/
+static int BenchStartDelayedLink(double delay, unsigned short* port, BenchLink links[2])
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0)
+        return -1;
+
+    struct sockaddr_in addr = {0};
+    socklen_t          size = sizeof(addr);
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 1) != 0
+        || getsockname(listener, (struct sockaddr*)&addr, &size) != 0) {
+        close(listener);
+        return -1;
+    }
+
+    *port = ntohs(addr.sin_port);
+    links[0].delay = delay;
+    links[1].delay = delay;
+    return listener;
+}
+
+/*
+    Accept the connection made to a delayed link and connect it
+    to the root server. Starts a thread for each direction.
+    Returns false if either side failed.
+*/
+static bool BenchAcceptDelayedLink(int listener, BenchLink links[2], pthread_t threads[2])
+{
+    int client = accept(listener, NULL, NULL);
+    int root   = socket(AF_INET, SOCK_STREAM, 0);
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(ROOT_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (client < 0 || root < 0 || connect(root, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        if (client >= 0)
+            close(client);
+        if (root >= 0)
+            close(root);
+        return false;
+    }
+
+    // A link passes bytes on as they come. The delay is all it adds
+    int noDelay = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    setsockopt(root, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    links[0].from = client;
+    links[0].to   = root;
+    links[1].from = root;
+    links[1].to   = client;
+    pthread_create(&threads[0], NULL, BenchDelayLink, &links[0]);
+    pthread_create(&threads[1], NULL, BenchDelayLink, &links[1]);
+    return true;
+}
+
+/*
+    Joins root on another thread so the delayed link can
+    be accepted on this one.
+*/
+typedef struct BenchJoinStr
+{
+    unsigned short port;   // Port to join through
+    int            fd;     // Joined socket or -1
+} BenchJoin;
+
+static void* BenchJoinThrough(void* context)
+{
+    BenchJoin* join = (BenchJoin*)context;
+    join->fd = JoinRoot(0, join->port);
+    return NULL;
+}
+
+/*
+    Make 'count' server list requests to root on 'fd' with
+    at most 'inFlight' waiting for their response at once.
+    Responses are matched to requests by id since root answers
+    them in whatever order its workers finish. Prints requests
+    per second and round trips. Returns 0 on success.
+*/
+static int BenchPipeline(int fd, int count, int inFlight)
+{
+    double*     sentAt    = calloc((size_t)count + 1, sizeof(double));
+    double*     latencies = calloc((size_t)count, sizeof(double));
+    FrameWriter request   = {0};
+    FrameStream stream;
+    if (sentAt == NULL || latencies == NULL)
+        return -1;
+
+    FrameStreamInit(&stream, fd);
+
+    double start    = Seconds();
+    int    sent     = 0;
+    int    answered = 0;
+    while (answered < count)
+    {
+        // Keep the window full
+        for (; sent < count && sent - answered < inFlight; sent++)
+        {
+            uint32_t requestId = (uint32_t)sent + 1;
+            FrameBegin(&request, k_fkRequest, k_cfRequestServerList, requestId);
+            FramePutU64(&request, 0);
+            sentAt[requestId] = Seconds();
+            if (!FrameFinish(&request) || FrameSend(fd, &request) != 0)
+                break;
+        }
+
+        FrameHeader header = {0};
+        FrameReader reader;
+        if (FrameStreamNext(&stream, &header, &reader) != 0)
+            break;
+
+        if (header.kind != k_fkReply || header.requestId == 0 || header.requestId > (uint32_t)count)
+            continue;
+
+        latencies[answered++] = Seconds() - sentAt[header.requestId];
+    }
+
+    double elapsed = Seconds() - start;
+    printf("in flight %-10d: %d of %d answered, %.0f requests/sec\n", inFlight, answered, count, answered / elapsed);
+    BenchPrintLatencies("  round trip", latencies, (size_t)answered);
+
+    FrameStreamFree(&stream);
+    FrameWriterFree(&request);
+    free(sentAt);
+    free(latencies);
+    return (answered == count) ? 0 : -1;
+}
+
+/*
+    Compare making root requests one at a time against having
+    up to 'inFlight' of them waiting, through a link that adds
+    'delayMs' each way, or straight to root if it's 0.
+*/
+static int BenchRequests(int count, int inFlight, double delayMs)
+{
+    BenchLink links[2] = {0};
+    pthread_t threads[2];
+    BenchJoin join     = { .port = ROOT_PORT, .fd = -1 };
+    int       listener = -1;
+
+    if (delayMs > 0) {
+        listener = BenchStartDelayedLink(delayMs / 1e3, &join.port, links);
+        if (listener < 0)
+            return -1;
+
+        pthread_t joiner;
+        pthread_create(&joiner, NULL, BenchJoinThrough, &join);
+        bool linked = BenchAcceptDelayedLink(listener, links, threads);
+        pthread_join(joiner, NULL);
+        close(listener);
+
+        if (!linked) {
+            printf("Failed to connect the delayed link to the root server\n");
+            return -1;
+        }
+    } else {
+        BenchJoinThrough(&join);
+    }
+
+    if (join.fd < 0) {
+        printf("Failed to join the root server. Error Code %i\n", errno);
+        return -1;
+    }
+
+    printf("delay each way      : %.1f ms\n", delayMs);
+    int result = BenchPipeline(join.fd, count, 1);
+    if (inFlight > 1)
+        result |= BenchPipeline(join.fd, count, inFlight);
+
+    close(join.fd);
+    if (delayMs > 0) {
+        pthread_join(threads[0], NULL);
+        pthread_join(threads[1], NULL);
+        close(links[0].from);
+        close(links[1].from);
+    }
+
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc >= 4 && strcmp(argv[1], "fanout") == 0) {
+        int recipients = atoi(argv[2]);
+        int messages   = atoi(argv[3]);
+        if (recipients <= 0 || messages <= 0)
+            return -1;
+
+        RaiseOpenFileLimit();
+
+        unsigned int threads = (argc > 5) ? (unsigned int)atoi(argv[5]) : 0;
+        bool         both    = argc < 5 || strcmp(argv[4], "both") == 0;
+
+        int result = 0;
+        if (both || strcmp(argv[4], "epoll") == 0)
+            result |= BenchFanOut(k_rbEpoll, recipients, messages, threads);
+        if (both || strcmp(argv[4], "io_uring") == 0)
+            result |= BenchFanOut(k_rbUring, recipients, messages, threads);
+
+        return result;
+    }
+
+    if (argc >= 4 && strcmp(argv[1], "room") == 0) {
+        int members  = atoi(argv[2]);
+        int messages = atoi(argv[3]);
+        if (members <= 0 || messages <= 0)
+            return -1;
+
+        unsigned short ports[BENCH_MAX_RELAYS] = { ROOM_PORT };
+        int            portCount = 1;
+        for (int i = 4; i < argc && i - 4 < BENCH_MAX_RELAYS; i++)
+            ports[(portCount = i - 3) - 1] = (unsigned short)atoi(argv[i]);
+
+        RaiseOpenFileLimit();
+        return BenchRoom(BENCH_ROOM_ALIAS, members, messages, ports, portCount, NULL);
+    }
+
+    if (argc >= 6 && strcmp(argv[1], "relay") == 0) {
+        int members  = atoi(argv[2]);
+        int messages = atoi(argv[3]);
+        int depth    = atoi(argv[4]);
+        int fanOut   = atoi(argv[5]);
+        if (members <= 0 || messages <= 0 || depth < 0 || depth > BENCH_MAX_DEPTH || fanOut <= 0)
+            return -1;
+
+        RaiseOpenFileLimit();
+        return BenchRelay((argc > 6) ? argv[6] : "./relay", members, messages, depth, fanOut);
+    }
+
+    if (argc >= 4 && strcmp(argv[1], "requests") == 0) {
+        int    count    = atoi(argv[2]);
+        int    inFlight = atoi(argv[3]);
+        double delayMs  = (argc > 4) ? atof(argv[4]) : 0;
+        if (count <= 0 || inFlight <= 0 || delayMs < 0)
+            return -1;
+
+        return BenchRequests(count, inFlight, delayMs);
+    }
+
+    if (argc < 2) {
+        printf("Usage: %s <clients> [root-pid]\n", argv[0]);
+        printf("       %s fanout <recipients> <messages> [epoll | io_uring | both] [threads]\n", argv[0]);
+        printf("       %s room <members> <messages> [port ...]\n", argv[0]);
+        printf("       %s relay <members> <messages> <max depth> <fan-out> [relay binary]\n", argv[0]);
+        printf("       %s requests <requests> <in flight> [delay ms]\n", argv[0]);
+        return -1;
+    }
+
+    int clients = atoi(argv[1]);
+    int rootPid = (argc > 2) ? atoi(argv[2]) : 0;
+
+    RaiseOpenFileLimit();
+
+    int* sockets = calloc((size_t)clients, sizeof(int));
+    if (sockets == NULL)
+        return -1;
+
+    long   rssBefore = rootPid ? ResidentKilobytes(rootPid) : -1;
+    double start     = Seconds();
+    int    joined    = 0;
+
+    for (int i = 0; i < clients; i++)
+    {
+        sockets[i] = JoinRoot(i, ROOT_PORT);
+        if (sockets[i] < 0) {
+            printf("Client %d failed to join. Error Code %i\n", i, errno);
+            break;
+        }
+        joined++;
+    }
+
+    double elapsed = Seconds() - start;
+
+    // Let the root server settle with every client idle
+    sleep(1);
+    long rssAfter = rootPid ? ResidentKilobytes(rootPid) : -1;
+
+    printf("clients joined      : %d\n", joined);
+    printf("connections/sec     : %.0f\n", joined / elapsed);
+
+    if (rssBefore >= 0 && rssAfter >= 0 && joined > 0) {
+        printf("root rss before     : %ld kB\n", rssBefore);
+        printf("root rss after      : %ld kB\n", rssAfter);
+        printf("root rss per client : %.2f kB\n", (double)(rssAfter - rssBefore) / joined);
+    }
+
+    for (int i = 0; i < joined; i++)
+        close(sockets[i]);
+
+    free(sockets);
+    return 0;
+}
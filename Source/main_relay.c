@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include "Headers/relay.h"
+#include "Headers/reactor.h"
+
+int main(int argc, char** argv) {
+    // Usage: ./relay <port> <upstream> [upstream ...] [allow=<address> ...] [epoll | io_uring]
+    //        An upstream is the room port of the root server or of another relay, as host:port or just port
+    //        Relays below can attach from this machine and every address allowed
+    if (argc < 3) {
+        printf("Usage: %s <port> <upstream> [upstream ...] [allow=<address> ...] [epoll | io_uring]\n", argv[0]);
+        return -1;
+    }
+
+    int port = atoi(argv[1]);
+    if (port <= 0 || port > 65535) {
+        printf("'%s' isn't a port\n", argv[1]);
+        return -1;
+    }
+
+    for (int i = 2; i < argc; i++)
+    {
+        // Falls back to epoll if io_uring can't be used
+        if (strcmp(argv[i], "io_uring") == 0)
+            reactorBackend = k_rbUring;
+        else if (strcmp(argv[i], "epoll") == 0)
+            reactorBackend = k_rbEpoll;
+        else if (strncmp(argv[i], "allow=", 6) == 0) {
+            if (relayPeerCount == RELAY_MAX_PEERS || inet_pton(AF_INET, argv[i] + 6, &relayPeers[relayPeerCount++]) != 1) {
+                printf("Can't let relays attach from '%s'. At most %d IPv4 addresses\n", argv[i] + 6, RELAY_MAX_PEERS);
+                return -1;
+            }
+        }
+        else if (relayUpstreamCount == RELAY_MAX_UPSTREAMS || !RelayParseAddress(argv[i], &relayUpstreams[relayUpstreamCount++])) {
+            printf("Can't use '%s' as an upstream. At most %d of host:port or port\n", argv[i], RELAY_MAX_UPSTREAMS);
+            return -1;
+        }
+    }
+
+    if (relayUpstreamCount == 0) {
+        printf("A relay needs an upstream\n");
+        return -1;
+    }
+
+    // Every client is a socket
+    RaiseOpenFileLimit();
+
+    if (RelayStart((unsigned short)port) != 0) {
+        printf("Failed Starting the Relay on port %d. Error Code: %i\n", port, errno);
+        return -1;
+    }
+
+    printf("Relay listening on port %d with %u upstreams\n", port, relayUpstreamCount);
+    RelayAcceptClients();
+    return 0;
+}
@@ -2,10 +2,139 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
+#include <limits.h>
 #include "Headers/server.h"
 #include "Headers/client.h"
+#include "Headers/chatlog.h"
+
+/*
+    Options the root takes. Each is given as "--name value"
+*/
+static const char* rootOptions[] = {
+    "--workers", "--overflow", "--history", "--log", "--client-rate",
+    "--room-rate", "--backend", "--large-rooms", "--relays",
+};
+
+static bool IsRootOption(const char* option)
+{
+    for (size_t i = 0; i < sizeof(rootOptions) / sizeof(rootOptions[0]); i++)
+        if (strcmp(option, rootOptions[i]) == 0)
+            return true;
+
+    return false;
+}
+
+static void PrintRootUsage(const char* program)
+{
+    printf("Usage: %s [--workers <n>] [--overflow drop-oldest | disconnect | mark-lagging] [--history <n>]\n"
+           "       [--log <directory>] [--client-rate <n>] [--room-rate <n>] [--backend epoll | io_uring]\n"
+           "       [--large-rooms <n>] [--relays <address,address,...>]\n", program);
+}
+
+/*
+    Read a whole number option. Returns false if
+    'text' is anything but digits.
+*/
+static bool ParseRootCount(const char* text, unsigned int* count)
+{
+    char*         end   = NULL;
+    unsigned long value = strtoul(text, &end, 10);
+
+    if (text[0] < '0' || text[0] > '9' || *end != '\0' || value > UINT_MAX)
+        return false;
+
+    *count = (unsigned int)value;
+    return true;
+}
+
+int main(int argc, char** argv) {
+    const char* logDirectory = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* option = argv[i];
+        const char* value  = (i + 1 < argc) ? argv[i + 1] : NULL;
+        bool        valid  = true;
+
+        if (!IsRootOption(option) || value == NULL) {
+            printf(IsRootOption(option) ? "'%s' needs a value\n" : "Unknown option '%s'\n", option);
+            PrintRootUsage(argv[0]);
+            return -1;
+        }
+        i++; // Past the value
+
+        // Threads running root requests and joins
+        if (strcmp(option, "--workers") == 0)
+            valid = ParseRootCount(value, &rootWorkerCount) && rootWorkerCount > 0;
+
+        // What happens to room members who can't keep up
+        else if (strcmp(option, "--overflow") == 0) {
+            if (strcmp(value, "drop-oldest") == 0)
+                roomOverflowPolicy = k_opDropOldest;
+            else if (strcmp(value, "disconnect") == 0)
+                roomOverflowPolicy = k_opDisconnect;
+            else if (strcmp(value, "mark-lagging") == 0)
+                roomOverflowPolicy = k_opMarkLagging;
+            else
+                valid = false;
+        }
+
+        // Messages each room replays to clients who join. 0 turns it off
+        else if (strcmp(option, "--history") == 0)
+            valid = ParseRootCount(value, &roomHistoryLength);
+
+        // Nothing said in rooms is saved unless a directory to keep it in is given
+        else if (strcmp(option, "--log") == 0)
+            logDirectory = value;
+
+        // How fast clients and rooms can send. 0 turns the limit off
+        else if (strcmp(option, "--client-rate") == 0)
+            valid = ParseRootCount(value, &clientRequestRate);
+        else if (strcmp(option, "--room-rate") == 0)
+            valid = ParseRootCount(value, &roomMessageRate);
+
+        // Event loops of the root and the rooms. Falls back to epoll if io_uring can't be used
+        else if (strcmp(option, "--backend") == 0) {
+            if (strcmp(value, "io_uring") == 0)
+                reactorBackend = k_rbUring;
+            else if (strcmp(value, "epoll") == 0)
+                reactorBackend = k_rbEpoll;
+            else
+                valid = false;
+        }
+
+        // Rooms can be made with more than kMaxServerMembers up to this many. 0 keeps them off
+        else if (strcmp(option, "--large-rooms") == 0)
+            valid = ParseRootCount(value, &largeRoomMaxClients);
+
+        // Other machines relays can attach from, separated by commas. Relays on this one always can
+        else if (strcmp(option, "--relays") == 0) {
+            char* saved = NULL; // strtok_r() cuts up 'value', which is argv[i]
+            for (char* address = strtok_r(argv[i], ",", &saved); address != NULL; address = strtok_r(NULL, ",", &saved))
+            {
+                if (roomRelayPeerCount == ROOM_MAX_RELAY_PEERS || inet_pton(AF_INET, address, &roomRelayPeers[roomRelayPeerCount++]) != 1) {
+                    SystemPrint(RED, false, "Can't Let Relays Attach From '%s'. At Most %d IPv4 Addresses\n", address, ROOM_MAX_RELAY_PEERS);
+                    return -1;
+                }
+            }
+        }
+
+        if (!valid) {
+            printf("Can't use '%s %s'\n", option, value);
+            PrintRootUsage(argv[0]);
+            return -1;
+        }
+    }
+
+    // The backlog and the join reply have to fit in a new clients queue
+    if (roomHistoryLength > OUTBOUND_QUEUE_FRAMES - 1)
+        roomHistoryLength = OUTBOUND_QUEUE_FRAMES - 1;
+
+    if (logDirectory != NULL && ChatLogStart(logDirectory) != 0) {
+        SystemPrint(RED, false, "Failed Starting the Chat Log in '%s'. Error Code: %i\n", logDirectory, errno);
+        return -1;
+    }
 
-int main() {
     /*
         Set the rootServer to all 0's
     */
@@ -0,0 +1,396 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       protocol.c
+ * @brief      build, parse, send and receive wire protocol frames
+ *
+ * @note
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#include "Headers/protocol.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define FRAME_MIN_CAPACITY 256
+
+/*
+    Make sure 'length' more bytes fit in the writer.
+*/
+static bool Grow(FrameWriter* writer, size_t length)
+{
+    if (writer->failed)
+        return false;
+
+    size_t needed = writer->length + length;
+    if (needed <= writer->capacity)
+        return true;
+
+    size_t newCapacity = writer->capacity ? writer->capacity : FRAME_MIN_CAPACITY;
+    while (newCapacity < needed)
+        newCapacity *= 2;
+
+    char* grown = realloc(writer->data, newCapacity);
+    if (grown == NULL) {
+        writer->failed = true;
+        return false;
+    }
+
+    writer->data     = grown;
+    writer->capacity = newCapacity;
+    return true;
+}
+
+void FrameBegin(FrameWriter* writer, FrameKind kind, int command, uint32_t requestId)
+{
+    writer->length = 0;
+    writer->failed = false;
+
+    FrameHeader header = {0};
+    header.version   = PROTOCOL_VERSION;
+    header.kind      = (uint8_t)kind;
+    header.command   = (int16_t)htons((uint16_t)(int16_t)command);
+    header.requestId = htonl(requestId);
+
+    FramePutBytes(writer, &header, sizeof(header));
+}
+
+void FramePutBytes(FrameWriter* writer, const void* bytes, size_t length)
+{
+    if (!Grow(writer, length))
+        return;
+
+    memcpy(writer->data + writer->length, bytes, length);
+    writer->length += length;
+}
+
+void* FrameReserve(FrameWriter* writer, size_t length)
+{
+    if (!Grow(writer, length))
+        return NULL;
+
+    void* reserved = writer->data + writer->length;
+    memset(reserved, 0, length);
+    writer->length += length;
+    return reserved;
+}
+
+void FramePutU8(FrameWriter* writer, uint8_t value)
+{
+    FramePutBytes(writer, &value, sizeof(value));
+}
+
+void FramePutU16(FrameWriter* writer, uint16_t value)
+{
+    value = htons(value);
+    FramePutBytes(writer, &value, sizeof(value));
+}
+
+void FramePutU32(FrameWriter* writer, uint32_t value)
+{
+    value = htonl(value);
+    FramePutBytes(writer, &value, sizeof(value));
+}
+
+void FramePutU64(FrameWriter* writer, uint64_t value)
+{
+    value = htobe64(value);
+    FramePutBytes(writer, &value, sizeof(value));
+}
+
+void FramePutString(FrameWriter* writer, const char* string)
+{
+    size_t length = strnlen(string, UINT8_MAX);
+    FramePutU8(writer, (uint8_t)length);
+    FramePutBytes(writer, string, length);
+}
+
+void FramePutLongString(FrameWriter* writer, const char* string)
+{
+    size_t length = strnlen(string, UINT16_MAX);
+    FramePutU16(writer, (uint16_t)length);
+    FramePutBytes(writer, string, length);
+}
+
+bool FrameFinish(FrameWriter* writer)
+{
+    if (writer->failed || writer->length < sizeof(FrameHeader))
+        return false;
+
+    uint32_t bodyLength = htonl((uint32_t)(writer->length - sizeof(FrameHeader)));
+    memcpy(writer->data + offsetof(FrameHeader, length), &bodyLength, sizeof(bodyLength));
+    return true;
+}
+
+void FrameWriterFree(FrameWriter* writer)
+{
+    free(writer->data);
+    memset(writer, 0, sizeof(FrameWriter));
+}
+
+void FrameReaderInit(FrameReader* reader, const char* body, size_t length)
+{
+    reader->data   = body;
+    reader->length = (body != NULL) ? length : 0;
+    reader->offset = 0;
+    reader->failed = false;
+}
+
+bool FrameGetBytes(FrameReader* reader, void* bytes, size_t length)
+{
+    if (reader->failed || length > reader->length - reader->offset) {
+        reader->failed = true;
+        memset(bytes, 0, length);
+        return false;
+    }
+
+    memcpy(bytes, reader->data + reader->offset, length);
+    reader->offset += length;
+    return true;
+}
+
+uint8_t FrameGetU8(FrameReader* reader)
+{
+    uint8_t value = 0;
+    FrameGetBytes(reader, &value, sizeof(value));
+    return value;
+}
+
+uint16_t FrameGetU16(FrameReader* reader)
+{
+    uint16_t value = 0;
+    FrameGetBytes(reader, &value, sizeof(value));
+    return ntohs(value);
+}
+
+uint32_t FrameGetU32(FrameReader* reader)
+{
+    uint32_t value = 0;
+    FrameGetBytes(reader, &value, sizeof(value));
+    return ntohl(value);
+}
+
+uint64_t FrameGetU64(FrameReader* reader)
+{
+    uint64_t value = 0;
+    FrameGetBytes(reader, &value, sizeof(value));
+    return be64toh(value);
+}
+
+/*
+    Read 'length' characters into 'string'. Extra
+    characters that don't fit are skipped.
+*/
+static void GetCharacters(FrameReader* reader, size_t length, char* string, size_t size)
+{
+    string[0] = '\0';
+    if (reader->failed || length > reader->length - reader->offset) {
+        reader->failed = true;
+        return;
+    }
+
+    size_t copied = (length < size - 1) ? length : size - 1;
+    memcpy(string, reader->data + reader->offset, copied);
+    string[copied] = '\0';
+    reader->offset += length;
+}
+
+void FrameGetString(FrameReader* reader, char* string, size_t size)
+{
+    GetCharacters(reader, FrameGetU8(reader), string, size);
+}
+
+void FrameGetLongString(FrameReader* reader, char* string, size_t size)
+{
+    GetCharacters(reader, FrameGetU16(reader), string, size);
+}
+
+size_t FrameRemaining(FrameReader* reader)
+{
+    return reader->failed ? 0 : reader->length - reader->offset;
+}
+
+int FrameParse(const char* data, size_t length, FrameHeader* header)
+{
+    if (length < sizeof(FrameHeader))
+        return 0;
+
+    memcpy(header, data, sizeof(FrameHeader));
+    header->command   = (int16_t)ntohs((uint16_t)header->command);
+    header->length    = ntohl(header->length);
+    header->requestId = ntohl(header->requestId);
+
+    if (header->version != PROTOCOL_VERSION || header->length > PROTOCOL_MAX_BODY)
+        return -1;
+
+    return (length - sizeof(FrameHeader) >= header->length) ? 1 : 0;
+}
+
+int FrameSend(int fd, FrameWriter* writer)
+{
+    size_t sent = 0;
+    while (sent < writer->length)
+    {
+        ssize_t wrote = send(fd, writer->data + sent, writer->length - sent, MSG_NOSIGNAL);
+        if (wrote < 0 && errno == EINTR)
+            continue;
+        if (wrote <= 0)
+            return -1;
+
+        sent += (size_t)wrote;
+    }
+
+    return 0;
+}
+
+int FrameReceive(int fd, FrameHeader* header, char** body)
+{
+    *body = NULL;
+
+    char raw[sizeof(FrameHeader)];
+    if (recv(fd, raw, sizeof(raw), MSG_WAITALL) != (ssize_t)sizeof(raw))
+        return -1;
+
+    if (FrameParse(raw, sizeof(raw), header) < 0)
+        return -1;
+
+    if (header->length == 0)
+        return 0;
+
+    *body = malloc(header->length);
+    if (*body == NULL)
+        return -1;
+
+    if (recv(fd, *body, header->length, MSG_WAITALL) != (ssize_t)header->length) {
+        free(*body);
+        *body = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+void FrameStreamInit(FrameStream* stream, int fd)
+{
+    memset(stream, 0, sizeof(FrameStream));
+    stream->fd = fd;
+}
+
+bool FrameStreamReady(FrameStream* stream)
+{
+    FrameHeader header;
+    return stream->data != NULL
+        && FrameParse(stream->data + stream->start, stream->length - stream->start, &header) == 1;
+}
+
+/*
+    Make room for a frame of 'needed' bytes at the end of
+    the buffer. Bytes already handled are dropped first.
+*/
+static bool MakeRoom(FrameStream* stream, size_t needed)
+{
+    if (stream->start > 0) {
+        memmove(stream->data, stream->data + stream->start, stream->length - stream->start);
+        stream->length -= stream->start;
+        stream->start   = 0;
+    }
+
+    // Always leave room for a full read so frames that arrive together come in one recv()
+    needed = (needed > stream->length + FRAME_STREAM_CHUNK) ? needed : stream->length + FRAME_STREAM_CHUNK;
+    if (needed <= stream->capacity)
+        return true;
+
+    char* grown = realloc(stream->data, needed);
+    if (grown == NULL)
+        return false;
+
+    stream->data     = grown;
+    stream->capacity = needed;
+    return true;
+}
+
+int FrameStreamNext(FrameStream* stream, FrameHeader* header, FrameReader* reader)
+{
+    while (1)
+    {
+        size_t buffered = stream->length - stream->start;
+        int    parsed   = (stream->data != NULL) ? FrameParse(stream->data + stream->start, buffered, header) : 0;
+
+        if (parsed < 0)
+            return -1;
+
+        if (parsed == 1) {
+            FrameReaderInit(reader, stream->data + stream->start + sizeof(FrameHeader), header->length);
+            stream->start += sizeof(FrameHeader) + header->length;
+            return 0;
+        }
+
+        // Whole frame once the header is in, otherwise just the header
+        size_t frameLength = sizeof(FrameHeader) + ((buffered >= sizeof(FrameHeader)) ? header->length : 0);
+        if (!MakeRoom(stream, frameLength))
+            return -1;
+
+        ssize_t received = recv(stream->fd, stream->data + stream->length, stream->capacity - stream->length, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return -1;
+
+        stream->length += (size_t)received;
+    }
+}
+
+int FrameStreamFill(FrameStream* stream)
+{
+    FrameHeader header   = {0};
+    size_t      buffered = stream->length - stream->start;
+    int         parsed   = (stream->data != NULL) ? FrameParse(stream->data + stream->start, buffered, &header) : 0;
+    if (parsed < 0)
+        return -1;
+
+    // Room for the rest of the frame being received like FrameStreamNext()
+    size_t frameLength = sizeof(FrameHeader) + ((buffered >= sizeof(FrameHeader)) ? header.length : 0);
+    if (!MakeRoom(stream, frameLength))
+        return -1;
+
+    ssize_t received = recv(stream->fd, stream->data + stream->length, stream->capacity - stream->length, MSG_DONTWAIT);
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return 0;
+    if (received <= 0)
+        return -1;
+
+    stream->length += (size_t)received;
+    return (int)received;
+}
+
+int FrameStreamAppend(FrameStream* stream, const char* data, size_t length)
+{
+    if (!MakeRoom(stream, stream->length - stream->start + length))
+        return -1;
+
+    memcpy(stream->data + stream->length, data, length);
+    stream->length += length;
+
+    FrameHeader header;
+    return (FrameParse(stream->data + stream->start, stream->length - stream->start, &header) < 0) ? -1 : 0;
+}
+
+void FrameStreamFree(FrameStream* stream)
+{
+    free(stream->data);
+    memset(stream, 0, sizeof(FrameStream));
+    stream->fd = -1;
+}
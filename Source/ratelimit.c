@@ -0,0 +1,57 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       ratelimit.c
+ * @brief      lock-free token buckets used to limit how fast clients send
+ *
+ * @note
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#include "Headers/ratelimit.h"
+
+#include <time.h>
+
+uint64_t MonotonicNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+void TokenBucketInit(TokenBucket* bucket, unsigned int rate, unsigned int burst)
+{
+    bucket->tokenNs = (rate > 0) ? 1000000000ULL / rate : 0;
+    bucket->burstNs = bucket->tokenNs * (burst > 0 ? burst : 1);
+    bucket->fullAt  = 0; // Full since forever
+}
+
+bool TokenBucketTake(TokenBucket* bucket)
+{
+    if (bucket->tokenNs == 0)
+        return true;
+
+    uint64_t now    = MonotonicNs();
+    uint64_t fullAt = __atomic_load_n(&bucket->fullAt, __ATOMIC_RELAXED);
+    while (1)
+    {
+        // A bucket that filled up in the past is just full
+        uint64_t from = (fullAt > now) ? fullAt : now;
+
+        // Taking a token would need more than a full bucket
+        if (from + bucket->tokenNs - now > bucket->burstNs)
+            return false;
+
+        if (__atomic_compare_exchange_n(&bucket->fullAt, &fullAt, from + bucket->tokenNs,
+                                        true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return true;
+    }
+}
@@ -0,0 +1,237 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       reactor.c
+ * @brief      event loop. Owns sockets and calls their handlers when ready
+ *
+ * @note
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#include "Headers/reactor.h"
+#include "Headers/uring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <arpa/inet.h>
+
+ReactorBackend reactorBackend = k_rbEpoll;
+
+int ReactorCreate(Reactor* reactor)
+{
+    memset(reactor, 0, sizeof(Reactor));
+    reactor->epfd = -1;
+
+    // Kernels without io_uring (or with it turned off) still get a working loop
+    if (reactorBackend == k_rbUring && UringCreate(reactor) == 0) {
+        reactor->running = true;
+        return 0;
+    }
+
+    reactor->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor->epfd < 0)
+        return -1;
+
+    reactor->running = true;
+    return 0;
+}
+
+const char* ReactorBackendName(Reactor* reactor)
+{
+    return (reactor->uring != NULL) ? "io_uring" : "epoll";
+}
+
+int ReactorAdd(Reactor* reactor, ReactorWatch* watch)
+{
+    if (reactor->uring != NULL)
+        return UringAdd(reactor, watch);
+
+    ReactorCountSyscall(reactor);
+
+    struct epoll_event event = {0};
+    event.events   = watch->events;
+    event.data.ptr = (void*)watch;
+
+    return epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, watch->fd, &event);
+}
+
+int ReactorModify(Reactor* reactor, ReactorWatch* watch, unsigned int events)
+{
+    if (reactor->uring != NULL)
+        return UringModify(reactor, watch, events);
+
+    ReactorCountSyscall(reactor);
+
+    struct epoll_event event = {0};
+    event.events   = events;
+    event.data.ptr = (void*)watch;
+
+    watch->events = events;
+    return epoll_ctl(reactor->epfd, EPOLL_CTL_MOD, watch->fd, &event);
+}
+
+void ReactorRemove(Reactor* reactor, ReactorWatch* watch)
+{
+    if (reactor->uring != NULL) {
+        UringRemove(reactor, watch);
+        return;
+    }
+
+    ReactorCountSyscall(reactor);
+
+    // Kernels before 2.6.9 require a non-null event even for a delete
+    struct epoll_event event = {0};
+    epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, watch->fd, &event);
+}
+
+int ReactorAddTimer(Reactor* reactor, ReactorWatch* watch, unsigned int intervalMs)
+{
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (tfd < 0)
+        return -1;
+
+    struct itimerspec interval = {0};
+    interval.it_interval.tv_sec  = intervalMs / 1000;
+    interval.it_interval.tv_nsec = (long)(intervalMs % 1000) * 1000000L;
+    interval.it_value            = interval.it_interval;
+
+    if (timerfd_settime(tfd, 0, &interval, NULL) != 0) {
+        close(tfd);
+        return -1;
+    }
+
+    watch->fd     = tfd;
+    watch->events = REACTOR_READ;
+
+    if (ReactorAdd(reactor, watch) != 0) {
+        close(tfd);
+        return -1;
+    }
+
+    return 0;
+}
+
+void ReactorTimerAcknowledge(ReactorWatch* watch)
+{
+    // Amount of ticks since the last read. Only used to clear the timer
+    uint64_t ticks = 0;
+    while (read(watch->fd, &ticks, sizeof(ticks)) < 0 && errno == EINTR)
+        ;
+}
+
+/**
+ * @brief           Wait for ready sockets and call their handlers
+ * @param[in]       reactor: the event loop to run
+ * @return          void
+ */
+void ReactorRun(Reactor* reactor)
+{
+    if (reactor->uring != NULL) {
+        UringRun(reactor);
+        return;
+    }
+
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+
+    while (reactor->running)
+    {
+        ReactorCountSyscall(reactor);
+
+        int ready = epoll_wait(reactor->epfd, events, REACTOR_MAX_EVENTS, -1);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+
+            fprintf(stderr, "epoll_wait() failed. Error Code %i\n", errno);
+            break;
+        }
+
+        for (int i = 0; i < ready; i++)
+        {
+            ReactorWatch* watch = (ReactorWatch*)events[i].data.ptr;
+            watch->handler(reactor, events[i].events, watch->context);
+        }
+    }
+}
+
+bool ReactorQueuesSends(Reactor* reactor)
+{
+    return reactor->uring != NULL;
+}
+
+bool ReactorReceives(Reactor* reactor)
+{
+    return reactor->uring != NULL && UringReceives(reactor);
+}
+
+int ReactorSendMessage(Reactor* reactor, ReactorOperation* operation, int fd, struct msghdr* message, int flags)
+{
+    if (reactor->uring == NULL)
+        return -1;
+
+    return UringSendMessage(reactor, operation, fd, message, flags);
+}
+
+void ReactorSubmit(Reactor* reactor)
+{
+    if (reactor->uring != NULL)
+        UringSubmit(reactor);
+}
+
+void ReactorCountSyscall(Reactor* reactor)
+{
+    __atomic_add_fetch(&reactor->syscalls, 1, __ATOMIC_RELAXED);
+}
+
+int SetSocketNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return -1;
+
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+void RaiseOpenFileLimit()
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+        return;
+
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+bool SocketPeerAllowed(int fd, const struct in_addr* allowed, unsigned int count)
+{
+    struct sockaddr_in peer = {0};
+    socklen_t          size = sizeof(peer);
+    if (getpeername(fd, (struct sockaddr*)&peer, &size) != 0 || peer.sin_family != AF_INET)
+        return false;
+
+    // All of 127.0.0.0/8 is this machine
+    if ((ntohl(peer.sin_addr.s_addr) >> 24) == 127)
+        return true;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (allowed[i].s_addr == peer.sin_addr.s_addr)
+            return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,1798 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       relay.c
+ * @brief      relay process passing rooms on to clients of its own
+ *
+ * @note
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#include "Headers/relay.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "Headers/flags.h"
+#include "Headers/min_max_values.h"
+#include "Headers/protocol.h"
+#include "Headers/ratelimit.h"
+#include "Headers/reactor.h"
+
+struct sockaddr_in relayUpstreams[RELAY_MAX_UPSTREAMS];
+unsigned int       relayUpstreamCount = 0;
+
+struct in_addr relayPeers[RELAY_MAX_PEERS];
+unsigned int   relayPeerCount = 0; // Only relays on this machine
+
+// Socket clients and relays below this one connect to
+static int relayListenerFd = -1;
+
+// Accepts, reads joins and sends what is queued for sockets that were full, upstream and down
+static Reactor      relayReactor        = {0};
+static ReactorWatch relayListenWatch    = {0};
+static ReactorWatch relayJoinSweepWatch = {0};
+
+// Reads what clients and relays below send once they joined
+static Reactor relayReaders = {0};
+
+// Handles joins once their frame is in. Attaching a room can take a while
+static WorkPool relayWorkers = {0};
+
+// Rooms passed on right now by id. Guards every RelayRoom too
+static HashMap         relayRooms;
+static pthread_mutex_t relayLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Broadcast with relayLock held whenever a room is done attaching, whether it worked or not
+static pthread_cond_t relayAttachDone = PTHREAD_COND_INITIALIZER;
+
+/*
+    What a room sent when a relay attached to it.
+*/
+typedef struct RelayAttachmentStr
+{
+    int          fd;                            // Socket to the room
+    FrameStream  stream;                        // Whatever the room sends next is read from here
+    char*        info;                          // Body of the reply without the history numbers
+    size_t       infoLength;                    // Bytes in 'info'
+    unsigned int historyLimit;                  // Frames of history the room keeps
+    SharedFrame* backlog[RELAY_HISTORY_LENGTH]; // History of the room, oldest first
+    unsigned int backlogCount;                  // Frames in 'backlog'
+    unsigned int clientRate;                    // Requests a second the room lets each client make
+} RelayAttachment;
+
+/*
+    Handed to the thread reading from upstream.
+*/
+typedef struct RelayUpstreamStr
+{
+    RelayRoom*      room;       // Room it reads for
+    RelayAttachment attachment; // What the room sent so far
+} RelayUpstream;
+
+/*
+    A connection below the relay that hasn't sent its join yet.
+    Watched by the reactor until the frame is in, then handed to
+    a worker. Hung up on after RELAY_JOIN_TIMEOUT_SEC.
+*/
+typedef struct RelayPendingJoinStr
+{
+    ReactorWatch                watch;    // Registration on the relay's reactor
+    FrameStream                 stream;   // Received bytes. The join frame comes first
+    uint64_t                    deadline; // MonotonicNs() the join frame has to be in by
+    struct RelayPendingJoinStr* previous; // Joins waiting longer. Reactor thread only
+    struct RelayPendingJoinStr* next;     // Joins waiting less long. Reactor thread only
+} RelayPendingJoin;
+
+/*
+    A client or relay below that joined a room through this relay.
+
+    Nobody gets a thread of their own. Every socket below is
+    watched by one reactor and what they send is handled as it
+    arrives. It holds a reference to the room and to the outbound
+    queue, which owns the socket, until they leave.
+*/
+typedef struct RelayDownstreamStr
+{
+    ReactorWatch   watch;                              // Registration on the reactor reading them
+    RelayRoom*     room;                               // Room they are in
+    OutboundQueue* queue;                              // What the room sends them
+    bool           isRelay;                            // Relays pass on their clients' messages, not requests
+    char           handle[kMaxClientHandleLength + 1]; // Clients only
+    bool           done;                               // Hung up or left. Freed once what is buffered was handled
+    FrameStream    stream;                             // Received bytes not handled yet
+    TokenBucket    requestLimit;                       // Requests a second they can make. Clients only
+    uint64_t       lastThrottleNs;                     // Last time they were told they are throttled
+} RelayDownstream;
+
+/*
+    Someone in a room through this relay, or joining it. A client
+    of its own or of a relay below, registered with the room upstream
+    by handle. Clients of this relay aren't read until the room lets
+    them in and hold the reference to the room and their queue their
+    reader takes over then. Guarded by relayLock.
+*/
+typedef struct RelayMemberStr
+{
+    char           handle[kMaxClientHandleLength + 1]; // Their key in the room's 'handles'
+    OutboundQueue* queue;                              // Theirs, or the one of the relay below they came through
+    bool           relayed;                            // Client of a relay below. The room's answer is passed down to it
+    bool           admitted;                           // The room let them in
+    uint32_t       requestId;                          // Of their join. Clients only
+    FrameStream    stream;                             // Clients only. What they sent after their join, until they are read
+} RelayMember;
+
+/*
+    A client of this relay the room let in, taken off 'handles'
+    for their reader to be started outside relayLock.
+*/
+typedef struct RelayAdmittedStr
+{
+    char           handle[kMaxClientHandleLength + 1]; // Who they are
+    OutboundQueue* queue;                              // Theirs. The reference their reader takes over
+    FrameStream    stream;                             // What they sent after their join
+} RelayAdmitted;
+
+/*
+    Frame naming clients to the room, or answering for them, filled
+    up to RELAY_HANDLE_BATCH at a time. Thousands of clients registered
+    at once take a few frames instead of filling the queue it goes to.
+*/
+typedef struct RelayBatchStr
+{
+    FrameWriter    writer;  // Frame being filled
+    FrameKind      kind;    // Requests name clients. Replies also say if each can join
+    int            command; // k_cfRelayClientJoined or k_cfRelayClientLeft
+    OutboundQueue* queue;   // Where it goes. NULL if nowhere right now
+    unsigned int   count;   // Clients in the frame so far
+} RelayBatch;
+
+// Joins waiting for their frame, oldest first. Reactor thread only
+static RelayPendingJoin* relayJoinsOldest = NULL;
+static RelayPendingJoin* relayJoinsNewest = NULL;
+
+static void RelayAnswerRegistration(RelayRoom* room, FrameReader* reader);
+
+/*
+    Drop a reference to 'room'. Its memory is
+    freed once nobody holds it.
+*/
+static void RelayRoomRelease(RelayRoom* room)
+{
+    pthread_mutex_lock(&relayLock);
+    bool last = --room->references == 0;
+    pthread_mutex_unlock(&relayLock);
+
+    if (!last)
+        return;
+
+    for (unsigned int i = 0; i < room->historyCount; i++)
+        SharedFrameRelease(room->history[(room->historyHead + i) % RELAY_HISTORY_LENGTH]);
+
+    // Said while it was reattaching to an upstream that never came
+    for (unsigned int i = 0; i < room->heldCount; i++)
+        SharedFrameRelease(room->held[i]);
+
+    // Only ones that left with a relay below or were turned away are gone by now
+    for (size_t i = 0; i < room->handles.capacity; i++)
+    {
+        if (room->handles.entries[i].used)
+            free(room->handles.entries[i].value);
+    }
+
+    FanOutListRelease(room->recipients);
+    HashMapFree(&room->handles);
+    free(room->downstream);
+    free(room->info);
+    free(room);
+}
+
+/*
+    Shared copy of a frame that was received, byte
+    for byte the same as it was sent, to pass it on.
+    Caller releases the frame. NULL on failure.
+*/
+static SharedFrame* RelayCopyFrame(FrameHeader* header, FrameReader* reader)
+{
+    FrameWriter writer = {0};
+    FrameBegin(&writer, (FrameKind)header->kind, header->command, header->requestId);
+    FramePutBytes(&writer, reader->data, reader->length);
+
+    SharedFrame* frame = SharedFrameCreate(&writer);
+    FrameWriterFree(&writer);
+    return frame;
+}
+
+/*
+    Lane a frame the room sent waits in. The
+    same one the room itself pushed it in.
+*/
+static PriorityLane RelayFrameLane(int command)
+{
+    return (command == k_cfPrintServerAnnouncement || command == k_cfConnectedServerShutDown) ? k_plControl : k_plChat;
+}
+
+static bool RelaySameFrame(SharedFrame* a, SharedFrame* b)
+{
+    return a->length == b->length && memcmp(a->data, b->data, a->length) == 0;
+}
+
+static void RelayAttachmentFree(RelayAttachment* attachment)
+{
+    for (unsigned int i = 0; i < attachment->backlogCount; i++)
+        SharedFrameRelease(attachment->backlog[i]);
+
+    free(attachment->info);
+    attachment->backlogCount = 0;
+    attachment->info         = NULL;
+}
+
+/*
+    Attach to room 'roomId' through relayUpstreams[upstreamIndex] and
+    read its reply and history into 'attachment'. The socket is left
+    in 'attachment' for the room to be read from. Relays are sent frames
+    in the order the room recorded them, so the history comes right
+    after the reply and everything after it is new.
+    Returns false if the upstream couldn't be reached or refused.
+*/
+static bool RelayAttach(uint64_t roomId, unsigned int upstreamIndex, RelayAttachment* attachment)
+{
+    memset(attachment, 0, sizeof(RelayAttachment));
+
+    DialPolicy policy = RELAY_DIAL_POLICY;
+    DialResult dialed;
+    if (!Dial(&relayUpstreams[upstreamIndex], 1, &policy, &dialed))
+        return false;
+
+    attachment->fd = dialed.fd;
+
+    // An upstream that accepts and never answers can't hold the room up forever
+    struct timeval timeout = { .tv_sec = RELAY_JOIN_TIMEOUT_SEC };
+    setsockopt(attachment->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    FrameWriter request = {0};
+    FrameBegin(&request, k_fkRequest, k_cfAttachRelayToServer, 1);
+    FramePutU64(&request, roomId);
+
+    bool sent = FrameFinish(&request) && FrameSend(attachment->fd, &request) == 0;
+    FrameWriterFree(&request);
+    FrameStreamInit(&attachment->stream, attachment->fd);
+
+    // Frames of history still to come. Unknown until the reply is in
+    long        expected = sent ? -1 : 0;
+    FrameHeader header   = {0};
+    FrameReader reader;
+    while (expected != 0)
+    {
+        if (FrameStreamNext(&attachment->stream, &header, &reader) != 0) {
+            sent = false;
+            break;
+        }
+
+        if (header.kind == k_fkReply) {
+            // How much history the room keeps, how much follows and the client rate are at the end. Clients aren't sent them
+            ResponseCode rcode = (ResponseCode)(int32_t)FrameGetU32(&reader);
+            size_t       tail  = 2 * sizeof(uint16_t) + sizeof(uint32_t);
+            if (rcode != k_rcRootOperationSuccessful || reader.length < sizeof(uint32_t) + tail) {
+                sent = false;
+                break;
+            }
+
+            attachment->infoLength = reader.length - tail;
+            attachment->info       = malloc(attachment->infoLength);
+            if (attachment->info == NULL) {
+                sent = false;
+                break;
+            }
+
+            memcpy(attachment->info, reader.data, attachment->infoLength);
+            reader.offset            = attachment->infoLength;
+            attachment->historyLimit = FrameGetU16(&reader);
+            expected                 = FrameGetU16(&reader);
+            attachment->clientRate   = FrameGetU32(&reader);
+            continue;
+        }
+
+        if (header.kind != k_fkPush || expected < 0)
+            continue;
+
+        expected--;
+        SharedFrame* frame = RelayCopyFrame(&header, &reader);
+        if (frame != NULL && attachment->backlogCount < RELAY_HISTORY_LENGTH)
+            attachment->backlog[attachment->backlogCount++] = frame;
+        else
+            SharedFrameRelease(frame);
+    }
+
+    if (!sent) {
+        RelayAttachmentFree(attachment);
+        FrameStreamFree(&attachment->stream);
+        close(attachment->fd);
+        return false;
+    }
+
+    // Rooms can be quiet for as long as they like
+    struct timeval noTimeout = {0};
+    setsockopt(attachment->fd, SOL_SOCKET, SO_RCVTIMEO, &noTimeout, sizeof(noTimeout));
+
+    if (attachment->historyLimit > RELAY_HISTORY_LENGTH)
+        attachment->historyLimit = RELAY_HISTORY_LENGTH;
+    return true;
+}
+
+/*
+    Remember 'frame' as the newest frame the room sent.
+    relayLock must be held unless nobody else has the room yet.
+*/
+static void RelayRecordLocked(RelayRoom* room, SharedFrame* frame)
+{
+    if (room->historyLimit == 0)
+        return;
+
+    if (room->historyCount == room->historyLimit) {
+        SharedFrameRelease(room->history[room->historyHead]);
+        room->historyHead = (room->historyHead + 1) % RELAY_HISTORY_LENGTH;
+        room->historyCount--;
+    }
+
+    room->history[(room->historyHead + room->historyCount) % RELAY_HISTORY_LENGTH] = SharedFrameRetain(frame);
+    room->historyCount++;
+}
+
+/*
+    Fan 'frame' out to everyone downstream of 'room'.
+    Only the thread reading from upstream calls this, so
+    everyone gets the frames in the order the room sent them.
+*/
+static void RelayPassOn(RelayRoom* room, SharedFrame* frame, int command)
+{
+    pthread_mutex_lock(&relayLock);
+
+    // Clients who join later hear about it from the room, not from history
+    if (command == k_cfConnectedServerShutDown)
+        room->shutDown = true;
+    else
+        RelayRecordLocked(room, frame);
+
+    if (room->recipients == NULL && room->downstreamCount > 0)
+        room->recipients = FanOutListCreate(room->downstream, room->downstreamCount, 1);
+
+    FanOutList* recipients = (room->recipients != NULL) ? FanOutListRetain(room->recipients) : NULL;
+    pthread_mutex_unlock(&relayLock);
+
+    if (recipients != NULL)
+        FanOutQueued(frame, recipients->queues, (int)recipients->count, RelayFrameLane(command));
+
+    FanOutListRelease(recipients);
+}
+
+/*
+    How many of the oldest frames of 'backlog' were already passed on,
+    found by where the newest frames 'room' remembers show up in it.
+    Everything after them was missed. relayLock must be held.
+*/
+static unsigned int RelaySeenLocked(RelayRoom* room, SharedFrame** backlog, unsigned int backlogCount)
+{
+    if (room->historyCount == 0)
+        return 0;
+
+    // Newest matching run first. Frames are compared as bytes
+    for (unsigned int end = backlogCount; end > 0; end--)
+    {
+        unsigned int compared = (end < room->historyCount) ? end : room->historyCount;
+        bool         same     = true;
+        for (unsigned int i = 0; i < compared && same; i++)
+        {
+            SharedFrame* remembered = room->history[(room->historyHead + room->historyCount - 1 - i) % RELAY_HISTORY_LENGTH];
+            same = RelaySameFrame(backlog[end - 1 - i], remembered);
+        }
+
+        if (same)
+            return end;
+    }
+
+    return 0;
+}
+
+/*
+    Send what 'batch' holds and start over.
+*/
+static void RelayBatchSend(RelayBatch* batch)
+{
+    if (batch->count == 0)
+        return;
+
+    batch->count = 0;
+    if (batch->queue == NULL)
+        return;
+
+    // Chat lane like messages, so nobody is let go of before what they said
+    SharedFrame* frame = SharedFrameCreate(&batch->writer);
+    if (frame != NULL)
+        OutboundQueuePush(batch->queue, frame, k_plChat);
+    SharedFrameRelease(frame);
+}
+
+/*
+    Add the client 'handle' to 'batch'. 'rcode' is only
+    sent in replies. Sent once RELAY_HANDLE_BATCH are in.
+*/
+static void RelayBatchPut(RelayBatch* batch, const char* handle, ResponseCode rcode)
+{
+    if (batch->count == 0)
+        FrameBegin(&batch->writer, batch->kind, batch->command, 0);
+
+    FramePutString(&batch->writer, handle);
+    if (batch->kind == k_fkReply)
+        FramePutU32(&batch->writer, (uint32_t)rcode);
+
+    if (++batch->count == RELAY_HANDLE_BATCH)
+        RelayBatchSend(batch);
+}
+
+/*
+    Send whatever is left in 'batch' and free it.
+*/
+static void RelayBatchFinish(RelayBatch* batch)
+{
+    RelayBatchSend(batch);
+    FrameWriterFree(&batch->writer);
+}
+
+/*
+    Tell the room upstream 'member' joined or left. Not sent
+    while the room is between upstreams. Everyone still in
+    is registered again once it is attached. relayLock must be held.
+*/
+static void RelaySendMemberLocked(RelayRoom* room, RelayMember* member, int command)
+{
+    RelayBatch batch = { .kind = k_fkRequest, .command = command, .queue = room->upstream };
+    RelayBatchPut(&batch, member->handle, k_rcRootOperationSuccessful);
+    RelayBatchFinish(&batch);
+}
+
+/*
+    Register everyone in 'room' through this relay with
+    the upstream it was just attached to. relayLock must be held.
+*/
+static void RelayRegisterAllLocked(RelayRoom* room)
+{
+    RelayBatch batch = { .kind = k_fkRequest, .command = k_cfRelayClientJoined, .queue = room->upstream };
+    for (size_t i = 0; i < room->handles.capacity; i++)
+    {
+        if (room->handles.entries[i].used)
+            RelayBatchPut(&batch, ((RelayMember*)room->handles.entries[i].value)->handle, k_rcRootOperationSuccessful);
+    }
+
+    RelayBatchFinish(&batch);
+}
+
+/*
+    Let go of every client of the relay below on 'queue' and
+    tell the room they left. relayLock must be held.
+*/
+static void RelayDropRelayedLocked(RelayRoom* room, OutboundQueue* queue)
+{
+    RelayBatch batch = { .kind = k_fkRequest, .command = k_cfRelayClientLeft, .queue = room->upstream };
+
+    // Removing shifts entries back, so whatever lands in a slot is looked at again
+    size_t i = 0;
+    while (i < room->handles.capacity)
+    {
+        RelayMember* member = (RelayMember*)room->handles.entries[i].value;
+        if (!room->handles.entries[i].used || member->queue != queue) {
+            i++;
+            continue;
+        }
+
+        HashMapRemove(&room->handles, member->handle);
+        RelayBatchPut(&batch, member->handle, k_rcRootOperationSuccessful);
+        free(member);
+    }
+
+    RelayBatchFinish(&batch);
+}
+
+/*
+    Send what was said below 'room' while it was between upstreams
+    to the one it was just attached to. After everyone was registered
+    again, so the room knows who said it. relayLock must be held.
+*/
+static void RelaySendHeldLocked(RelayRoom* room)
+{
+    if (room->heldCount == 0)
+        return;
+
+    OutboundQueuePushBatch(room->upstream, room->held, (int)room->heldCount, k_plChat);
+    for (unsigned int i = 0; i < room->heldCount; i++)
+        SharedFrameRelease(room->held[i]);
+
+    room->heldCount = 0;
+}
+
+/*
+    Pass a k_cfClientMessageDropped from upstream on to the
+    client it names, or to the relay below they came through.
+    Nobody else in the room hears about it.
+*/
+static void RelayPassOnDropped(RelayRoom* room, FrameHeader* header, FrameReader* reader)
+{
+    SharedFrame* frame = RelayCopyFrame(header, reader);
+    char         handle[kMaxClientHandleLength + 1] = {0};
+    FrameGetString(reader, handle, sizeof(handle));
+    if (frame == NULL || reader->failed) {
+        SharedFrameRelease(frame);
+        return;
+    }
+
+    pthread_mutex_lock(&relayLock);
+    RelayMember* member = (RelayMember*)HashMapGet(&room->handles, handle);
+    if (member != NULL && (member->relayed || member->admitted))
+        OutboundQueuePush(member->queue, frame, k_plControl);
+    pthread_mutex_unlock(&relayLock);
+
+    SharedFrameRelease(frame);
+}
+
+/*
+    Let go of 'room' upstream once nobody is in it through this
+    relay or waiting to be let in. Wakes the thread reading from
+    upstream, which sees the room was let go of. relayLock must be held.
+*/
+static void RelayLetGoIfEmptyLocked(RelayRoom* room)
+{
+    if (room->downstreamCount > 0 || room->joining > 0 || room->closed)
+        return;
+
+    room->closed = true;
+    HashMapRemoveId(&relayRooms, room->roomId);
+    room->references--; // The map's
+
+    if (room->upstream != NULL)
+        OutboundQueueClose(room->upstream);
+}
+
+/*
+    Turn away a client of this relay the room didn't let in,
+    already taken out of 'handles', with 'rcode' and let go of
+    their queue, what they sent and their reference to 'room'.
+*/
+static void RelayRefuseMember(RelayRoom* room, RelayMember* member, ResponseCode rcode)
+{
+    FrameWriter writer = {0};
+    FrameBegin(&writer, k_fkReply, k_cfAddClientToServer, member->requestId);
+    FramePutU32(&writer, (uint32_t)rcode);
+
+    SharedFrame* reply = SharedFrameCreate(&writer);
+    FrameWriterFree(&writer);
+    if (reply != NULL)
+        OutboundQueuePush(member->queue, reply, k_plControl);
+    SharedFrameRelease(reply);
+
+    // The reply is sent before the socket closes
+    OutboundQueueClose(member->queue);
+    OutboundQueueRelease(member->queue);
+    FrameStreamFree(&member->stream);
+    RelayRoomRelease(room);
+    free(member);
+}
+
+/*
+    The upstream of 'room' went away. Attach to the next one that
+    answers and pass on what was missed while it was gone.
+    'stream' is set to read from the new upstream.
+    Returns false if the room is gone or no upstream would take it.
+*/
+static bool RelayReattach(RelayRoom* room, FrameStream* stream)
+{
+    pthread_mutex_lock(&relayLock);
+    bool           gone     = room->closed || room->shutDown;
+    OutboundQueue* previous = room->upstream;
+    room->upstream = NULL;
+    pthread_mutex_unlock(&relayLock);
+
+    if (previous != NULL) {
+        OutboundQueueClose(previous);
+        OutboundQueueRelease(previous);
+    }
+
+    for (unsigned int round = 0; !gone && round < RELAY_REATTACH_ROUNDS; round++)
+    {
+        // The next upstream first. The one that went away is tried last
+        for (unsigned int i = 1; i <= relayUpstreamCount; i++)
+        {
+            unsigned int    index = (room->upstreamIndex + i) % relayUpstreamCount;
+            RelayAttachment attachment;
+            if (!RelayAttach(room->roomId, index, &attachment))
+                continue;
+
+            OutboundQueue* upstream = OutboundQueueCreate(&relayReactor, attachment.fd, k_opDropOldest);
+            if (upstream == NULL) {
+                RelayAttachmentFree(&attachment);
+                FrameStreamFree(&attachment.stream);
+                close(attachment.fd);
+                continue;
+            }
+
+            pthread_mutex_lock(&relayLock);
+            unsigned int seen = RelaySeenLocked(room, attachment.backlog, attachment.backlogCount);
+            gone = room->closed;
+            if (!gone) {
+                room->upstream      = upstream;
+                room->upstreamIndex = index;
+                room->clientRate    = attachment.clientRate;
+
+                // Under the lock so nobody joining, leaving or talking is passed on out of order
+                RelayRegisterAllLocked(room);
+                RelaySendHeldLocked(room);
+            }
+            pthread_mutex_unlock(&relayLock);
+
+            // Everyone left while it was reattaching
+            if (gone) {
+                RelayAttachmentFree(&attachment);
+                FrameStreamFree(&attachment.stream);
+                OutboundQueueClose(upstream);
+                OutboundQueueRelease(upstream);
+                return false;
+            }
+
+            for (unsigned int missed = seen; missed < attachment.backlogCount; missed++)
+            {
+                FrameHeader header;
+                FrameParse(attachment.backlog[missed]->data, attachment.backlog[missed]->length, &header);
+                RelayPassOn(room, attachment.backlog[missed], header.command);
+            }
+
+            printf("[relay] Room %" PRIu64 " reattached through upstream %u. %u missed frames passed on\n",
+                   room->roomId, index, attachment.backlogCount - seen);
+
+            *stream = attachment.stream;
+            RelayAttachmentFree(&attachment);
+            return true;
+        }
+
+        usleep(RELAY_REATTACH_DELAY_MS * 1000);
+
+        pthread_mutex_lock(&relayLock);
+        gone = room->closed;
+        pthread_mutex_unlock(&relayLock);
+    }
+
+    return false;
+}
+
+/*
+    Stop passing on 'room' and hang up on everyone downstream.
+    Their threads leave the room as they wake up.
+*/
+static void RelayCloseRoom(RelayRoom* room)
+{
+    SharedFrame*  notice       = NULL;
+    RelayMember** refused      = NULL;
+    unsigned int  refusedCount = 0;
+
+    pthread_mutex_lock(&relayLock);
+    if (!room->closed) {
+        room->closed = true;
+        HashMapRemoveId(&relayRooms, room->roomId);
+        room->references--; // The map's
+    }
+
+    // Clients waiting for the room to let them in never will be
+    if (room->joining > 0)
+        refused = malloc(room->joining * sizeof(RelayMember*));
+
+    size_t i = 0;
+    while (refused != NULL && i < room->handles.capacity)
+    {
+        RelayMember* member = (RelayMember*)room->handles.entries[i].value;
+        if (!room->handles.entries[i].used || member->relayed || member->admitted) {
+            i++;
+            continue;
+        }
+
+        HashMapRemove(&room->handles, member->handle);
+        refused[refusedCount++] = member;
+        room->joining--;
+    }
+
+    // The room didn't say it shut down, but nobody will hear from it again
+    if (!room->shutDown) {
+        FrameWriter writer = {0};
+        FrameBegin(&writer, k_fkPush, k_cfConnectedServerShutDown, 0);
+        FramePutString(&writer, "");
+        FramePutLongString(&writer, "");
+        notice = SharedFrameCreate(&writer);
+        FrameWriterFree(&writer);
+    }
+
+    for (unsigned int i = 0; i < room->downstreamCount; i++)
+    {
+        if (notice != NULL)
+            OutboundQueuePush(room->downstream[i], notice, k_plControl);
+
+        OutboundQueueClose(room->downstream[i]);
+    }
+
+    OutboundQueue* upstream = room->upstream;
+    room->upstream = NULL;
+    pthread_mutex_unlock(&relayLock);
+
+    SharedFrameRelease(notice);
+    if (upstream != NULL) {
+        OutboundQueueClose(upstream);
+        OutboundQueueRelease(upstream);
+    }
+
+    for (unsigned int j = 0; j < refusedCount; j++)
+        RelayRefuseMember(room, refused[j], k_rcInternalServerError);
+    free(refused);
+}
+
+/**
+ * @brief           Read what a room sends from upstream and pass it on
+ * @param[in]       argument: malloc'd RelayUpstream of the room
+ * @return          void*
+ * @retval          NULL once the room is gone
+ */
+static void* RelayListenUpstream(void* argument)
+{
+    RelayUpstream* info   = (RelayUpstream*)argument;
+    RelayRoom*     room   = info->room;
+    FrameStream    stream = info->attachment.stream;
+    RelayAttachmentFree(&info->attachment);
+    free(info);
+
+    do
+    {
+        FrameHeader header = {0};
+        FrameReader reader;
+        while (FrameStreamNext(&stream, &header, &reader) == 0)
+        {
+            // Whether someone registered through this relay can join
+            if (header.kind == k_fkReply && header.command == k_cfRelayClientJoined) {
+                RelayAnswerRegistration(room, &reader);
+                continue;
+            }
+
+            // Only for whoever sent what was dropped
+            if (header.kind == k_fkPush && header.command == k_cfClientMessageDropped) {
+                RelayPassOnDropped(room, &header, &reader);
+                continue;
+            }
+
+            if (header.kind != k_fkPush)
+                continue;
+
+            SharedFrame* frame = RelayCopyFrame(&header, &reader);
+            if (frame == NULL)
+                continue;
+
+            RelayPassOn(room, frame, header.command);
+            SharedFrameRelease(frame);
+        }
+
+        FrameStreamFree(&stream);
+    } while (RelayReattach(room, &stream));
+
+    printf("[relay] Stopped passing on room %" PRIu64 "\n", room->roomId);
+    RelayCloseRoom(room);
+    RelayRoomRelease(room);
+    return NULL;
+}
+
+/*
+    Attach 'room', just put in the map by RelayGetRoom(), through
+    the first upstream that takes it and start passing it on. No lock
+    is held meanwhile, so other rooms are attached alongside it and
+    joins of this one wait on relayAttachDone.
+    Returns false if no upstream took it. The room is closed then.
+*/
+static bool RelayAttachRoom(RelayRoom* room)
+{
+    RelayUpstream* info  = calloc(1, sizeof(RelayUpstream));
+    unsigned int   index = 0;
+    while (info != NULL && index < relayUpstreamCount && !RelayAttach(room->roomId, index, &info->attachment))
+        index++;
+
+    bool           attached = info != NULL && index < relayUpstreamCount;
+    OutboundQueue* upstream = attached ? OutboundQueueCreate(&relayReactor, info->attachment.fd, k_opDropOldest) : NULL;
+    if (upstream == NULL) {
+        if (attached) {
+            RelayAttachmentFree(&info->attachment);
+            FrameStreamFree(&info->attachment.stream);
+            close(info->attachment.fd);
+        }
+        free(info);
+
+        pthread_mutex_lock(&relayLock);
+        room->attaching = false;
+        pthread_cond_broadcast(&relayAttachDone);
+        pthread_mutex_unlock(&relayLock);
+
+        RelayCloseRoom(room);
+        return false;
+    }
+
+    pthread_mutex_lock(&relayLock);
+    room->references++; // The thread reading from upstream
+    room->upstream      = upstream;
+    room->upstreamIndex = index;
+    room->info          = info->attachment.info;
+    room->infoLength    = info->attachment.infoLength;
+    room->historyLimit  = info->attachment.historyLimit;
+    room->clientRate    = info->attachment.clientRate;
+    info->attachment.info = NULL;
+    info->room            = room;
+
+    // Kept for whoever joins. Nobody could before now
+    for (unsigned int i = 0; i < info->attachment.backlogCount; i++)
+        RelayRecordLocked(room, info->attachment.backlog[i]);
+
+    room->attaching = false;
+    pthread_cond_broadcast(&relayAttachDone);
+    pthread_mutex_unlock(&relayLock);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, RelayListenUpstream, (void*)info) != 0) {
+        RelayAttachmentFree(&info->attachment);
+        FrameStreamFree(&info->attachment.stream);
+        free(info);
+        RelayCloseRoom(room);
+        RelayRoomRelease(room); // The thread's
+        return false;
+    }
+
+    pthread_detach(thread);
+    printf("[relay] Passing on room %" PRIu64 " from upstream %u\n", room->roomId, index);
+    return true;
+}
+
+/*
+    The room 'roomId' as passed on by this relay, attached to
+    if nobody joined it through here yet. Whoever comes first
+    attaches it and the rest wait for them. It may be closed if
+    that failed, which joining it refuses.
+    Returns it with a reference for the caller, or NULL.
+*/
+static RelayRoom* RelayGetRoom(uint64_t roomId)
+{
+    pthread_mutex_lock(&relayLock);
+    RelayRoom* room = (RelayRoom*)HashMapGetId(&relayRooms, roomId);
+    if (room != NULL) {
+        room->references++;
+
+        while (room->attaching)
+            pthread_cond_wait(&relayAttachDone, &relayLock);
+
+        pthread_mutex_unlock(&relayLock);
+        return room;
+    }
+
+    // In the map before attaching so the room is never attached twice
+    room = calloc(1, sizeof(RelayRoom));
+    bool listed = room != NULL && HashMapInit(&room->handles, 64);
+    if (listed && !HashMapPutId(&relayRooms, roomId, (void*)room)) {
+        HashMapFree(&room->handles);
+        listed = false;
+    }
+
+    if (!listed) {
+        pthread_mutex_unlock(&relayLock);
+        free(room);
+        return NULL;
+    }
+
+    // The map and the caller
+    room->references = 2;
+    room->roomId     = roomId;
+    room->attaching  = true;
+    pthread_mutex_unlock(&relayLock);
+
+    if (!RelayAttachRoom(room)) {
+        RelayRoomRelease(room);
+        return NULL;
+    }
+
+    return room;
+}
+
+/*
+    Add 'queue' downstream of 'room' and queue the reply to its
+    join and the history of the room. Clients were let in by the
+    room already. relayLock must be held.
+    Returns the response code of the join.
+*/
+static ResponseCode RelayJoinLocked(RelayRoom* room, OutboundQueue* queue, bool isRelay, uint32_t requestId)
+{
+    ResponseCode rcode = k_rcRootOperationSuccessful;
+
+    if (room->closed)
+        rcode = k_rcInternalServerError;
+    else if (room->downstreamCount == room->downstreamCapacity) {
+        unsigned int    capacity = (room->downstreamCapacity > 0) ? room->downstreamCapacity * 2 : 64;
+        OutboundQueue** grown    = realloc(room->downstream, capacity * sizeof(OutboundQueue*));
+        if (grown == NULL)
+            rcode = k_rcInternalServerError;
+        else {
+            room->downstream         = grown;
+            room->downstreamCapacity = capacity;
+        }
+    }
+
+    if (rcode == k_rcRootOperationSuccessful) {
+        // Relays below tell history from what's new by the order frames come in
+        if (isRelay)
+            OutboundQueueKeepOrder(queue);
+
+        room->downstream[room->downstreamCount++] = OutboundQueueRetain(queue);
+        FanOutListRelease(room->recipients);
+        room->recipients = NULL;
+
+        // The room's own reply. Relays below are told about the history that follows like this one was
+        FrameWriter writer = {0};
+        FrameBegin(&writer, k_fkReply, k_cfAddClientToServer, requestId);
+        FramePutBytes(&writer, room->info, room->infoLength);
+        if (isRelay) {
+            FramePutU16(&writer, (uint16_t)room->historyLimit);
+            FramePutU16(&writer, (uint16_t)room->historyCount);
+            FramePutU32(&writer, room->clientRate);
+        }
+
+        SharedFrame* backlog[RELAY_HISTORY_LENGTH + 1];
+        backlog[0] = SharedFrameCreate(&writer);
+        FrameWriterFree(&writer);
+
+        // Queued before anything else is passed on, oldest first
+        for (unsigned int i = 0; i < room->historyCount; i++)
+            backlog[i + 1] = room->history[(room->historyHead + i) % RELAY_HISTORY_LENGTH];
+
+        if (backlog[0] != NULL)
+            OutboundQueuePushBatch(queue, backlog, (int)room->historyCount + 1, k_plChat);
+        SharedFrameRelease(backlog[0]);
+    }
+
+    return rcode;
+}
+
+/*
+    Register the client 'handle' on 'queue' with 'room' upstream.
+    They are joined once it lets them in. Until then it holds the
+    callers references to the room and to 'queue', and 'received',
+    what they sent after their join frame.
+    Returns an error if they can't even ask, and the caller still
+    holds everything, or k_rcRootOperationSuccessful.
+*/
+static ResponseCode RelayRegisterClient(RelayRoom* room, OutboundQueue* queue, const char* handle, uint32_t requestId, FrameStream* received)
+{
+    ResponseCode rcode  = k_rcRootOperationSuccessful;
+    RelayMember* member = calloc(1, sizeof(RelayMember));
+    if (member == NULL)
+        return k_rcInternalServerError;
+
+    snprintf(member->handle, sizeof(member->handle), "%s", handle);
+    member->queue     = queue;
+    member->requestId = requestId;
+    member->stream    = *received;
+
+    pthread_mutex_lock(&relayLock);
+    if (room->closed)
+        rcode = k_rcInternalServerError;
+    else if (HashMapGet(&room->handles, member->handle) != NULL)
+        rcode = k_rcErrorHandleInUse; // Known without asking the room
+    else if (!HashMapPut(&room->handles, member->handle, (void*)member))
+        rcode = k_rcInternalServerError;
+    else {
+        room->joining++;
+        RelaySendMemberLocked(room, member, k_cfRelayClientJoined);
+    }
+    pthread_mutex_unlock(&relayLock);
+
+    if (rcode != k_rcRootOperationSuccessful)
+        free(member);
+
+    return rcode;
+}
+
+/*
+    Add 'queue' downstream of 'room' like RelayJoinLocked().
+*/
+static ResponseCode RelayJoin(RelayRoom* room, OutboundQueue* queue, bool isRelay, uint32_t requestId)
+{
+    pthread_mutex_lock(&relayLock);
+    ResponseCode rcode = RelayJoinLocked(room, queue, isRelay, requestId);
+    pthread_mutex_unlock(&relayLock);
+    return rcode;
+}
+
+/*
+    Take 'queue' out of 'room' and tell the room that the client
+    'handle', or every client of the relay below on 'queue' if it
+    is NULL, left. Once nobody is left the room is let go of upstream.
+*/
+static void RelayLeave(RelayRoom* room, OutboundQueue* queue, const char* handle)
+{
+    pthread_mutex_lock(&relayLock);
+    for (unsigned int i = 0; i < room->downstreamCount; i++)
+    {
+        if (room->downstream[i] != queue)
+            continue;
+
+        room->downstream[i] = room->downstream[--room->downstreamCount];
+        FanOutListRelease(room->recipients);
+        room->recipients = NULL;
+        OutboundQueueRelease(queue);
+        break;
+    }
+
+    RelayMember* member = (handle != NULL) ? (RelayMember*)HashMapGet(&room->handles, handle) : NULL;
+    if (member != NULL && member->queue == queue) {
+        HashMapRemove(&room->handles, handle);
+        RelaySendMemberLocked(room, member, k_cfRelayClientLeft);
+        free(member);
+    }
+    else if (handle == NULL)
+        RelayDropRelayedLocked(room, queue);
+
+    RelayLetGoIfEmptyLocked(room);
+    pthread_mutex_unlock(&relayLock);
+}
+
+/*
+    Send 'frame' to the room upstream. While the room is between
+    upstreams it is held until it is attached again, up to
+    RELAY_HELD_MESSAGES. Returns false if it was dropped.
+*/
+static bool RelayPushUpstream(RelayRoom* room, SharedFrame* frame)
+{
+    bool held = false;
+
+    pthread_mutex_lock(&relayLock);
+    OutboundQueue* upstream = (room->upstream != NULL) ? OutboundQueueRetain(room->upstream) : NULL;
+    if (upstream == NULL && !room->closed && room->heldCount < RELAY_HELD_MESSAGES) {
+        room->held[room->heldCount++] = SharedFrameRetain(frame);
+        held = true;
+    }
+    pthread_mutex_unlock(&relayLock);
+
+    if (upstream == NULL)
+        return held;
+
+    bool sent = OutboundQueuePush(upstream, frame, k_plChat) == 0;
+    OutboundQueueRelease(upstream);
+    return sent;
+}
+
+/*
+    Tell the client 'handle', of this relay or of the relay below
+    on 'queue', that what they said didn't reach the room. Laid out
+    like a message the room sends, so relays below can tell who it's for.
+*/
+static void RelayTellDropped(OutboundQueue* queue, const char* handle)
+{
+    FrameWriter writer = {0};
+    FrameBegin(&writer, k_fkPush, k_cfClientMessageDropped, 0);
+    FramePutString(&writer, handle);
+    FramePutLongString(&writer, "The Room Is Reconnecting. Your Message Wasn't Sent.");
+
+    SharedFrame* frame = SharedFrameCreate(&writer);
+    FrameWriterFree(&writer);
+    if (frame != NULL)
+        OutboundQueuePush(queue, frame, k_plControl);
+    SharedFrameRelease(frame);
+}
+
+/*
+    Tell a client what they sent was dropped for going over the
+    request rate of the room, like the room itself would. Only
+    once every RELAY_THROTTLE_NOTICE_MS.
+*/
+static void RelayThrottleClient(OutboundQueue* queue, uint64_t* lastNoticeNs)
+{
+    uint64_t now = MonotonicNs();
+    if (*lastNoticeNs != 0 && now - *lastNoticeNs < (uint64_t)RELAY_THROTTLE_NOTICE_MS * 1000000ULL)
+        return;
+
+    *lastNoticeNs = now;
+
+    // Laid out like any message a room sends its clients
+    FrameWriter writer = {0};
+    FrameBegin(&writer, k_fkPush, k_cfClientThrottled, 0);
+    FramePutString(&writer, "");
+    FramePutLongString(&writer, "You Are Sending Messages Too Fast. Slow Down.");
+
+    SharedFrame* frame = SharedFrameCreate(&writer);
+    FrameWriterFree(&writer);
+    if (frame != NULL)
+        OutboundQueuePush(queue, frame, k_plControl);
+    SharedFrameRelease(frame);
+}
+
+/*
+    Stop reading a client or relay below that hung up or left
+    and let go of their queue, the room and the reader.
+*/
+static void RelayCloseDownstream(RelayDownstream* reader)
+{
+    // Before the queue can close the socket
+    ReactorRemove(&relayReaders, &reader->watch);
+    FrameStreamFree(&reader->stream);
+    RelayLeave(reader->room, reader->queue, reader->isRelay ? NULL : reader->handle);
+
+    // Whatever is still queued for them is sent before the socket closes
+    OutboundQueueClose(reader->queue);
+    OutboundQueueRelease(reader->queue);
+    RelayRoomRelease(reader->room);
+    free(reader);
+}
+
+/*
+    Register clients of the relay below of 'reader' with the
+    room, or let go of them. Handles someone is already in with
+    through this relay are turned away without asking the room.
+*/
+static void RelayHandleRelayed(RelayDownstream* reader, FrameHeader* header, FrameReader* frame)
+{
+    RelayRoom* room    = reader->room;
+    bool       joining = header->command == k_cfRelayClientJoined;
+
+    pthread_mutex_lock(&relayLock);
+    RelayBatch upstream = { .kind = k_fkRequest, .command = header->command, .queue = room->upstream };
+    RelayBatch refused  = { .kind = k_fkReply, .command = k_cfRelayClientJoined, .queue = reader->queue };
+    while (FrameRemaining(frame) > 0)
+    {
+        char handle[kMaxClientHandleLength + 1] = {0};
+        FrameGetString(frame, handle, sizeof(handle));
+        if (frame->failed || handle[0] == '\0')
+            break;
+
+        RelayMember* member = (RelayMember*)HashMapGet(&room->handles, handle);
+        if (!joining) {
+            if (member != NULL && member->queue == reader->queue) {
+                HashMapRemove(&room->handles, handle);
+                RelayBatchPut(&upstream, handle, k_rcRootOperationSuccessful);
+                free(member);
+            }
+            continue;
+        }
+
+        ResponseCode rcode = k_rcRootOperationSuccessful;
+        if (room->closed)
+            rcode = k_rcInternalServerError;
+        else if (member != NULL)
+            rcode = k_rcErrorHandleInUse;
+        else if ((member = calloc(1, sizeof(RelayMember))) == NULL)
+            rcode = k_rcInternalServerError;
+        else {
+            snprintf(member->handle, sizeof(member->handle), "%s", handle);
+            member->queue   = reader->queue;
+            member->relayed = true;
+            if (!HashMapPut(&room->handles, member->handle, (void*)member)) {
+                free(member);
+                rcode = k_rcInternalServerError;
+            }
+        }
+
+        // Answered like the room would
+        if (rcode == k_rcRootOperationSuccessful)
+            RelayBatchPut(&upstream, handle, rcode);
+        else
+            RelayBatchPut(&refused, handle, rcode);
+    }
+
+    RelayBatchFinish(&upstream);
+    RelayBatchFinish(&refused);
+    pthread_mutex_unlock(&relayLock);
+}
+
+/*
+    Handle the next frame a client or relay
+    below sent. Buffered whole.
+*/
+static void RelayHandleDownstreamFrame(RelayDownstream* reader)
+{
+    FrameHeader header = {0};
+    FrameReader frame;
+    if (FrameStreamNext(&reader->stream, &header, &frame) != 0) {
+        reader->done = true;
+        return;
+    }
+
+    if (header.kind != k_fkRequest)
+        return;
+
+    if (reader->isRelay) {
+        if (header.command == k_cfRelayClientJoined || header.command == k_cfRelayClientLeft) {
+            RelayHandleRelayed(reader, &header, &frame);
+            return;
+        }
+
+        if (header.command != k_cfRelayClientMessage)
+            return;
+
+        // Already has the handle of whoever said it
+        SharedFrame* copy = RelayCopyFrame(&header, &frame);
+        char         handle[kMaxClientHandleLength + 1] = {0};
+        FrameGetString(&frame, handle, sizeof(handle));
+        if (copy != NULL && !RelayPushUpstream(reader->room, copy) && !frame.failed)
+            RelayTellDropped(reader->queue, handle);
+        SharedFrameRelease(copy);
+        return;
+    }
+
+    char message[kMaxClientMessageLength + 1] = {0};
+    FrameGetLongString(&frame, message, sizeof(message));
+    if (frame.failed)
+        return;
+
+    // Kicking nobody or themselves is how clients leave. Only the host can kick others
+    if (header.command == k_cfKickClientFromServer && (message[0] == '\0' || strcmp(message, reader->handle) == 0)) {
+        reader->done = true;
+        return;
+    }
+
+    // Dropped before it reaches the room, which can't tell the relay's clients apart
+    if (header.command != k_cfKickClientFromServer && !TokenBucketTake(&reader->requestLimit)) {
+        RelayThrottleClient(reader->queue, &reader->lastThrottleNs);
+        return;
+    }
+
+    if (header.command != k_cfEchoClientMessageInServer)
+        return;
+
+    FrameWriter writer = {0};
+    FrameBegin(&writer, k_fkRequest, k_cfRelayClientMessage, 0);
+    FramePutString(&writer, reader->handle);
+    FramePutLongString(&writer, message);
+
+    SharedFrame* relayed = SharedFrameCreate(&writer);
+    FrameWriterFree(&writer);
+    if (relayed == NULL || !RelayPushUpstream(reader->room, relayed))
+        RelayTellDropped(reader->queue, reader->handle);
+    SharedFrameRelease(relayed);
+}
+
+/**
+ * @brief           Handle what a client or relay below sent once their socket is readable
+ * @param[in]       reactor: relayReaders
+ * @param[in]       events:  ready events of the socket
+ * @param[in]       context: the RelayDownstream
+ * @return          void
+ */
+static void RelayHandleDownstreamEvent(Reactor* reactor, unsigned int events, void* context)
+{
+    RelayDownstream* reader = (RelayDownstream*)context;
+
+    // With io_uring the bytes were already handed over
+    if (!ReactorReceives(reactor)) {
+        ReactorCountSyscall(reactor);
+        if (FrameStreamFill(&reader->stream) < 0)
+            reader->done = true;
+    }
+
+    // Everything that arrived together is handled at once
+    while (!reader->done && FrameStreamReady(&reader->stream))
+        RelayHandleDownstreamFrame(reader);
+
+    if (reader->done)
+        RelayCloseDownstream(reader);
+}
+
+/*
+    Keep bytes the reactor received for a client or
+    relay below and handle the frames they complete.
+*/
+static void RelayDownstreamReceived(Reactor* reactor, const char* data, ssize_t length, void* context)
+{
+    RelayDownstream* reader = (RelayDownstream*)context;
+
+    if (length <= 0 || FrameStreamAppend(&reader->stream, data, (size_t)length) != 0)
+        reader->done = true;
+
+    RelayHandleDownstreamEvent(reactor, REACTOR_READ, context);
+}
+
+/*
+    Start reading what a client or relay that joined 'room' sends.
+    The reader takes over the callers references to the room and
+    to 'queue'. Returns false if it couldn't, and the caller still
+    holds them. 'received' is what they sent after their join
+    frame and is taken over either way.
+*/
+static bool RelayStartDownstream(RelayRoom* room, OutboundQueue* queue, const char* handle, FrameStream* received)
+{
+    RelayDownstream* reader = calloc(1, sizeof(RelayDownstream));
+    if (reader == NULL) {
+        FrameStreamFree(received);
+        return false;
+    }
+
+    // Clients are held to the rate of the room. Relays below hold their own clients to it
+    pthread_mutex_lock(&relayLock);
+    unsigned int rate = room->clientRate;
+    pthread_mutex_unlock(&relayLock);
+
+    reader->room           = room;
+    reader->queue          = queue;
+    reader->isRelay        = (handle == NULL);
+    reader->stream         = *received;
+    reader->watch.fd       = queue->fd;
+    reader->watch.events   = REACTOR_READ;
+    reader->watch.handler  = RelayHandleDownstreamEvent;
+    reader->watch.receiver = RelayDownstreamReceived;
+    reader->watch.context  = (void*)reader;
+    if (handle != NULL)
+        snprintf(reader->handle, sizeof(reader->handle), "%s", handle);
+    TokenBucketInit(&reader->requestLimit, rate, rate * 2);
+
+    // Its handler can run and free it before this returns
+    if (ReactorAdd(&relayReaders, &reader->watch) != 0) {
+        FrameStreamFree(&reader->stream);
+        free(reader);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+    Handle the room's answers for clients registered through this
+    relay. Clients of a relay below have theirs passed down. Clients
+    of this relay are joined and read from now or turned away. One who
+    was in already and isn't let back in after a reattach, because
+    someone took their handle meanwhile, is hung up on.
+*/
+static void RelayAnswerRegistration(RelayRoom* room, FrameReader* reader)
+{
+    // A handle and a response code each. The smallest is a byte of length and the code
+    unsigned int   most     = (unsigned int)(FrameRemaining(reader) / (1 + sizeof(uint32_t)));
+    RelayAdmitted* admitted = calloc(most + 1, sizeof(RelayAdmitted));
+    RelayMember**  refused  = calloc(most + 1, sizeof(RelayMember*));
+    ResponseCode*  codes    = calloc(most + 1, sizeof(ResponseCode));
+    unsigned int   admittedCount = 0;
+    unsigned int   refusedCount  = 0;
+
+    // Relays below the answers are passed down to. Usually one
+    RelayBatch*  passed      = NULL;
+    unsigned int passedCount = 0;
+
+    pthread_mutex_lock(&relayLock);
+    while (admitted != NULL && refused != NULL && codes != NULL && FrameRemaining(reader) > 0)
+    {
+        char handle[kMaxClientHandleLength + 1] = {0};
+        FrameGetString(reader, handle, sizeof(handle));
+        ResponseCode rcode = (ResponseCode)(int32_t)FrameGetU32(reader);
+        if (reader->failed)
+            break;
+
+        RelayMember* member = (RelayMember*)HashMapGet(&room->handles, handle);
+        if (member != NULL && member->relayed) {
+            unsigned int to = 0;
+            while (to < passedCount && passed[to].queue != member->queue)
+                to++;
+
+            if (to == passedCount) {
+                RelayBatch* grown = realloc(passed, (passedCount + 1) * sizeof(RelayBatch));
+                if (grown == NULL)
+                    continue;
+
+                passed = grown;
+                passed[passedCount++] = (RelayBatch){ .kind = k_fkReply, .command = k_cfRelayClientJoined, .queue = member->queue };
+            }
+
+            RelayBatchPut(&passed[to], handle, rcode);
+            member->admitted = rcode == k_rcRootOperationSuccessful;
+            if (!member->admitted) {
+                HashMapRemove(&room->handles, handle);
+                free(member);
+            }
+        }
+        else if (member != NULL && member->admitted) {
+            if (rcode != k_rcRootOperationSuccessful)
+                OutboundQueueClose(member->queue); // Their reader leaves the room once it wakes
+        }
+        else if (member != NULL) {
+            room->joining--;
+            if (rcode == k_rcRootOperationSuccessful)
+                rcode = RelayJoinLocked(room, member->queue, false, member->requestId);
+
+            if (rcode == k_rcRootOperationSuccessful) {
+                RelayAdmitted* next = &admitted[admittedCount++];
+                snprintf(next->handle, sizeof(next->handle), "%s", member->handle);
+                next->queue      = member->queue;
+                next->stream     = member->stream;
+                member->admitted = true;
+                memset(&member->stream, 0, sizeof(FrameStream));
+            }
+            else {
+                HashMapRemove(&room->handles, handle);
+                codes[refusedCount]     = rcode;
+                refused[refusedCount++] = member;
+            }
+        }
+    }
+
+    for (unsigned int i = 0; i < passedCount; i++)
+        RelayBatchFinish(&passed[i]);
+
+    RelayLetGoIfEmptyLocked(room);
+    pthread_mutex_unlock(&relayLock);
+    free(passed);
+
+    // Their reference to the room goes with them
+    for (unsigned int i = 0; i < refusedCount; i++)
+        RelayRefuseMember(room, refused[i], codes[i]);
+
+    for (unsigned int i = 0; i < admittedCount; i++)
+    {
+        RelayAdmitted* next = &admitted[i];
+        if (!RelayStartDownstream(room, next->queue, next->handle, &next->stream)) {
+            // Never listened to. Leaves the room like anyone who drops
+            RelayLeave(room, next->queue, next->handle);
+            OutboundQueueClose(next->queue);
+            OutboundQueueRelease(next->queue);
+            RelayRoomRelease(room);
+        }
+    }
+
+    free(admitted);
+    free(refused);
+    free(codes);
+}
+
+/*
+    Worker job. Join a client or relay whose join frame is in to
+    the room they named, attaching it first if nobody joined it
+    through this relay yet. 'argument' is their RelayPendingJoin,
+    already taken off the reactor.
+*/
+static void RelayServeJoin(void* argument)
+{
+    RelayPendingJoin* join   = (RelayPendingJoin*)argument;
+    int               fd     = join->watch.fd;
+    FrameStream       stream = join->stream; // What they send after the join frame stays buffered for their reader
+    free(join);
+
+    // The same join a room gets. Relays below only send the id of the room
+    FrameHeader header = {0};
+    FrameReader reader;
+    if (FrameStreamNext(&stream, &header, &reader) != 0 || header.kind != k_fkRequest
+        || (header.command != k_cfAddClientToServer && header.command != k_cfAttachRelayToServer))
+    {
+        FrameStreamFree(&stream);
+        close(fd);
+        return;
+    }
+
+    bool isRelay = header.command == k_cfAttachRelayToServer;
+    char handle[kMaxClientHandleLength + 1] = {0};
+    uint64_t roomId = FrameGetU64(&reader);
+    if (!isRelay)
+        FrameGetString(&reader, handle, sizeof(handle));
+
+    if (reader.failed || (!isRelay && handle[0] == '\0')) {
+        FrameStreamFree(&stream);
+        close(fd);
+        return;
+    }
+
+    // Relays below say which client sent what. Anyone else could pretend to be one
+    bool trusted = !isRelay || SocketPeerAllowed(fd, relayPeers, relayPeerCount);
+    if (!trusted)
+        printf("[relay] Refused a relay attaching from an address that isn't allowed\n");
+
+    RelayRoom*     room  = trusted ? RelayGetRoom(roomId) : NULL;
+    OutboundQueue* queue = (room != NULL) ? OutboundQueueCreate(&relayReactor, fd, k_opDropOldest) : NULL;
+    ResponseCode   rcode = k_rcInternalServerError;
+
+    // Clients wait for the room to let them in. Relays below register their own clients
+    if (queue != NULL && isRelay)
+        rcode = RelayJoin(room, queue, true, header.requestId);
+    else if (queue != NULL)
+        rcode = RelayRegisterClient(room, queue, handle, header.requestId, &stream);
+
+    if (rcode != k_rcRootOperationSuccessful) {
+        FrameStreamFree(&stream);
+
+        FrameWriter reply = {0};
+        FrameBegin(&reply, k_fkReply, k_cfAddClientToServer, header.requestId);
+        FramePutU32(&reply, (uint32_t)rcode);
+        if (FrameFinish(&reply))
+            FrameSend(fd, &reply);
+        FrameWriterFree(&reply);
+
+        // The queue owns the socket once it was made
+        if (queue != NULL) {
+            OutboundQueueClose(queue);
+            OutboundQueueRelease(queue);
+        }
+        else
+            close(fd);
+
+        if (room != NULL)
+            RelayRoomRelease(room);
+        return;
+    }
+
+    if (!isRelay)
+        return;
+
+    if (!RelayStartDownstream(room, queue, NULL, &stream)) {
+        // Never listened to. Leaves the room like anyone who drops
+        RelayLeave(room, queue, NULL);
+        OutboundQueueClose(queue);
+        OutboundQueueRelease(queue);
+        RelayRoomRelease(room);
+    }
+}
+
+/*
+    Stop watching a join. Reactor thread only.
+*/
+static void RelayUnlinkJoin(RelayPendingJoin* join)
+{
+    ReactorRemove(&relayReactor, &join->watch);
+
+    if (join->previous != NULL)
+        join->previous->next = join->next;
+    else
+        relayJoinsOldest = join->next;
+
+    if (join->next != NULL)
+        join->next->previous = join->previous;
+    else
+        relayJoinsNewest = join->previous;
+}
+
+/*
+    Hang up on a join that isn't watched anymore.
+*/
+static void RelayFreeJoin(RelayPendingJoin* join)
+{
+    FrameStreamFree(&join->stream);
+    close(join->watch.fd);
+    free(join);
+}
+
+/**
+ * @brief           Read the join frame of a connection as it arrives and hand it to a worker once it's in
+ * @param[in]       reactor: relayReactor
+ * @param[in]       events:  ready events of the socket
+ * @param[in]       context: the RelayPendingJoin
+ * @return          void
+ */
+static void RelayHandleJoinEvent(Reactor* reactor, unsigned int events, void* context)
+{
+    RelayPendingJoin* join = (RelayPendingJoin*)context;
+
+    // With io_uring the bytes were already handed over
+    if (!ReactorReceives(reactor)) {
+        ReactorCountSyscall(reactor);
+        if (FrameStreamFill(&join->stream) < 0) {
+            RelayUnlinkJoin(join);
+            RelayFreeJoin(join);
+            return;
+        }
+    }
+
+    if (!FrameStreamReady(&join->stream))
+        return;
+
+    // Only a whole frame is given to a worker, so reading it never waits
+    RelayUnlinkJoin(join);
+    if (!WorkPoolSubmit(&relayWorkers, RelayServeJoin, (void*)join)) // Too busy. They can retry
+        RelayFreeJoin(join);
+}
+
+/*
+    Keep bytes the reactor received for a join.
+*/
+static void RelayJoinReceived(Reactor* reactor, const char* data, ssize_t length, void* context)
+{
+    RelayPendingJoin* join = (RelayPendingJoin*)context;
+
+    if (length <= 0 || FrameStreamAppend(&join->stream, data, (size_t)length) != 0) {
+        RelayUnlinkJoin(join);
+        RelayFreeJoin(join);
+        return;
+    }
+
+    RelayHandleJoinEvent(reactor, REACTOR_READ, context);
+}
+
+/**
+ * @brief           Start waiting for the join frame of an accepted connection
+ * @param[in]       reactor: relayReactor
+ * @param[in]       fd:      the accepted socket or -errno
+ * @param[in]       context: unused
+ * @return          void
+ */
+static void RelayAdmitClient(Reactor* reactor, int fd, void* context)
+{
+    if (fd < 0)
+        return;
+
+    RelayPendingJoin* join = calloc(1, sizeof(RelayPendingJoin));
+    if (join == NULL) {
+        close(fd);
+        return;
+    }
+
+    FrameStreamInit(&join->stream, fd);
+    join->deadline       = MonotonicNs() + (uint64_t)RELAY_JOIN_TIMEOUT_SEC * 1000000000ULL;
+    join->watch.fd       = fd;
+    join->watch.events   = REACTOR_READ;
+    join->watch.handler  = RelayHandleJoinEvent;
+    join->watch.receiver = RelayJoinReceived;
+    join->watch.context  = (void*)join;
+
+    if (ReactorAdd(reactor, &join->watch) != 0) {
+        RelayFreeJoin(join);
+        return;
+    }
+
+    // Newest last, so joins run out of time in order. Its handler only runs once this returns
+    join->previous = relayJoinsNewest;
+    if (relayJoinsNewest != NULL)
+        relayJoinsNewest->next = join;
+    else
+        relayJoinsOldest = join;
+    relayJoinsNewest = join;
+}
+
+/**
+ * @brief           Accept every client and relay waiting to connect below this relay
+ * @param[in]       reactor: relayReactor
+ * @param[in]       events:  unused
+ * @param[in]       context: unused
+ * @return          void
+ */
+static void RelayAcceptConnections(Reactor* reactor, unsigned int events, void* context)
+{
+    while (1)
+    {
+        ReactorCountSyscall(reactor);
+        int fd = accept(relayListenerFd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            break; // Backlog empty
+        }
+
+        RelayAdmitClient(reactor, fd, NULL);
+    }
+}
+
+/**
+ * @brief           Reactor timer. Hang up on connections that didn't send their join frame in time
+ * @param[in]       reactor: relayReactor
+ * @param[in]       events:  unused
+ * @param[in]       context: unused
+ * @return          void
+ */
+static void RelaySweepJoins(Reactor* reactor, unsigned int events, void* context)
+{
+    ReactorTimerAcknowledge(&relayJoinSweepWatch);
+
+    uint64_t now = MonotonicNs();
+    while (relayJoinsOldest != NULL && relayJoinsOldest->deadline <= now)
+    {
+        RelayPendingJoin* late = relayJoinsOldest;
+        RelayUnlinkJoin(late);
+        RelayFreeJoin(late);
+    }
+}
+
+bool RelayParseAddress(const char* text, struct sockaddr_in* address)
+{
+    memset(address, 0, sizeof(struct sockaddr_in));
+    address->sin_family      = AF_INET;
+    address->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    char        host[64] = {0};
+    const char* port     = strrchr(text, ':');
+    if (port != NULL) {
+        size_t hostLength = (size_t)(port - text);
+        if (hostLength == 0 || hostLength >= sizeof(host))
+            return false;
+
+        memcpy(host, text, hostLength);
+        if (inet_pton(AF_INET, host, &address->sin_addr) != 1)
+            return false;
+        port++;
+    }
+    else
+        port = text;
+
+    int number = atoi(port);
+    if (number <= 0 || number > 65535)
+        return false;
+
+    address->sin_port = htons((unsigned short)number);
+    return true;
+}
+
+/**
+ * @brief           Handle what clients and relays below send as it arrives
+ * @param[in]       unused: nothing
+ * @return          void*
+ * @retval          NULL once the reactor stops
+ */
+static void* RelayRunReaders(void* unused)
+{
+    ReactorRun(&relayReaders);
+    return NULL;
+}
+
+int RelayStart(unsigned short port)
+{
+    struct sockaddr_in addrInfo;
+    memset(&addrInfo, 0, sizeof(struct sockaddr_in));
+    addrInfo.sin_family      = AF_INET;
+    addrInfo.sin_addr.s_addr = htonl(INADDR_ANY);
+    addrInfo.sin_port        = htons(port);
+
+    int sfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sfd < 0)
+        return -1;
+
+    int optVal = 1;
+    setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &optVal, sizeof(optVal));
+
+    if (bind(sfd, (struct sockaddr*)&addrInfo, sizeof(addrInfo)) < 0 || listen(sfd, RELAY_LISTEN_BACKLOG) < 0
+        || SetSocketNonBlocking(sfd) != 0 || !HashMapInit(&relayRooms, 16)
+        || ReactorCreate(&relayReactor) != 0 || ReactorCreate(&relayReaders) != 0
+        || WorkPoolCreate(&relayWorkers, RELAY_WORKERS, RELAY_WORK_QUEUE_DEPTH) != 0)
+    {
+        close(sfd);
+        return -1;
+    }
+
+    relayListenWatch.fd       = sfd;
+    relayListenWatch.events   = REACTOR_READ;
+    relayListenWatch.handler  = RelayAcceptConnections;
+    relayListenWatch.acceptor = RelayAdmitClient; // Multishot accepts with io_uring
+    relayListenWatch.context  = NULL;
+
+    relayJoinSweepWatch.handler = RelaySweepJoins;
+    relayJoinSweepWatch.context = NULL;
+
+    // Before anything can be accepted
+    relayListenerFd = sfd;
+
+    if (ReactorAdd(&relayReactor, &relayListenWatch) != 0 || ReactorAddTimer(&relayReactor, &relayJoinSweepWatch, RELAY_JOIN_SWEEP_MS) != 0) {
+        close(sfd);
+        return -1;
+    }
+
+    pthread_t readerThread;
+    if (pthread_create(&readerThread, NULL, RelayRunReaders, NULL) != 0) {
+        close(sfd);
+        return -1;
+    }
+
+    pthread_detach(readerThread);
+    return 0;
+}
+
+void RelayAcceptClients()
+{
+    ReactorRun(&relayReactor);
+    printf("[relay] Stopped accepting clients. Error Code %i\n", errno);
+}
@@ -17,500 +17,1495 @@
  */
 
 #include "Headers/root.h"
+#include "Headers/hashmap.h"
+#include "Headers/chatlog.h"
+
+#include <endian.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
 
 /*
     Global statistics about the
     root server
 */
-unsigned int onlineGlobalClients = 0; // All clients connected to the root server
-User   rootConnectedClients[] = {};  // List of all clients on the root server
-Server rootServer = { 0 };          // Root server info
+unsigned int onlineGlobalClients = 0; // All clients connected to the root server
+Server rootServer = { 0 };          // Root server info
+
+/*
+    Root event loop
+*/
+static Reactor      rootReactor     = {0};
+static ReactorWatch rootListenWatch = {0};
+static ReactorWatch rootTickWatch   = {0};
+static ReactorWatch rootStatsWatch  = {0};
+static ReactorWatch rootInviteWatch = {0};
+
+/*
+    Root requests are ran on these workers
+    so the event loop only does I/O
+*/
+unsigned int    rootWorkerCount = ROOT_DEFAULT_WORKERS;
+static WorkPool rootWorkers     = {0};
+
+/*
+    Registry of every client on the root server.
+
+    Sessions are indexed by their socket (rfd) from the moment
+    they connect, and by handle once they have joined. Both
+    lookups and removal are O(1) and the tables grow at runtime.
+*/
+static RootSession**   rootClientsByRfd         = NULL;
+static size_t          rootClientsByRfdCapacity = 0;
+static HashMap         rootClientsByHandle      = {0};
+static unsigned int    nextRootClientId         = 1;
+static pthread_mutex_t rootClientsLock          = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+    Clients subscribed to server list changes.
+    Packed like the server list. 'rootClientsLock' must be held.
+*/
+static RootSession**   rootSubscribers          = NULL;
+static unsigned int    rootSubscriberCount      = 0;
+static unsigned int    rootSubscriberCapacity   = 0;
+
+/*
+    Sessions with a pm invite nobody answered yet.
+    Packed like the subscribers. 'rootClientsLock' must be held.
+*/
+static RootSession**   rootInvites              = NULL;
+static unsigned int    rootInviteCount          = 0;
+static unsigned int    rootInviteCapacity       = 0;
+
+/*
+    Session using socket 'rfd' or NULL.
+    'rootClientsLock' must be held.
+*/
+static RootSession* SessionFromRfd(int rfd)
+{
+    if (rfd < 0 || (size_t)rfd >= rootClientsByRfdCapacity)
+        return NULL;
+
+    return rootClientsByRfd[rfd];
+}
+
+bool RSFindClientByHandle(const char* handle, User* client)
+{
+    pthread_mutex_lock(&rootClientsLock);
+    RootSession* session = (RootSession*)HashMapGet(&rootClientsByHandle, handle);
+    if (session != NULL)
+        *client = session->user;
+    pthread_mutex_unlock(&rootClientsLock);
+
+    return session != NULL;
+}
+
+bool RSFindClientByRfd(int rfd, User* client)
+{
+    pthread_mutex_lock(&rootClientsLock);
+    RootSession* session = SessionFromRfd(rfd);
+    bool         found   = (session != NULL && session->joined);
+    if (found)
+        *client = session->user;
+    pthread_mutex_unlock(&rootClientsLock);
+
+    return found;
+}
+
+void SSUpdateClientWithNewInfo(User updatedUserInfo)
+{
+    pthread_mutex_lock(&rootClientsLock);
+
+    RootSession* session = (RootSession*)HashMapGet(&rootClientsByHandle, updatedUserInfo.handle);
+    if (session != NULL)
+    {
+        // The root socket and id belong to the root server, not whoever sent the update
+        updatedUserInfo.rfd      = session->user.rfd;
+        updatedUserInfo.clientId = session->user.clientId;
+        session->user            = updatedUserInfo;
+    }
+
+    pthread_mutex_unlock(&rootClientsLock);
+}
+
+void RSClientLeftRoom(const char* handle, Server* room)
+{
+    pthread_mutex_lock(&rootClientsLock);
+
+    RootSession* session = (RootSession*)HashMapGet(&rootClientsByHandle, handle);
+    if (session != NULL && session->user.connectedServer == room)
+        session->user.connectedServer = &rootServer;
+
+    pthread_mutex_unlock(&rootClientsLock);
+}
+
+void RSUpdateServerWithNewInfo(Server* updatedServerInfo)
+{
+    // Held so the room can't be freed while it is updated
+    Server* listed = ServerListRetainById(updatedServerInfo->serverId);
+    if (listed == NULL)
+        return;
+
+    // The caller may have changed the listed server itself
+    if (listed != updatedServerInfo) {
+        pthread_mutex_lock(listed->membersLock);
+
+        /*
+            Only what a copy can change. Its socket, members, lock, place in
+            the list and references (changed atomically) stay the listed server's
+        */
+        listed->domain     = updatedServerInfo->domain;
+        listed->type       = updatedServerInfo->type;
+        listed->protocol   = updatedServerInfo->protocol;
+        listed->port       = updatedServerInfo->port;
+        listed->maxClients = updatedServerInfo->maxClients;
+        listed->addr       = updatedServerInfo->addr;
+        listed->online     = updatedServerInfo->online;
+        listed->isRoot     = updatedServerInfo->isRoot;
+        listed->host       = updatedServerInfo->host;
+
+        pthread_mutex_unlock(listed->membersLock);
+    }
+
+    ServerListTouch(listed);
+    SSRoomRelease(listed);
+}
+
+void UpdateClientInConnectedServer(User* userToUpdate)
+{
+    Server* server = userToUpdate->connectedServer;
+
+    pthread_mutex_lock(server->membersLock);
+    User* member = server->online ? SSFindMember(server, userToUpdate->handle) : NULL;
+    if (member != NULL) {
+        // Their socket belongs to the room, only the info is updated
+        unsigned int   cfd      = member->cfd;
+        OutboundQueue* outbound = member->outbound;
+
+        *member          = *userToUpdate;
+        member->cfd      = cfd;
+        member->outbound = outbound;
+    }
+    pthread_mutex_unlock(server->membersLock);
+
+    // Finally take changes into affect and update this server on the root server
+    if (member != NULL)
+        RSUpdateServerWithNewInfo(server);
+}
+
+/*
+    Client-sided. A request sent to root still waiting for its response.
+*/
+typedef struct PendingRootRequestStr
+{
+    uint32_t            requestId; // 0 if the slot is free
+    RootResponseHandler handler;   // NULL if WaitForRootResponse() takes the response instead
+    void*               context;   // Given to 'handler'
+    uint64_t            deadline;  // MonotonicNs() 'handler' is given up on at
+    bool                answered;  // 'response' was filled in. Only for requests without a handler
+    RootResponse        response;  // Response kept for WaitForRootResponse()
+} PendingRootRequest;
+
+/*
+    Client-sided. Only the client loop uses the root socket
+    (see RunClientLoop()) so none of this is locked.
+    Requests are found by id in 'pendingRootRequests'.
+*/
+static uint32_t           nextRootRequestId = 1; // Id of the next request made to root. Never 0
+static FrameStream        rootStream        = { .fd = -1 };
+static PendingRootRequest pendingRootRequests[ROOT_MAX_PENDING_REQUESTS];
+
+/*
+    Client-sided. Receive buffer of the root socket.
+    Started over if the client reconnected to root.
+*/
+static FrameStream* RootStream()
+{
+    if (rootStream.fd != rootServer.sfd) {
+        FrameStreamFree(&rootStream);
+        FrameStreamInit(&rootStream, rootServer.sfd);
+    }
+
+    return &rootStream;
+}
+
+int ReceiveRootFrame(FrameHeader* header, FrameReader* reader)
+{
+    return FrameStreamNext(RootStream(), header, reader);
+}
+
+/*
+    Client-sided. Build the frame for a request to root.
+
+    Only the fields the command needs are sent.
+    Returns false for commands clients can't send.
+*/
+static bool EncodeRootRequest(FrameWriter* writer, RootRequest* request)
+{
+    FrameBegin(writer, k_fkRequest, request->cmdFlag, request->requestId);
+
+    switch (request->cmdFlag)
+    {
+    case k_cfConnectClientToServer:
+        FramePutString(writer, request->user.handle);
+        break;
+    case k_cfRequestServerList:
+    case k_cfSubscribeServerList:
+        FramePutU64(writer, request->directoryVersion);
+        break;
+    case k_cfMakeNewServer:
+        FramePutString(writer, request->server.alias);
+        FramePutU16(writer, (uint16_t)request->server.maxClients);
+        break;
+    case k_cfDisconnectClientFromRoot:
+        // Server the client is in, so root can shut it down if they host it
+        FramePutU64(writer, request->server.serverId);
+        break;
+    case k_cfClientRequestPrivateMessage:
+        FramePutString(writer, request->clientSentMessage.message); // Handle of the peer
+        break;
+    case k_cfUnsubscribeServerList:
+    case k_cfClientAcceptedPrivateMessage:
+    case k_cfClientDeclinedPrivateMessage:
+        break;
+    default:
+        return false;
+    }
+
+    return FrameFinish(writer);
+}
+
+/*
+    Client-sided. The request waiting for the response
+    with id 'requestId'. NULL if there isn't one.
+*/
+static PendingRootRequest* PendingRootRequestFor(uint32_t requestId)
+{
+    PendingRootRequest* pending = &pendingRootRequests[requestId % ROOT_MAX_PENDING_REQUESTS];
+    return (requestId != 0 && pending->requestId == requestId) ? pending : NULL;
+}
+
+/*
+    Client-sided. Handle a frame root sent without being asked.
+*/
+static void HandleRootPush(FrameHeader* header, FrameReader* reader)
+{
+    switch (header->command)
+    {
+    case k_cfSubscribeServerList: // Server list changed
+        ServerListApplyDelta(reader, rootServer.addr);
+        break;
+    case k_cfClientRequestPrivateMessage: // Someone wants to pm. Body is who
+    {
+        char handle[kMaxClientHandleLength + 1] = {0};
+        FrameGetString(reader, handle, sizeof(handle));
+        if (!reader->failed)
+            AskToAcceptPrivateMessage(handle);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/*
+    Client-sided. Handle a frame from root. Responses go to
+    the request they answer, whichever order they come in.
+*/
+static void HandleRootFrame(FrameHeader* header, FrameReader* reader)
+{
+    if (header->kind == k_fkPush) {
+        HandleRootPush(header, reader);
+        return;
+    }
+
+    PendingRootRequest* pending = PendingRootRequestFor(header->requestId);
+    if (header->kind != k_fkReply || pending == NULL)
+        return; // A response nobody is waiting for anymore
+
+    RootResponse response = {0};
+    response.rcode        = (ResponseCode)(int32_t)FrameGetU32(reader);
+    response.rflag        = (ResponseFlag)(int32_t)FrameGetU32(reader);
+    response.command      = (CommandFlag)header->command;
+    response.requestId    = header->requestId;
+
+    // Server list changes follow the response in the same frame
+    if ((response.command == k_cfRequestServerList || response.command == k_cfSubscribeServerList)
+        && response.rcode == k_rcRootOperationSuccessful)
+        ServerListApplyDelta(reader, rootServer.addr);
+
+    if (reader->failed)
+        response.rcode = k_rcInternalServerError;
+
+    if (pending->handler == NULL) {
+        pending->response = response;
+        pending->answered = true;
+        return;
+    }
+
+    // Slot is free before the handler runs so it can make requests of its own
+    RootResponseHandler handler = pending->handler;
+    void*               context = pending->context;
+    memset(pending, 0, sizeof(PendingRootRequest));
+    handler(&response, context);
+}
+
+uint32_t SendRootRequest(
+    CommandFlag         commandFlag,
+    Server              currentServer,
+    User                relatedClient,
+    CMessage            clientMessageInfo,
+    RootResponseHandler handler,
+    void*               context
+)
+{
+    RootRequest request;
+    request.cmdFlag           = commandFlag;
+    request.server            = currentServer;
+    request.user              = relatedClient;
+    request.clientSentMessage = clientMessageInfo;
+    request.directoryVersion  = ServerListSyncedVersion();
+    request.requestId         = nextRootRequestId;
+
+    // Ids go round the slots. One still taken means too many are waiting
+    PendingRootRequest* pending = &pendingRootRequests[request.requestId % ROOT_MAX_PENDING_REQUESTS];
+    if (pending->requestId != 0) {
+        printf(RED "Too many requests to root server waiting...\n" RESET);
+        return 0;
+    }
+
+    FrameWriter frame = {0};
+    if (!EncodeRootRequest(&frame, &request)) {
+        printf(RED "Can't make request %i to root server...\n" RESET, commandFlag);
+        FrameWriterFree(&frame);
+        return 0;
+    }
+
+    // Send request to root server
+    if (FrameSend(rootServer.sfd, &frame) != 0) { // Client disconnected or something went wrong sending
+        printf(RED "Error making request to root server...\n" RESET);
+        FrameWriterFree(&frame);
+        return 0;
+    }
+
+    FrameWriterFree(&frame);
+    nextRootRequestId = (nextRootRequestId == UINT32_MAX) ? 1 : nextRootRequestId + 1;
+
+    // Root closes the socket instead of answering a disconnect
+    if (commandFlag != k_cfDisconnectClientFromRoot) {
+        pending->requestId = request.requestId;
+        pending->handler   = handler;
+        pending->context   = context;
+        pending->answered  = false;
+        pending->deadline  = MonotonicNs() + (uint64_t)ROOT_REQUEST_TIMEOUT_SEC * 1000000000ULL;
+    }
+
+    return request.requestId;
+}
+
+bool WaitForRootResponse(uint32_t requestId, RootResponse* response)
+{
+    PendingRootRequest* pending = PendingRootRequestFor(requestId);
+    if (pending == NULL || pending->handler != NULL)
+        return false;
+
+    // Frames root sent before the response are handled on the way
+    while (!pending->answered)
+    {
+        FrameHeader header = {0};
+        FrameReader reader;
+        if (ReceiveRootFrame(&header, &reader) != 0) {
+            memset(pending, 0, sizeof(PendingRootRequest));
+            return false;
+        }
+
+        HandleRootFrame(&header, &reader);
+    }
+
+    *response = pending->response;
+    memset(pending, 0, sizeof(PendingRootRequest));
+    return true;
+}
+
+int ReceiveRootPushes()
+{
+    int result = 0;
+
+    // Only read what is already there
+    struct pollfd rootSocket = { .fd = rootServer.sfd, .events = POLLIN };
+    do
+    {
+        while (FrameStreamReady(RootStream()))
+        {
+            FrameHeader header = {0};
+            FrameReader reader;
+            if (ReceiveRootFrame(&header, &reader) != 0)
+                break;
+
+            HandleRootFrame(&header, &reader);
+        }
+    } while (poll(&rootSocket, 1, 0) > 0 && (result = FrameStreamFill(RootStream())) > 0);
+
+    return (result < 0) ? -1 : 0;
+}
+
+int ExpireRootRequests()
+{
+    uint64_t now  = MonotonicNs();
+    uint64_t next = 0;
+
+    for (unsigned int i = 0; i < ROOT_MAX_PENDING_REQUESTS; i++)
+    {
+        PendingRootRequest* pending = &pendingRootRequests[i];
+        if (pending->requestId == 0 || pending->handler == NULL)
+            continue;
+
+        if (pending->deadline > now) {
+            if (next == 0 || pending->deadline < next)
+                next = pending->deadline;
+            continue;
+        }
+
+        RootResponse response = {0};
+        response.rcode        = k_rcInternalServerError;
+        response.rflag        = k_rfNoResponse;
+        response.requestId    = pending->requestId;
+
+        // Slot is free before the handler runs, like an answered request
+        RootResponseHandler handler = pending->handler;
+        void*               context = pending->context;
+        memset(pending, 0, sizeof(PendingRootRequest));
+        handler(&response, context);
+    }
+
+    if (next == 0)
+        return -1;
+
+    // Round up so poll() doesn't wake just before the deadline
+    return (int)((next - now + 999999ULL) / 1000000ULL);
+}
+
+/**
+ * @brief           Make a request from the client to the root server. Kind of like http
+ * @param[in]       commandFlag:   tell the server what to do with the data
+ * @param[in]       currentServer: server to make the request from
+ * @param[in]       relatedClient: client who made the request
+ * @return          void*
+ * @retval          RootResponse from server as void*
+ */
+RootResponse MakeRootRequest(
+    CommandFlag    commandFlag,
+    Server    currentServer,
+    User      relatedClient,
+    CMessage clientMessageInfo
+)
+{
+    // Default response values
+    RootResponse response = {0};
+    response.rcode        = k_rcInternalServerError;
+    response.rflag        = k_rfNoResponse;
+    response.returnValue  = NULL;
+    response.command      = commandFlag;
+
+    uint32_t requestId = SendRootRequest(commandFlag, currentServer, relatedClient, clientMessageInfo, NULL, NULL);
+    if (requestId == 0)
+        return response;
+
+    // Client wont be able to receive messages when their socket file descriptor is closed
+    if (commandFlag == k_cfDisconnectClientFromRoot)
+        return response;
+
+    // Receive a response from the root server
+    if (!WaitForRootResponse(requestId, &response)) { // Client disconnected or something went wrong receiving
+        printf(RED "Failed to receive data from root server...\n" RESET);
+        response.rcode = k_rcInternalServerError;
+        response.rflag = k_rfNoResponse;
+    }
+
+    return response;
+}
+
+/*
+    Read a request frame from a client into 'request'.
+
+    Only the fields the command sends are filled in, the rest
+    are zeroed. Returns false for frames that aren't requests,
+    commands clients can't send and bodies that are too short.
+*/
+static bool RSDecodeRootRequest(FrameHeader* header, FrameReader* reader, RootRequest* request)
+{
+    memset(request, 0, sizeof(RootRequest));
+    if (header->kind != k_fkRequest)
+        return false;
+
+    request->cmdFlag   = (CommandFlag)header->command;
+    request->requestId = header->requestId;
+
+    switch (request->cmdFlag)
+    {
+    case k_cfConnectClientToServer:
+        FrameGetString(reader, request->user.handle, sizeof(request->user.handle));
+        break;
+    case k_cfRequestServerList:
+    case k_cfSubscribeServerList:
+        request->directoryVersion = FrameGetU64(reader);
+        break;
+    case k_cfMakeNewServer:
+        FrameGetString(reader, request->server.alias, sizeof(request->server.alias));
+        request->server.maxClients = FrameGetU16(reader);
+        request->server.domain     = AF_INET;
+        request->server.type       = SOCK_STREAM;
+        break;
+    case k_cfDisconnectClientFromRoot:
+    {
+        // Only the id is sent. Use what root knows about the server
+        Server* listed = ServerListRetainById(FrameGetU64(reader));
+        request->server = rootServer;
+        if (listed != NULL) {
+            pthread_mutex_lock(listed->membersLock);
+            request->server = *listed;
+            pthread_mutex_unlock(listed->membersLock);
+            SSRoomRelease(listed);
+        }
+        break;
+    }
+    case k_cfClientRequestPrivateMessage:
+        FrameGetString(reader, request->clientSentMessage.message, kMaxClientHandleLength + 1);
+        break;
+    case k_cfUnsubscribeServerList:
+    case k_cfClientAcceptedPrivateMessage:
+    case k_cfClientDeclinedPrivateMessage:
+        break;
+    default:
+        return false;
+    }
+
+    return !reader->failed;
+}
+
+/*
+    Start the reply frame to a request. Whatever
+    the command returns is appended after this.
+*/
+static void RSBeginResponse(FrameWriter* writer, RootResponse* response)
+{
+    FrameBegin(writer, k_fkReply, response->command, response->requestId);
+    FramePutU32(writer, (uint32_t)response->rcode);
+    FramePutU32(writer, (uint32_t)response->rflag);
+}
+
+/*
+    Send a reply with no extra data on a client connection.
+    Returns 0 on success.
+*/
+static int RSRespond(Connection* connection, RootResponse* response)
+{
+    FrameWriter frame = {0};
+    RSBeginResponse(&frame, response);
+
+    int result = FrameFinish(&frame) ? ConnectionSend(connection, frame.data, frame.length, k_plChat) : -1;
+    FrameWriterFree(&frame);
+    return result;
+}
+
+/*
+    Open or close the pm invite of 'session'. Opening fails
+    if the invite list can't grow. 'rootClientsLock' must be held.
+*/
+static bool RSSetInvitePendingLocked(RootSession* session, bool pending)
+{
+    if (session->privateMessagePending == pending)
+        return true;
+
+    if (pending) {
+        if (rootInviteCount == rootInviteCapacity) {
+            unsigned int newCapacity = rootInviteCapacity ? rootInviteCapacity * 2 : 64;
+            RootSession** grown = realloc(rootInvites, sizeof(RootSession*) * newCapacity);
+            if (grown == NULL)
+                return false;
+
+            rootInvites        = grown;
+            rootInviteCapacity = newCapacity;
+        }
+
+        session->privateMessageIndex = rootInviteCount;
+        rootInvites[rootInviteCount++] = session;
+    }
+    else {
+        RootSession* last = rootInvites[--rootInviteCount];
+        rootInvites[session->privateMessageIndex] = last;
+        last->privateMessageIndex = session->privateMessageIndex;
+    }
+
+    session->privateMessagePending = pending;
+    return true;
+}
+
+/*
+    Tell whoever sent the pm invite 'requestId'
+    that it won't be answered.
+*/
+static void RSFailPrivateMessage(User* requester, uint32_t requestId)
+{
+    RootResponse response = {0};
+    response.rcode        = k_rcInternalServerError;
+    response.rflag        = k_rfNoResponse;
+    response.command      = k_cfClientRequestPrivateMessage;
+    response.requestId    = requestId;
+
+    RSRespondToRootRequestMaker(requester, response);
+}
+
+/**
+ * @brief           Event loop timer. Fail pm invites the peer didn't answer in time
+ * @param[in]       reactor: root event loop
+ * @param[in]       events:  unused
+ * @param[in]       context: unused
+ * @return          void
+ */
+static void RSExpirePrivateMessages(Reactor* reactor, unsigned int events, void* context)
+{
+    ReactorTimerAcknowledge(&rootInviteWatch);
+
+    uint64_t now = MonotonicNs();
+
+    pthread_mutex_lock(&rootClientsLock);
+
+    unsigned int i = 0;
+    while (i < rootInviteCount)
+    {
+        RootSession* session = rootInvites[i];
+        if (session->privateMessageDeadline > now) {
+            i++;
+            continue;
+        }
+
+        // The last invite takes this index
+        User     requester = session->privateMessageFrom;
+        uint32_t requestId = session->privateMessageRequestId;
+        RSSetInvitePendingLocked(session, false);
+
+        // Responding takes the lock
+        pthread_mutex_unlock(&rootClientsLock);
+        RSFailPrivateMessage(&requester, requestId);
+        pthread_mutex_lock(&rootClientsLock);
+    }
+
+    pthread_mutex_unlock(&rootClientsLock);
+}
+
+ResponseCode DoRootRequest(void* req)
+{
+    RootRequest  request = *(RootRequest*)req;
+    RootResponse response;
+    memset(&response, 0, sizeof(response)); 
+
+    // Default response
+    response.rcode       = k_rcRootOperationSuccessful;
+    response.returnValue = NULL;
+    response.rflag       = k_rfSentDataWasUnused;
+    response.command     = request.cmdFlag;
+    response.requestId   = request.requestId;
+
+    printf("Doing root request\n");
+
+    // Handle possible request commands
+    switch (request.cmdFlag)
+    {
+    case k_cfClientRequestPrivateMessage:
+        CMessage options = request.clientSentMessage;
+        User peer = {0};
+        options.message[kMaxClientHandleLength] = '\0';
+
+        printf("%s wants to pm %s\n", request.user.handle, options.message);
+
+        pthread_mutex_lock(&rootClientsLock);
+        RootSession* peerSession = (RootSession*)HashMapGet(&rootClientsByHandle, options.message);
+        if (peerSession != NULL && !peerSession->privateMessagePending) {
+            /*
+                Don't wait for the peer here, that would stall every
+                other client on the event loop. The requester gets their
+                response once the peer answers with accept/decline.
+            */
+            peer = peerSession->user;
+            peerSession->privateMessageFrom      = request.user;
+            peerSession->privateMessageRequestId = request.requestId;
+            peerSession->privateMessageDeadline  = MonotonicNs() + (uint64_t)ROOT_PRIVATE_MESSAGE_TIMEOUT_SEC * 1000000000ULL;
+            if (!RSSetInvitePendingLocked(peerSession, true))
+                peerSession = NULL;
+        } else {
+            peerSession = NULL;
+        }
+        pthread_mutex_unlock(&rootClientsLock);
+
+        if (peerSession == NULL) {
+            response.rcode = k_rcInternalServerError;
+            response.rflag = k_rfNoResponse;
+            RSRespondToRootRequestMaker(&request.user, response);
+            break;
+        }
+
+        printf("found the client %s\n", peer.handle);
+
+        // Ask the peer. Only who is asking is sent
+        FrameWriter invite = {0};
+        FrameBegin(&invite, k_fkPush, k_cfClientRequestPrivateMessage, 0);
+        FramePutString(&invite, request.user.handle);
+        if (FrameFinish(&invite))
+            RSSendToClient(&peer, invite.data, invite.length, k_plControl);
+
+        FrameWriterFree(&invite);
+        break;
+    case k_cfClientAcceptedPrivateMessage:
+    case k_cfClientDeclinedPrivateMessage:
+    {
+        // Peer answered a pm invite. Now respond to whoever asked
+        User requester = {0};
+        bool pending   = false;
+
+        pthread_mutex_lock(&rootClientsLock);
+        RootSession* session = SessionFromRfd(request.user.rfd);
+        if (session != NULL && session->privateMessagePending) {
+            requester          = session->privateMessageFrom;
+            response.requestId = session->privateMessageRequestId;
+            response.command   = k_cfClientRequestPrivateMessage;
+            pending            = true;
+            RSSetInvitePendingLocked(session, false);
+        }
+        pthread_mutex_unlock(&rootClientsLock);
+
+        if (!pending)
+            break;
+
+        if (request.cmdFlag == k_cfClientAcceptedPrivateMessage) {
+            printf("they accepted the pm!\n");
+        } else {
+            printf("declined :(\n");
+            response.rcode = k_rcInternalServerError;
+        }
+
+        RSRespondToRootRequestMaker(&requester, response);
+        response.rcode = k_rcRootOperationSuccessful;
+        break;
+    }
+    case k_cfRequestServerList: // Client wants to know the updated server list 
+    {
+        /*
+            The response and the servers that changed since the
+            version the client has go out in one write.
+        */
+        FrameWriter frame   = {0};
+        uint64_t    version = 0;
+        RSBeginResponse(&frame, &response);
+        ServerListPack(&frame, request.directoryVersion, &version);
+
+        if (!FrameFinish(&frame) || RSSendToClient(&request.user, frame.data, frame.length, k_plChat) < 0)
+            SystemPrint(RED, true, "Error sending server list to %s. Errno %i", request.user.handle, errno);
+
+        FrameWriterFree(&frame);
+        break;
+    }
+    case k_cfAppendServer: // Add server to server list
+        printf("Append server\n");
+        SSAddServerToList(request.server);
+        response.rflag = k_rfNoValueReturnedFromRequest;
+        RSRespondToRootRequestMaker(&request.user, response);
+        break;
+    case k_cfRemoveServer: // Remove server from server list
+    {
+        Server* listed = ServerListFind(request.server.alias);
+        if (listed == NULL) // Server doesnt exist...
+            break;
+
+        ServerListRemove(listed);
+        // Server list now removed
+        RSRespondToRootRequestMaker(&request.user, response);
+        break;
+    }
+    case k_cfMakeNewServer: // Make new server and run it
+        printf("Make new server\n");
+        /*
+            RSServerBareMetal frees what it is given
+            so it gets its own copy of the server and host.
+        */
+        ServerCreationInfo* creationInfo = malloc(sizeof(ServerCreationInfo));
+        creationInfo->serverInfo    = malloc(sizeof(Server));
+        creationInfo->clientAKAhost = malloc(sizeof(User));
+        *creationInfo->serverInfo    = request.server;
+        *creationInfo->clientAKAhost = request.user;
+        creationInfo->requestId      = request.requestId;
+
+        // Already on a worker. It starts the servers accept thread and returns
+        RSServerBareMetal((void*)creationInfo);
+        printf("Created Server\n");
+        break;
+    // pthread_exit(NULL);
+    case k_cfDisconnectClientFromRoot:
+        RSDisconnectClientFromRootServer(request.user);
+        return k_rcRootOperationSuccessful;
+    case k_cfKickClientFromServer:
+        /*
+            Rooms take leaves and kicks over their own socket. Root only
+            knows the room from the session, which may be shut down and
+            freed by the time this runs.
+        */
+        return k_rcInternalServerError;
+    case k_cfRSUpdateServerWithNewInfo:
+        RSUpdateServerWithNewInfo(&request.server);
+        break;
+    case k_cfSSUpdateClientWithNewInfo:
+        // Keeps the room they are in. 'request.server' is gone once this returns
+        SSUpdateClientWithNewInfo(request.user);
+        response.rflag = k_rfRequestedDataUpdated;
+        RSRespondToRootRequestMaker(&request.user, response);
+        break;
+    default:
+        return k_rcInternalServerError; // LIkely the command doesnt exist
+    }
+
+    return response.rcode;
+}
+ 
+/*
+    Add or remove a session from the subscriber list.
+    'rootClientsLock' must be held.
+*/
+static bool RSSetSubscribedLocked(RootSession* session, bool subscribe)
+{
+    if (session->subscribed == subscribe)
+        return true;
+
+    if (subscribe) {
+        if (rootSubscriberCount == rootSubscriberCapacity) {
+            unsigned int newCapacity = rootSubscriberCapacity ? rootSubscriberCapacity * 2 : 64;
+            RootSession** grown = realloc(rootSubscribers, sizeof(RootSession*) * newCapacity);
+            if (grown == NULL)
+                return false;
+
+            rootSubscribers        = grown;
+            rootSubscriberCapacity = newCapacity;
+        }
+
+        session->subscriberIndex = rootSubscriberCount;
+        rootSubscribers[rootSubscriberCount++] = session;
+    }
+    else {
+        RootSession* last = rootSubscribers[--rootSubscriberCount];
+        rootSubscribers[session->subscriberIndex] = last;
+        last->subscriberIndex = session->subscriberIndex;
+    }
+
+    session->subscribed = subscribe;
+    return true;
+}
+
+/*
+    Handle k_cfSubscribeServerList and k_cfUnsubscribeServerList.
+
+    A new subscriber is answered like a server list request
+    so it starts off in sync. Changes after that are pushed.
+*/
+static void RSSubscribeToServerList(RootSession* session, RootRequest* request)
+{
+    bool subscribe = (request->cmdFlag == k_cfSubscribeServerList);
+
+    RootResponse response = {0};
+    response.rcode        = k_rcRootOperationSuccessful;
+    response.rflag        = subscribe ? k_rfRequestedDataUpdated : k_rfNoValueReturnedFromRequest;
+    response.command      = request->cmdFlag;
+    response.requestId    = request->requestId;
+
+    pthread_mutex_lock(&rootClientsLock);
+
+    if (!RSSetSubscribedLocked(session, subscribe))
+        response.rcode = k_rcInternalServerError;
+
+    FrameWriter frame = {0};
+    RSBeginResponse(&frame, &response);
+
+    // New subscribers start off in sync
+    if (subscribe && response.rcode == k_rcRootOperationSuccessful)
+        ServerListPack(&frame, request->directoryVersion, &session->pushedDirectoryVersion);
+
+    if (FrameFinish(&frame))
+        ConnectionSend(session->connection, frame.data, frame.length, k_plChat);
+
+    pthread_mutex_unlock(&rootClientsLock);
+    FrameWriterFree(&frame);
+}
+
+/**
+ * @brief           Event loop timer. Push server list changes to subscribers
+ * @param[in]       reactor: root event loop
+ * @param[in]       events:  unused
+ * @param[in]       context: unused
+ * @return          void
+ */
+static void RSPushServerListChanges(Reactor* reactor, unsigned int events, void* context)
+{
+    ReactorTimerAcknowledge(&rootTickWatch);
+
+    // Joins and leaves since the last tick are one change per room
+    ServerListFlushCounts();
+
+    uint64_t version = ServerListVersion();
+
+    // Most subscribers are at the same version so they share one frame
+    FrameWriter push          = {0};
+    bool        packed        = false;
+    uint64_t    packedSince   = 0;
+    uint64_t    packedVersion = 0;
+
+    pthread_mutex_lock(&rootClientsLock);
+
+    for (unsigned int i = 0; i < rootSubscriberCount; i++)
+    {
+        RootSession* session = rootSubscribers[i];
+        if (session->pushedDirectoryVersion == version)
+            continue;
+
+        // Client hasn't read the last push yet. It gets everything in one go later
+        if (ConnectionQueued(session->connection, k_plChat) > 0)
+            continue;
+
+        if (!packed || packedSince != session->pushedDirectoryVersion) {
+            packedSince = session->pushedDirectoryVersion;
+            FrameBegin(&push, k_fkPush, k_cfSubscribeServerList, 0);
+            ServerListPack(&push, packedSince, &packedVersion);
+
+            packed = FrameFinish(&push);
+            if (!packed)
+                break;
+        }
+
+        if (ConnectionSend(session->connection, push.data, push.length, k_plChat) == 0)
+            session->pushedDirectoryVersion = packedVersion;
+    }
+
+    pthread_mutex_unlock(&rootClientsLock);
+    FrameWriterFree(&push);
+}
+
+/*
+    Unregister a session and free it. If the client joined,
+    they are removed from the root server like a normal disconnect.
+*/
+static void RSCloseRootSession(RootSession* session)
+{
+    if (session->joined) {
+        session->joined = false;
+        RSDisconnectClientFromRootServer(session->user);
+    }
+
+    User     requester = {0};
+    uint32_t requestId = 0;
+    bool     invited   = false;
+
+    pthread_mutex_lock(&rootClientsLock);
+    if ((size_t)session->connection->fd < rootClientsByRfdCapacity)
+        rootClientsByRfd[session->connection->fd] = NULL;
+    RSSetSubscribedLocked(session, false);
+
+    // Whoever asked this client to pm won't get an answer
+    if (session->privateMessagePending) {
+        requester = session->privateMessageFrom;
+        requestId = session->privateMessageRequestId;
+        invited   = true;
+        RSSetInvitePendingLocked(session, false);
+    }
+
+    // Invites this client sent are closed so the peers can be asked again
+    unsigned int i = 0;
+    while (session->user.clientId != 0 && i < rootInviteCount)
+    {
+        if (rootInvites[i]->privateMessageFrom.clientId == session->user.clientId)
+            RSSetInvitePendingLocked(rootInvites[i], false);
+        else
+            i++;
+    }
+    pthread_mutex_unlock(&rootClientsLock);
+
+    if (invited)
+        RSFailPrivateMessage(&requester, requestId);
+
+    ConnectionDestroy(session->connection);
+    free(session);
+}
+
+/*
+    Handle the join request. Add the client to the
+    root server and send their updated info back.
+*/
+static void RSAcceptRootClient(RootSession* session, RootRequest* request)
+{
+    RootResponse response = {0};
+    response.rcode        = k_rcRootOperationSuccessful;
+    response.returnValue  = (void*)&session->user;
+    response.rflag        = k_rfRequestedDataUpdated;
+    response.command      = request->cmdFlag;
+    response.requestId    = request->requestId;
+
+    request->user.handle[kMaxClientHandleLength] = '\0';
+    request->user.rfd             = session->connection->fd;
+    request->user.connectedServer = &rootServer;
+
+    pthread_mutex_lock(&rootClientsLock);
+
+    // Handles are how clients find each other so they must be unique
+    bool handleTaken = (HashMapGet(&rootClientsByHandle, request->user.handle) != NULL);
+    if (!handleTaken) {
+        request->user.clientId = nextRootClientId++;
+        session->user          = request->user;
+        session->joined        = HashMapPut(&rootClientsByHandle, session->user.handle, (void*)session);
+    }
+
+    if (session->joined)
+        onlineGlobalClients++;
+
+    pthread_mutex_unlock(&rootClientsLock);
+
+    if (!session->joined) {
+        response.rcode   = handleTaken ? k_rcErrorHandleInUse : k_rcInternalServerError;
+        response.rflag   = k_rfSentDataWasUnused;
+        session->closing = true;
+        RSRespond(session->connection, &response);
+        return;
+    }
+
+    SystemPrint(CYN, false, "%s Joined! (id %u)", session->user.handle, session->user.clientId);
+
+    // Send info back
+    if (RSRespond(session->connection, &response) != 0) {
+        printf(RED "\tError Sending Updated Struct Back\n" RESET);
+        session->closing = true;
+    }
+}
+
+/*
+    Worker job. Do a root request the
+    event loop queued and free it.
+*/
+static void RSRunRootRequest(void* argument)
+{
+    RootRequest* request = (RootRequest*)argument;
 
-void SSUpdateClientWithNewInfo(User updatedUserInfo)
+    ResponseCode result = DoRootRequest((void*)request);
+    if (result != k_rcRootOperationSuccessful)
+        printf(RED "Error Doing Request '%i' From %s\n" RESET, request->cmdFlag, request->user.handle);
+
+    free(request);
+}
+
+/*
+    Worker job. Shut down a server whose host
+    left root. 'argument' is a copy of the server.
+*/
+static void RSRunServerShutdown(void* argument)
 {
-    // Iterate through rootConnectedClients list to find the client to update
-    for (size_t i = 0; i < onlineGlobalClients; i++)
-    {
-        if (strcmp(rootConnectedClients[i].handle, updatedUserInfo.handle) == 0) 
-        {
-            rootConnectedClients[i] = updatedUserInfo;
-            break;
-        }
-    }
+    Server* server = (Server*)argument;
+    ShutdownServer(server);
+    free(server);
 }
 
-void RSUpdateServerWithNewInfo(Server* updatedServerInfo)
+bool RSSubmitWork(WorkFunction function, void* argument)
 {
-    // Iterate through server list to find the server to update
-    for (size_t i = 0; i < onlineServers; i++)
-    {
-        // 'server' is at index 'i' in the list.
-        if (strcmp(serverList[i].alias, updatedServerInfo->alias) == 0) 
-        {
-            // found it now replace it with updated server aka 'server'
-            serverList[i] = *updatedServerInfo;
-            backendServerList[updatedServerInfo->serverId] = *updatedServerInfo;
-            break;
-        }
-    }
-    // Now the server should be updated in the serverList
+    return WorkPoolSubmit(&rootWorkers, function, argument);
 }
 
-void UpdateClientInConnectedServer(User* userToUpdate)
+void RSGetWorkMetrics(WorkPoolMetrics* metrics)
 {
-    if (!userToUpdate->connectedServer->online)
-        return;
+    WorkPoolGetMetrics(&rootWorkers, metrics);
+}
 
-    Server* server = userToUpdate->connectedServer;
+/**
+ * @brief           Event loop timer. Print how busy the root workers are
+ * @param[in]       reactor: root event loop
+ * @param[in]       events:  unused
+ * @param[in]       context: unused
+ * @return          void
+ */
+static void RSPrintWorkMetrics(Reactor* reactor, unsigned int events, void* context)
+{
+    ReactorTimerAcknowledge(&rootStatsWatch);
+
+    static uint64_t lastSubmitted = 0;
+    static uint64_t lastRejected  = 0;
+    static uint64_t lastAppended  = 0;
+
+    // Disk log of the rooms, only if it's turned on and was written to
+    ChatLogMetrics logMetrics;
+    ChatLogGetMetrics(&logMetrics);
+    if (ChatLogEnabled() && logMetrics.appended != lastAppended) {
+        lastAppended = logMetrics.appended;
+        SystemPrint(CYN, false, "Chat log: %" PRIu64 " written (%" PRIu64 " bytes), %" PRIu64 " dropped, %" PRIu64 " syncs, %" PRIu64 " segments rolled, %" PRIu64 " purged",
+                    logMetrics.written, logMetrics.bytesWritten, logMetrics.dropped, logMetrics.syncs,
+                    logMetrics.segmentsRolled, logMetrics.segmentsPurged);
+    }
 
-    // Get the index of the client from the connectedServers Client list
-    int clientIndexInCList = ClientIndex(
-                                server->clientList,
-                                server->connectedClients,
-                                userToUpdate);
-    
-    // Temp array to copy all clients to including the updated client info
-    User* tmpArray[] = {0};
-    
-    // Copy over the connected servers client list to tmpArray
-    // and input the most updated info into tmpArray
-    for (int i=0; i<server->connectedClients; i++)
-    {
-        // Found the user to update in the connected servers client list
-        if (strcmp(server->clientList[i].handle, userToUpdate->handle) == 0)
-            // Put updated User* struct in tmpArray
-            tmpArray[i] = userToUpdate;
-        else
-            // Normal client we dont need to update
-            tmpArray[i] = &server->clientList[i];
+    // Room sockets. Control frames backing up means readers stopped reading altogether
+    static uint64_t     lastPushed = 0;
+    OutboundLaneMetrics lanes[PRIORITY_LANES];
+    OutboundLaneGetMetrics(lanes);
+    if (lanes[k_plControl].pushed + lanes[k_plChat].pushed != lastPushed) {
+        lastPushed = lanes[k_plControl].pushed + lanes[k_plChat].pushed;
+        SystemPrint(CYN, false, "Room lanes: control %" PRIu64 " queued (max %" PRIu64 "), %" PRIu64 " dropped; chat %" PRIu64 " queued (max %" PRIu64 "), %" PRIu64 " dropped",
+                    lanes[k_plControl].depth, lanes[k_plControl].maxDepth, lanes[k_plControl].dropped,
+                    lanes[k_plChat].depth, lanes[k_plChat].maxDepth, lanes[k_plChat].dropped);
     }
 
-    // Now copy tmpArray into connected servers client list so client list
-    // is fully up to date
-    for (int i=0; i<server->connectedClients; i++)
-        server->clientList[i] = *tmpArray[i];
+    WorkPoolMetrics metrics;
+    RSGetWorkMetrics(&metrics);
 
-    // Finally take changes into affect and update this server on the root server
-    RSUpdateServerWithNewInfo(server);
+    // Nothing happened since last time
+    if (metrics.submitted == lastSubmitted && metrics.rejected == lastRejected)
+        return;
+
+    lastSubmitted = metrics.submitted;
+    lastRejected  = metrics.rejected;
+
+    // Jobs that left the queue are the ones with a wait time
+    uint64_t started       = metrics.submitted - metrics.queueDepth;
+    double   averageWaitMs = (started > 0) ? (double)metrics.totalWaitNs / 1e6 / (double)started : 0.0;
+
+    SystemPrint(CYN, false, "Workers: %" PRIu64 " done, %zu waiting (max %zu), %" PRIu64 " rejected, wait avg %.3f ms max %.3f ms",
+                metrics.completed, metrics.queueDepth, metrics.maxQueueDepth, metrics.rejected,
+                averageWaitMs, (double)metrics.maxWaitNs / 1e6);
 }
 
-/**
- * @brief           Make a request from the client to the root server. Kind of like http
- * @param[in]       commandFlag:   tell the server what to do with the data
- * @param[in]       currentServer: server to make the request from
- * @param[in]       relatedClient: client who made the request
- * @return          void*
- * @retval          RootResponse from server as void*
- */
-RootResponse MakeRootRequest(
-    CommandFlag    commandFlag,
-    Server    currentServer,
-    User      relatedClient,
-    CMessage clientMessageInfo
-)
+void PerformRootRequestFromClient(RootSession* session, RootRequest* request)
 {
-    RootRequest request;
-    request.cmdFlag           = commandFlag;
-    request.server            = currentServer;
-    request.user              = relatedClient;
-    request.clientSentMessage = clientMessageInfo;
-
-    // Default response values
-    RootResponse response = {0};
-    response.rcode        = k_rcInternalServerError;
-    response.rflag        = k_rfNoResponse;
-    response.returnValue  = NULL;
+    if (!session->joined) {
+        // Nothing else is allowed until the client has joined
+        if (request->cmdFlag == k_cfConnectClientToServer)
+            RSAcceptRootClient(session, request);
+        else
+            session->closing = true;
 
-    // Send request to root server
-    int sentBytes = send(rootServer.sfd, (const void*)&request, sizeof(RootRequest), 0);
-    if (sentBytes <= 0) { // Client disconnected or something went wrong sending
-        printf(RED "Error making request to root server...\n" RESET);
-        return response;
+        return;
     }
 
-    // Client wont be able to receive messages when their socket file descriptor is closed
-    if (request.cmdFlag == k_cfDisconnectClientFromRoot)
-        return response;
+    // No command to perform
+    if (request->cmdFlag == k_cfNone)
+        return;
 
-    // Receive a response from the root server
-    int receivedBytes = recv(rootServer.sfd, (void*)&response, sizeof(RootResponse), 0);
-    if (receivedBytes <= 0) { // Client disconnected or something went wrong receiving
-        printf(RED "Failed to receive data from root server...\n" RESET);
-        return response;
+    // Rooms change it when they shut down
+    pthread_mutex_lock(&rootClientsLock);
+    request->user = session->user;
+    pthread_mutex_unlock(&rootClientsLock);
+
+    if (request->cmdFlag == k_cfDisconnectClientFromRoot)
+        request->user.connectedServer = &request->server;
+
+    if (request->cmdFlag == k_cfSubscribeServerList || request->cmdFlag == k_cfUnsubscribeServerList) {
+        RSSubscribeToServerList(session, request);
+        return;
     }
- 
-    // In the case of special commands
-    // where we may need to send or recv more than once
-    switch (request.cmdFlag)
-    {
-    case k_cfClientRequestPrivateMessage:
-        if (response.rcode == k_rcRootOperationSuccessful) {
-            // client accepted the pm
-            char pmName[400];
-            snprintf(pmName, sizeof(pmName), "%s-%s", localClient->handle, request.clientSentMessage.message);
-            int pmServer = MakeServer(AF_INET, SOCK_STREAM, 0, 5023, 2, pmName);
-        }
-        break;
-    case k_cfMakeNewServer:
-        break;
-    case k_cfRequestServerList: // Need to receive all servers individually
-    {
-        // Receive the number of online servers
-        uint32_t onlineServersTemp = 0;
-        int initialReceivedBytes = recv(rootServer.sfd, &onlineServersTemp, sizeof(onlineServersTemp), 0);
-        
-        if (initialReceivedBytes <= 0)
-            break;
-        
-        onlineServers = ntohl(onlineServersTemp);
-
-        // Receive all servers
-        for (int i = 0; i < onlineServers; i++){
-            Server receivedServer = {0};
-            int receive = recv(rootServer.sfd, (void*)&receivedServer, sizeof(Server), 0);
-            
-            if (receive <= 0)
-                break;
-            
-            // Update server list
-            serverList[i] = receivedServer;
-        } 
 
-        break;
+    if (request->cmdFlag == k_cfDisconnectClientFromRoot) {
+        // Removing the client is quick. Shutting down their server is queued
+        DoRootRequest((void*)request);
+        session->joined  = false;
+        session->closing = true;
+        return;
     }
-    default:
-        break;
+
+    // The request is copied since the worker runs after this returns
+    RootRequest* queued = malloc(sizeof(RootRequest));
+    if (queued != NULL) {
+        *queued = *request;
+        if (!RSSubmitWork(RSRunRootRequest, (void*)queued)) {
+            free(queued);
+            queued = NULL;
+        }
     }
 
-    return response;
+    if (queued == NULL) {
+        RootResponse response = {0};
+        response.rcode        = k_rcErrorServerBusy;
+        response.rflag        = k_rfSentDataWasUnused;
+        response.command      = request->cmdFlag;
+        response.requestId    = request->requestId;
+        RSRespond(session->connection, &response);
+    }
 }
 
-ResponseCode DoRootRequest(void* req)
+/**
+ * @brief           Event loop handler for a client socket on the root server
+ * @param[in]       reactor: root event loop
+ * @param[in]       events:  what the socket is ready for
+ * @param[in]       context: the clients Connection
+ * @return          void
+ */
+static void RSHandleRootClientEvent(Reactor* reactor, unsigned int events, void* context)
 {
-    RootRequest  request = *(RootRequest*)req;
-    RootResponse response;
-    memset(&response, 0, sizeof(response)); 
+    Connection*  connection = (Connection*)context;
+    RootSession* session    = (RootSession*)connection->owner;
 
-    // Default response
-    response.rcode       = k_rcRootOperationSuccessful;
-    response.returnValue = NULL;
-    response.rflag       = k_rfSentDataWasUnused;
+    if ((events & REACTOR_WRITE) && ConnectionFlush(connection) != 0) {
+        RSCloseRootSession(session);
+        return;
+    }
 
-    printf("Doing root request\n");
+    if (!(events & (REACTOR_READ | EPOLLHUP | EPOLLERR)))
+        return;
 
-    // Handle possible request commands
-    switch (request.cmdFlag)
+    if (ConnectionFill(connection) < 0) {
+        RSCloseRootSession(session);
+        return;
+    }
+
+    // Handle every complete request that has arrived so far
+    FrameHeader header  = {0};
+    size_t      handled = 0;
+    int         parsed  = 0;
+    while ((parsed = FrameParse(connection->inbound + handled, connection->inboundLength - handled, &header)) == 1)
     {
-    case k_cfClientRequestPrivateMessage:
-        CMessage options = request.clientSentMessage;
-        bool userExists = false;
-        User peer = {0};
+        FrameReader reader;
+        FrameReaderInit(&reader, connection->inbound + handled + sizeof(FrameHeader), header.length);
+        handled += sizeof(FrameHeader) + header.length;
 
-        printf("%s wants to pm %s\n", request.user.handle, options.message);
-        for (int ci = 1; ci <= onlineGlobalClients; ci++) { // terrible o(n) dont have tiem for hashmap
-            printf("- %s\n", rootConnectedClients[ci].handle);
-            
-            if (strcmp(rootConnectedClients[ci].handle, options.message) == 0) {
-                userExists = true;
-                peer = rootConnectedClients[ci];
-                break;
+        RootRequest request;
+        if (!RSDecodeRootRequest(&header, &reader, &request)) {
+            // Tell the client instead of silently dropping it
+            RootResponse response = {0};
+            response.rcode        = k_rcInternalServerError;
+            response.rflag        = k_rfSentDataWasUnused;
+            response.command      = (CommandFlag)header.command;
+            response.requestId    = header.requestId;
+            RSRespond(connection, &response);
+
+            // Before joining a bad frame means it isn't one of our clients
+            if (!session->joined) {
+                RSCloseRootSession(session);
+                return;
             }
+            continue;
         }
 
-        if (!userExists) {
-            response.rcode = k_rcInternalServerError;
-            response.rflag = k_rfNoResponse;
-            RSRespondToRootRequestMaker(&request.user, response);
-            break;
+        PerformRootRequestFromClient(session, &request);
+        if (session->closing) {
+            RSCloseRootSession(session);
+            return;
         }
+    }
 
-        printf("found the client %s\n", peer.handle);
-        CMessage pmCMD = {0};
-        pmCMD.cflag = k_cfClientRequestPrivateMessage;
-        pmCMD.sender = request.user;
+    // Drop every handled frame at once. A partial frame stays for the next read
+    ConnectionConsume(connection, handled);
 
-        CMessage peerResponse = {0};
+    // Not speaking our protocol
+    if (parsed < 0) {
+        RSCloseRootSession(session);
+        return;
+    }
 
-        send(peer.rfd, (void*)&pmCMD, sizeof(pmCMD), 0);
-        int recvd = recv(peer.rfd, (void*)&peerResponse, sizeof(peerResponse), 0);
-        printf("recvd %d, cf %d\n", recvd, peerResponse.cflag);
+    if (connection->peerClosed)
+        RSCloseRootSession(session);
+}
 
-        if (peerResponse.cflag == k_cfClientAcceptedPrivateMessage) {
-            printf("they accepted the pm!\n");
-            
-        } else if (peerResponse.cflag == k_cfClientDeclinedPrivateMessage) {
-            printf("declined :(\n");
-            response.rcode = k_rcInternalServerError;
-        }
+/**
+ * @brief           Start a root session for a socket accepted on the root listening socket
+ * @param[in]       reactor: root event loop
+ * @param[in]       cfd:     the accepted socket or -errno
+ * @param[in]       context: unused
+ * @return          void
+ */
+static void RSAdmitRootConnection(Reactor* reactor, int cfd, void* context)
+{
+    if (cfd < 0)
+        return;
 
-        RSRespondToRootRequestMaker(&request.user, response);
+    // Only limit is how many sockets the process may open
+    if ((size_t)cfd >= rootClientsByRfdCapacity) {
+        close(cfd);
+        return;
+    }
 
-        break;
-    case k_cfRequestServerList: // Client wants to know the updated server list 
-        RSRespondToRootRequestMaker(&request.user, response);
+    RootSession* session = calloc(1, sizeof(RootSession));
+    if (session == NULL) {
+        close(cfd);
+        return;
+    }
 
-        // First send the amount of online servers as an int
-        uint32_t nlOnlineServers = htonl(onlineServers); // htonl version of onlineServers int
-        
-        int sentBytes = send(request.user.rfd, &nlOnlineServers, sizeof(nlOnlineServers), 0);
-        if (sentBytes <= 0)
-            SystemPrint(RED, true, "Error sending online servers int. Errno %i", errno);
+    // Workers answer requests one at a time. Don't hold each back until the client acked the last
+    int noDelay = 1;
+    setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
 
-        // After prepare and send all the servers from the list individually
-        for (int servIndex=0; servIndex<onlineServers; servIndex++)
-        {
-            Server server = serverList[servIndex];
-            Server updated = backendServerList[server.serverId];
+    session->connection = ConnectionCreate(reactor, cfd, RSHandleRootClientEvent, (void*)session);
+    if (session->connection == NULL) {
+        free(session);
+        close(cfd);
+        return;
+    }
 
-            printf("serv: %s, online: %d, backend name: %s, backend online: %d\n", server.alias, server.online, updated.alias, updated.online);
+    pthread_mutex_lock(&rootClientsLock);
+    rootClientsByRfd[cfd] = session;
+    pthread_mutex_unlock(&rootClientsLock);
+}
 
-            // the server isnt online so don't send it
-            if (!updated.online) {
-                printf("server not online dotn sedn it\n");
+/**
+ * @brief           Event loop handler for the root listening socket
+ * @param[in]       reactor: root event loop
+ * @param[in]       events:  unused
+ * @param[in]       context: unused
+ * @return          void
+ */
+static void RSAcceptRootConnections(Reactor* reactor, unsigned int events, void* context)
+{
+    // Accept everyone waiting in the backlog
+    while (1)
+    {
+        ReactorCountSyscall(reactor);
+        int cfd = accept(rootServer.sfd, (struct sockaddr*)NULL, NULL);
+        if (cfd < 0) {
+            if (errno == EINTR)
                 continue;
-            }
-
-            int sent = send(request.user.rfd, (void*)&updated, sizeof(Server), 0);
-            if (sent <= 0)
-                SystemPrint(RED, true, "Error couldn't send server: %s", updated.alias);
-        }
-
-        break;
-    case k_cfAppendServer: // Add server to server list
-        printf("Append server\n");
-        SSAddServerToList(request.server);
-        response.rflag = k_rfNoValueReturnedFromRequest;
-        RSRespondToRootRequestMaker(&request.user, response);
-        break;
-    case k_cfRemoveServer: // Remove server from server list
-        int index = -1;
-        for (int i=0; i < onlineServers; i++){
-            if (strcmp(serverList[i].alias, request.server.alias) == 0) // Server exists in the list
-                index = i;
+            break; // Backlog empty
         }
 
-        if (index == -1) // Server doesnt exist...
-            break;
+        RSAdmitRootConnection(reactor, cfd, NULL);
+    }
+}
 
-        // shift array to remove that server
-        for (int b=index; b < onlineServers - 1; b++) 
-            serverList[b] = serverList[b + 1]; 
-        
-        onlineServers--;
-        // Server list now removed
-        RSRespondToRootRequestMaker(&request.user, response);
-        break;
-    case k_cfMakeNewServer: // Make new server and run it
-        printf("Make new server\n");
-        // Index will be the port hashed by max servers allowed online
-        int indexInList = request.server.port % kMaxServersOnline;
+void* AcceptClientsToRoot() {
+    // One slot per possible file descriptor
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    rootClientsByRfdCapacity = (limit.rlim_cur == RLIM_INFINITY) ? 65536 : (size_t)limit.rlim_cur;
+    rootClientsByRfd         = calloc(rootClientsByRfdCapacity, sizeof(RootSession*));
+
+    if (rootClientsByRfd == NULL || !HashMapInit(&rootClientsByHandle, 1024) || ReactorCreate(&rootReactor) != 0 || SetSocketNonBlocking(rootServer.sfd) != 0) {
+        SystemPrint(RED, false, "Failed to create root event loop. Error Code %i", errno);
+        return NULL;
+    }
 
-        // Make sure port isnt in use
-        // Try and find the port in the hash map
-        // Check if ports in use
-        if (portList[indexInList].port == request.server.port && portList[indexInList].inUse)
-        {
-            // in use
-            printf("In use\n");
-            response.rcode = k_rcErrorPortInUse;
-            response.rflag = k_rfSentDataWasUnused;
-            RSRespondToRootRequestMaker(&request.user, response);
-            break;
-        }
+    rootListenWatch.fd       = rootServer.sfd;
+    rootListenWatch.events   = REACTOR_READ;
+    rootListenWatch.handler  = RSAcceptRootConnections;
+    rootListenWatch.acceptor = RSAdmitRootConnection; // Multishot accepts with io_uring
+    rootListenWatch.context  = NULL;
 
-        // Add it to the list of ports
-        PortDesc portInfo = {0};
-        portInfo.inUse = true;
-        portInfo.port = request.server.port;
-        portList[indexInList] = portInfo;
+    if (ReactorAdd(&rootReactor, &rootListenWatch) != 0) {
+        SystemPrint(RED, false, "Failed to watch root socket. Error Code %i", errno);
+        return NULL;
+    }
 
-        ServerCreationInfo creationInfo = {0};
-        creationInfo.serverInfo = &request.server;
-        creationInfo.clientAKAhost = &request.user;
+    // Server list changes are pushed to subscribers once per tick
+    rootTickWatch.handler = RSPushServerListChanges;
+    rootTickWatch.context = NULL;
 
-        cpthread tinfo = cpThreadCreate(RSServerBareMetal, (void*)&creationInfo);
-        printf("Created Server\n");
-        break;
-    // pthread_exit(NULL);
-    case k_cfDisconnectClientFromRoot:
-        RSDisconnectClientFromRootServer(request.user);
-        return k_rcRootOperationSuccessful;
-    case k_cfKickClientFromServer:
-        SSDisconnectClientFromServer(&request.user);
-        break;
-    case k_cfRSUpdateServerWithNewInfo:
-        RSUpdateServerWithNewInfo(&request.server);
-        break;
-    case k_cfSSUpdateClientWithNewInfo:
-        request.user.connectedServer = &request.server;
-        SSUpdateClientWithNewInfo(request.user);
-        response.rflag = k_rfRequestedDataUpdated;
-        RSRespondToRootRequestMaker(&request.user, response);
-        break;
-    default:
-        return k_rcInternalServerError; // LIkely the command doesnt exist
+    if (ReactorAddTimer(&rootReactor, &rootTickWatch, ROOT_DIRECTORY_TICK_MS) != 0) {
+        SystemPrint(RED, false, "Failed to start root tick. Error Code %i", errno);
+        return NULL;
     }
 
-    return response.rcode;
-}
- 
-void* AcceptClientsToRoot() {
-    Server rootServerBackup = rootServer;
-    
-    while (1) {
-        // Make sure onlineGlobalClients does not exceed max allowed clients
-        if (onlineGlobalClients + 1 >= kMaxGlobalClients)
-            continue;
+    if (WorkPoolCreate(&rootWorkers, rootWorkerCount, ROOT_WORK_QUEUE_DEPTH) != 0) {
+        SystemPrint(RED, false, "Failed to start %u root workers. Error Code %i", rootWorkerCount, errno);
+        return NULL;
+    }
 
-        int cfd = accept(rootServerBackup.sfd, (struct sockaddr*)NULL, NULL);
+    // Rooms are joined through one listener. Joins are ran on the workers
+    if (SSStartRoomListener() != 0) {
+        SystemPrint(RED, false, "Failed to listen for room clients on port %i. Error Code %i", ROOM_PORT, errno);
+        return NULL;
+    }
 
-        if (cfd < 0) // Bad client file descriptor.
-            continue;
+    // Pm invites nobody answered are failed
+    rootInviteWatch.handler = RSExpirePrivateMessages;
+    rootInviteWatch.context = NULL;
 
-        printf("Accepted a join.\n");
+    if (ReactorAddTimer(&rootReactor, &rootInviteWatch, ROOT_PRIVATE_MESSAGE_SWEEP_MS) != 0) {
+        SystemPrint(RED, false, "Failed to start pm invite timer. Error Code %i", errno);
+        return NULL;
+    }
 
-        // Receive client info on join
-        RootRequest request = { 0 };
-        int clientInfo = recv(cfd, (void*)&request, sizeof(request), 0);
-        
-        if (clientInfo < 0) 
-        {
-            SystemPrint(RED, false, "Error Receiving Client '%i' Info.", cfd);
-            close(cfd);
-            continue;
-        }
+    rootStatsWatch.handler = RSPrintWorkMetrics;
+    rootStatsWatch.context = NULL;
 
-        // user wants to join
-        if (request.cmdFlag == k_cfConnectClientToServer)
-        {
-            SystemPrint(CYN, false, "%s Joined!", request.user.handle);
-                        
-            request.user.rfd             = cfd;
-            request.user.connectedServer = &rootServer;
-            onlineGlobalClients++;
-            rootConnectedClients[onlineGlobalClients] = request.user;
-
-            // Send info back
-            RootResponse response = {0};
-            response.rcode        = k_rcRootOperationSuccessful;
-            response.returnValue  = (void*)&request.user;
-            response.rflag        = k_rfRequestedDataUpdated;
-           
-            int sendResponse = send(cfd, (void*)&response, sizeof(response), 0);
-            if (sendResponse <= 0)
-            {
-                printf(RED "\tError Sending Updated Struct Back\n" RESET);
-                continue;
-            }
+    if (ReactorAddTimer(&rootReactor, &rootStatsWatch, ROOT_STATS_INTERVAL_MS) != 0) {
+        SystemPrint(RED, false, "Failed to start root stats timer. Error Code %i", errno);
+        return NULL;
+    }
 
-            // Make a thread for each client who connects
-            cpthread tinfo = cpThreadCreate(PerformRootRequestFromClient, (void*)&request.user);
-            printf("Make a thread for client\n");
+    SystemPrint(CYN, false, "Root event loop using %s", ReactorBackendName(&rootReactor));
+    ReactorRun(&rootReactor);
 
-            // Reset rootServer to rootServerBackup incase of a garbage values ??*
-            // rootServer = rootServerBackup;
-        }
-    }
+    WorkPoolDestroy(&rootWorkers);
     printf("Stopped accepting clients root\n");
-    // pthread_exit(NULL);
+    return NULL;
 }
 
-void* PerformRootRequestFromClient(void* client) {
-    
-    User connectedClient = rootConnectedClients[onlineGlobalClients];
-    printf("- Root thread created for %s: %i\n", connectedClient.handle, connectedClient.rfd);
-    
-    /*
-        Forever receive requests
-        from a client unless a condition is met
-        to break from the loop. Usually an error.
-    */
-    while (1) 
-    {
-        RootRequest receivedRequest = { 0 };
-        size_t      receivedBytes = recv(connectedClient.rfd, (void*)&receivedRequest, sizeof(RootRequest), 0);
-        printf("Received information from %s: %i\n", connectedClient.handle, connectedClient.rfd);
-
-        if (receivedBytes < 0) 
-        {
-            SystemPrint(RED, false, "Failed to Receive Message");
-            continue;
-        }
-        else if (receivedBytes == 0)
-        {
-            RSDisconnectClientFromRootServer(receivedRequest.user);
-            break;
-        }
+int RSSendToClient(User* to, const void* data, size_t length, PriorityLane lane)
+{
+    int result = -1;
 
-        // No command to perform
-        if (receivedRequest.cmdFlag == k_cfNone)
-            continue;
+    pthread_mutex_lock(&rootClientsLock);
+    RootSession* session = SessionFromRfd(to->rfd);
 
-        if (receivedRequest.cmdFlag != k_cfDisconnectClientFromRoot)
-            receivedRequest.user = connectedClient;
-        else
-            receivedRequest.user.connectedServer = &receivedRequest.server;
+    // Workers can answer after the client left and someone else got their socket
+    if (session != NULL && to->clientId != 0 && session->user.clientId != to->clientId)
+        session = NULL;
 
-        ResponseCode result = DoRootRequest((void*)&receivedRequest);
-        if (receivedRequest.cmdFlag == k_cfDisconnectClientFromRoot)
-            break;
+    if (session != NULL)
+        result = ConnectionSend(session->connection, data, length, lane);
+    pthread_mutex_unlock(&rootClientsLock);
 
-        if (result != k_rcRootOperationSuccessful) 
-        {
-            printf(RED "Error Doing Request '%i' From %s\n" RESET, receivedRequest.cmdFlag, connectedClient.handle);
-            continue;
-        }
-    }
-    printf("Thread for %s ended\n", connectedClient.handle);
-    // pthread_exit(NULL);
-} 
+    return result;
+}
 
 void RSRespondToRootRequestMaker(User* to, RootResponse response) {
     fprintf(stderr, CYN "[AMS] Response to Client '%s' ", to->handle);
     
-    int msg_signal = 0;
+    FrameWriter frame = {0};
+    RSBeginResponse(&frame, &response);
 
-#ifdef __unix__
-    msg_signal = MSG_NOSIGNAL;
-#endif
+    int snd = FrameFinish(&frame) ? RSSendToClient(to, frame.data, frame.length, k_plChat) : -1;
+    FrameWriterFree(&frame);
 
-    int snd = send(to->rfd, (void*)&response, sizeof(response), msg_signal);
-    // int snd = sendto(to->rfd, (void*)&response, sizeof(response), msg_signal, (struct sockaddr*)&to->addressInfo, sizeof(to->addressInfo));
-
-    if (snd <= 0)
+    if (snd < 0)
         printf(RED "Failed\n" RESET);
     else
         printf(GRN "Good\n" RESET);
 }
 
 void RSDisconnectClientFromRootServer(User usr) {
-    int index = 0;
-
-    // Get index where client is on the root connected clients arra    
-    for (int i = 0; i < onlineGlobalClients; i++){
-        // Is the user we want equal to the user in the list at the index 'i'
-        if (strcmp(rootConnectedClients[i].handle, usr.handle) == 0)
-            index = i;
+    bool     removed    = false;
+    uint64_t hostedRoom = 0;
+
+    pthread_mutex_lock(&rootClientsLock);
+    RootSession* session = (RootSession*)HashMapGet(&rootClientsByHandle, usr.handle);
+    if (session != NULL && session->user.rfd == usr.rfd) {
+        /*
+            Check if client is connected to a server they host.
+            Rooms let go of the session before they are freed,
+            so it is only looked at while the lock is held
+        */
+        Server* room = session->user.connectedServer;
+        if (room != NULL && !room->isRoot && IsUserHost(session->user, room))
+            hostedRoom = room->serverId;
+
+        HashMapRemove(&rootClientsByHandle, usr.handle);
+        // Remove 1 client from connected client count
+        onlineGlobalClients--;
+        removed = true;
     }
+    pthread_mutex_unlock(&rootClientsLock);
 
-    // remove client from rootConnectedClients by shifting array
-    for (int i = index; i < onlineGlobalClients - 1; i++) 
-        rootConnectedClients[i] = rootConnectedClients[i + 1]; 
+    if (!removed)
+        return;
 
-    // Check if client is connected to server
-    // If client is, update the server statistics
-    if (!usr.connectedServer->isRoot) {
-        if (IsUserHost(usr, usr.connectedServer))
-        {
-            ShutdownServer(usr.connectedServer);
+    if (hostedRoom != 0)
+    {
+        // Closing every client of the server takes a while. Do it on a worker. Only the id is used
+        Server* server = calloc(1, sizeof(Server));
+        if (server != NULL) {
+            server->serverId = hostedRoom;
+            if (!RSSubmitWork(RSRunServerShutdown, (void*)server))
+                RSRunServerShutdown((void*)server); // It has to happen either way
         }
     }
 
-    close(usr.cfd);
-    close(usr.rfd);
-
-    // Remove 1 client from connected client count
-    onlineGlobalClients--;
+    // The root socket (rfd) is owned by the event loop and
+    // gets closed there once this request is finished
     printf("Disconnected %s\n", usr.handle);
 }
 
@@ -534,6 +1529,9 @@ int CreateRootServer() {
 
     printf("Done\n");
 
+    // Every client is one socket on the event loop
+    RaiseOpenFileLimit();
+
     printf("Creating socket for the server... ");
 	int sfd = socket(rootServer.domain, rootServer.type, rootServer.protocol);
     if (sfd < 0)
@@ -564,7 +1562,7 @@ int CreateRootServer() {
     printf("Done\n");
     printf("Setting up listener for client connections... ");
 
-	int lsn = listen(sfd, 10);
+	int lsn = listen(sfd, SOMAXCONN);
     if (lsn < 0) {
         close(sfd);
         return -1;
@@ -584,29 +1582,26 @@ void SSDisconnectClientFromServer(User* user) {
     Server* server = user->connectedServer;
     printf("Disconnecting %s from server\n", user->handle);
 
-    // get index of client in server client list
-    int index = -1;
-    for (int i=0; i < server->connectedClients; i++){
-        if (strcmp(server->clientList[i].handle, user->handle) == 0) // Server exists in the list
-            index = i;
-    }            
-
-    printf("Getting index of client\n");
-
-    // shift array to remove client from clientlist
-    for (int b=index; b < server->connectedClients; b++) 
-        server->clientList[b] = server->clientList[b + 1]; 
-
-    printf("Shift array\n");
-
-    server->connectedClients--;
+    /*
+        Frees their slot in the room. connectedClients is kept up to date.
+        Checked and removed under one lock by their queue, not their
+        handle, which could belong to someone who joined since
+    */
+    User  removed   = {0};
+    pthread_mutex_lock(server->membersLock);
+    User* member    = SSFindMember(server, user->handle);
+    bool  wasMember = member != NULL && member->outbound == user->outbound
+                      && SSRemoveMember(server, user->handle, &removed);
+    pthread_mutex_unlock(server->membersLock);
+
+    if (!wasMember) // Already left
+        return;
 
-    // close(user->cfd);
-    printf("Closed the client file descriptor\n");
+    // The list's reference to their outbound queue. Their listener closes the socket
+    OutboundQueueRelease(removed.outbound);
     
-    // Update server with new info since 
-    // the client list and connectedClients has been updated
-    RSUpdateServerWithNewInfo(server);
+    // Only connectedClients changed. Clients see it on the next server list tick
+    ServerListTouchCount(server);
     printf("Updated server with new info\n");
 
     if (IsUserHost(*user, server))
@@ -24,137 +24,1543 @@ bool DEBUG = false; // Debug mode
 #include "Headers/client.h"
 #include "Headers/ccmds.h"
 #include "Headers/tools.h"
+#include "Headers/chatlog.h"
 
-PortDesc portList[] = {};
+OverflowPolicy roomOverflowPolicy  = k_opDropOldest;
+unsigned int   roomHistoryLength   = ROOM_HISTORY_LENGTH;
+size_t         roomHistoryBytes    = ROOM_HISTORY_BYTES;
+unsigned int   clientRequestRate   = ROOM_CLIENT_REQUEST_RATE;
+unsigned int   roomMessageRate     = ROOM_MESSAGE_RATE;
+unsigned int   largeRoomMaxClients = 0; // Large rooms are off
+
+struct in_addr roomRelayPeers[ROOM_MAX_RELAY_PEERS];
+unsigned int   roomRelayPeerCount  = 0; // Only relays on this machine
+
+// Socket every room is reached on
+static int roomListenerFd = -1;
+
+// Sends what is queued for members whose sockets were full. Also accepts on ROOM_PORT and reads join frames
+static Reactor roomReactor = {0};
+
+// Accepts on roomListenerFd and hangs up on joins that ran out of time
+static ReactorWatch roomListenWatch    = {0};
+static ReactorWatch roomJoinSweepWatch = {0};
+
+// Connections whose join frame isn't in yet, oldest first. roomReactor thread only
+static RoomJoin* roomJoinsOldest = NULL;
+static RoomJoin* roomJoinsNewest = NULL;
+
+// Read what members and relays send to their rooms. One for each roomFanOut partition
+static Reactor      roomReaders[FANOUT_MAX_PARTITIONS];
+static unsigned int roomReaderCount = 0;
+
+// Pushes messages to the members of large rooms on every core. No threads unless large rooms are on
+static FanOutPool roomFanOut = {0};
+
+// Next id handed out by GenerateServerUID
+static uint64_t nextServerId = 1;
 
 void ServerPrint(const char* color, const char* str, ...) {
     struct tm* timestr = gmt();
 
-    va_list argp;
-    va_start(argp, str);
-    printf("%s", color);
-    printf("[srv/][%02d:%02d:%02d] ", timestr->tm_hour, timestr->tm_min, timestr->tm_sec);
+    va_list argp;
+    va_start(argp, str);
+    printf("%s", color);
+    printf("[srv/][%02d:%02d:%02d] ", timestr->tm_hour, timestr->tm_min, timestr->tm_sec);
+
+    // Prefix
+    vfprintf(stdout, str, argp);
+    va_end(argp);    
+    printf(RESET "\n");
+}
+
+SharedFrame* SSEncodeClientMessage(CMessage* message)
+{
+    // What to do with the message is the command of the frame
+    FrameWriter writer = {0};
+    FrameBegin(&writer, k_fkPush, message->cflag, 0);
+    FramePutString(&writer, message->sender.handle);
+    FramePutLongString(&writer, message->message);
+
+    SharedFrame* frame = SharedFrameCreate(&writer);
+    FrameWriterFree(&writer);
+    return frame;
+}
+
+int SSSendClientMessage(int cfd, CMessage* message)
+{
+    SharedFrame* frame = SSEncodeClientMessage(message);
+    if (frame == NULL)
+        return -1;
+
+    int sent = (FanOutWrite(cfd, &frame, 1) == 0) ? (int)frame->length : -1;
+    SharedFrameRelease(frame);
+    return sent;
+}
+
+/*
+    Members changed. The next fan-out builds a new
+    recipient list. The room's membersLock must be held.
+*/
+static void SSRecipientsChanged(RoomMembers* members)
+{
+    FanOutListRelease(members->recipients);
+    members->recipients = NULL;
+}
+
+static void SSRoomMembersFree(RoomMembers* members)
+{
+    SSRecipientsChanged(members);
+    HashMapFree(&members->byHandle);
+    for (size_t i = 0; i < members->relayed.capacity; i++)
+    {
+        if (members->relayed.entries[i].used)
+            free(members->relayed.entries[i].value);
+    }
+
+    HashMapFree(&members->relayed);
+    for (unsigned int i = 0; i < members->chunkCount; i++)
+        free(members->chunks[i]);
+
+    free(members->chunks);
+    free(members->freeSlots);
+    free(members->active);
+    free(members->activeIndex);
+    free(members->outbound);
+    free(members->relays);
+    free(members->joining);
+    memset(members, 0, sizeof(RoomMembers));
+}
+
+/*
+    Set up an empty member table that can grow to 'capacity' members.
+    Nothing is allocated for the slots until someone joins.
+    Returns false if memory couldn't be allocated.
+*/
+static bool SSRoomMembersInit(RoomMembers* members, unsigned int capacity)
+{
+    memset(members, 0, sizeof(RoomMembers));
+    members->capacity   = capacity;
+    members->chunkSlots = (capacity < ROOM_MEMBER_CHUNK) ? capacity : ROOM_MEMBER_CHUNK;
+
+    // Grows with the room like the slots do
+    return HashMapInit(&members->byHandle, members->chunkSlots) && HashMapInit(&members->relayed, 64);
+}
+
+/*
+    Clients in the room, members and everyone in through a relay.
+*/
+static unsigned int SSClientCount(RoomMembers* members)
+{
+    return members->count + (unsigned int)members->relayed.count;
+}
+
+/*
+    Resize one of the arrays of a member table. It is
+    left as it was if memory couldn't be allocated.
+*/
+static bool SSResize(void** array, size_t size)
+{
+    void* resized = realloc(*array, size);
+    if (resized == NULL)
+        return false;
+
+    *array = resized;
+    return true;
+}
+
+/*
+    Allocate another block of slots and put them on 'freeSlots'.
+    Returns false if the room is full or memory ran out.
+*/
+static bool SSRoomMembersGrow(RoomMembers* members)
+{
+    if (members->allocated >= members->capacity)
+        return false;
+
+    unsigned int added     = members->capacity - members->allocated;
+    added                  = (added < members->chunkSlots) ? added : members->chunkSlots;
+    unsigned int allocated = members->allocated + added;
+
+    // Indexed by slot or position so these can move. The slots themselves can't
+    bool resized = SSResize((void**)&members->chunks, (members->chunkCount + 1) * sizeof(User*))
+                   && SSResize((void**)&members->freeSlots, allocated * sizeof(unsigned int))
+                   && SSResize((void**)&members->active, allocated * sizeof(unsigned int))
+                   && SSResize((void**)&members->activeIndex, allocated * sizeof(unsigned int))
+                   && SSResize((void**)&members->outbound, allocated * sizeof(OutboundQueue*));
+
+    User* chunk = resized ? calloc(members->chunkSlots, sizeof(User)) : NULL;
+    if (chunk == NULL)
+        return false;
+
+    members->chunks[members->chunkCount++] = chunk;
+
+    // Lowest slots are handed out first
+    for (unsigned int slot = allocated; slot > members->allocated; slot--)
+        members->freeSlots[members->freeCount++] = slot - 1;
+
+    members->allocated = allocated;
+    return true;
+}
+
+/*
+    The member in 'slot'.
+*/
+static User* SSMemberAt(RoomMembers* members, unsigned int slot)
+{
+    return &members->chunks[slot / members->chunkSlots][slot % members->chunkSlots];
+}
+
+/*
+    Slot 'member' is in. Found by the block it is in.
+*/
+static unsigned int SSSlotOf(RoomMembers* members, User* member)
+{
+    uintptr_t address = (uintptr_t)member;
+    for (unsigned int i = 0; i < members->chunkCount; i++)
+    {
+        uintptr_t start = (uintptr_t)members->chunks[i];
+        if (address >= start && address < start + members->chunkSlots * sizeof(User))
+            return i * members->chunkSlots + (unsigned int)((address - start) / sizeof(User));
+    }
+
+    return members->allocated; // Not a member
+}
+
+/*
+    Leave 'queue' out of fan-outs until SSJoinQueued(), so nothing
+    said in the room reaches it before its join reply does.
+    The room's membersLock must be held. False if memory ran out.
+*/
+static bool SSHoldJoin(RoomMembers* members, OutboundQueue* queue)
+{
+    if (members->joiningCount == members->joiningCapacity) {
+        unsigned int capacity = (members->joiningCapacity > 0) ? members->joiningCapacity * 2 : 4;
+        if (!SSResize((void**)&members->joining, capacity * sizeof(OutboundQueue*)))
+            return false;
+
+        members->joiningCapacity = capacity;
+    }
+
+    members->joining[members->joiningCount++] = queue;
+    return true;
+}
+
+/*
+    Let fan-outs reach 'queue'. The room's membersLock must be held.
+    False if it wasn't held back, because it left in the meantime
+    or the room was shut down.
+*/
+static bool SSJoinQueued(RoomMembers* members, OutboundQueue* queue)
+{
+    for (unsigned int i = 0; i < members->joiningCount; i++)
+    {
+        if (members->joining[i] != queue)
+            continue;
+
+        members->joining[i] = members->joining[--members->joiningCount];
+        SSRecipientsChanged(members);
+        return true;
+    }
+
+    return false;
+}
+
+/*
+    True if 'queue' is held back by SSHoldJoin().
+    The room's membersLock must be held.
+*/
+static bool SSJoining(RoomMembers* members, OutboundQueue* queue)
+{
+    for (unsigned int i = 0; i < members->joiningCount; i++)
+    {
+        if (members->joining[i] == queue)
+            return true;
+    }
+
+    return false;
+}
+
+User* SSAddMember(Server* server, User* user)
+{
+    RoomMembers* members = &server->members;
+    if (HashMapGet(&members->byHandle, user->handle) != NULL)
+        return NULL;
+
+    if (members->freeCount == 0 && !SSRoomMembersGrow(members))
+        return NULL;
+
+    unsigned int slot   = members->freeSlots[--members->freeCount];
+    User*        member = SSMemberAt(members, slot);
+    *member = *user;
+
+    // The key is the handle inside the slot, which never moves
+    if (!HashMapPut(&members->byHandle, member->handle, (void*)member)) {
+        memset(member, 0, sizeof(User));
+        members->freeSlots[members->freeCount++] = slot;
+        return NULL;
+    }
+
+    members->active[members->count]   = slot;
+    members->outbound[members->count] = member->outbound;
+    members->activeIndex[slot]        = members->count;
+    members->count++;
+    SSRecipientsChanged(members);
+
+    server->connectedClients = SSClientCount(members);
+    return member;
+}
+
+bool SSRemoveMember(Server* server, const char* handle, User* removed)
+{
+    RoomMembers* members = &server->members;
+    User*        member  = (User*)HashMapRemove(&members->byHandle, handle);
+    if (member == NULL)
+        return false;
+
+    unsigned int slot = SSSlotOf(members, member);
+
+    // Fill the hole in 'active' with the last member
+    unsigned int position = members->activeIndex[slot];
+    unsigned int last     = members->count - 1;
+    members->active[position]                       = members->active[last];
+    members->outbound[position]                     = members->outbound[last];
+    members->activeIndex[members->active[position]] = position;
+    members->outbound[last]                         = NULL;
+    members->count--;
+    SSRecipientsChanged(members);
+
+    // Left before their join reply was queued
+    SSJoinQueued(members, member->outbound);
+
+    if (removed != NULL)
+        *removed = *member;
+
+    memset(member, 0, sizeof(User));
+    members->freeSlots[members->freeCount++] = slot;
+
+    server->connectedClients = SSClientCount(members);
+    return true;
+}
+
+/*
+    Start fanning out everything said in 'server' to the
+    relay on 'relay'. The room keeps the reference it's given.
+    The room's membersLock must be held. False if memory ran out.
+*/
+static bool SSAddRelay(Server* server, OutboundQueue* relay)
+{
+    RoomMembers* members = &server->members;
+    if (members->relayCount == members->relayCapacity) {
+        unsigned int capacity = (members->relayCapacity > 0) ? members->relayCapacity * 2 : 4;
+        if (!SSResize((void**)&members->relays, capacity * sizeof(OutboundQueue*)))
+            return false;
+
+        members->relayCapacity = capacity;
+    }
+
+    members->relays[members->relayCount++] = relay;
+    SSRecipientsChanged(members);
+    return true;
+}
+
+/*
+    Let in the client 'handle' of 'relay' if the room has
+    space and nobody else has the handle. The room's
+    membersLock must be held. Returns the response code.
+*/
+static ResponseCode SSAddRelayedClient(Server* server, OutboundQueue* relay, const char* handle)
+{
+    RoomMembers* members = &server->members;
+    if (!server->online)
+        return k_rcInternalServerError;
+
+    if (server->connectedClients >= server->maxClients)
+        return k_rcErrorServerFull;
+
+    if (SSHandleTaken(server, handle))
+        return k_rcErrorHandleInUse;
+
+    RelayedClient* client = calloc(1, sizeof(RelayedClient));
+    if (client == NULL)
+        return k_rcInternalServerError;
+
+    snprintf(client->handle, sizeof(client->handle), "%s", handle);
+    client->relay = relay;
+    if (!HashMapPut(&members->relayed, client->handle, (void*)client)) {
+        free(client);
+        return k_rcInternalServerError;
+    }
+
+    server->connectedClients = SSClientCount(members);
+    return k_rcRootOperationSuccessful;
+}
+
+/*
+    Take the client 'handle' of 'relay' out of the room. Left
+    alone if someone else has the handle. The room's membersLock
+    must be held. False if they weren't in through 'relay'.
+*/
+static bool SSRemoveRelayedClient(Server* server, OutboundQueue* relay, const char* handle)
+{
+    RoomMembers*   members = &server->members;
+    RelayedClient* client  = (RelayedClient*)HashMapGet(&members->relayed, handle);
+    if (client == NULL || client->relay != relay)
+        return false;
+
+    HashMapRemove(&members->relayed, handle);
+    free(client);
+    server->connectedClients = SSClientCount(members);
+    return true;
+}
+
+/*
+    Take every client of 'relay' out of the room. The
+    room's membersLock must be held. Returns how many.
+*/
+static unsigned int SSRemoveRelayedClients(Server* server, OutboundQueue* relay)
+{
+    RoomMembers* members = &server->members;
+    unsigned int removed = 0;
+
+    // Removing shifts entries back, so whatever lands in a slot is looked at again
+    size_t i = 0;
+    while (i < members->relayed.capacity)
+    {
+        RelayedClient* client = (RelayedClient*)members->relayed.entries[i].value;
+        if (!members->relayed.entries[i].used || client->relay != relay) {
+            i++;
+            continue;
+        }
+
+        HashMapRemove(&members->relayed, client->handle);
+        free(client);
+        removed++;
+    }
+
+    server->connectedClients = SSClientCount(members);
+    return removed;
+}
+
+/*
+    Stop fanning out to 'relay' and take its clients out of the
+    room. The caller gets the room's reference to it. The room's
+    membersLock must be held. False if it wasn't relaying the room.
+*/
+static bool SSRemoveRelay(Server* server, OutboundQueue* relay)
+{
+    RoomMembers* members = &server->members;
+    for (unsigned int i = 0; i < members->relayCount; i++)
+    {
+        if (members->relays[i] != relay)
+            continue;
+
+        members->relays[i] = members->relays[--members->relayCount];
+        SSRecipientsChanged(members);
+        SSJoinQueued(members, relay);
+        SSRemoveRelayedClients(server, relay);
+        return true;
+    }
+
+    return false;
+}
+
+User* SSFindMember(Server* server, const char* handle)
+{
+    return (User*)HashMapGet(&server->members.byHandle, handle);
+}
+
+bool SSHandleTaken(Server* server, const char* handle)
+{
+    return SSFindMember(server, handle) != NULL || HashMapGet(&server->members.relayed, handle) != NULL;
+}
+
+/*
+    Set up an empty history with room for 'capacity' frames.
+    Returns false if memory couldn't be allocated.
+*/
+static bool SSRoomHistoryInit(RoomHistory* history, unsigned int capacity)
+{
+    memset(history, 0, sizeof(RoomHistory));
+    if (capacity == 0) // History turned off
+        return true;
+
+    history->frames   = calloc(capacity, sizeof(SharedFrame*));
+    history->capacity = capacity;
+    return history->frames != NULL;
+}
+
+/*
+    Drop every frame of a history and free it.
+    The room's membersLock must be held.
+*/
+static void SSRoomHistoryFree(RoomHistory* history)
+{
+    for (unsigned int i = 0; i < history->count; i++)
+        SharedFrameRelease(history->frames[(history->head + i) % history->capacity]);
+
+    free(history->frames);
+    memset(history, 0, sizeof(RoomHistory));
+}
+
+/*
+    Keep a reference to a message fanned out in a room,
+    dropping the oldest ones to stay under the limits.
+    The room's membersLock must be held.
+*/
+static void SSRecordHistory(Server* server, SharedFrame* frame)
+{
+    RoomHistory* history = &server->history;
+    history->recorded++;
+    if (history->capacity == 0 || frame->length > roomHistoryBytes)
+        return;
+
+    while (history->count > 0 && (history->count == history->capacity || history->bytes + frame->length > roomHistoryBytes))
+    {
+        SharedFrame* oldest = history->frames[history->head];
+        history->bytes -= oldest->length;
+        history->head   = (history->head + 1) % history->capacity;
+        history->count--;
+        SharedFrameRelease(oldest);
+    }
+
+    history->frames[(history->head + history->count) % history->capacity] = SharedFrameRetain(frame);
+    history->count++;
+    history->bytes += frame->length;
+}
+
+/*
+    Take a reference to the frames 'history' recorded after its first
+    'since', oldest first. At most 'maxFrames' and only those it still
+    keeps. The room's membersLock must be held. Returns how many.
+*/
+static int SSHistoryRetain(RoomHistory* history, uint64_t since, SharedFrame** frames, int maxFrames)
+{
+    uint64_t     missed = history->recorded - since;
+    unsigned int first  = (missed < history->count) ? history->count - (unsigned int)missed : 0;
+    int          found  = 0;
+
+    for (unsigned int i = first; i < history->count && found < maxFrames; i++)
+        frames[found++] = SharedFrameRetain(history->frames[(history->head + i) % history->capacity]);
+
+    return found;
+}
+
+/*
+    Free what a room was made with. Nobody else can hold it.
+*/
+static void SSRoomFree(Server* server)
+{
+    SSRoomMembersFree(&server->members);
+    SSRoomHistoryFree(&server->history);
+    free(server->messageLimit);
+
+    if (server->membersLock != NULL)
+        pthread_mutex_destroy(server->membersLock);
+    free(server->membersLock);
+}
+
+void SSRoomRelease(Server* server)
+{
+    if (__atomic_sub_fetch(&server->references, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    // Nobody else holds it, so nothing is locked
+    printf("Freed server '%s'\n", server->alias);
+    SSRoomFree(server);
+    free(server);
+}
+
+/*
+    True if 'server' is a large room and its
+    messages are pushed by roomFanOut.
+*/
+static bool SSUsesFanOutPool(Server* server)
+{
+    return server->maxClients > kMaxServerMembers && roomFanOut.partitionCount > 0;
+}
+
+/*
+    Send 'frame' to everyone in 'server' and keep it in the history
+    (and the log, if it's on) of the room, so a client who joins right
+    after gets it from one or the other but never both.
+
+    The recipient list is shared by every fan-out and only rebuilt if
+    members came or went since the last one, so the lock is never held
+    while pushing. Large rooms hand the frame to roomFanOut before the
+    lock is let go, so every member gets messages in the order they were
+    recorded in even if several are sent at once. Only this room is
+    locked, so rooms never wait on each other. 'recipientCount' is
+    set to the members and relays of the room.
+    Returns how many members it was sent, queued or handed over for.
+*/
+static int SSFanOutToRoom(Server* server, SharedFrame* frame, PriorityLane lane, int* recipientCount)
+{
+    RoomMembers* members = &server->members;
+    int          handed  = 0;
+    bool         pooled  = SSUsesFanOutPool(server);
+
+    pthread_mutex_lock(server->membersLock);
+    SSRecordHistory(server, frame);
+    ChatLogAppend(server->serverId, frame); // Only queued for the writer, disk is never waited on
+
+    // Grouped by partition even when pushed here. It is only walked in order then
+    unsigned int everyone = members->count + members->relayCount;
+    if (members->recipients == NULL && members->relayCount == 0 && members->joiningCount == 0 && everyone > 0)
+        members->recipients = FanOutListCreate(members->outbound, everyone, pooled ? roomFanOut.partitionCount : 1);
+    else if (members->recipients == NULL && everyone > 0) {
+        // Relays are sent to like members and whoever is still joining is left out. Only copied when the list is rebuilt
+        OutboundQueue** queues = malloc(everyone * sizeof(OutboundQueue*));
+        if (queues != NULL) {
+            unsigned int listed = 0;
+            for (unsigned int i = 0; i < members->count; i++)
+            {
+                if (!SSJoining(members, members->outbound[i]))
+                    queues[listed++] = members->outbound[i];
+            }
+
+            for (unsigned int i = 0; i < members->relayCount; i++)
+            {
+                if (!SSJoining(members, members->relays[i]))
+                    queues[listed++] = members->relays[i];
+            }
+
+            members->recipients = FanOutListCreate(queues, listed, pooled ? roomFanOut.partitionCount : 1);
+            free(queues);
+        }
+    }
+
+    FanOutList* recipients = (members->recipients != NULL) ? FanOutListRetain(members->recipients) : NULL;
+    if (recipients != NULL && pooled)
+        handed = FanOutPoolPush(&roomFanOut, frame, recipients, lane);
+    pthread_mutex_unlock(server->membersLock);
+
+    *recipientCount = (recipients != NULL) ? (int)recipients->count : 0;
+    if (recipients != NULL && !pooled)
+        handed = FanOutQueued(frame, recipients->queues, (int)recipients->count, lane);
+
+    FanOutListRelease(recipients);
+    return handed;
+}
+
+int ReceiveClientMessage(FrameStream* stream, CMessage* message)
+{
+    FrameHeader header = {0};
+    FrameReader reader;
+    if (FrameStreamNext(stream, &header, &reader) != 0)
+        return -1;
+
+    memset(message, 0, sizeof(CMessage));
+    message->cflag = (CommandFlag)header.command;
+    FrameGetString(&reader, message->sender.handle, sizeof(message->sender.handle));
+    FrameGetLongString(&reader, message->message, sizeof(message->message));
+
+    return reader.failed ? -1 : 0;
+}
+
+void ServerAnnouncement(Server* server, char* message) {    
+    CMessage msgToSend = {0};
+    msgToSend.cflag = k_cfPrintServerAnnouncement;
+    strcpy(msgToSend.message, message);
+
+    // Encoded once, every client gets the same bytes
+    SharedFrame* frame = SSEncodeClientMessage(&msgToSend);
+    if (frame == NULL)
+        return;
+
+    int recipientCount = 0;
+    SSFanOutToRoom(server, frame, k_plControl, &recipientCount);
+    SharedFrameRelease(frame);
+}
+
+/*
+    Read the next request frame from a client in a server.
+    Returns 1 on success, 0 if the frame wasn't a valid
+    request and -1 if the client disconnected.
+*/
+static int SSReceiveServerRequest(FrameStream* stream, ServerRequest* request)
+{
+    FrameHeader header = {0};
+    FrameReader reader;
+    if (FrameStreamNext(stream, &header, &reader) != 0)
+        return -1;
+
+    request->command                     = (CommandFlag)header.command;
+    request->optionalClientMessage.cflag = request->command;
+    FrameGetLongString(&reader, request->optionalClientMessage.message, sizeof(request->optionalClientMessage.message));
+
+    return (header.kind == k_fkRequest && !reader.failed) ? 1 : 0;
+}
+
+/*
+    Answer a join. If 'rcode' is a success the info
+    a client needs about the server they joined follows.
+    Relays are also told how much history the room keeps, how
+    many frames of it come after the reply in 'backlog' and how
+    many requests a second each client can make, which they hold
+    their own clients to. 'backlog' is -1 when answering clients.
+    Caller releases the frame. NULL on failure.
+*/
+static SharedFrame* SSEncodeServerInfo(Server* server, ResponseCode rcode, uint32_t requestId, int backlog)
+{
+    FrameWriter writer = {0};
+    FrameBegin(&writer, k_fkReply, k_cfAddClientToServer, requestId);
+    FramePutU32(&writer, (uint32_t)rcode);
+
+    if (rcode == k_rcRootOperationSuccessful && server != NULL) {
+        FramePutU64(&writer, server->serverId);
+        FramePutU16(&writer, (uint16_t)server->port);
+        FramePutU16(&writer, (uint16_t)server->connectedClients);
+        FramePutU16(&writer, (uint16_t)server->maxClients);
+        FramePutString(&writer, server->alias);
+        FramePutString(&writer, server->host.handle);
+
+        // How much history the room keeps, then how much of it follows
+        if (backlog >= 0) {
+            FramePutU16(&writer, (uint16_t)server->history.capacity);
+            FramePutU16(&writer, (uint16_t)backlog);
+            FramePutU32(&writer, clientRequestRate);
+        }
+    }
+
+    SharedFrame* frame = SharedFrameCreate(&writer);
+    FrameWriterFree(&writer);
+    return frame;
+}
+
+/*
+    Tell a client what they sent was dropped for going over
+    a rate limit. Only once every ROOM_THROTTLE_NOTICE_MS
+    so the notices don't become a flood of their own.
+*/
+static void SSThrottleClient(User* client, const char* reason, uint64_t* lastNoticeNs)
+{
+    uint64_t now = MonotonicNs();
+    if (*lastNoticeNs != 0 && now - *lastNoticeNs < (uint64_t)ROOM_THROTTLE_NOTICE_MS * 1000000ULL)
+        return;
+
+    *lastNoticeNs = now;
+
+    CMessage notice = {0};
+    notice.cflag = k_cfClientThrottled;
+    snprintf(notice.message, sizeof(notice.message), "%s", reason);
+
+    SharedFrame* frame = SSEncodeClientMessage(&notice);
+    if (frame != NULL)
+        OutboundQueuePush(client->outbound, frame, k_plControl);
+    SharedFrameRelease(frame);
+}
+
+/*
+    Handle the next request of a member. Buffered
+    whole, so reading it never waits on the socket.
+*/
+static void SSHandleMemberRequest(RoomReader* reader)
+{
+    Server*       serverToListenOn = reader->server;
+    User*         requestMaker     = &reader->client;
+    ServerRequest request          = {0};
+
+    int received = SSReceiveServerRequest(&reader->stream, &request);
+    if (received < 0) {
+        reader->done = true;
+        return;
+    }
+    else if (received == 0)
+        return;
+
+    // Who sent it is known from the socket, it isn't sent
+    request.requestMaker                 = *requestMaker;
+    request.requestMaker.connectedServer = serverToListenOn;
+    request.optionalClientMessage.sender = request.requestMaker;
+
+    // Kicking nobody means leaving
+    if (request.command == k_cfKickClientFromServer && request.optionalClientMessage.message[0] == '\0')
+        strcpy(request.optionalClientMessage.message, requestMaker->handle);
+
+    bool leaving = request.command == k_cfKickClientFromServer
+                && strcmp(request.optionalClientMessage.message, requestMaker->handle) == 0;
+
+    printf(CYN "[%s] Received Server Request: %i\n" RESET, serverToListenOn->alias, request.command);
+
+    /*
+        Checked before anything is fanned out. A client over their own
+        budget or in a room over its budget is told so and the request
+        is dropped. Leaving is never limited, kicking someone else is.
+    */
+    if (!leaving) {
+        if (!TokenBucketTake(&reader->requestLimit)) {
+            SSThrottleClient(requestMaker, "You Are Sending Messages Too Fast. Slow Down.", &reader->lastThrottleNs);
+            return;
+        }
+
+        if (request.command == k_cfEchoClientMessageInServer && !TokenBucketTake(serverToListenOn->messageLimit)) {
+            SSThrottleClient(requestMaker, "This Server Is Too Busy Right Now. Try Again In a Moment.", &reader->lastThrottleNs);
+            return;
+        }
+    }
+
+    DoServerRequest(request);
+
+    // Don't listen for requests from that client anymore
+    if (leaving)
+        reader->done = true;
+}
+
+/*
+    Let in or take out clients of the relay of 'reader', who
+    registered or let go of their handles. Joins are answered with
+    each handle and its response code so the relay knows who is in.
+*/
+static void SSHandleRelayedClients(RoomReader* reader, FrameHeader* header, FrameReader* frame)
+{
+    Server*        server  = reader->server;
+    OutboundQueue* relay   = reader->client.outbound;
+    bool           joining = header->command == k_cfRelayClientJoined;
+    bool           changed = false;
+    FrameWriter    writer  = {0};
+    FrameBegin(&writer, k_fkReply, k_cfRelayClientJoined, header->requestId);
+
+    pthread_mutex_lock(server->membersLock);
+    while (FrameRemaining(frame) > 0)
+    {
+        char handle[kMaxClientHandleLength + 1] = {0};
+        FrameGetString(frame, handle, sizeof(handle));
+        if (frame->failed || handle[0] == '\0')
+            break;
+
+        if (!joining) {
+            changed |= SSRemoveRelayedClient(server, relay, handle);
+            continue;
+        }
+
+        ResponseCode rcode = SSAddRelayedClient(server, relay, handle);
+        changed |= rcode == k_rcRootOperationSuccessful;
+        FramePutString(&writer, handle);
+        FramePutU32(&writer, (uint32_t)rcode);
+    }
+    pthread_mutex_unlock(server->membersLock);
+
+    if (changed)
+        ServerListTouchCount(server);
+
+    SharedFrame* reply = joining ? SharedFrameCreate(&writer) : NULL;
+    FrameWriterFree(&writer);
+    if (reply != NULL)
+        OutboundQueuePush(relay, reply, k_plChat);
+    SharedFrameRelease(reply);
+}
+
+/*
+    Handle the next frame a relay sent. A message one of its
+    clients said or one of them joining or leaving. Buffered whole.
+*/
+static void SSHandleRelayMessage(RoomReader* reader)
+{
+    Server*     server = reader->server;
+    FrameHeader header = {0};
+    FrameReader frame;
+    if (FrameStreamNext(&reader->stream, &header, &frame) != 0) {
+        reader->done = true;
+        return;
+    }
+
+    if (header.kind != k_fkRequest)
+        return;
+
+    if (header.command == k_cfRelayClientJoined || header.command == k_cfRelayClientLeft) {
+        SSHandleRelayedClients(reader, &header, &frame);
+        return;
+    }
+
+    if (header.command != k_cfRelayClientMessage)
+        return;
+
+    // Sent by one of the relays clients. Their handle comes with it
+    CMessage message = {0};
+    message.cflag = k_cfPrintPeerClientMessage;
+    FrameGetString(&frame, message.sender.handle, sizeof(message.sender.handle));
+    FrameGetLongString(&frame, message.message, sizeof(message.message));
+    if (frame.failed)
+        return;
+
+    // Only clients the room let in through this relay can speak through it
+    pthread_mutex_lock(server->membersLock);
+    RelayedClient* sender  = (RelayedClient*)HashMapGet(&server->members.relayed, message.sender.handle);
+    bool           allowed = sender != NULL && sender->relay == reader->client.outbound;
+    pthread_mutex_unlock(server->membersLock);
+
+    if (!allowed)
+        return;
+
+    // Takes from the same budget as members of the room
+    if (!TokenBucketTake(server->messageLimit))
+        return;
+
+    SharedFrame* encoded = SSEncodeClientMessage(&message);
+    if (encoded == NULL)
+        return;
+
+    int recipientCount = 0;
+    SSFanOutToRoom(server, encoded, k_plChat, &recipientCount);
+    SharedFrameRelease(encoded);
+}
+
+/*
+    Stop reading a member or relay that hung up or left
+    and let go of their queue, the room and the reader.
+*/
+static void SSCloseRoomReader(RoomReader* reader)
+{
+    Server*        server   = reader->server;
+    OutboundQueue* outbound = reader->client.outbound;
+
+    // Before the queue can close the socket
+    ReactorRemove(reader->reactor, &reader->watch);
+    FrameStreamFree(&reader->stream);
+
+    if (reader->relay) {
+        // Unless the room already let go of it when it was shut down
+        pthread_mutex_lock(server->membersLock);
+        bool removed = SSRemoveRelay(server, outbound);
+        pthread_mutex_unlock(server->membersLock);
+
+        // Its clients left with it
+        if (removed) {
+            OutboundQueueRelease(outbound);
+            ServerListTouchCount(server);
+        }
+
+        printf("Relay left '%s'\n", server->alias);
+    }
+    else {
+        /*
+            Left without saying so. Does nothing if they were kicked or the
+            room was shut down, even if their handle was taken again since
+        */
+        SSDisconnectClientFromServer(&reader->client);
+    }
+
+    // Whatever is still queued for them is sent before the socket closes
+    OutboundQueueClose(outbound);
+    OutboundQueueRelease(outbound);
+    SSRoomRelease(server);
+    free(reader);
+}
+
+/**
+ * @brief           Handle what a member or relay sent once their socket is readable
+ * @param[in]       reactor: event loop reading the socket
+ * @param[in]       events:  ready events of the socket
+ * @param[in]       context: the RoomReader
+ * @return          void
+ */
+static void SSHandleRoomReaderEvent(Reactor* reactor, unsigned int events, void* context)
+{
+    RoomReader* reader = (RoomReader*)context;
+
+    // With io_uring the bytes were already handed over
+    if (!ReactorReceives(reactor)) {
+        ReactorCountSyscall(reactor);
+        if (FrameStreamFill(&reader->stream) < 0)
+            reader->done = true;
+    }
+
+    // Everything that arrived together is handled at once
+    while (!reader->done && FrameStreamReady(&reader->stream))
+    {
+        if (reader->relay)
+            SSHandleRelayMessage(reader);
+        else
+            SSHandleMemberRequest(reader);
+    }
+
+    if (reader->done)
+        SSCloseRoomReader(reader);
+}
 
-    // Prefix
-    vfprintf(stdout, str, argp);
-    va_end(argp);    
-    printf(RESET "\n");
+/*
+    Keep bytes the reactor received for a member or relay
+    and handle the requests they complete.
+*/
+static void SSRoomReaderReceived(Reactor* reactor, const char* data, ssize_t length, void* context)
+{
+    RoomReader* reader = (RoomReader*)context;
+
+    if (length <= 0 || FrameStreamAppend(&reader->stream, data, (size_t)length) != 0)
+        reader->done = true;
+
+    SSHandleRoomReaderEvent(reactor, REACTOR_READ, context);
 }
 
-void ServerAnnouncement(Server* server, char* message) {    
-    CMessage msgToSend = {0};
-    msgToSend.cflag = k_cfPrintServerAnnouncement;
-    strcpy(msgToSend.message, message);
+/*
+    Start reading what a member or relay of 'server' sends. The
+    reader takes over the callers references to the room and
+    to 'client->outbound'. Returns false if it couldn't, and
+    the caller still holds them. 'received' is what they sent
+    after their join frame and is taken over either way.
+
+    Read on the thread of the partition pushing to them, so
+    a large room's reads are spread over every core too.
+*/
+static bool SSStartRoomReader(Server* server, User* client, bool relay, FrameStream* received)
+{
+    RoomReader* reader = calloc(1, sizeof(RoomReader));
+    if (reader == NULL) {
+        FrameStreamFree(received);
+        return false;
+    }
 
-    for (int clientIndex = 1; clientIndex<=server->connectedClients; clientIndex++){
-        int sent = send(server->clientList[clientIndex].cfd, (void*)&msgToSend, sizeof(msgToSend), 0);
+    reader->reactor        = &roomReaders[client->outbound->partition % roomReaderCount];
+    reader->server         = server;
+    reader->client         = *client;
+    reader->relay          = relay;
+    reader->watch.fd       = client->cfd;
+    reader->watch.events   = REACTOR_READ;
+    reader->watch.handler  = SSHandleRoomReaderEvent;
+    reader->watch.receiver = SSRoomReaderReceived;
+    reader->watch.context  = (void*)reader;
+
+    // Requests that arrive together are handled with one read
+    reader->stream = *received;
+    TokenBucketInit(&reader->requestLimit, clientRequestRate, clientRequestRate * 2);
+
+    // Its handler can run and free it before this returns
+    if (ReactorAdd(reader->reactor, &reader->watch) != 0) {
+        FrameStreamFree(&reader->stream);
+        free(reader);
+        return false;
     }
+
+    return true;
 }
 
-void* ListenForRequestsOnServer(void* server)
+/*
+    Let the room's fan-outs reach 'queue' of someone who just joined
+    or attached, once their reply and the history they were sent are
+    queued. What the room recorded since they were sent 'recorded'
+    frames of history is queued first, under the lock, so it still
+    comes before anything said after. That's only what was said in
+    between, usually nothing.
+*/
+static void SSFinishJoin(Server* server, OutboundQueue* queue, uint64_t recorded)
 {
-    Server* serverToListenOn = (Server*)server;
-    User requestMaker = serverToListenOn->clientList[serverToListenOn->connectedClients];
-    printf("Listening for requests from %s, %i\n", requestMaker.handle, requestMaker.cfd);
-    
-    while (1)
+    SharedFrame* missed[OUTBOUND_QUEUE_FRAMES];
+    int          missedCount = 0;
+
+    pthread_mutex_lock(server->membersLock);
+    if (SSJoinQueued(&server->members, queue)) {
+        missedCount = SSHistoryRetain(&server->history, recorded, missed, OUTBOUND_QUEUE_FRAMES);
+        if (missedCount > 0)
+            OutboundQueuePushBatch(queue, missed, missedCount, k_plChat);
+    }
+    pthread_mutex_unlock(server->membersLock);
+
+    for (int i = 0; i < missedCount; i++)
+        SharedFrameRelease(missed[i]);
+}
+
+/*
+    Send everything said in the room 'serverId' from now on to the
+    relay on 'cfd', and fan out what its clients say. Only relays
+    on this machine or at one of roomRelayPeers can attach.
+
+    Answered like a join. The info of the room, then its history,
+    so the relay can tell new clients what was said before and fill
+    in what it missed if it is coming back after losing its upstream.
+    'received' is what it sent after its join frame and is taken over.
+*/
+static void SSAttachRelay(int cfd, uint64_t serverId, uint32_t requestId, FrameStream* received)
+{
+    Server*        server = NULL;
+    ResponseCode   rcode  = k_rcRootOperationSuccessful;
+    OutboundQueue* relay  = NULL;
+    SharedFrame*   backlog[OUTBOUND_QUEUE_FRAMES] = {0}; // The reply, then the history
+    int            backlogCount = 0;
+    uint64_t       recorded     = 0;
+
+    // Relays say which client sent what. Anyone else could pretend to be a relay
+    bool trusted = SocketPeerAllowed(cfd, roomRelayPeers, roomRelayPeerCount);
+    if (!trusted)
+        ServerPrint(YEL, "Refused a relay attaching from an address that isn't allowed");
+
+    // Its reader holds the room until the relay leaves
+    server = trusted ? ServerListRetainById(serverId) : NULL;
+
+    // Made before the room is locked. Nobody else can reach it yet
+    if (server != NULL && (relay = OutboundQueueCreate(&roomReactor, cfd, roomOverflowPolicy)) != NULL) {
+        // In the order the room recorded them, so the relay can tell history from what's new
+        OutboundQueueKeepOrder(relay);
+
+        // Pushed to and read from the same partition every time, like a member
+        FanOutPoolAssign(&roomFanOut, relay);
+    }
+
+    if (server == NULL || relay == NULL)
+        rcode = k_rcInternalServerError;
+    else {
+        pthread_mutex_lock(server->membersLock);
+        if (server->online && SSHoldJoin(&server->members, relay)) {
+            // The reply says how much history follows it
+            backlogCount = SSHistoryRetain(&server->history, 0, backlog + 1, OUTBOUND_QUEUE_FRAMES - 1);
+            recorded     = server->history.recorded;
+            backlog[0]   = SSEncodeServerInfo(server, rcode, requestId, backlogCount);
+        }
+
+        if (backlog[0] == NULL)
+            rcode = k_rcInternalServerError;
+        else if (!SSAddRelay(server, OutboundQueueRetain(relay))) {
+            OutboundQueueRelease(relay);
+            rcode = k_rcInternalServerError;
+        }
+
+        // Unless it wasn't held back
+        if (rcode != k_rcRootOperationSuccessful)
+            SSJoinQueued(&server->members, relay);
+        pthread_mutex_unlock(server->membersLock);
+    }
+
+    // The queue owns the socket once it was made
+    if (rcode != k_rcRootOperationSuccessful) {
+        for (int i = 0; i <= backlogCount; i++)
+            SharedFrameRelease(backlog[i]);
+
+        SharedFrame* reply = SSEncodeServerInfo(NULL, rcode, requestId, -1);
+        if (reply != NULL)
+            FanOutWrite(cfd, &reply, 1);
+
+        SharedFrameRelease(reply);
+        FrameStreamFree(received);
+        if (relay != NULL) {
+            OutboundQueueClose(relay);
+            OutboundQueueRelease(relay);
+        }
+        else
+            close(cfd);
+
+        if (server != NULL)
+            SSRoomRelease(server);
+        return;
+    }
+
+    // Queued outside the lock. Nothing fanned out reaches the relay before it
+    OutboundQueuePushBatch(relay, backlog, backlogCount + 1, k_plChat);
+    for (int i = 0; i <= backlogCount; i++)
+        SharedFrameRelease(backlog[i]);
+
+    SSFinishJoin(server, relay, recorded);
+    printf("Relay attached to '%s'\n", server->alias);
+
+    User attached = {0};
+    attached.cfd      = cfd;
+    attached.outbound = relay;
+
+    if (!SSStartRoomReader(server, &attached, true, received)) {
+        pthread_mutex_lock(server->membersLock);
+        bool removed = SSRemoveRelay(server, relay);
+        pthread_mutex_unlock(server->membersLock);
+
+        if (removed)
+            OutboundQueueRelease(relay);
+
+        OutboundQueueClose(relay);
+        OutboundQueueRelease(relay);
+        SSRoomRelease(server);
+    }
+}
+
+/*
+    Root worker job. Hand a client whose join frame is in
+    to the room they named. 'argument' is their RoomJoin,
+    already taken off the reactor.
+*/
+static void SSJoinRoom(void* argument)
+{
+    RoomJoin*   join   = (RoomJoin*)argument;
+    int         cfd    = join->watch.fd;
+    FrameStream stream = join->stream; // What they send after the join frame stays buffered for their reader
+    free(join);
+
+    // Join request. The id of the room and the handle of the client. Relays only send the id
+    FrameHeader header = {0};
+    FrameReader reader;
+    if (FrameStreamNext(&stream, &header, &reader) != 0 || header.kind != k_fkRequest
+        || (header.command != k_cfAddClientToServer && header.command != k_cfAttachRelayToServer))
     {
-        ServerRequest request = {0};
+        FrameStreamFree(&stream);
+        close(cfd);
+        return;
+    }
 
-        // Recv info from the most recent client
-        // New thread created every client. Bad but will do
-        int recvBytes = recv(requestMaker.cfd, (void*)&request, sizeof(request), 0);
+    User     receivedUserInfo = {0};
+    uint64_t serverId         = FrameGetU64(&reader);
+    if (header.command == k_cfAddClientToServer)
+        FrameGetString(&reader, receivedUserInfo.handle, sizeof(receivedUserInfo.handle));
 
-        if (recvBytes <= 0)
-            continue;
-        
-        request.requestMaker.cfd = serverToListenOn->clientList[serverToListenOn->connectedClients].cfd;
-        request.requestMaker.connectedServer = serverToListenOn;
+    if (reader.failed) {
+        FrameStreamFree(&stream);
+        close(cfd);
+        return;
+    }
+
+    if (header.command == k_cfAttachRelayToServer) {
+        SSAttachRelay(cfd, serverId, header.requestId, &stream);
+        return;
+    }
 
-        printf(CYN "[%s] Received Server Request: %i\n" RESET, serverToListenOn->alias, request.command);
+    printf("Received client information %s\n", receivedUserInfo.handle);
 
-        DoServerRequest(request);
-        
-        // Don't listen for requests from that client anymore
-        if (request.command == k_cfKickClientFromServer && strcmp(request.optionalClientMessage.message, request.requestMaker.handle) == 0)
-            break;
+    SharedFrame* backlog[OUTBOUND_QUEUE_FRAMES] = {0}; // The reply, then the history
+    int          backlogCount = 0;
+    uint64_t     recorded     = 0;
+    ResponseCode rcode        = k_rcRootOperationSuccessful;
+
+    // Their reader holds the room until they are gone
+    Server* server = ServerListRetainById(serverId);
+
+    /*
+        Update the clients connection info
+    */
+    receivedUserInfo.cfd             = cfd;
+    receivedUserInfo.connectedServer = server;
+
+    // Made before the room is locked. Nobody else can reach it yet
+    if (server != NULL)
+        receivedUserInfo.outbound = OutboundQueueCreate(&roomReactor, cfd, roomOverflowPolicy);
+
+    /*
+        Update the servers client list. They take their slot
+        and handle now but are left out of fan-outs until
+        their reply is queued, which is done outside the lock
+    */
+    if (server == NULL || receivedUserInfo.outbound == NULL)
+        rcode = k_rcInternalServerError;
+    else {
+        pthread_mutex_lock(server->membersLock);
+        if (!server->online)
+            rcode = k_rcInternalServerError;
+        else if (server->connectedClients >= server->maxClients)
+            rcode = k_rcErrorServerFull;
+        else if (SSHandleTaken(server, receivedUserInfo.handle))
+            rcode = k_rcErrorHandleInUse; // Someone with that handle is already in, maybe through a relay
+        else if (!SSHoldJoin(&server->members, receivedUserInfo.outbound))
+            rcode = k_rcInternalServerError;
+        else if (SSAddMember(server, &receivedUserInfo) == NULL) { // Only fails if memory ran out. Room and handle were checked above
+            SSJoinQueued(&server->members, receivedUserInfo.outbound);
+            rcode = k_rcInternalServerError;
+        }
+        else {
+            // Messages of a large room reach them from the same thread every time, which also reads them
+            FanOutPoolAssign(&roomFanOut, receivedUserInfo.outbound);
+
+            // The member list holds a reference of its own
+            OutboundQueueRetain(receivedUserInfo.outbound);
+
+            // The reply and what was said before they joined go out together, oldest message first
+            backlog[0]   = SSEncodeServerInfo(server, rcode, header.requestId, -1);
+            backlogCount = SSHistoryRetain(&server->history, 0, backlog + 1, OUTBOUND_QUEUE_FRAMES - 1);
+            recorded     = server->history.recorded;
+        }
+        pthread_mutex_unlock(server->membersLock);
+    }
+
+    // The queue owns the socket once it was made
+    if (rcode != k_rcRootOperationSuccessful) {
+        SharedFrame* reply = SSEncodeServerInfo(NULL, rcode, header.requestId, -1);
+        if (reply != NULL)
+            FanOutWrite(cfd, &reply, 1);
+
+        SharedFrameRelease(reply);
+        FrameStreamFree(&stream);
+        if (receivedUserInfo.outbound != NULL) {
+            OutboundQueueClose(receivedUserInfo.outbound);
+            OutboundQueueRelease(receivedUserInfo.outbound);
+        }
+        else
+            close(cfd);
+
+        if (server != NULL)
+            SSRoomRelease(server);
+        return;
     }
+
+    // Queued before anyone else can send them a message
+    if (backlog[0] != NULL)
+        OutboundQueuePushBatch(receivedUserInfo.outbound, backlog, backlogCount + 1, k_plChat);
+
+    for (int i = 0; i <= backlogCount; i++)
+        SharedFrameRelease(backlog[i]);
+
+    SSFinishJoin(server, receivedUserInfo.outbound, recorded);
+    ServerListTouchCount(server);
+
+    if (!SSStartRoomReader(server, &receivedUserInfo, false, &stream)) {
+        // Never listened to. Leaves the room like any client that drops
+        SSDisconnectClientFromServer(&receivedUserInfo);
+        OutboundQueueClose(receivedUserInfo.outbound);
+        OutboundQueueRelease(receivedUserInfo.outbound);
+        SSRoomRelease(server);
+    }
+}
+
+/*
+    Take a join off roomReactor and out of the joins waiting.
+*/
+static void SSUnlinkRoomJoin(RoomJoin* join)
+{
+    ReactorRemove(&roomReactor, &join->watch);
+
+    if (join->previous != NULL)
+        join->previous->next = join->next;
+    else
+        roomJoinsOldest = join->next;
+
+    if (join->next != NULL)
+        join->next->previous = join->previous;
+    else
+        roomJoinsNewest = join->previous;
+}
+
+/*
+    Hang up on a join that isn't watched anymore.
+*/
+static void SSFreeRoomJoin(RoomJoin* join)
+{
+    FrameStreamFree(&join->stream);
+    close(join->watch.fd);
+    free(join);
 }
 
 /**
- * 
- * @brief           Accept all client connections on the server provided
- * @param[in]       serverInfo: the server to accept client connections for
- * @return          void*
- * @retval          None
+ * @brief           Read the join frame of a client as it arrives and hand it to a worker once it's in
+ * @param[in]       reactor: roomReactor
+ * @param[in]       events:  ready events of the socket
+ * @param[in]       context: the RoomJoin
+ * @return          void
+ */
+static void SSHandleRoomJoinEvent(Reactor* reactor, unsigned int events, void* context)
+{
+    RoomJoin* join = (RoomJoin*)context;
+
+    // With io_uring the bytes were already handed over
+    if (!ReactorReceives(reactor)) {
+        ReactorCountSyscall(reactor);
+        if (FrameStreamFill(&join->stream) < 0) {
+            SSUnlinkRoomJoin(join);
+            SSFreeRoomJoin(join);
+            return;
+        }
+    }
+
+    if (!FrameStreamReady(&join->stream))
+        return;
+
+    // Only a whole frame is given to a worker, so reading it never waits
+    SSUnlinkRoomJoin(join);
+    if (!RSSubmitWork(SSJoinRoom, (void*)join)) // Root is too busy. Client can retry
+        SSFreeRoomJoin(join);
+}
+
+/*
+    Keep bytes the reactor received for a join.
+*/
+static void SSRoomJoinReceived(Reactor* reactor, const char* data, ssize_t length, void* context)
+{
+    RoomJoin* join = (RoomJoin*)context;
+
+    if (length <= 0 || FrameStreamAppend(&join->stream, data, (size_t)length) != 0) {
+        SSUnlinkRoomJoin(join);
+        SSFreeRoomJoin(join);
+        return;
+    }
+
+    SSHandleRoomJoinEvent(reactor, REACTOR_READ, context);
+}
+
+/**
+ * @brief           Start waiting for the join frame of a socket accepted on ROOM_PORT
+ * @param[in]       reactor: roomReactor
+ * @param[in]       cfd:     the accepted socket or -errno
+ * @param[in]       context: unused
+ * @return          void
  */
-void ServerAcceptThread(void* serverInfo)
+static void SSAdmitRoomClient(Reactor* reactor, int cfd, void* context)
 {
-    // Server info
-    Server* server = (Server*)serverInfo; 
+    if (cfd < 0)
+        return;
+
+    RoomJoin* join = calloc(1, sizeof(RoomJoin));
+    if (join == NULL) {
+        close(cfd);
+        return;
+    }
 
-    int lstn = listen(server->sfd, server->maxClients);
-    if (lstn < 0) {
-        ServerPrint(RED, "Error Listening on Server %s", server->alias);
-        close(server->sfd);
+    FrameStreamInit(&join->stream, cfd);
+    join->deadline       = MonotonicNs() + (uint64_t)ROOM_JOIN_TIMEOUT_SEC * 1000000000ULL;
+    join->watch.fd       = cfd;
+    join->watch.events   = REACTOR_READ;
+    join->watch.handler  = SSHandleRoomJoinEvent;
+    join->watch.receiver = SSRoomJoinReceived;
+    join->watch.context  = (void*)join;
+
+    if (ReactorAdd(reactor, &join->watch) != 0) {
+        SSFreeRoomJoin(join);
         return;
     }
 
-    // 'server' becomes unsafe since we are in a thread.
-    // make copy of 'server' by dereferencing it. dont even need it as a pointer anymore
-    Server dereferencedServer = *server;
-    dereferencedServer.connectedClients = 0;
-    int cfd = 0; // client file descriptor. get it from accepting the client
+    // Newest last, so joins run out of time in order. Its handler only runs once this returns
+    join->previous = roomJoinsNewest;
+    if (roomJoinsNewest != NULL)
+        roomJoinsNewest->next = join;
+    else
+        roomJoinsOldest = join;
+    roomJoinsNewest = join;
+}
+
+/**
+ * @brief           Accept clients for every room on ROOM_PORT
+ * @param[in]       reactor: roomReactor
+ * @param[in]       events:  unused
+ * @param[in]       context: unused
+ * @return          void
+ */
+static void SSAcceptRoomClients(Reactor* reactor, unsigned int events, void* context)
+{
+    // Accept everyone waiting in the backlog
     while (1)
     {
-        cfd = accept(dereferencedServer.sfd, NULL, NULL);
-
+        ReactorCountSyscall(reactor);
+        int cfd = accept(roomListenerFd, NULL, NULL);
         if (cfd < 0) {
-            continue;
+            if (errno == EINTR)
+                continue;
+            break; // Backlog empty
         }
 
-        User receivedUserInfo = {0};
-        int clientInfo = recv(cfd, (void*)&receivedUserInfo, sizeof(User), 0);  
-        if (clientInfo < 0)
-            continue;
-        else if (clientInfo == 0) // client disconnected
-            break;
-
-        printf("Received client information %s\n", receivedUserInfo.handle);
-        
-        /*
-            Update the clients connection info
-        */
-        receivedUserInfo.cfd             = cfd;
-        receivedUserInfo.connectedServer = &dereferencedServer;
+        SSAdmitRoomClient(reactor, cfd, NULL);
+    }
+}
 
-        /*
-            Update the servers client list and since its dereferenced we 
-            dont have to worry about putting inaccurate information
-            in the actual server.
-        */
-        dereferencedServer.connectedClients++;
-        dereferencedServer.clientList[dereferencedServer.connectedClients] = receivedUserInfo;
-        backendServerList[dereferencedServer.serverId] = dereferencedServer;
+/**
+ * @brief           Event loop timer. Hang up on clients who didn't send their join frame in time
+ * @param[in]       reactor: roomReactor
+ * @param[in]       events:  unused
+ * @param[in]       context: unused
+ * @return          void
+ */
+static void SSSweepRoomJoins(Reactor* reactor, unsigned int events, void* context)
+{
+    ReactorTimerAcknowledge(&roomJoinSweepWatch);
 
-        // Send the server info
-        int sentServerInfo = send(cfd, (void*)&backendServerList[dereferencedServer.serverId], sizeof(backendServerList[dereferencedServer.serverId]), 0);
-        if (sentServerInfo <= 0) // Error sending info
-            break;
-        
-        cpthread tinfo = cpThreadCreate(ListenForRequestsOnServer, (void*)&backendServerList[dereferencedServer.serverId]);
+    uint64_t now = MonotonicNs();
+    while (roomJoinsOldest != NULL && roomJoinsOldest->deadline <= now)
+    {
+        RoomJoin* late = roomJoinsOldest;
+        SSUnlinkRoomJoin(late);
+        SSFreeRoomJoin(late);
     }
 }
 
-unsigned int GenerateServerUID(Server* server)
+/**
+ * @brief           Send queued frames to room members as their sockets free up
+ * @param[in]       unused: nothing
+ * @return          void*
+ * @retval          NULL once the reactor stops
+ */
+static void* SSRunRoomReactor(void* unused)
+{
+    ReactorRun(&roomReactor);
+    return NULL;
+}
+
+/**
+ * @brief           Handle what the room members and relays of one partition send as it arrives
+ * @param[in]       reactor: the Reactor reading them
+ * @return          void*
+ * @retval          NULL once the reactor stops
+ */
+static void* SSRunRoomReaders(void* reactor)
+{
+    ReactorRun((Reactor*)reactor);
+    return NULL;
+}
+
+int SSStartRoomListener()
 {
-    srand(server->port ^ 0x92EFF);
+    struct sockaddr_in addrInfo;
+    memset(&addrInfo, 0, sizeof(struct sockaddr_in));
+    addrInfo.sin_family      = AF_INET;
+    addrInfo.sin_addr.s_addr = htonl(INADDR_ANY);
+    addrInfo.sin_port        = htons(ROOM_PORT);
+
+    int sfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sfd < 0)
+        return -1;
 
-    int uid = rand() % 1000;
-    server->serverId = uid;
-    printf("Generated UID: %d\n", uid);
+    int optVal = 1;
+    setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &optVal, sizeof(optVal));
+
+    // Large rooms can have thousands of members joining at once
+    int backlog = (largeRoomMaxClients > kMaxServerMembers) ? ROOM_LARGE_LISTEN_BACKLOG : SOMAXCONN;
+    if (bind(sfd, (struct sockaddr*)&addrInfo, sizeof(addrInfo)) < 0 || listen(sfd, backlog) < 0) {
+        close(sfd);
+        return -1;
+    }
+
+    if (ReactorCreate(&roomReactor) != 0 || SetSocketNonBlocking(sfd) != 0) {
+        close(sfd);
+        return -1;
+    }
+
+    roomListenWatch.fd       = sfd;
+    roomListenWatch.events   = REACTOR_READ;
+    roomListenWatch.handler  = SSAcceptRoomClients;
+    roomListenWatch.acceptor = SSAdmitRoomClient; // Multishot accepts with io_uring
+    roomListenWatch.context  = NULL;
+
+    roomJoinSweepWatch.handler = SSSweepRoomJoins;
+    roomJoinSweepWatch.context = NULL;
+
+    // Before anything can be accepted
+    roomListenerFd = sfd;
+
+    if (ReactorAdd(&roomReactor, &roomListenWatch) != 0 || ReactorAddTimer(&roomReactor, &roomJoinSweepWatch, ROOM_JOIN_SWEEP_MS) != 0) {
+        close(sfd);
+        return -1;
+    }
+
+    if (largeRoomMaxClients > kMaxServerMembers && FanOutPoolCreate(&roomFanOut, 0) != 0) {
+        close(sfd);
+        return -1;
+    }
 
-    return uid;
+    // Members are read by the partition that pushes to them
+    unsigned int readers = (roomFanOut.partitionCount > 0) ? roomFanOut.partitionCount : 1;
+    for (; roomReaderCount < readers; roomReaderCount++)
+    {
+        if (ReactorCreate(&roomReaders[roomReaderCount]) != 0) {
+            close(sfd);
+            return -1;
+        }
+    }
+
+    cpthread flushInfo = cpThreadCreate(SSRunRoomReactor, NULL);
+    cpThreadDetach(flushInfo);
+
+    for (unsigned int i = 0; i < roomReaderCount; i++)
+    {
+        cpthread readInfo = cpThreadCreate(SSRunRoomReaders, (void*)&roomReaders[i]);
+        cpThreadDetach(readInfo);
+    }
+    return 0;
+}
+
+uint64_t GenerateServerUID(Server* server)
+{
+    server->serverId = __atomic_fetch_add(&nextServerId, 1, __ATOMIC_RELAXED);
+    printf("Generated UID: %" PRIu64 "\n", server->serverId);
+
+    return server->serverId;
 }
 
 /**
@@ -178,57 +1584,25 @@ void RSServerBareMetal(void* serverStruct)
     response.rcode       = k_rcInternalServerError;
     response.returnValue = (void*)serverInfo;
     response.rflag       = k_rfSentDataWasUnused;
+    response.command     = k_cfMakeNewServer;
+    response.requestId   = creationInfo->requestId;
+
+    // Rooms bigger than kMaxServerMembers are large rooms and only allowed if they are on
+    unsigned int mostClients = (largeRoomMaxClients > kMaxServerMembers) ? largeRoomMaxClients : kMaxServerMembers;
+    if (mostClients > kMaxLargeServerMembers)
+        mostClients = kMaxLargeServerMembers;
 
-    if (serverInfo->maxClients > kMaxServerMembers){
+    if (serverInfo->maxClients > mostClients || serverInfo->maxClients == 0){
         // Max clients is greater
         serverInfo->maxClients = kDefaultMaxClients;
     }
 
-    /* Server address information */
-    struct sockaddr_in addrInfo;
-    memset(&addrInfo, 0, sizeof(struct sockaddr_in));
-	addrInfo.sin_family      = serverInfo->domain;
-	// addrInfo.sin_addr.s_addr = inet_addr(HOST_IP_ADDRESS);
-    addrInfo.sin_addr.s_addr = htonl(INADDR_ANY);
-	addrInfo.sin_port        = htons(serverInfo->port);
-
-    // Create server socket
-    int sfd = socket(serverInfo->domain, serverInfo->type, 0);
-    if (sfd == -1) {
-        ServerPrint(RED, "[ERROR]: Failed Creating Socket. Error Code %i", errno);
-        RSRespondToRootRequestMaker(creationInfo->clientAKAhost, response);
-        goto server_close;
-    }
-    
     /*
-        We set SO_REUSEADDR to true, in case a server
-        that previously used this port is closed but 
-        we cant create another socket with this port because of
-        the TIME_WAIT state in the kernel.
+        Rooms share the listener on ROOM_PORT so
+        creating one is just filling in its info
     */
-    int optVal = 1;
-    int set = setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &optVal, sizeof(optVal));
-    if (set < 0) {
-        ServerPrint(RED, "setsockopt() for SO_REUSEADDR failed. Maybe port is in use.");
-        RSRespondToRootRequestMaker(creationInfo->clientAKAhost, response);
-        goto server_close;
-    }
-
-    // Bind socket to the address info provided
-    int bnd = bind(sfd, (struct sockaddr * )&addrInfo, sizeof(addrInfo));
-    if (bnd == -1) {
-        ServerPrint(RED, "[ERROR]: Failed Binding Socket. Error Code %d", errno);
-        RSRespondToRootRequestMaker(creationInfo->clientAKAhost, response);
-        goto server_close;
-    }
-
-    // Listen for client connections
-    int lsn = listen(sfd, serverInfo->maxClients);
-    if (lsn == -1) {
-        ServerPrint(RED, "[ERROR]: Error while listening. Error Code %d", errno);
-        RSRespondToRootRequestMaker(creationInfo->clientAKAhost, response);
-        goto server_close;
-    }
+    struct sockaddr_in addrInfo = rootServer.addr;
+    addrInfo.sin_port = htons(ROOM_PORT);
 
     /* Server online, fill in rest of info */
     User hostCopy = *creationInfo->clientAKAhost;
@@ -238,20 +1612,47 @@ void RSServerBareMetal(void* serverStruct)
     serverInfo->host             = hostCopy;
     serverInfo->domain           = creationInfo->serverInfo->domain;
     serverInfo->isRoot           = false;
-    serverInfo->port             = serverInfo->port;
+    serverInfo->port             = ROOM_PORT;
     serverInfo->type             = serverInfo->type;
     serverInfo->maxClients       = creationInfo->serverInfo->maxClients;
-    serverInfo->sfd              = sfd;
+    serverInfo->sfd              = -1; // Reached through the room listener
     serverInfo->addr             = addrInfo;
     serverInfo->online           = true; // True. Server online and ready
-    serverInfo->clientList       = (User**)malloc(sizeof(User*) * serverInfo->maxClients); // Allocate memory for the servers client list
-    strcpy(serverInfo->alias, creationInfo->serverInfo->alias);
-    
+    serverInfo->references       = 1;    // Held by the server list until it is shut down
+
+    bool membersReady = SSRoomMembersInit(&serverInfo->members, serverInfo->maxClients);
+    bool historyReady = SSRoomHistoryInit(&serverInfo->history, roomHistoryLength);
+
+    // Allocated so copies of the server all take from the same bucket and lock the same room
+    serverInfo->messageLimit = malloc(sizeof(TokenBucket));
+    if (serverInfo->messageLimit != NULL)
+        TokenBucketInit(serverInfo->messageLimit, roomMessageRate, roomMessageRate * 2);
+
+    serverInfo->membersLock = malloc(sizeof(pthread_mutex_t));
+    if (serverInfo->membersLock != NULL)
+        pthread_mutex_init(serverInfo->membersLock, NULL);
+
+    if (!membersReady || !historyReady || serverInfo->messageLimit == NULL || serverInfo->membersLock == NULL) {
+        SSRoomFree(serverInfo);
+        RSRespondToRootRequestMaker(creationInfo->clientAKAhost, response);
+        goto server_close;
+    }
+
     // add server to server list
 
+    // From here on the listed copy is the real server
     if (strcmp(serverInfo->alias, "direct-message") != 0) {
-        serverList[onlineServers++] = *serverInfo; 
-        backendServerList[serverInfo->serverId] = *serverInfo;
+        Server* listed = ServerListAdd(serverInfo);
+        if (listed == NULL) {
+            ServerPrint(RED, "[ERROR]: A Server Named '%s' Already Exists.", serverInfo->alias);
+            SSRoomFree(serverInfo);
+            response.rcode = k_rcErrorServerNameInUse;
+            RSRespondToRootRequestMaker(creationInfo->clientAKAhost, response);
+            goto server_close;
+        }
+
+        free(serverInfo);
+        serverInfo = listed;
     }
 
     // respond to host telling them their server was made
@@ -266,13 +1667,15 @@ void RSServerBareMetal(void* serverStruct)
     RSRespondToRootRequestMaker(&serverInfo->host, response);
     printf("Responded saying server creation successful\n");
 
-    cpthread tinfo = cpThreadCreate(ServerAcceptThread, (void*)serverInfo);
-    cpThreadJoin(tinfo);
+    free(creationInfo->clientAKAhost);
+    free(creationInfo);
 
     return;
 
 server_close:
-    close(sfd);
+    free(creationInfo->clientAKAhost);
+    free(creationInfo->serverInfo);
+    free(creationInfo);
     // pthread_exit(NULL);
     return;
 }
@@ -293,7 +1696,6 @@ int MakeServer(
     int domain, // AF_INET
     int type, // SOCK_STREAM
     int protocol, // USUALLY ZERO
-    int port,
     unsigned int maxClients,
     char* alias
 )
@@ -314,7 +1716,7 @@ int MakeServer(
         return -1;
     }
 
-    // Iterate through servers, Check if the alias, and port is already in use
+    // Iterate through servers, Check if the alias is already in use
     // TODO: Optimize. Might be extremely slow when theres a lot of servers
     // O(n). Slow
     
@@ -348,7 +1750,6 @@ int MakeServer(
     serv.domain     = domain;
     serv.type       = type;
     serv.protocol   = protocol;
-    serv.port       = port;
     serv.maxClients = maxClients;
     serv.isRoot     = false;
     serv.host       = *localClient;
@@ -358,9 +1759,12 @@ int MakeServer(
     RootResponse response = MakeRootRequest(k_cfMakeNewServer, serv, *localClient, (CMessage){0});
     if (response.rcode == k_rcRootOperationSuccessful) 
     {
-        localClient->connectedServer = &serv;
-        SystemPrint(CYN, false, "Server '%s' Created on Port '%i'\n", serv.alias, serv.port);
+        // Only made. The client joins it like anyone else
+        ServerListInvalidate();
+        SystemPrint(CYN, false, "Server '%s' Created\n", serv.alias);
     }
+    else if (response.rcode == k_rcErrorServerNameInUse)
+        SystemPrint(RED, false, "A Server Named '%s' Already Exists. Choose a Different Name.\n", serv.alias);
     else
         SystemPrint(RED, false, "Error Making Server '%s'\n", serv.alias);
 
@@ -374,79 +1778,93 @@ bool IsUserHost(User user, Server* server)
 
 void ShutdownServer(Server* server)
 {
-    Server serverCopy = *server;
+    // send a message to the clients saying that the current server they were connected
+    // to has been shutdown
+    CMessage disconnectMessage = {0};
+    disconnectMessage.cflag = k_cfConnectedServerShutDown;
 
-    printf("Server shutdown requested for '%s'...\n", serverCopy.alias);
-    
-    int shutdownMethod = 0;
-    
-#ifdef _WIN32 
-    shutdownMethod = SD_BOTH; 
-#elif __unix__ 
-    shutdownMethod = SHUT_RDWR;
-#endif
+    SharedFrame* notice = SSEncodeClientMessage(&disconnectMessage);
+
+    /*
+        'server' can be a copy (e.g. one a client sent in a request).
+        Always shut down the server thats in the server list. If it isn't
+        listed anymore or already offline it was already shut down.
+        Held so it can't be freed while it is shut down.
+    */
+    Server* listed = ServerListRetainById(server->serverId);
+    if (listed == NULL) {
+        SharedFrameRelease(notice);
+        return;
+    }
+
+    server = listed;
+    pthread_mutex_lock(server->membersLock);
+    if (!server->online) {
+        pthread_mutex_unlock(server->membersLock);
+        SSRoomRelease(server);
+        SharedFrameRelease(notice);
+        return;
+    }
 
-    // if (shutdown(server->sfd, shutdownMethod) < 0)
-    //     printf("Error Calling 'shutdown()' for Server. Error Code %i\n", errno);
+    printf("Server shutdown requested for '%s'...\n", server->alias);
+
+    /*
+        Nobody can join once it is offline. Everyone is taken out at
+        once by taking the queues of the member table, which hold its
+        references to them, and leaving it empty. They are told outside
+        the lock, so the room is never locked while pushing to them.
+    */
+    RoomMembers*    members     = &server->members;
+    OutboundQueue** queues      = members->outbound; // Packed, one for every member
+    unsigned int    memberCount = members->count;
+    OutboundQueue** relays      = members->relays;
+    unsigned int    relayCount  = members->relayCount;
+
+    server->online    = false;
+    members->outbound = NULL;
+    members->relays   = NULL;
+    SSRoomMembersFree(members);
+    server->connectedClients = 0;
+
+    // Nobody is left to replay it to
+    SSRoomHistoryFree(&server->history);
+    pthread_mutex_unlock(server->membersLock);
 
-    printf("Disconnecting all %d clients from server...\n", server->connectedClients);
-    for (int cl_index=1; cl_index<=server->connectedClients; cl_index++)
-    {
-        User clientToDisconnect = server->clientList[cl_index];
-        printf("- Closing: %s\n", clientToDisconnect.handle);
-        // send a message to the client saying that the current server they were connected
-        // to has been shutdown
-        CMessage disconnectMessage = {0};
-        disconnectMessage.cflag = k_cfConnectedServerShutDown;
-        disconnectMessage.sender = clientToDisconnect;
-        int sent = send(clientToDisconnect.cfd, (void*)&disconnectMessage, sizeof(disconnectMessage), 0);
-        printf("sent bytes %d to %d, errno %d\n", sent, clientToDisconnect.cfd, errno);
-        sleep(1);
-        // close(clientToDisconnect.cfd);
-        memset(clientToDisconnect.connectedServer, 0, sizeof(Server));
-        printf(" - Closed\n");
-    }
-
-    printf("Done\n");
     printf("Removing server from server list... \n");
-    int serverIndex = -1;
-    printf("is name still good %s\n", serverCopy.alias);
-
-    // Get index where the server is located on serverList
-    for (int i=0; i < onlineServers; i++){
-        printf("i: %d, name: %s, strcmp: %d, name2: %s\n", i, serverList[i].alias, strcmp(serverList[i].alias, serverCopy.alias), serverCopy.alias);
-        if (strcmp(serverList[i].alias, serverCopy.alias) == 0){
-            printf("located server in serverlist\n");
-            serverIndex = i;
-            break;
-        }        
+    ServerListRemove(server);
+
+    for (unsigned int i = 0; i < memberCount; i++)
+    {
+        if (notice != NULL)
+            OutboundQueuePush(queues[i], notice, k_plControl);
+
+        // Hangs up once the notice is out and wakes their reader up
+        OutboundQueueClose(queues[i]);
+        OutboundQueueRelease(queues[i]);
     }
 
-    // Remove the server from the server list
-    if (serverIndex != -1){
-        for (int i = serverIndex; i < onlineServers; i++)
-        {
-            serverList[i] = serverList[i + 1];
-            printf("shifted\n");
-        }
+    // Relays pass the notice on to their own clients and hang up
+    for (unsigned int i = 0; i < relayCount; i++)
+    {
+        if (notice != NULL)
+            OutboundQueuePush(relays[i], notice, k_plControl);
 
-        onlineServers--;
+        OutboundQueueClose(relays[i]);
+        OutboundQueueRelease(relays[i]);
     }
 
-    // Unuse port
-    int portIndex = server->port % kMaxServersOnline;
-    portList[portIndex].inUse = false;
+    free(queues);
+    free(relays);
+    SharedFrameRelease(notice);
+    printf("Disconnected all %u clients from server\n", memberCount);
 
-    serverCopy.online = false;
-    backendServerList[server->serverId].online = false;
-    printf("Server online? %d\n", backendServerList[server->serverId].online);
-    printf("server online2: %d\n", serverList[serverIndex].online);
-    // printf("Done\n");
-    printf("Closing server socket and freeing memory... ");
+    // The host's session pointed at it since they made it
+    RSClientLeftRoom(server->host.handle, server);
 
-    close(server->sfd);
-    printf("Done\n");
+    // Ours and the list's. Freed here unless a reader is still finishing up
     printf("Server closed successfully... Done\n");
+    SSRoomRelease(server);
+    SSRoomRelease(server);
 }
 
 CMessage EncryptClientMessage(CMessage* message)
@@ -465,18 +1883,12 @@ CMessage EncryptClientMessage(CMessage* message)
 }
 
 User GetClientFromClientList(char* username, Server* server) {
-    for (int ci = 1; ci<=server->connectedClients; ci++)
-        if (strcmp(server->clientList[ci].handle, username) == 0) 
-            return server->clientList[ci];
-    
-    return (User){0};
+    User* member = SSFindMember(server, username);
+    return (member != NULL) ? *member : (User){0};
 }
 
 bool IsClientInServer(char* username, Server* server){
-    if (strcmp(GetClientFromClientList(username, server).handle, username) == 0) 
-        return true;
-
-    return false;
+    return SSFindMember(server, username) != NULL;
 }
 
 ResponseCode DoServerRequest(ServerRequest request)
@@ -496,17 +1908,31 @@ ResponseCode DoServerRequest(ServerRequest request)
             // user wants to kick someone
             printf("Going to kick %s\n", detailedCommand.message);
 
-            if (!IsClientInServer(detailedCommand.message, sender.connectedServer))
+            // Only the host can kick
+            if (!IsUserHost(sender, sender.connectedServer))
                 break;
 
+            pthread_mutex_lock(sender.connectedServer->membersLock);
             User client = GetClientFromClientList(detailedCommand.message, sender.connectedServer);
+            if (client.outbound != NULL)
+                OutboundQueueRetain(client.outbound);
+            pthread_mutex_unlock(sender.connectedServer->membersLock);
+
             if (strcmp(client.handle, detailedCommand.message) != 0) { break; }
 
             CMessage kick = {0};
             kick.cflag = k_cfKickClientFromServer;
-            send(client.cfd, (void*)&kick, sizeof(kick), 0);
+
+            SharedFrame* kickFrame = SSEncodeClientMessage(&kick);
+            if (kickFrame != NULL)
+                OutboundQueuePush(client.outbound, kickFrame, k_plControl);
+            SharedFrameRelease(kickFrame);
             
             SSDisconnectClientFromServer(&client);
+
+            // Their reader sees them hang up once the kick is sent
+            OutboundQueueClose(client.outbound);
+            OutboundQueueRelease(client.outbound);
             char announcement[kMaxClientHandleLength + 50];
             snprintf(announcement, sizeof(announcement), "%s was kicked from the server.", detailedCommand.message);
             ServerAnnouncement(sender.connectedServer, announcement);
@@ -526,26 +1952,47 @@ ResponseCode DoServerRequest(ServerRequest request)
         // tell the clients that we want them to print it out when they recv
         request.optionalClientMessage.cflag = k_cfPrintPeerClientMessage;
         
-        // relay encrypted message to all connected clients
-        for (int ci = 1; ci <= connectedServer->connectedClients; ci++)
-        {
-            User recipient = connectedServer->clientList[ci];
-            // if (strcmp(sender.handle, recipient.handle) == 0)
-                // continue; // Dont send the message to the client who sent the message
-
-            printf("- [%i] cfd: %i name: %s\n", ci, recipient.cfd, recipient.handle);
-
-            int sentBytes = send(recipient.cfd,
-                                 (void*)&request.optionalClientMessage, 
-                                 sizeof(request.optionalClientMessage), 0);
-            fprintf(stderr, "-- Sent bytes: %i\n", sentBytes);
-            // printf("Sent messaage to one client\n");
-        }
+        // Encode once. Every recipient is sent the same buffer
+        SharedFrame* frame = SSEncodeClientMessage(&request.optionalClientMessage);
+        if (frame == NULL)
+            break;
+
+        // relay encrypted message to all connected clients. Slow readers get it queued
+        int recipientCount = 0;
+        int delivered      = SSFanOutToRoom(connectedServer, frame, k_plChat, &recipientCount);
+        fprintf(stderr, "-- Sent %zu bytes to %i/%i clients\n", frame->length, delivered, recipientCount);
+        SharedFrameRelease(frame);
 
         responseStatus = k_rcRootOperationSuccessful;
 
         printf("Responded. Message sent successfully.");
 
+        break;
+    case k_cfRequestServerHistory:
+        /*
+            Send the last messages said in the server to whoever asked.
+            Read from the log on disk if it's on, otherwise what
+            the server remembers. Sent like any other message
+        */
+        int          wanted = atoi(request.optionalClientMessage.message);
+        SharedFrame* older[ROOM_HISTORY_QUERY_MAX];
+        int          found  = 0;
+
+        wanted = (wanted <= 0 || wanted > ROOM_HISTORY_QUERY_MAX) ? ROOM_HISTORY_QUERY_MAX : wanted;
+        if (ChatLogEnabled())
+            found = ChatLogQuery(sender.connectedServer->serverId, older, wanted);
+        else {
+            pthread_mutex_lock(sender.connectedServer->membersLock);
+            RoomHistory* history = &sender.connectedServer->history;
+            found = SSHistoryRetain(history, history->recorded - (uint64_t)wanted, older, wanted);
+            pthread_mutex_unlock(sender.connectedServer->membersLock);
+        }
+
+        OutboundQueuePushBatch(sender.outbound, older, found, k_plChat);
+        for (int i = 0; i < found; i++)
+            SharedFrameRelease(older[i]);
+
+        responseStatus = k_rcRootOperationSuccessful;
         break;
     default:
         break;
@@ -0,0 +1,705 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       uring.c
+ * @brief      io_uring event loop. Batches polls, accepts, receives and sends
+ *
+ * @note       Talks to the kernel with the raw syscalls, no liburing needed
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#include "Headers/uring.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/*
+    What a completion belongs to. Kept in the top two
+    bits of the user data of its request.
+*/
+#define URING_KIND_SHIFT     62
+#define URING_KIND_IGNORED   0ULL // Cancels. Nothing to do once they are done
+#define URING_KIND_POLL      1ULL // Readiness of a watch
+#define URING_KIND_READ      2ULL // Multishot receive or accept of a watch
+#define URING_KIND_OPERATION 3ULL // A ReactorOperation. The rest is its address
+
+#define URING_PAYLOAD_MASK ((1ULL << URING_KIND_SHIFT) - 1)
+
+/*
+    Set next to the slot of an accept so sockets accepted
+    for a watch that is already gone can still be closed.
+*/
+#define URING_ACCEPT_BIT (1U << 31)
+#define URING_SLOT_MASK  (URING_ACCEPT_BIT - 1)
+
+/*
+    Group the receive buffers are registered as.
+*/
+#define URING_BUFFER_GROUP 0
+
+/*
+    A registered watch.
+
+    Requests in the kernel name their watch by slot and
+    generation instead of by address. A watch can be removed
+    and freed while completions for it are still on the way,
+    and those are recognized by their old generation and dropped.
+*/
+typedef struct UringSlotStr
+{
+    ReactorWatch* watch;          // NULL while the slot is free
+    uint32_t      pollGeneration; // Bumped whenever the poll is cancelled
+    uint32_t      readGeneration; // Bumped whenever the receive or accept is cancelled
+    bool          polling;        // A poll is armed
+    bool          reading;        // A multishot receive or accept is armed
+} UringSlot;
+
+/*
+    The rings shared with the kernel and
+    the state of the watches using them.
+*/
+typedef struct UringStr
+{
+    int                      fd;            // io_uring instance
+    pthread_mutex_t          lock;          // Guards the submission ring and the slots
+
+    void*                    sqRing;        // Mapped submission ring
+    size_t                   sqRingSize;
+    unsigned int*            sqHead;        // Next request the kernel takes
+    unsigned int*            sqTail;        // Past the last request written
+    unsigned int             sqMask;
+    unsigned int             sqEntries;
+    unsigned int             sqWritten;     // Our copy of the tail
+    unsigned int             pending;       // Requests written and not handed to the kernel yet
+    struct io_uring_sqe*     sqes;          // Mapped requests
+    size_t                   sqesSize;
+
+    void*                    cqRing;        // Mapped completion ring. Same as 'sqRing' on newer kernels
+    size_t                   cqRingSize;
+    unsigned int*            cqHead;        // Next completion to handle
+    unsigned int*            cqTail;        // Past the last completion posted
+    unsigned int             cqMask;
+    struct io_uring_cqe*     cqes;
+
+    UringSlot*               slots;         // Every watch ever registered. Reused once removed
+    unsigned int             slotCount;
+    unsigned int*            freeSlots;     // Stack of slots not in use
+    unsigned int             freeCount;
+
+    struct io_uring_buf_ring* buffers;      // Receive buffers the kernel can pick from
+    char*                    bufferMemory;  // What the buffers point at
+    unsigned short           bufferTail;    // Our copy of the tail of 'buffers'
+    bool                     receives;      // Buffers were registered so receives can be used
+
+    pthread_t                thread;        // Thread running the loop
+    bool                     running;       // 'thread' is set
+} Uring;
+
+static int UringEnter(Reactor* reactor, unsigned int toSubmit, unsigned int minComplete, unsigned int flags)
+{
+    ReactorCountSyscall(reactor);
+    return (int)syscall(__NR_io_uring_enter, reactor->uring->fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static uint64_t UringUserData(uint64_t kind, uint32_t generation, unsigned int slot)
+{
+    return (kind << URING_KIND_SHIFT) | ((uint64_t)(generation & 0x3FFFFFFF) << 32) | slot;
+}
+
+static bool UringOnLoopThread(Uring* ring)
+{
+    return __atomic_load_n(&ring->running, __ATOMIC_ACQUIRE) && pthread_equal(ring->thread, pthread_self());
+}
+
+/*
+    Free everything 'ring' has mapped or allocated.
+*/
+static void UringFree(Uring* ring)
+{
+    if (ring->buffers != NULL)
+        munmap(ring->buffers, URING_RECEIVE_BUFFERS * sizeof(struct io_uring_buf));
+    if (ring->sqes != NULL)
+        munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRing != NULL && ring->cqRing != ring->sqRing)
+        munmap(ring->cqRing, ring->cqRingSize);
+    if (ring->sqRing != NULL)
+        munmap(ring->sqRing, ring->sqRingSize);
+    if (ring->fd >= 0)
+        close(ring->fd);
+
+    free(ring->bufferMemory);
+    free(ring->slots);
+    free(ring->freeSlots);
+    free(ring);
+}
+
+/*
+    Give receive buffer 'id' back to the kernel.
+    Only called on the loop thread.
+*/
+static void UringRecycleBuffer(Uring* ring, unsigned short id)
+{
+    struct io_uring_buf* buffer = &ring->buffers->bufs[ring->bufferTail & (URING_RECEIVE_BUFFERS - 1)];
+    buffer->addr = (uint64_t)(uintptr_t)(ring->bufferMemory + (size_t)id * URING_RECEIVE_BUFFER_BYTES);
+    buffer->len  = URING_RECEIVE_BUFFER_BYTES;
+    buffer->bid  = id;
+
+    ring->bufferTail++;
+    __atomic_store_n(&ring->buffers->tail, ring->bufferTail, __ATOMIC_RELEASE);
+}
+
+/*
+    Register the receive buffers. Kernels before 5.19 can't,
+    in which case sockets are polled and read like with epoll.
+*/
+static bool UringSetupBuffers(Uring* ring)
+{
+    ring->buffers = mmap(NULL, URING_RECEIVE_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buffers == MAP_FAILED) {
+        ring->buffers = NULL;
+        return false;
+    }
+
+    ring->bufferMemory = malloc((size_t)URING_RECEIVE_BUFFERS * URING_RECEIVE_BUFFER_BYTES);
+
+    struct io_uring_buf_reg registration = {0};
+    registration.ring_addr    = (uint64_t)(uintptr_t)ring->buffers;
+    registration.ring_entries = URING_RECEIVE_BUFFERS;
+    registration.bgid         = URING_BUFFER_GROUP;
+
+    if (ring->bufferMemory == NULL
+        || syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &registration, 1) != 0)
+    {
+        munmap(ring->buffers, URING_RECEIVE_BUFFERS * sizeof(struct io_uring_buf));
+        free(ring->bufferMemory);
+        ring->buffers      = NULL;
+        ring->bufferMemory = NULL;
+        return false;
+    }
+
+    for (unsigned int i = 0; i < URING_RECEIVE_BUFFERS; i++)
+        UringRecycleBuffer(ring, (unsigned short)i);
+
+    return true;
+}
+
+int UringCreate(Reactor* reactor)
+{
+    Uring* ring = calloc(1, sizeof(Uring));
+    if (ring == NULL)
+        return -1;
+
+    struct io_uring_params params = {0};
+    ring->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ring->fd < 0) {
+        free(ring);
+        return -1;
+    }
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesSize   = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Newer kernels put both rings in one mapping
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap) {
+        if (ring->cqRingSize > ring->sqRingSize)
+            ring->sqRingSize = ring->cqRingSize;
+        ring->cqRingSize = ring->sqRingSize;
+    }
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED) {
+        ring->sqRing = NULL;
+        goto failed;
+    }
+
+    ring->cqRing = singleMap ? ring->sqRing
+                             : mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cqRing == MAP_FAILED) {
+        ring->cqRing = NULL;
+        goto failed;
+    }
+
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto failed;
+    }
+
+    char* sq = (char*)ring->sqRing;
+    char* cq = (char*)ring->cqRing;
+    ring->sqHead    = (unsigned int*)(sq + params.sq_off.head);
+    ring->sqTail    = (unsigned int*)(sq + params.sq_off.tail);
+    ring->sqMask    = *(unsigned int*)(sq + params.sq_off.ring_mask);
+    ring->sqEntries = *(unsigned int*)(sq + params.sq_off.ring_entries);
+    ring->sqWritten = *ring->sqTail;
+    ring->cqHead    = (unsigned int*)(cq + params.cq_off.head);
+    ring->cqTail    = (unsigned int*)(cq + params.cq_off.tail);
+    ring->cqMask    = *(unsigned int*)(cq + params.cq_off.ring_mask);
+    ring->cqes      = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // Request i always sits in entry i
+    unsigned int* array = (unsigned int*)(sq + params.sq_off.array);
+    for (unsigned int i = 0; i < ring->sqEntries; i++)
+        array[i] = i;
+
+    ring->receives = UringSetupBuffers(ring);
+    pthread_mutex_init(&ring->lock, NULL);
+
+    reactor->uring = ring;
+    return 0;
+
+failed:
+    UringFree(ring);
+    return -1;
+}
+
+/*
+    Get the next free request in the submission ring,
+    cleared. NULL if the ring is full even after handing
+    it to the kernel. 'lock' must be held.
+*/
+static struct io_uring_sqe* UringNextLocked(Reactor* reactor)
+{
+    Uring* ring = reactor->uring;
+
+    if (ring->sqWritten - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) == ring->sqEntries && ring->pending > 0) {
+        int submitted = UringEnter(reactor, ring->pending, 0, 0);
+        if (submitted > 0)
+            ring->pending -= ((unsigned int)submitted < ring->pending) ? (unsigned int)submitted : ring->pending;
+    }
+
+    if (ring->sqWritten - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) == ring->sqEntries)
+        return NULL;
+
+    struct io_uring_sqe* sqe = &ring->sqes[ring->sqWritten & ring->sqMask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+/*
+    Make the request filled in after UringNextLocked()
+    visible to the kernel. 'lock' must be held.
+*/
+static void UringPublishLocked(Uring* ring)
+{
+    ring->sqWritten++;
+    ring->pending++;
+    __atomic_store_n(ring->sqTail, ring->sqWritten, __ATOMIC_RELEASE);
+}
+
+/*
+    Events of 'watch' that are waited on with a poll. Reading is left
+    out when it is done by a multishot receive or accept instead.
+*/
+static unsigned int UringPollEvents(Uring* ring, ReactorWatch* watch)
+{
+    bool readsItself = watch->acceptor != NULL || (watch->receiver != NULL && ring->receives);
+    return readsItself ? (watch->events & ~(unsigned int)REACTOR_READ) : watch->events;
+}
+
+/*
+    Wait once for the poll events of the watch in 'slot'.
+    Polls are re-armed after every event so they behave like
+    level triggered epoll. 'lock' must be held.
+*/
+static int UringArmPollLocked(Reactor* reactor, unsigned int slot)
+{
+    Uring*        ring   = reactor->uring;
+    UringSlot*    entry  = &ring->slots[slot];
+    unsigned int  events = UringPollEvents(ring, entry->watch);
+
+    if (entry->polling || events == 0)
+        return 0;
+
+    struct io_uring_sqe* sqe = UringNextLocked(reactor);
+    if (sqe == NULL)
+        return -1;
+
+    sqe->opcode        = IORING_OP_POLL_ADD;
+    sqe->fd            = entry->watch->fd;
+    sqe->poll32_events = events;
+    sqe->user_data     = UringUserData(URING_KIND_POLL, entry->pollGeneration, slot);
+    UringPublishLocked(ring);
+
+    entry->polling = true;
+    return 0;
+}
+
+/*
+    Start the multishot receive or accept of the watch in
+    'slot' if it has one. 'lock' must be held.
+*/
+static int UringArmReadLocked(Reactor* reactor, unsigned int slot)
+{
+    Uring*        ring  = reactor->uring;
+    UringSlot*    entry = &ring->slots[slot];
+    ReactorWatch* watch = entry->watch;
+
+    bool readsItself = watch->acceptor != NULL || (watch->receiver != NULL && ring->receives);
+    if (entry->reading || !readsItself || !(watch->events & REACTOR_READ))
+        return 0;
+
+    struct io_uring_sqe* sqe = UringNextLocked(reactor);
+    if (sqe == NULL)
+        return -1;
+
+    sqe->fd        = watch->fd;
+    sqe->user_data = UringUserData(URING_KIND_READ, entry->readGeneration, slot);
+    if (watch->acceptor != NULL) {
+        sqe->user_data |= URING_ACCEPT_BIT;
+        sqe->opcode     = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    }
+    else {
+        // The kernel picks a buffer once bytes arrive
+        sqe->opcode    = IORING_OP_RECV;
+        sqe->ioprio    = IORING_RECV_MULTISHOT;
+        sqe->flags     = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUFFER_GROUP;
+    }
+    UringPublishLocked(ring);
+
+    entry->reading = true;
+    return 0;
+}
+
+/*
+    Cancel the request with 'userData'. 'lock' must be held.
+*/
+static void UringCancelLocked(Reactor* reactor, uint64_t userData)
+{
+    struct io_uring_sqe* sqe = UringNextLocked(reactor);
+    if (sqe == NULL)
+        return; // Its completions are dropped by generation anyway
+
+    sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+    sqe->addr      = userData;
+    sqe->user_data = URING_KIND_IGNORED << URING_KIND_SHIFT;
+    UringPublishLocked(reactor->uring);
+}
+
+static void UringCancelPollLocked(Reactor* reactor, unsigned int slot)
+{
+    UringSlot* entry = &reactor->uring->slots[slot];
+    if (entry->polling)
+        UringCancelLocked(reactor, UringUserData(URING_KIND_POLL, entry->pollGeneration, slot));
+
+    entry->polling = false;
+    entry->pollGeneration++;
+}
+
+static void UringCancelReadLocked(Reactor* reactor, unsigned int slot)
+{
+    UringSlot* entry = &reactor->uring->slots[slot];
+    if (entry->reading) {
+        uint64_t userData = UringUserData(URING_KIND_READ, entry->readGeneration, slot);
+        UringCancelLocked(reactor, (entry->watch->acceptor != NULL) ? userData | URING_ACCEPT_BIT : userData);
+    }
+
+    entry->reading = false;
+    entry->readGeneration++;
+}
+
+int UringAdd(Reactor* reactor, ReactorWatch* watch)
+{
+    Uring* ring = reactor->uring;
+
+    pthread_mutex_lock(&ring->lock);
+    if (ring->freeCount == 0) {
+        // Grow by half so registering many watches stays cheap
+        unsigned int grown     = (ring->slotCount == 0) ? 64 : ring->slotCount + ring->slotCount / 2;
+        UringSlot*   slots     = realloc(ring->slots, grown * sizeof(UringSlot));
+        unsigned int* freeSlots = (slots != NULL) ? realloc(ring->freeSlots, grown * sizeof(unsigned int)) : NULL;
+
+        if (slots != NULL)
+            ring->slots = slots;
+        if (freeSlots == NULL) {
+            pthread_mutex_unlock(&ring->lock);
+            return -1;
+        }
+
+        ring->freeSlots = freeSlots;
+        memset(ring->slots + ring->slotCount, 0, (grown - ring->slotCount) * sizeof(UringSlot));
+
+        // Lowest slots on top of the stack
+        for (unsigned int i = grown; i > ring->slotCount; i--)
+            ring->freeSlots[ring->freeCount++] = i - 1;
+        ring->slotCount = grown;
+    }
+
+    unsigned int slot = ring->freeSlots[--ring->freeCount];
+    ring->slots[slot].watch = watch;
+    watch->slot             = slot;
+
+    if (UringArmReadLocked(reactor, slot) != 0 || UringArmPollLocked(reactor, slot) != 0) {
+        UringCancelReadLocked(reactor, slot);
+        ring->slots[slot].watch             = NULL;
+        ring->freeSlots[ring->freeCount++] = slot;
+        pthread_mutex_unlock(&ring->lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&ring->lock);
+
+    UringSubmit(reactor);
+    return 0;
+}
+
+int UringModify(Reactor* reactor, ReactorWatch* watch, unsigned int events)
+{
+    Uring* ring   = reactor->uring;
+    int    result = 0;
+
+    pthread_mutex_lock(&ring->lock);
+    unsigned int before = UringPollEvents(ring, watch);
+    watch->events = events;
+
+    // A poll that is waiting for the old events is swapped for one with the new
+    UringSlot* entry = &ring->slots[watch->slot];
+    if (UringPollEvents(ring, watch) != before && entry->polling)
+        UringCancelPollLocked(reactor, watch->slot);
+
+    result = UringArmPollLocked(reactor, watch->slot);
+    pthread_mutex_unlock(&ring->lock);
+
+    UringSubmit(reactor);
+    return result;
+}
+
+void UringRemove(Reactor* reactor, ReactorWatch* watch)
+{
+    Uring* ring = reactor->uring;
+
+    pthread_mutex_lock(&ring->lock);
+    UringCancelPollLocked(reactor, watch->slot);
+    UringCancelReadLocked(reactor, watch->slot);
+    ring->slots[watch->slot].watch      = NULL;
+    ring->freeSlots[ring->freeCount++] = watch->slot;
+    pthread_mutex_unlock(&ring->lock);
+
+    UringSubmit(reactor);
+}
+
+bool UringReceives(Reactor* reactor)
+{
+    return reactor->uring->receives;
+}
+
+int UringSendMessage(Reactor* reactor, ReactorOperation* operation, int fd, struct msghdr* message, int flags)
+{
+    Uring* ring = reactor->uring;
+
+    pthread_mutex_lock(&ring->lock);
+    struct io_uring_sqe* sqe = UringNextLocked(reactor);
+    if (sqe == NULL) {
+        pthread_mutex_unlock(&ring->lock);
+        return -1;
+    }
+
+    sqe->opcode    = IORING_OP_SENDMSG;
+    sqe->fd        = fd;
+    sqe->addr      = (uint64_t)(uintptr_t)message;
+    sqe->len       = 1;
+    sqe->msg_flags = (uint32_t)flags;
+    sqe->user_data = (URING_KIND_OPERATION << URING_KIND_SHIFT) | (uint64_t)(uintptr_t)operation;
+    UringPublishLocked(ring);
+    pthread_mutex_unlock(&ring->lock);
+
+    return 0;
+}
+
+void UringSubmit(Reactor* reactor)
+{
+    Uring* ring = reactor->uring;
+
+    // The loop hands everything over before it waits
+    if (UringOnLoopThread(ring))
+        return;
+
+    pthread_mutex_lock(&ring->lock);
+    unsigned int toSubmit = ring->pending;
+    ring->pending = 0;
+    pthread_mutex_unlock(&ring->lock);
+
+    if (toSubmit == 0)
+        return;
+
+    int submitted = UringEnter(reactor, toSubmit, 0, 0);
+    if (submitted < 0)
+        submitted = 0;
+
+    // Whatever didn't go is handed over by the next caller
+    if ((unsigned int)submitted < toSubmit) {
+        pthread_mutex_lock(&ring->lock);
+        ring->pending += toSubmit - (unsigned int)submitted;
+        pthread_mutex_unlock(&ring->lock);
+    }
+}
+
+/*
+    Tell the watch of a poll completion what its socket is ready for.
+*/
+static void UringHandlePoll(Reactor* reactor, struct io_uring_cqe* cqe)
+{
+    Uring*       ring       = reactor->uring;
+    unsigned int slot       = (unsigned int)(cqe->user_data & URING_SLOT_MASK);
+    uint32_t     generation = (uint32_t)((cqe->user_data & URING_PAYLOAD_MASK) >> 32);
+
+    pthread_mutex_lock(&ring->lock);
+    UringSlot*    entry = &ring->slots[slot];
+    ReactorWatch* watch = entry->watch;
+    bool          live  = watch != NULL && entry->polling && (entry->pollGeneration & 0x3FFFFFFF) == generation;
+    if (live)
+        entry->polling = false;
+    pthread_mutex_unlock(&ring->lock);
+
+    if (!live)
+        return;
+
+    unsigned int events = (cqe->res < 0) ? EPOLLERR : (unsigned int)cqe->res;
+    watch->handler(reactor, events, watch->context);
+
+    // Wait again unless the handler removed or re-armed it
+    pthread_mutex_lock(&ring->lock);
+    if (ring->slots[slot].watch == watch)
+        UringArmPollLocked(reactor, slot);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+/*
+    Hand bytes or a socket from a multishot receive
+    or accept to its watch.
+*/
+static void UringHandleRead(Reactor* reactor, struct io_uring_cqe* cqe)
+{
+    Uring*       ring       = reactor->uring;
+    unsigned int slot       = (unsigned int)(cqe->user_data & URING_SLOT_MASK);
+    uint32_t     generation = (uint32_t)((cqe->user_data & URING_PAYLOAD_MASK) >> 32);
+    bool         accepted   = (cqe->user_data & URING_ACCEPT_BIT) != 0;
+    bool         more       = (cqe->flags & IORING_CQE_F_MORE) != 0;
+    bool         buffered   = (cqe->flags & IORING_CQE_F_BUFFER) != 0;
+    unsigned short bufferId = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+    pthread_mutex_lock(&ring->lock);
+    UringSlot*    entry = &ring->slots[slot];
+    ReactorWatch* watch = entry->watch;
+    bool          live  = watch != NULL && entry->reading && (entry->readGeneration & 0x3FFFFFFF) == generation;
+    if (live && !more)
+        entry->reading = false;
+    pthread_mutex_unlock(&ring->lock);
+
+    // Re-armed once handled unless the socket is done for
+    bool rearm = !more;
+
+    if (!live) {
+        // Accepted after the watch went away. Nobody else will close it
+        if (accepted && cqe->res >= 0)
+            close(cqe->res);
+        rearm = false;
+    }
+    else if (accepted)
+        watch->acceptor(reactor, cqe->res, watch->context);
+    else if (cqe->res > 0 && buffered) {
+        const char* data = ring->bufferMemory + (size_t)bufferId * URING_RECEIVE_BUFFER_BYTES;
+        watch->receiver(reactor, data, cqe->res, watch->context);
+    }
+    else if (cqe->res != -ENOBUFS) {
+        // Hung up or failed. Nothing more will arrive
+        watch->receiver(reactor, NULL, cqe->res, watch->context);
+        rearm = false;
+    }
+
+    if (buffered)
+        UringRecycleBuffer(ring, bufferId);
+
+    if (rearm) {
+        pthread_mutex_lock(&ring->lock);
+        if (ring->slots[slot].watch == watch)
+            UringArmReadLocked(reactor, slot);
+        pthread_mutex_unlock(&ring->lock);
+    }
+}
+
+/**
+ * @brief           Submit requests and handle their completions
+ * @param[in]       reactor: the event loop to run
+ * @return          void
+ */
+void UringRun(Reactor* reactor)
+{
+    Uring* ring = reactor->uring;
+
+    ring->thread = pthread_self();
+    __atomic_store_n(&ring->running, true, __ATOMIC_RELEASE);
+
+    while (reactor->running)
+    {
+        pthread_mutex_lock(&ring->lock);
+        unsigned int toSubmit = ring->pending;
+        ring->pending = 0;
+        pthread_mutex_unlock(&ring->lock);
+
+        // Only wait if nothing has completed yet
+        bool ready = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE) != *ring->cqHead;
+        if (toSubmit > 0 || !ready) {
+            int entered = UringEnter(reactor, toSubmit, ready ? 0 : 1, IORING_ENTER_GETEVENTS);
+            if (entered < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                fprintf(stderr, "io_uring_enter() failed. Error Code %i\n", errno);
+                break;
+            }
+
+            unsigned int submitted = (entered > 0) ? (unsigned int)entered : 0;
+            if (submitted < toSubmit) {
+                pthread_mutex_lock(&ring->lock);
+                ring->pending += toSubmit - submitted;
+                pthread_mutex_unlock(&ring->lock);
+            }
+        }
+
+        unsigned int head = *ring->cqHead;
+        unsigned int tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            // Copied out so the entry can be reused while it's handled
+            struct io_uring_cqe cqe = ring->cqes[head & ring->cqMask];
+            head++;
+            __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+
+            switch (cqe.user_data >> URING_KIND_SHIFT)
+            {
+            case URING_KIND_POLL:
+                UringHandlePoll(reactor, &cqe);
+                break;
+            case URING_KIND_READ:
+                UringHandleRead(reactor, &cqe);
+                break;
+            case URING_KIND_OPERATION: {
+                ReactorOperation* operation = (ReactorOperation*)(uintptr_t)(cqe.user_data & URING_PAYLOAD_MASK);
+                operation->complete(reactor, cqe.res, operation->context);
+                break;
+            }
+            default:
+                break;
+            }
+        }
+    }
+
+    __atomic_store_n(&ring->running, false, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,149 @@
+/**
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ * @file       workpool.c
+ * @brief      fixed size pool of worker threads fed by a bounded queue
+ *
+ * @note
+ * @history:
+ *   Version   Date            Author          Modification    Email
+ *   V1.0.0    Jun-05-2024     Ethan Oliveira                  ethanjamesoliveira@gmail.com
+ *
+ * @verbatim
+ * ==============================================================================
+ *
+ * ==============================================================================
+ * @endverbatim
+ * ****************************(C) COPYRIGHT 2023 ****************************
+ */
+
+#include "Headers/workpool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t NowNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static void* WorkerThread(void* context)
+{
+    WorkPool* pool = (WorkPool*)context;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1)
+    {
+        while (pool->count == 0 && !pool->stopping)
+            pthread_cond_wait(&pool->hasWork, &pool->lock);
+
+        if (pool->count == 0) // Stopping and nothing left to do
+            break;
+
+        WorkItem item = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % pool->capacity;
+        pool->count--;
+
+        uint64_t waited = NowNs() - item.enqueuedNs;
+        pool->metrics.queueDepth   = pool->count;
+        pool->metrics.totalWaitNs += waited;
+        if (waited > pool->metrics.maxWaitNs)
+            pool->metrics.maxWaitNs = waited;
+
+        // Other workers can take jobs while this one runs
+        pthread_mutex_unlock(&pool->lock);
+        item.function(item.argument);
+        pthread_mutex_lock(&pool->lock);
+
+        pool->metrics.completed++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+int WorkPoolCreate(WorkPool* pool, unsigned int workerCount, size_t capacity)
+{
+    memset(pool, 0, sizeof(WorkPool));
+    if (workerCount == 0 || capacity == 0)
+        return -1;
+
+    pool->queue   = calloc(capacity, sizeof(WorkItem));
+    pool->workers = calloc(workerCount, sizeof(pthread_t));
+    if (pool->queue == NULL || pool->workers == NULL)
+        goto create_failed;
+
+    pool->capacity = capacity;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->hasWork, NULL);
+
+    for (unsigned int i = 0; i < workerCount; i++)
+    {
+        if (pthread_create(&pool->workers[i], NULL, WorkerThread, (void*)pool) != 0) {
+            // Stop the ones that did start
+            WorkPoolDestroy(pool);
+            return -1;
+        }
+        pool->workerCount++;
+    }
+
+    return 0;
+
+create_failed:
+    free(pool->queue);
+    free(pool->workers);
+    memset(pool, 0, sizeof(WorkPool));
+    return -1;
+}
+
+bool WorkPoolSubmit(WorkPool* pool, WorkFunction function, void* argument)
+{
+    pthread_mutex_lock(&pool->lock);
+
+    if (pool->count == pool->capacity || pool->stopping) {
+        pool->metrics.rejected++;
+        pthread_mutex_unlock(&pool->lock);
+        return false;
+    }
+
+    WorkItem* item   = &pool->queue[(pool->head + pool->count) % pool->capacity];
+    item->function   = function;
+    item->argument   = argument;
+    item->enqueuedNs = NowNs();
+    pool->count++;
+
+    pool->metrics.submitted++;
+    pool->metrics.queueDepth = pool->count;
+    if (pool->count > pool->metrics.maxQueueDepth)
+        pool->metrics.maxQueueDepth = pool->count;
+
+    pthread_cond_signal(&pool->hasWork);
+    pthread_mutex_unlock(&pool->lock);
+    return true;
+}
+
+void WorkPoolGetMetrics(WorkPool* pool, WorkPoolMetrics* metrics)
+{
+    pthread_mutex_lock(&pool->lock);
+    *metrics = pool->metrics;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void WorkPoolDestroy(WorkPool* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->hasWork);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (unsigned int i = 0; i < pool->workerCount; i++)
+        pthread_join(pool->workers[i], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->hasWork);
+    free(pool->queue);
+    free(pool->workers);
+    memset(pool, 0, sizeof(WorkPool));
+}